@@ -0,0 +1,376 @@
+/* File: cluster_bench.cpp
+ *
+ * Benchmarks the clustering runners on a synthetic corpus (see
+ * synthetic_corpus.h). Each selected runner (serial, OpenMP and, if it is
+ * compiled in, Galois) is run for every k and thread count of the grid, and
+ * the wall time, time per iteration, cosine similarities per second, peak
+ * resident memory and final quality of each run are reported as CSV (and
+ * optionally JSON), so regressions can be caught and hardware sized. The
+ * same parameters always give the same corpus and the same results.
+ *
+ * $ ./cluster_bench [-d docs] [-w words] [-n draws] [-z zipf] [-c clusters]
+ *       [-p purity] [-s seed] [-k k,...] [-t threads,...] [-m mode,...]
+ *       [-r repeats] [--csv file] [--json file] [--corpus file]
+ */
+
+#include <fstream>
+#include <iostream>
+#include <omp.h>
+#include <sstream>
+#include <stdlib.h>
+#include <string>
+#include <sys/resource.h>
+#include <vector>
+
+#include "binary_corpus.h"
+#include "cluster_data.h"
+#include "spkmeans.h"
+#include "synthetic_corpus.h"
+
+using namespace std;
+
+
+
+// the outcome of one benchmark run
+struct BenchResult {
+    string mode;
+    int k;
+    int threads;
+    int iterations;
+    double wall_ms;
+    double cosines_per_sec; // -1 if the cosines are not counted
+    double peak_rss_mb;
+    float quality;
+};
+
+
+
+// Returns the comma-separated items of the given list.
+vector<string> splitList(const string &list)
+{
+    vector<string> items;
+    stringstream stream(list);
+    string item;
+    while(getline(stream, item, ','))
+        if(!item.empty())
+            items.push_back(item);
+    return items;
+}
+
+
+
+// Returns the comma-separated numbers of the given list.
+vector<int> parseNumbers(const string &list)
+{
+    vector<string> items = splitList(list);
+    vector<int> numbers;
+    for(size_t i=0; i<items.size(); i++)
+        numbers.push_back(atoi(items[i].c_str()));
+    return numbers;
+}
+
+
+
+// Resets the peak resident memory of the process (Linux only; elsewhere the
+// peak covers the whole process so far).
+void resetPeakRSS()
+{
+    ofstream clear_refs("/proc/self/clear_refs");
+    if(clear_refs.good())
+        clear_refs << "5" << endl;
+}
+
+
+
+// Returns the peak resident memory in MB, from /proc/self/status if it is
+// available, and from getrusage otherwise.
+double peakRSS()
+{
+    ifstream status("/proc/self/status");
+    string line;
+    while(getline(status, line)) {
+        if(line.compare(0, 6, "VmHWM:") == 0)
+            return atol(line.c_str() + 6) / 1024.0;
+    }
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    return usage.ru_maxrss / 1024.0;
+}
+
+
+
+// Runs the given runner once on the (normalized) documents, with the
+// printed output of the run discarded. The thread count is the one the
+// runner actually uses.
+BenchResult runOnce(SparseMatrix *D, const string &mode, int k,
+                    int num_threads)
+{
+    BenchResult result;
+    result.mode = mode;
+    result.k = k;
+
+    SPKMeans *spkm;
+    if(mode == "openmp") {
+        SPKMeansOpenMP *spkm_openmp = new SPKMeansOpenMP(D, k, num_threads);
+        result.threads = spkm_openmp->getNumThreads();
+        spkm = spkm_openmp;
+    }
+#ifndef NO_GALOIS
+    else if(mode == "galois") {
+        SPKMeansGalois *spkm_galois = new SPKMeansGalois(D, k, num_threads);
+        result.threads = spkm_galois->getNumThreads();
+        spkm = spkm_galois;
+    }
+#endif
+    else {
+        spkm = new SPKMeans(D, k);
+        result.threads = 1;
+    }
+
+    // a stream without a buffer drops everything written to it
+    streambuf *out = cout.rdbuf(0);
+    resetPeakRSS();
+    ClusterData *data = spkm->runSPKMeans();
+    result.peak_rss_mb = peakRSS();
+    cout.rdbuf(out);
+
+    Profiler *profile = spkm->getProfiler();
+    result.iterations = spkm->getIterations();
+    result.wall_ms = profile->millis(Profiler::RUN_PHASE);
+    long cosines = profile->totalCosines();
+    result.cosines_per_sec = (cosines >= 0 && result.wall_ms > 0)
+        ? cosines / (result.wall_ms / 1000) : -1;
+    result.quality = 0;
+    for(int c=0; c<k; c++)
+        result.quality += data->qualities[c];
+
+    delete data;
+    delete spkm;
+    return result;
+}
+
+
+
+// Writes the CSV header line.
+void writeCSVHeader(ostream &out)
+{
+    out << "mode,k,threads,docs,words,nnz,iterations,wall_ms,"
+        << "ms_per_iteration,cosines_per_sec,peak_rss_mb,quality" << endl;
+}
+
+
+
+// Writes the given result as a CSV line (an unknown rate is left empty).
+void writeCSVLine(ostream &out, const BenchResult &r, SparseMatrix *D)
+{
+    out << r.mode << "," << r.k << "," << r.threads << "," << D->rows << ","
+        << D->cols << "," << D->nnz << "," << r.iterations << ","
+        << r.wall_ms << "," << r.wall_ms / max(r.iterations, 1) << ",";
+    if(r.cosines_per_sec >= 0)
+        out << r.cosines_per_sec;
+    out << "," << r.peak_rss_mb << "," << r.quality << endl;
+}
+
+
+
+// Writes the corpus parameters and all results as one JSON object.
+bool writeJSON(const char *fname, const SyntheticCorpus &corpus,
+               SparseMatrix *D, const vector<BenchResult> &results)
+{
+    ofstream out(fname);
+    if(!out.good())
+        return false;
+    out.precision(9);
+    out << "{" << endl
+        << "  \"corpus\": {\"docs\": " << D->rows << ", \"words\": "
+        << D->cols << ", \"nnz\": " << D->nnz << ", \"nnz_per_doc\": "
+        << corpus.nnz_per_doc << ", \"zipf\": " << corpus.zipf
+        << ", \"clusters\": " << corpus.clusters << ", \"purity\": "
+        << corpus.purity << ", \"seed\": " << corpus.seed << "}," << endl
+        << "  \"runs\": [";
+    for(size_t i=0; i<results.size(); i++) {
+        const BenchResult &r = results[i];
+        out << (i > 0 ? "," : "") << endl
+            << "    {\"mode\": \"" << r.mode << "\", \"k\": " << r.k
+            << ", \"threads\": " << r.threads << ", \"iterations\": "
+            << r.iterations << ", \"wall_ms\": " << r.wall_ms
+            << ", \"ms_per_iteration\": "
+            << r.wall_ms / max(r.iterations, 1) << ", \"cosines_per_sec\": ";
+        if(r.cosines_per_sec >= 0)
+            out << r.cosines_per_sec;
+        else
+            out << "null";
+        out << ", \"peak_rss_mb\": " << r.peak_rss_mb << ", \"quality\": "
+            << r.quality << "}";
+    }
+    out << (results.empty() ? "]" : "\n  ]") << endl << "}" << endl;
+    out.close();
+    return !out.fail();
+}
+
+
+
+// Prints a message on how to use this program.
+void printUsage()
+{
+    SyntheticCorpus corpus = defaultSyntheticCorpus();
+    cout << "$ ./cluster_bench [options]" << endl
+         << "Corpus options:" << endl
+         << "  [-d docs]       number of documents (" << corpus.docs << ")"
+         << endl
+         << "  [-w words]      vocabulary size (" << corpus.words << ")"
+         << endl
+         << "  [-n draws]      average word draws per document ("
+         << corpus.nnz_per_doc << ")" << endl
+         << "  [-z zipf]       Zipf exponent of the word frequencies ("
+         << corpus.zipf << ")" << endl
+         << "  [-c clusters]   number of planted clusters ("
+         << corpus.clusters << ")" << endl
+         << "  [-p purity]     fraction of draws from the cluster topic ("
+         << corpus.purity << ")" << endl
+         << "  [-s seed]       random seed (" << corpus.seed << ")" << endl
+         << "  [--corpus file] also write the corpus as a binary docfile"
+         << endl
+         << "Grid options:" << endl
+         << "  [-k k,...]      values of k (20,100)" << endl
+         << "  [-t threads,...] thread counts (1 and the max.)" << endl
+         << "  [-m mode,...]   runners: serial, openmp, galois (all)" << endl
+         << "  [-r repeats]    runs per point, the fastest is kept (1)"
+         << endl
+         << "  [--csv file]    also write the CSV lines to a file" << endl
+         << "  [--json file]   write the results as JSON" << endl;
+}
+
+
+
+// main: generate the corpus, and run the grid.
+int main(int argc, char **argv)
+{
+    SyntheticCorpus corpus = defaultSyntheticCorpus();
+    vector<int> ks;
+    ks.push_back(20);
+    ks.push_back(100);
+    vector<int> thread_counts;
+    int max_threads = omp_get_max_threads();
+    thread_counts.push_back(1);
+    if(max_threads > 1)
+        thread_counts.push_back(max_threads);
+    vector<string> modes = splitList("serial,openmp,galois");
+    int repeats = 1;
+    string csv_fname, json_fname, corpus_fname;
+    for(int i=1; i<argc; i++) {
+        string arg(argv[i]);
+        if(arg == "--help" || arg == "-h") {
+            printUsage();
+            return 0;
+        }
+        if(i+1 >= argc) {
+            cout << "Error: expected a value after \"" << arg << "\"."
+                 << endl;
+            printUsage();
+            return -1;
+        }
+        string value(argv[++i]);
+        if(arg == "-d")
+            corpus.docs = atoi(value.c_str());
+        else if(arg == "-w")
+            corpus.words = atoi(value.c_str());
+        else if(arg == "-n")
+            corpus.nnz_per_doc = atoi(value.c_str());
+        else if(arg == "-z")
+            corpus.zipf = atof(value.c_str());
+        else if(arg == "-c")
+            corpus.clusters = atoi(value.c_str());
+        else if(arg == "-p")
+            corpus.purity = atof(value.c_str());
+        else if(arg == "-s")
+            corpus.seed = strtoul(value.c_str(), 0, 10);
+        else if(arg == "-k")
+            ks = parseNumbers(value);
+        else if(arg == "-t")
+            thread_counts = parseNumbers(value);
+        else if(arg == "-m")
+            modes = splitList(value);
+        else if(arg == "-r")
+            repeats = atoi(value.c_str());
+        else if(arg == "--csv")
+            csv_fname = value;
+        else if(arg == "--json")
+            json_fname = value;
+        else if(arg == "--corpus")
+            corpus_fname = value;
+        else {
+            cout << "Error: unknown argument \"" << arg << "\"." << endl;
+            printUsage();
+            return -1;
+        }
+    }
+    if(corpus.docs < 1 || corpus.words < 1) {
+        cout << "Error: the corpus needs documents and words." << endl;
+        return -1;
+    }
+    if(repeats < 1)
+        repeats = 1;
+
+    // generate (and normalize) the corpus once for all runs
+    SparseMatrix *D = generateSyntheticCorpus(corpus);
+    D->normalizeRows();
+    cout << "# corpus: " << D->rows << " documents, " << D->cols
+         << " words, " << D->nnz << " non-zero entries (zipf " << corpus.zipf
+         << ", " << corpus.clusters << " planted clusters, purity "
+         << corpus.purity << ", seed " << corpus.seed << ")" << endl;
+    if(!corpus_fname.empty() && !writeBinaryDocFile(corpus_fname.c_str(), D))
+        cout << "Error: could not write \"" << corpus_fname << "\"." << endl;
+
+    ofstream csv;
+    if(!csv_fname.empty()) {
+        csv.open(csv_fname.c_str());
+        writeCSVHeader(csv);
+    }
+    writeCSVHeader(cout);
+
+    // run the grid; the serial runner only runs once per k
+    vector<BenchResult> results;
+    for(size_t m=0; m<modes.size(); m++) {
+        string mode = modes[m];
+#ifdef NO_GALOIS
+        if(mode == "galois") {
+            cout << "# Note: Galois is not available; skipping it." << endl;
+            continue;
+        }
+#endif
+        if(mode != "serial" && mode != "openmp" && mode != "galois") {
+            cout << "# Note: unknown runner \"" << mode << "\"; skipping it."
+                 << endl;
+            continue;
+        }
+        for(size_t ki=0; ki<ks.size(); ki++) {
+            if(ks[ki] < 1 || ks[ki] > D->rows)
+                continue;
+            for(size_t t=0; t<thread_counts.size(); t++) {
+                if(mode == "serial" && t > 0)
+                    break;
+                BenchResult best;
+                for(int r=0; r<repeats; r++) {
+                    // the OpenMP runner lowers the thread limit it checks
+                    // its thread count against, so it is restored first
+                    omp_set_num_threads(max_threads);
+                    BenchResult result = runOnce(D, mode, ks[ki],
+                                                 thread_counts[t]);
+                    if(r == 0 || result.wall_ms < best.wall_ms)
+                        best = result;
+                }
+                writeCSVLine(cout, best, D);
+                if(csv.is_open())
+                    writeCSVLine(csv, best, D);
+                results.push_back(best);
+            }
+        }
+    }
+
+    if(!json_fname.empty() &&
+       !writeJSON(json_fname.c_str(), corpus, D, results))
+        cout << "Error: could not write \"" << json_fname << "\"." << endl;
+    delete D;
+    return 0;
+}
@@ -0,0 +1,615 @@
+/* File: kernel_bench.cpp
+ *
+ * Microbenchmarks the hot kernels in isolation: every vec_* routine of
+ * vectors.h (on dense vectors of each given size, and on the rows of
+ * synthetic corpora of each given sparsity), and SPKMeans::cosineSimilarity,
+ * SPKMeans::computeConcepts and ClusterData::findChangedClusters on those
+ * corpora, and the k-means++ and k-means|| seedings for each given k. Each
+ * kernel is repeated until it has run for a minimum time, and the fastest
+ * of a few repeats is reported in nanoseconds per operation, GB/s and
+ * (where perf_event_open is permitted) hardware counters per operation,
+ * once for each selected kernel set (scalar, AVX2, AVX-512).
+ *
+ * $ ./kernel_bench [-v size,...] [-n draws,...] [-d docs] [-w words] [-k k]
+ *       [-f moved] [-e k,...] [-s seed] [-x set,...] [-o kernel,...]
+ *       [-r repeats] [-m ms] [--csv file]
+ */
+
+#include <fstream>
+#include <functional>
+#include <iostream>
+#include <sstream>
+#include <stdlib.h>
+#include <string>
+#include <vector>
+
+#include "cluster_data.h"
+#include "perf_counters.h"
+#include "seeding.h"
+#include "spkmeans.h"
+#include "synthetic_corpus.h"
+#include "timer.h"
+#include "vectors.h"
+
+using namespace std;
+
+
+// the results of the kernels are added up here, so they are not optimized
+// away
+volatile float sink;
+
+
+
+// the options shared by all benchmarks
+struct BenchOptions {
+    vector<string> only;  // substrings of the kernels to run (all if empty)
+    int repeats;          // timed repeats, the fastest is kept
+    double min_ms;        // minimum time of each timed repeat
+    string kernels;       // name of the kernel set in use
+    PerfCounters *counters;
+    ostream *csv;         // optional copy of the CSV lines
+};
+
+
+
+// Returns the comma-separated items of the given list.
+vector<string> splitList(const string &list)
+{
+    vector<string> items;
+    stringstream stream(list);
+    string item;
+    while(getline(stream, item, ','))
+        if(!item.empty())
+            items.push_back(item);
+    return items;
+}
+
+
+
+// Returns the comma-separated numbers of the given list.
+vector<long> parseNumbers(const string &list)
+{
+    vector<string> items = splitList(list);
+    vector<long> numbers;
+    for(size_t i=0; i<items.size(); i++)
+        numbers.push_back(atol(items[i].c_str()));
+    return numbers;
+}
+
+
+
+// Returns a new array of the given number of floats, aligned like the
+// concept matrix and filled with values in (0, 1].
+float* alignedVector(long size)
+{
+    void *memory = 0;
+    if(posix_memalign(&memory, CONCEPT_ALIGN, sizeof(float) * max(size, 1L)))
+        return 0;
+    float *vec = (float*)memory;
+    for(long i=0; i<size; i++)
+        vec[i] = (i % 97 + 1) / 97.0f;
+    return vec;
+}
+
+
+
+// Returns the row length of a word-major concept matrix with k concepts
+// (k rounded up to whole aligned blocks, like ClusterData pads its rows).
+long paddedStride(int k)
+{
+    long block = CONCEPT_ALIGN / sizeof(float);
+    return (k + block - 1) / block * block;
+}
+
+
+
+// Writes the CSV header line.
+void writeCSVHeader(ostream &out)
+{
+    out << "kernels,kernel,size,nnz,ops,ns_per_op,gb_per_sec";
+    for(int c=0; c<PerfCounters::NUM_COUNTERS; c++)
+        out << "," << PerfCounters::name((PerfCounters::Counter)c)
+            << "_per_op";
+    out << ",ipc" << endl;
+}
+
+
+
+// Times the given kernel, where body(ops) runs ops operations, and prints
+// its CSV line. The number of operations is doubled until a repeat takes
+// at least the minimum time; the counters are those of the fastest repeat.
+// size is the vector length (or vocabulary size), nnz the average number
+// of non-zero entries of an operation (0 for dense kernels), and bytes the
+// minimum number of bytes an operation reads and writes.
+void measure(BenchOptions &options, const string &kernel, long size,
+             double nnz, double bytes, const function<void(long)> &body)
+{
+    if(!options.only.empty()) {
+        bool selected = false;
+        for(size_t i=0; i<options.only.size(); i++)
+            selected = selected
+                || kernel.find(options.only[i]) != string::npos;
+        if(!selected)
+            return;
+    }
+
+    // calibrate (this also warms up the caches)
+    long ops = 1;
+    while(true) {
+        Timer timer;
+        timer.start();
+        body(ops);
+        timer.stop();
+        if(timer.getNanos() >= options.min_ms * 1e6 || ops >= (1L << 40))
+            break;
+        ops *= 2;
+    }
+
+    double best_ns = -1;
+    long long counts[PerfCounters::NUM_COUNTERS];
+    for(int r=0; r<options.repeats; r++) {
+        long long repeat_counts[PerfCounters::NUM_COUNTERS];
+        Timer timer;
+        options.counters->start();
+        timer.start();
+        body(ops);
+        timer.stop();
+        options.counters->stop(repeat_counts);
+        double ns = timer.getNanos();
+        if(best_ns < 0 || ns < best_ns) {
+            best_ns = ns;
+            for(int c=0; c<PerfCounters::NUM_COUNTERS; c++)
+                counts[c] = repeat_counts[c];
+        }
+    }
+
+    // print the line to cout, and to the CSV file if there is one
+    stringstream line;
+    double ns_per_op = best_ns / ops;
+    line << options.kernels << "," << kernel << "," << size << "," << nnz
+         << "," << ops << "," << ns_per_op << "," << bytes / ns_per_op;
+    for(int c=0; c<PerfCounters::NUM_COUNTERS; c++) {
+        line << ",";
+        if(counts[c] >= 0)
+            line << (double)counts[c] / ops;
+    }
+    line << ",";
+    long long cycles = counts[PerfCounters::CYCLES];
+    long long instructions = counts[PerfCounters::INSTRUCTIONS];
+    if(cycles > 0 && instructions >= 0)
+        line << (double)instructions / cycles;
+    cout << line.str() << endl;
+    if(options.csv != 0)
+        *options.csv << line.str() << endl;
+}
+
+
+
+// Benchmarks the dense vec_* routines on vectors of the given size.
+void benchDense(BenchOptions &options, long size)
+{
+    int n = size;
+    float *a = alignedVector(size);
+    float *b = alignedVector(size);
+    float *vecs[4] = {a, b, a, b};
+
+    measure(options, "vec_norm", size, 0, 4.0 * size, [&](long ops) {
+        float total = 0;
+        for(long o=0; o<ops; o++)
+            total += vec_norm(a, n);
+        sink += total;
+    });
+    measure(options, "vec_sum", size, 0, 4.0 * size, [&](long ops) {
+        float total = 0;
+        for(long o=0; o<ops; o++)
+            total += vec_sum(a, n);
+        sink += total;
+    });
+    measure(options, "vec_dot", size, 0, 8.0 * size, [&](long ops) {
+        float total = 0;
+        for(long o=0; o<ops; o++)
+            total += vec_dot(a, b, n);
+        sink += total;
+    });
+    measure(options, "vec_sum_vecs", size, 0, 20.0 * size, [&](long ops) {
+        for(long o=0; o<ops; o++) {
+            float *sum = vec_sum(vecs, n, 4);
+            sink += sum[o % n];
+            delete[] sum;
+        }
+    });
+    measure(options, "vec_pow_new", size, 0, 8.0 * size, [&](long ops) {
+        for(long o=0; o<ops; o++) {
+            float *powers = vec_pow_new(a, n, 2);
+            sink += powers[o % n];
+            delete[] powers;
+        }
+    });
+    measure(options, "vec_zeros", size, 0, 4.0 * size, [&](long ops) {
+        for(long o=0; o<ops; o++) {
+            float *zeros = vec_zeros(n);
+            sink += zeros[o % n];
+            delete[] zeros;
+        }
+    });
+
+    // the in-place kernels keep the values bounded: a grows by at most
+    // about ops, and the others converge to fixed points
+    measure(options, "vec_add", size, 0, 12.0 * size, [&](long ops) {
+        for(long o=0; o<ops; o++)
+            vec_add(a, b, n);
+    });
+    measure(options, "vec_add_scaled", size, 0, 12.0 * size, [&](long ops) {
+        for(long o=0; o<ops; o++)
+            vec_add_scaled(a, b, n, 1e-6f);
+    });
+    measure(options, "vec_multiply", size, 0, 8.0 * size, [&](long ops) {
+        for(long o=0; o<ops; o++)
+            vec_multiply(b, n, 1);
+    });
+    measure(options, "vec_divide", size, 0, 8.0 * size, [&](long ops) {
+        for(long o=0; o<ops; o++)
+            vec_divide(b, n, 1);
+    });
+    measure(options, "vec_pow", size, 0, 8.0 * size, [&](long ops) {
+        for(long o=0; o<ops; o++)
+            vec_pow(b, n, 0.5f);
+    });
+    measure(options, "vec_normalize", size, 0, 12.0 * size, [&](long ops) {
+        for(long o=0; o<ops; o++)
+            vec_normalize(a, n);
+    });
+
+    free(a);
+    free(b);
+}
+
+
+
+// Benchmarks the strided vec_* routines on a word-major matrix of the
+// given number of words and concepts, one concept (column) per operation.
+// Only the values of the column count as bytes moved, although every one
+// of them is on its own cache line for large k.
+void benchStrided(BenchOptions &options, int words, int k)
+{
+    long stride = paddedStride(k);
+    float *matrix = alignedVector(words * stride);
+
+    measure(options, "vec_norm_strided", words, 0, 4.0 * words,
+            [&](long ops) {
+        float total = 0;
+        for(long o=0; o<ops; o++)
+            total += vec_norm_strided(matrix + o % k, words, stride);
+        sink += total;
+    });
+    measure(options, "vec_fill_strided", words, 0, 4.0 * words,
+            [&](long ops) {
+        for(long o=0; o<ops; o++)
+            vec_fill_strided(matrix + o % k, words, stride, 1);
+    });
+    measure(options, "vec_divide_strided", words, 0, 8.0 * words,
+            [&](long ops) {
+        for(long o=0; o<ops; o++)
+            vec_divide_strided(matrix + o % k, words, stride, 1);
+    });
+
+    free(matrix);
+}
+
+
+
+// Benchmarks the sparse vec_* routines and the clustering kernels on the
+// given (normalized) corpus. The sparse routines take one document row per
+// operation, against a dense vector (contiguous, or one column of a
+// word-major matrix for the strided ones). The clusters are seeded randomly,
+// and moved is the fraction of documents findChangedClusters finds moved.
+void benchCorpus(BenchOptions &options, SparseMatrix *D, int k, double moved,
+                 unsigned int seed)
+{
+    int dc = D->rows;
+    int wc = D->cols;
+    double nnz = (double)D->nnz / dc;
+    int *offsets = D->offsets;
+    int *indices = D->indices;
+    float *values = D->values;
+
+    // a sparse row is read as indices and values, and gathers (or updates)
+    // one dense value per entry
+    float *dense = alignedVector(wc);
+    measure(options, "vec_sparse_dot", wc, nnz, 12 * nnz, [&](long ops) {
+        float total = 0;
+        for(long o=0; o<ops; o++) {
+            int d = o % dc;
+            total += vec_sparse_dot(dense, indices + offsets[d],
+                                    values + offsets[d],
+                                    offsets[d+1] - offsets[d]);
+        }
+        sink += total;
+    });
+    measure(options, "vec_scatter_add", wc, nnz, 16 * nnz, [&](long ops) {
+        for(long o=0; o<ops; o++) {
+            int d = o % dc;
+            vec_scatter_add(dense, indices + offsets[d], values + offsets[d],
+                            offsets[d+1] - offsets[d]);
+        }
+    });
+    free(dense);
+
+    long stride = paddedStride(k);
+    float *matrix = alignedVector(wc * stride);
+    measure(options, "vec_sparse_dot_strided", wc, nnz, 12 * nnz,
+            [&](long ops) {
+        float total = 0;
+        for(long o=0; o<ops; o++) {
+            int d = o % dc;
+            total += vec_sparse_dot_strided(matrix + o % k, stride,
+                                            indices + offsets[d],
+                                            values + offsets[d],
+                                            offsets[d+1] - offsets[d]);
+        }
+        sink += total;
+    });
+    measure(options, "vec_scatter_add_strided", wc, nnz, 16 * nnz,
+            [&](long ops) {
+        for(long o=0; o<ops; o++) {
+            int d = o % dc;
+            vec_scatter_add_strided(matrix + o % k, stride,
+                                    indices + offsets[d], values + offsets[d],
+                                    offsets[d+1] - offsets[d]);
+        }
+    });
+    free(matrix);
+
+    // set up the clustering state like the start of a run
+    SPKMeans spkm(D, k);
+    ClusterData data(k, D);
+    data.allocateConcepts();
+    data.allocateCache();
+    seedRandom(&data, seed);
+    spkm.computeConcepts(&data);
+
+    // one similarity per operation: the documents in order, against a
+    // different cluster each time
+    measure(options, "cosineSimilarity", wc, nnz, 12 * nnz, [&](long ops) {
+        float total = 0;
+        for(long o=0; o<ops; o++) {
+            int d = o % dc;
+            total += spkm.cosineSimilarity(&data, d, (d + o / dc) % k);
+        }
+        sink += total;
+    });
+
+    // all concepts per operation: the documents are grouped, summed up into
+    // the concepts, and the concepts are normalized
+    double concept_bytes = 16.0 * D->nnz + 16.0 * k * wc + 8.0 * dc;
+    measure(options, "computeConcepts", wc, D->nnz, concept_bytes,
+            [&](long ops) {
+        float total = 0;
+        for(long o=0; o<ops; o++) {
+            for(int c=0; c<k; c++)
+                data.changed[c] = true;
+            total += spkm.computeConcepts(&data);
+        }
+        sink += total;
+    });
+
+    // all documents per operation, with the given fraction of them moved to
+    // the next cluster (the assignments are never applied, so every
+    // operation finds the same moves); its nnz is the number of moves
+    int step = (moved > 0) ? max((int)(1 / moved), 1) : dc + 1;
+    long num_moved = 0;
+    for(int d=0; d<dc; d++) {
+        bool moves = (d % step == 0);
+        data.p_asgns_new[d] = moves ? (data.p_asgns[d] + 1) % k
+                                    : data.p_asgns[d];
+        if(moves && k > 1)
+            num_moved++;
+    }
+    double change_bytes = 8.0 * dc + 24.0 * num_moved;
+    measure(options, "findChangedClusters", dc, num_moved, change_bytes,
+            [&](long ops) {
+        for(long o=0; o<ops; o++)
+            data.findChangedClusters();
+        sink += data.num_moved;
+    });
+}
+
+
+
+// Benchmarks the k-means++ and k-means|| seedings on the given corpus for
+// each of the given k, one whole seeding per operation (so its size is k).
+// k-means++ makes k passes over the documents, and k-means|| a few batched
+// passes plus a weighted k-means++ over its candidates, so the bytes are
+// those of a single pass over the corpus.
+void benchSeeding(BenchOptions &options, SparseMatrix *D,
+                  const vector<long> &seed_ks, unsigned int seed)
+{
+    vector<float> doc_norms(D->rows);
+    for(int i=0; i<D->rows; i++)
+        doc_norms[i] = D->rowNorm(i);
+    double nnz = (double)D->nnz / D->rows;
+    for(size_t i=0; i<seed_ks.size(); i++) {
+        int k = seed_ks[i];
+        if(k < 1 || k > D->rows)
+            continue;
+        ClusterData data(k, D);
+        data.allocateConcepts();
+        measure(options, "seedKMeansPP", k, nnz, 8.0 * D->nnz,
+                [&](long ops) {
+            for(long o=0; o<ops; o++)
+                seedKMeansPP(&data, &doc_norms[0], seed);
+            sink += data.p_asgns[0];
+        });
+        measure(options, "seedKMeansParallel", k, nnz, 8.0 * D->nnz,
+                [&](long ops) {
+            for(long o=0; o<ops; o++)
+                seedKMeansParallel(&data, &doc_norms[0], seed);
+            sink += data.p_asgns[0];
+        });
+    }
+}
+
+
+
+// Prints a message on how to use this program.
+void printUsage()
+{
+    SyntheticCorpus corpus = defaultSyntheticCorpus();
+    cout << "$ ./kernel_bench [options]" << endl
+         << "  [-v size,...]   dense vector sizes (1024,65536,4194304)"
+         << endl
+         << "  [-n draws,...]  word draws per document of each corpus"
+         << " (20,60,200)" << endl
+         << "  [-d docs]       documents of each corpus (" << corpus.docs
+         << ")" << endl
+         << "  [-w words]      vocabulary size (" << corpus.words << ")"
+         << endl
+         << "  [-k k]          number of clusters (50)" << endl
+         << "  [-f moved]      fraction of documents moved (0.05)" << endl
+         << "  [-e k,...]      values of k of the seedings (50,500)" << endl
+         << "  [-s seed]       random seed (" << corpus.seed << ")" << endl
+         << "  [-x set,...]    kernel sets: scalar, avx2, avx512"
+         << " (all available)" << endl
+         << "  [-o kernel,...] only run kernels whose names contain one"
+         << " of these" << endl
+         << "  [-r repeats]    timed repeats, the fastest is kept (5)"
+         << endl
+         << "  [-m ms]         minimum time of a repeat (50)" << endl
+         << "  [--csv file]    also write the CSV lines to a file" << endl;
+}
+
+
+
+// main: run every kernel for each kernel set, size and corpus.
+int main(int argc, char **argv)
+{
+    SyntheticCorpus corpus = defaultSyntheticCorpus();
+    vector<long> sizes = parseNumbers("1024,65536,4194304");
+    vector<long> draws = parseNumbers("20,60,200");
+    vector<string> sets = splitList("scalar,avx2,avx512");
+    vector<long> seed_ks = parseNumbers("50,500");
+    int k = 50;
+    double moved = 0.05;
+    BenchOptions options;
+    options.repeats = 5;
+    options.min_ms = 50;
+    options.csv = 0;
+    string csv_fname;
+    for(int i=1; i<argc; i++) {
+        string arg(argv[i]);
+        if(arg == "--help" || arg == "-h") {
+            printUsage();
+            return 0;
+        }
+        if(i+1 >= argc) {
+            cout << "Error: expected a value after \"" << arg << "\"."
+                 << endl;
+            printUsage();
+            return -1;
+        }
+        string value(argv[++i]);
+        if(arg == "-v")
+            sizes = parseNumbers(value);
+        else if(arg == "-n")
+            draws = parseNumbers(value);
+        else if(arg == "-d")
+            corpus.docs = atoi(value.c_str());
+        else if(arg == "-w")
+            corpus.words = atoi(value.c_str());
+        else if(arg == "-k")
+            k = atoi(value.c_str());
+        else if(arg == "-f")
+            moved = atof(value.c_str());
+        else if(arg == "-e")
+            seed_ks = parseNumbers(value);
+        else if(arg == "-s")
+            corpus.seed = strtoul(value.c_str(), 0, 10);
+        else if(arg == "-x")
+            sets = splitList(value);
+        else if(arg == "-o")
+            options.only = splitList(value);
+        else if(arg == "-r")
+            options.repeats = atoi(value.c_str());
+        else if(arg == "-m")
+            options.min_ms = atof(value.c_str());
+        else if(arg == "--csv")
+            csv_fname = value;
+        else {
+            cout << "Error: unknown argument \"" << arg << "\"." << endl;
+            printUsage();
+            return -1;
+        }
+    }
+    if(corpus.docs < 1 || corpus.words < 1 || k < 1) {
+        cout << "Error: the corpus needs documents and words, and k must be"
+             << " positive." << endl;
+        return -1;
+    }
+    if(options.repeats < 1)
+        options.repeats = 1;
+
+    PerfCounters counters;
+    options.counters = &counters;
+    if(!counters.available())
+        cout << "Note: hardware counters are not available (see"
+             << " /proc/sys/kernel/perf_event_paranoid)." << endl;
+
+    // generate (and normalize) the corpora once for all kernel sets
+    vector<SparseMatrix*> corpora;
+    for(size_t i=0; i<draws.size(); i++) {
+        SyntheticCorpus sparsity = corpus;
+        sparsity.nnz_per_doc = draws[i];
+        SparseMatrix *D = generateSyntheticCorpus(sparsity);
+        D->normalizeRows();
+        cout << "# corpus " << (i+1) << ": " << D->rows << " documents, "
+             << D->cols << " words, " << D->nnz << " non-zero entries ("
+             << draws[i] << " draws per document)" << endl;
+        corpora.push_back(D);
+    }
+
+    ofstream csv;
+    if(!csv_fname.empty()) {
+        csv.open(csv_fname.c_str());
+        writeCSVHeader(csv);
+        options.csv = &csv;
+    }
+    writeCSVHeader(cout);
+
+    for(size_t s=0; s<sets.size(); s++) {
+        VecKernels type;
+        if(sets[s] == "scalar")
+            type = VEC_SCALAR;
+        else if(sets[s] == "avx2")
+            type = VEC_AVX2;
+        else if(sets[s] == "avx512")
+            type = VEC_AVX512;
+        else {
+            cout << "Error: unknown kernel set \"" << sets[s] << "\"."
+                 << endl;
+            continue;
+        }
+        if(!vec_set_kernels(type)) {
+            cout << "# " << sets[s] << " kernels are not supported by this"
+                 << " CPU" << endl;
+            continue;
+        }
+        options.kernels = vec_kernels_name();
+
+        for(size_t i=0; i<sizes.size(); i++)
+            benchDense(options, sizes[i]);
+        benchStrided(options, corpus.words, k);
+        for(size_t i=0; i<corpora.size(); i++) {
+            benchCorpus(options, corpora[i], k, moved, corpus.seed);
+            benchSeeding(options, corpora[i], seed_ks, corpus.seed);
+        }
+    }
+
+    for(size_t i=0; i<corpora.size(); i++)
+        delete corpora[i];
+    if(!csv_fname.empty()) {
+        csv.close();
+        if(csv.fail())
+            cout << "Error: could not write \"" << csv_fname << "\"." << endl;
+    }
+    return 0;
+}
@@ -0,0 +1,135 @@
+/* File: perf_counters.cpp
+ *
+ * Defines the PerfCounters functions on top of the Linux perf_event_open
+ * system call (there is no glibc wrapper for it).
+ */
+
+#include "perf_counters.h"
+
+#ifdef __linux__
+#include <linux/perf_event.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+
+// names of the counters (in the order of PerfCounters::Counter)
+static const char *COUNTER_NAMES[PerfCounters::NUM_COUNTERS] = {
+    "cycles", "instructions", "cache_misses", "branch_misses"
+};
+
+
+#ifdef __linux__
+
+// the generic hardware events of the counters
+static const unsigned long long
+COUNTER_EVENTS[PerfCounters::NUM_COUNTERS] = {
+    PERF_COUNT_HW_CPU_CYCLES, PERF_COUNT_HW_INSTRUCTIONS,
+    PERF_COUNT_HW_CACHE_MISSES, PERF_COUNT_HW_BRANCH_MISSES
+};
+
+
+
+// Opens one (stopped) counter of user space events for the calling thread
+// on any CPU. Returns -1 if it is not supported or not permitted.
+static int openCounter(unsigned long long event)
+{
+    struct perf_event_attr attr;
+    memset(&attr, 0, sizeof(attr));
+    attr.size = sizeof(attr);
+    attr.type = PERF_TYPE_HARDWARE;
+    attr.config = event;
+    attr.disabled = 1;
+    attr.exclude_kernel = 1;
+    attr.exclude_hv = 1;
+    attr.read_format = PERF_FORMAT_TOTAL_TIME_ENABLED
+                     | PERF_FORMAT_TOTAL_TIME_RUNNING;
+    return syscall(__NR_perf_event_open, &attr, 0, -1, -1, 0);
+}
+
+#endif
+
+
+
+// The counters are opened independently, so any subset of them can work.
+PerfCounters::PerfCounters()
+{
+    for(int c=0; c<NUM_COUNTERS; c++) {
+#ifdef __linux__
+        fds[c] = openCounter(COUNTER_EVENTS[c]);
+#else
+        fds[c] = -1;
+#endif
+    }
+}
+
+
+
+// Closes the counters.
+PerfCounters::~PerfCounters()
+{
+#ifdef __linux__
+    for(int c=0; c<NUM_COUNTERS; c++) {
+        if(fds[c] >= 0)
+            close(fds[c]);
+    }
+#endif
+}
+
+
+
+// Returns true if at least one counter could be opened.
+bool PerfCounters::available()
+{
+    for(int c=0; c<NUM_COUNTERS; c++) {
+        if(fds[c] >= 0)
+            return true;
+    }
+    return false;
+}
+
+
+
+// Returns the name of the given counter.
+const char* PerfCounters::name(Counter counter)
+{
+    return COUNTER_NAMES[counter];
+}
+
+
+
+// Resets and starts all counters.
+void PerfCounters::start()
+{
+#ifdef __linux__
+    for(int c=0; c<NUM_COUNTERS; c++) {
+        if(fds[c] >= 0) {
+            ioctl(fds[c], PERF_EVENT_IOC_RESET, 0);
+            ioctl(fds[c], PERF_EVENT_IOC_ENABLE, 0);
+        }
+    }
+#endif
+}
+
+
+
+// A counter that only ran for part of the time (because more counters were
+// requested than the CPU has) is scaled up to the whole time.
+void PerfCounters::stop(long long values[NUM_COUNTERS])
+{
+    for(int c=0; c<NUM_COUNTERS; c++) {
+        values[c] = -1;
+#ifdef __linux__
+        if(fds[c] < 0)
+            continue;
+        ioctl(fds[c], PERF_EVENT_IOC_DISABLE, 0);
+        // the count, the time enabled and the time running
+        unsigned long long data[3];
+        if(read(fds[c], data, sizeof(data)) != sizeof(data) || data[2] == 0)
+            continue;
+        values[c] = (long long)((double)data[0] * data[1] / data[2]);
+#endif
+    }
+}
@@ -0,0 +1,57 @@
+/* File: perf_counters.h
+ *
+ * Contains the PerfCounters class, which reads the hardware performance
+ * counters of the calling thread (cycles, instructions, last level cache
+ * misses and branch misses) through perf_event_open. Counters that the
+ * kernel or the CPU do not provide (or any counter, outside of Linux) are
+ * simply reported as unavailable.
+ */
+
+#ifndef PERF_COUNTERS_H
+#define PERF_COUNTERS_H
+
+
+// PerfCounters class counts hardware events of the thread that created it.
+class PerfCounters {
+
+  public:
+
+    // the counted events
+    enum Counter {
+        CYCLES,
+        INSTRUCTIONS,
+        CACHE_MISSES,
+        BRANCH_MISSES,
+        NUM_COUNTERS
+    };
+
+  private:
+
+    // one file descriptor per counter (-1 if it could not be opened)
+    int fds[NUM_COUNTERS];
+
+  public:
+
+    // Constructor: opens all counters (stopped).
+    PerfCounters();
+
+    // Destructor: closes the counters.
+    ~PerfCounters();
+
+    // Returns true if at least one counter could be opened.
+    bool available();
+
+    // Returns the name of the given counter.
+    static const char* name(Counter counter);
+
+    // Resets and starts all counters.
+    void start();
+
+    // Stops all counters and stores their counts (scaled up if the kernel
+    // had to multiplex them) in values; -1 marks an unavailable counter.
+    void stop(long long values[NUM_COUNTERS]);
+
+};
+
+
+#endif
@@ -0,0 +1,135 @@
+/* File: reader_bench.cpp
+ *
+ * Benchmarks the document file readers: the original (iostream) reader is
+ * compared against the multithreaded reader on each given file, and the two
+ * resulting matrices are checked to be identical. Synthetic document files
+ * of any size can be generated for the comparison.
+ *
+ * $ ./reader_bench [-t numthreads] [-r repeats] [-s numdocs] [docfile ...]
+ */
+
+#include <fstream>
+#include <iostream>
+#include <stdlib.h>
+#include <string>
+#include <string.h>
+#include <vector>
+
+#include "reader.h"
+#include "sparse_matrix.h"
+#include "timer.h"
+
+using namespace std;
+
+
+
+// Writes a synthetic document file with the given number of documents. Each
+// document gets 20 to 180 entries; word IDs are skewed towards the low IDs
+// (roughly like real word frequencies), and counts are small integers.
+void writeSyntheticFile(const char *fname, int dc, int wc)
+{
+    srand(dc);
+    vector<int> doc_ids, word_ids, counts;
+    for(int d=1; d<=dc; d++) {
+        int size = 20 + rand() % 161;
+        for(int i=0; i<size; i++) {
+            double r = (double)rand() / RAND_MAX;
+            doc_ids.push_back(d);
+            word_ids.push_back(1 + (int)(r * r * r * (wc - 1)));
+            counts.push_back(1 + rand() % 8);
+        }
+    }
+
+    ofstream outfile(fname);
+    outfile << dc << endl << wc << endl << counts.size() << endl;
+    for(size_t i=0; i<counts.size(); i++)
+        outfile << doc_ids[i] << " " << word_ids[i] << " " << counts[i]
+                << endl;
+    outfile.close();
+}
+
+
+
+// Returns true if the two matrices have exactly the same CSR contents.
+bool sameMatrix(SparseMatrix *a, SparseMatrix *b)
+{
+    if(a->rows != b->rows || a->cols != b->cols || a->nnz != b->nnz)
+        return false;
+    return memcmp(a->offsets, b->offsets, sizeof(int) * (a->rows+1)) == 0
+        && memcmp(a->indices, b->indices, sizeof(int) * a->nnz) == 0
+        && memcmp(a->values, b->values, sizeof(float) * a->nnz) == 0;
+}
+
+
+
+// Times both readers on the given file (average of the given number of
+// repeats), and reports the speedup and whether the results match.
+void benchFile(const char *fname, int num_threads, int repeats)
+{
+    int dc, wc, non_zero;
+    Timer serial_timer, parallel_timer;
+    SparseMatrix *serial = 0;
+    SparseMatrix *parallel = 0;
+    for(int r=0; r<repeats; r++) {
+        delete serial;
+        delete parallel;
+        serial_timer.start();
+        serial = readDocFile(fname, &dc, &wc, &non_zero);
+        serial_timer.stop();
+        parallel_timer.start();
+        parallel = readDocFileParallel(fname, &dc, &wc, &non_zero,
+                                       num_threads);
+        parallel_timer.stop();
+    }
+
+    float serial_ms = (float)serial_timer.get() / repeats;
+    float parallel_ms = (float)parallel_timer.get() / repeats;
+    cout << fname << ": " << dc << " documents, " << non_zero
+         << " non-zero entries" << endl
+         << "   readDocFile          " << serial_ms << " ms" << endl
+         << "   readDocFileParallel  " << parallel_ms << " ms";
+    if(parallel_ms > 0)
+        cout << " (" << serial_ms / parallel_ms << "x)";
+    cout << endl
+         << "   results " << (sameMatrix(serial, parallel) ? "match" : "DIFFER")
+         << endl;
+    delete serial;
+    delete parallel;
+}
+
+
+
+// main: generate the synthetic files (if any) and benchmark each file.
+int main(int argc, char **argv)
+{
+    int num_threads = 0;
+    int repeats = 3;
+    vector<string> fnames;
+    for(int i=1; i<argc; i++) {
+        string arg(argv[i]);
+        if(i+1 < argc && arg == "-t")
+            num_threads = atoi(argv[++i]);
+        else if(i+1 < argc && arg == "-r")
+            repeats = atoi(argv[++i]);
+        else if(i+1 < argc && arg == "-s") {
+            int dc = atoi(argv[++i]);
+            string fname = "/tmp/spkmeans_synthetic_" + string(argv[i]);
+            cout << "Writing synthetic file " << fname << "..." << endl;
+            writeSyntheticFile(fname.c_str(), dc, 50000);
+            fnames.push_back(fname);
+        }
+        else
+            fnames.push_back(arg);
+    }
+    if(repeats < 1)
+        repeats = 1;
+    if(fnames.empty()) {
+        cout << "$ ./reader_bench [-t numthreads] [-r repeats] [-s numdocs] "
+             << "[docfile ...]" << endl;
+        return 0;
+    }
+
+    for(size_t i=0; i<fnames.size(); i++)
+        benchFile(fnames[i].c_str(), num_threads, repeats);
+    return 0;
+}
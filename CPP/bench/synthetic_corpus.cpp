@@ -0,0 +1,124 @@
+/* File: synthetic_corpus.cpp
+ *
+ * Defines the synthetic document matrix generator of the benchmarks.
+ */
+
+#include "synthetic_corpus.h"
+
+#include <algorithm>
+#include <math.h>
+#include <random>
+#include <string.h>
+#include <vector>
+
+using namespace std;
+
+
+
+// Returns the default parameters of a synthetic corpus.
+SyntheticCorpus defaultSyntheticCorpus()
+{
+    SyntheticCorpus corpus;
+    corpus.docs = 20000;
+    corpus.words = 20000;
+    corpus.nnz_per_doc = 60;
+    corpus.zipf = 1.1;
+    corpus.clusters = 20;
+    corpus.purity = 0.7;
+    corpus.seed = 1;
+    return corpus;
+}
+
+
+
+// Returns the cumulative weights of n ranks, where rank r has the weight
+// 1 / (r+1)^s.
+static vector<double> zipfWeights(int n, double s)
+{
+    vector<double> cdf(n);
+    double sum = 0;
+    for(int r=0; r<n; r++) {
+        sum += 1.0 / pow(r + 1.0, s);
+        cdf[r] = sum;
+    }
+    return cdf;
+}
+
+
+
+// Draws a rank from the given cumulative weights.
+static int drawRank(const vector<double> &cdf, mt19937 &rng)
+{
+    uniform_real_distribution<double> uniform(0, cdf.back());
+    int rank = upper_bound(cdf.begin(), cdf.end(), uniform(rng)) - cdf.begin();
+    return min(rank, (int)cdf.size() - 1);
+}
+
+
+
+// The words of the whole vocabulary are ranked by their IDs (low IDs are the
+// most frequent); each cluster's topic words are a random sample of the
+// vocabulary, ranked in the order they were sampled.
+SparseMatrix* generateSyntheticCorpus(const SyntheticCorpus &corpus,
+                                      int *labels)
+{
+    mt19937 rng(corpus.seed);
+    int words = max(corpus.words, 1);
+    int clusters = max(corpus.clusters, 1);
+    int draws = max(corpus.nnz_per_doc, 1);
+
+    // choose the topic words of each planted cluster
+    int topic_size = min(words, max(4 * draws, words / clusters));
+    vector<int> pool(words);
+    for(int w=0; w<words; w++)
+        pool[w] = w;
+    vector<vector<int>> topics(clusters);
+    for(int c=0; c<clusters; c++) {
+        for(int t=0; t<topic_size; t++)
+            swap(pool[t], pool[t + rng() % (words - t)]);
+        topics[c].assign(pool.begin(), pool.begin() + topic_size);
+    }
+    vector<double> vocab_cdf = zipfWeights(words, corpus.zipf);
+    vector<double> topic_cdf = zipfWeights(topic_size, corpus.zipf);
+
+    // draw the words of each document, and count the repeated ones
+    uniform_real_distribution<double> uniform(0, 1);
+    vector<int> offsets(1, 0);
+    vector<int> indices;
+    vector<float> values;
+    vector<int> doc_words;
+    for(int d=0; d<corpus.docs; d++) {
+        int c = rng() % clusters;
+        if(labels != 0)
+            labels[d] = c;
+        int count = draws / 2 + rng() % (draws + 1);
+        if(count < 1)
+            count = 1;
+
+        doc_words.clear();
+        for(int i=0; i<count; i++) {
+            if(uniform(rng) < corpus.purity)
+                doc_words.push_back(topics[c][drawRank(topic_cdf, rng)]);
+            else
+                doc_words.push_back(drawRank(vocab_cdf, rng));
+        }
+        sort(doc_words.begin(), doc_words.end());
+        for(int i=0; i<count; i++) {
+            if(i > 0 && doc_words[i] == doc_words[i-1])
+                values.back() += 1;
+            else {
+                indices.push_back(doc_words[i]);
+                values.push_back(1);
+            }
+        }
+        offsets.push_back(indices.size());
+    }
+
+    SparseMatrix *mat = new SparseMatrix(corpus.docs, words, indices.size());
+    memcpy(mat->offsets, &offsets[0], sizeof(int) * offsets.size());
+    if(!indices.empty()) {
+        memcpy(mat->indices, &indices[0], sizeof(int) * indices.size());
+        memcpy(mat->values, &values[0], sizeof(float) * values.size());
+    }
+    return mat;
+}
@@ -0,0 +1,51 @@
+/* File: synthetic_corpus.h
+ *
+ * Generates synthetic sparse document matrices for the benchmarks. Word
+ * frequencies follow a Zipf distribution, and the documents are drawn from
+ * a number of planted clusters: each cluster has its own topic words (with
+ * their own Zipf distribution), which a document of that cluster prefers
+ * over the words of the whole vocabulary. The same parameters (and seed)
+ * always give the same matrix.
+ */
+
+#ifndef SYNTHETIC_CORPUS_H
+#define SYNTHETIC_CORPUS_H
+
+#include "sparse_matrix.h"
+
+
+// parameters of a synthetic corpus
+struct SyntheticCorpus {
+    int docs;           // number of documents (rows)
+    int words;          // vocabulary size (columns)
+    int nnz_per_doc;    // average number of word draws per document
+    double zipf;        // Zipf exponent of the word frequencies
+    int clusters;       // number of planted clusters
+    double purity;      // fraction of each document's draws from its topic
+    unsigned int seed;  // seed of the random choices
+};
+
+
+// Returns the default parameters (20000 documents and words, 60 draws per
+// document, Zipf exponent 1.1, 20 planted clusters with purity 0.7).
+SyntheticCorpus defaultSyntheticCorpus();
+
+
+/* Generates a document matrix with the given parameters. Each document
+ * belongs to a uniformly random planted cluster, and gets between half and
+ * one and a half times nnz_per_doc word draws; a draw comes from the
+ * cluster's topic words with probability purity, and from the whole
+ * vocabulary otherwise. The value of each word is the number of times it
+ * was drawn (so a document has at most as many entries as draws).
+ * PARAMETERS:
+ *  corpus - The parameters of the corpus.
+ *  labels - If not null, filled with the planted cluster of each document
+ *           (must hold corpus.docs entries).
+ * RETURNS:
+ *  The (not normalized) document matrix.
+ */
+SparseMatrix* generateSyntheticCorpus(const SyntheticCorpus &corpus,
+                                      int *labels = 0);
+
+
+#endif
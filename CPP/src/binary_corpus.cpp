@@ -0,0 +1,232 @@
+/* File: binary_corpus.cpp
+ *
+ * Definitions of the binary document file writing and mapping functions.
+ */
+
+#include "binary_corpus.h"
+
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+using namespace std;
+
+
+
+// Rounds the given byte count up to the array alignment of the file.
+static size_t alignedBytes(size_t bytes)
+{
+    return (bytes + BINARY_CORPUS_ALIGN - 1) / BINARY_CORPUS_ALIGN
+        * BINARY_CORPUS_ALIGN;
+}
+
+
+
+// Adds the given array of 32-bit words to a running FNV-1a checksum.
+uint64_t checksumWords(uint64_t hash, const void *data, long count)
+{
+    const uint32_t *words = (const uint32_t*)data;
+    for(long i=0; i<count; i++) {
+        hash ^= words[i];
+        hash *= 1099511628211ULL;
+    }
+    return hash;
+}
+
+
+
+// Returns the checksum of the CSR arrays of a matrix.
+static uint64_t checksumArrays(int rows, int nnz,
+                               int *offsets, int *indices, float *values)
+{
+    uint64_t hash = CHECKSUM_START;
+    hash = checksumWords(hash, offsets, (long)rows + 1);
+    hash = checksumWords(hash, indices, nnz);
+    hash = checksumWords(hash, values, nnz);
+    return hash;
+}
+
+
+
+// Writes the given bytes to the file, followed by zero padding up to the
+// array alignment. Returns false if the write failed.
+static bool writePadded(FILE *file, const void *data, size_t bytes)
+{
+    static const char zeros[BINARY_CORPUS_ALIGN] = {0};
+    if(bytes > 0 && fwrite(data, 1, bytes, file) != bytes)
+        return false;
+    size_t padding = alignedBytes(bytes) - bytes;
+    return padding == 0 || fwrite(zeros, 1, padding, file) == padding;
+}
+
+
+
+// Checks the magic string at the top of the file.
+bool isBinaryDocFile(const char *fname)
+{
+    FILE *file = fopen(fname, "rb");
+    if(file == 0)
+        return false;
+    char magic[8];
+    bool binary = fread(magic, 1, 8, file) == 8
+        && memcmp(magic, BINARY_CORPUS_MAGIC, 8) == 0;
+    fclose(file);
+    return binary;
+}
+
+
+
+// The arrays follow the header in order, each one padded to the alignment.
+const char* checkBinaryDocHeader(const BinaryCorpusHeader *header,
+                                 size_t file_size, BinaryCorpusLayout *layout)
+{
+    if(memcmp(header->magic, BINARY_CORPUS_MAGIC, 8) != 0)
+        return "not a binary document file";
+    if(header->version != BINARY_CORPUS_VERSION)
+        return "unsupported binary file version";
+    if(header->rows < 0 || header->cols < 0 || header->nnz < 0
+       || header->rows >= 0x7fffffff || header->cols > 0x7fffffff
+       || header->nnz > 0x7fffffff)
+        return "invalid matrix dimensions";
+
+    layout->offsets_pos = alignedBytes(sizeof(BinaryCorpusHeader));
+    layout->indices_pos = layout->offsets_pos
+        + alignedBytes(sizeof(int) * (header->rows + 1));
+    layout->values_pos = layout->indices_pos
+        + alignedBytes(sizeof(int) * header->nnz);
+    layout->end_pos = layout->values_pos + sizeof(float) * header->nnz;
+    if(layout->end_pos > file_size)
+        return "file is truncated";
+    return 0;
+}
+
+
+
+// One pass over the offsets.
+const char* checkRowOffsets(const int *offsets, int rows, int nnz)
+{
+    if(offsets[0] != 0 || offsets[rows] != nnz)
+        return "inconsistent row offsets";
+    for(int i=0; i<rows; i++) {
+        if(offsets[i+1] < offsets[i])
+            return "inconsistent row offsets";
+    }
+    return 0;
+}
+
+
+
+// One pass over the indices; each index is compared with the one before it
+// in its row.
+const char* checkColumnIndices(const int *offsets, const int *indices,
+                               int rows, int cols)
+{
+    for(int i=0; i<rows; i++) {
+        for(int a=offsets[i]; a<offsets[i+1]; a++) {
+            if(indices[a] < 0 || indices[a] >= cols)
+                return "column index out of range";
+            if(a > offsets[i] && indices[a] <= indices[a-1])
+                return "column indices not strictly increasing";
+        }
+    }
+    return 0;
+}
+
+
+
+// Writes the header followed by the three (padded) CSR arrays.
+bool writeBinaryDocFile(const char *fname, SparseMatrix *mat)
+{
+    BinaryCorpusHeader header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, BINARY_CORPUS_MAGIC, 8);
+    header.version = BINARY_CORPUS_VERSION;
+    header.flags = mat->normalized ? BINARY_CORPUS_TXN : 0;
+    header.rows = mat->rows;
+    header.cols = mat->cols;
+    header.nnz = mat->nnz;
+    header.checksum = checksumArrays(mat->rows, mat->nnz,
+        mat->offsets, mat->indices, mat->values);
+
+    FILE *file = fopen(fname, "wb");
+    if(file == 0)
+        return false;
+    bool ok = writePadded(file, &header, sizeof(header))
+        && writePadded(file, mat->offsets, sizeof(int) * (mat->rows + 1))
+        && writePadded(file, mat->indices, sizeof(int) * mat->nnz)
+        && writePadded(file, mat->values, sizeof(float) * mat->nnz);
+    if(fclose(file) != 0)
+        ok = false;
+    return ok;
+}
+
+
+
+// Stores the given reason in error_message (if it is not null), and returns
+// a null matrix.
+static SparseMatrix* mapFailed(const char **error_message, const char *error)
+{
+    if(error_message != 0)
+        *error_message = error;
+    return 0;
+}
+
+
+
+// Maps the whole file and points the matrix arrays into the mapping. The
+// header is validated against the file size, and the offsets and indices
+// against the header (an O(rows + nnz) pass), so a truncated, mismatched or
+// corrupted file is never used; only the checksum is optional.
+SparseMatrix* mapBinaryDocFile(const char *fname, bool verify,
+                               const char **error_message)
+{
+    int fd = open(fname, O_RDONLY);
+    if(fd < 0)
+        return mapFailed(error_message, "could not open the file");
+    struct stat info;
+    if(fstat(fd, &info) != 0
+       || info.st_size < (off_t)sizeof(BinaryCorpusHeader)) {
+        close(fd);
+        return mapFailed(error_message, "not a binary document file");
+    }
+    size_t size = info.st_size;
+    void *mapping = mmap(0, size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if(mapping == MAP_FAILED)
+        return mapFailed(error_message, "could not map the file");
+
+    // check the header and the expected size of the file
+    BinaryCorpusHeader *header = (BinaryCorpusHeader*)mapping;
+    BinaryCorpusLayout layout = {0, 0, 0, 0};
+    const char *error = checkBinaryDocHeader(header, size, &layout);
+
+    int rows = header->rows;
+    int nnz = header->nnz;
+    char *base = (char*)mapping;
+    int *offsets = (int*)(base + layout.offsets_pos);
+    int *indices = (int*)(base + layout.indices_pos);
+    float *values = (float*)(base + layout.values_pos);
+    if(error == 0)
+        error = checkRowOffsets(offsets, rows, nnz);
+    if(error == 0)
+        error = checkColumnIndices(offsets, indices, rows, header->cols);
+    if(error == 0 && verify &&
+       checksumArrays(rows, nnz, offsets, indices, values) != header->checksum)
+        error = "checksum mismatch";
+    if(error != 0) {
+        munmap(mapping, size);
+        return mapFailed(error_message, error);
+    }
+
+    // every iteration visits all documents, so start reading the file in
+    // the background (the call returns right away)
+    madvise(mapping, size, MADV_WILLNEED);
+
+    SparseMatrix *mat = new SparseMatrix(rows, header->cols, nnz,
+        offsets, indices, values, mapping, size);
+    mat->normalized = (header->flags & BINARY_CORPUS_TXN) != 0;
+    return mat;
+}
@@ -0,0 +1,117 @@
+/* File: binary_corpus.h
+ *
+ * Provides functions for writing the document matrix to a binary CSR file,
+ * and for loading such a file back by memory-mapping it, so the matrix can
+ * be used directly from the mapped arrays without parsing or copying.
+ */
+
+#ifndef BINARY_CORPUS_H
+#define BINARY_CORPUS_H
+
+#include "sparse_matrix.h"
+
+#include <stdint.h>
+
+// identifies binary document files (first 8 bytes of the file)
+#define BINARY_CORPUS_MAGIC "SPKMCSR"
+#define BINARY_CORPUS_VERSION 1
+
+// header flags
+#define BINARY_CORPUS_TXN 0x1 // the TXN scheme (normalization) is applied
+
+// alignment (in bytes) of the header and of each CSR array in the file
+#define BINARY_CORPUS_ALIGN 64
+
+// starting value of a checksum (the FNV-1a offset basis)
+#define CHECKSUM_START 14695981039346656037ULL
+
+
+/* Header of a binary document file. The file is laid out as:
+ *  <top of file>
+ *      header (64 bytes)
+ *      row offsets      (rows+1 ints)
+ *      column indices   (nnz ints)
+ *      values           (nnz floats)
+ *  <end of file>
+ * Each array starts on a BINARY_CORPUS_ALIGN byte boundary (zero padded).
+ * Everything is stored in the byte order of the machine that wrote the file.
+ * The checksum covers the three arrays (but not the padding or header).
+ */
+struct BinaryCorpusHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t flags;
+    int64_t rows;
+    int64_t cols;
+    int64_t nnz;
+    uint64_t checksum;
+    char reserved[16];
+};
+
+
+// Positions (in bytes from the top of the file) of the three CSR arrays of a
+// binary document file, and of the end of the last one.
+struct BinaryCorpusLayout {
+    size_t offsets_pos;
+    size_t indices_pos;
+    size_t values_pos;
+    size_t end_pos;
+};
+
+
+// Adds the given array of 32-bit words (ints or floats) to a running FNV-1a
+// checksum, which starts at CHECKSUM_START; also used by the model files.
+uint64_t checksumWords(uint64_t hash, const void *data, long count);
+
+
+// Returns true if the given file exists and starts with the binary document
+// file magic string.
+bool isBinaryDocFile(const char *fname);
+
+
+// Writes the given matrix to a binary document file. If the matrix rows are
+// normalized, the TXN flag is set in the header.
+// Returns true on success, or false if the file could not be written.
+bool writeBinaryDocFile(const char *fname, SparseMatrix *mat);
+
+
+// Checks the given header (magic string, version and dimensions) against the
+// size of its file, and fills in the positions of the CSR arrays.
+// Returns an error message, or a null pointer if the header is valid.
+const char* checkBinaryDocHeader(const BinaryCorpusHeader *header,
+                                 size_t file_size, BinaryCorpusLayout *layout);
+
+
+// Checks the row offsets of a matrix with the given rows and non-zero
+// entries: they must start at 0, never decrease, and end at nnz.
+// Returns an error message, or a null pointer if the offsets are valid.
+const char* checkRowOffsets(const int *offsets, int rows, int nnz);
+
+
+// Checks the column indices of the given rows (offsets[i] is the position of
+// row i in indices): each must be in [0, cols), and they must be strictly
+// increasing within a row. The offsets must already be valid.
+// Returns an error message, or a null pointer if the indices are valid.
+const char* checkColumnIndices(const int *offsets, const int *indices,
+                               int rows, int cols);
+
+
+/* Memory-maps a binary document file and returns a SparseMatrix that uses
+ * the mapped arrays directly. The mapping is private (copy-on-write), so the
+ * matrix can still be modified in memory without changing the file. If the
+ * file has the TXN flag set, the matrix is marked as normalized.
+ * PARAMETERS:
+ *  fname    - Name of the binary file.
+ *  verify   - If true, also check the checksum of the arrays (the header,
+ *             the file size, and the structure of the row offsets and
+ *             column indices are always checked).
+ *  error_message - If not null, set to the reason the file was rejected.
+ * RETURNS:
+ *  The mapped SparseMatrix, or a null pointer if the file is not a valid
+ *  binary document file (nothing is printed).
+ */
+SparseMatrix* mapBinaryDocFile(const char *fname, bool verify = false,
+                               const char **error_message = 0);
+
+
+#endif
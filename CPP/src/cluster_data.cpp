@@ -7,45 +7,52 @@
 
 #include "cluster_data.h"
 
-#include <vector>
+#include "vectors.h"
 
+#include <new>
+#include <omp.h>
+#include <stdlib.h>
+#include <sys/mman.h>
 
 
-// Constructor: pass in the four required values (k, wc, dc, doc_matrix), and
-// set up the appropriate data structures.
+
+// Constructor: pass in the two required values (k, docs), and set up the
+// appropriate data structures. The document matrix is shared with the caller
+// and is not copied or deleted by ClusterData.
 // If pointers to the optional lists are not provided, new lists will be
 // initialized instead.
-ClusterData::ClusterData(int k_, int dc_, int wc_, float **doc_matrix,
-    float **concepts_, int *p_asgns_, float *doc_priorities_,
+ClusterData::ClusterData(int k_, SparseMatrix *docs_,
+    int *p_asgns_, float *doc_priorities_,
     bool *changed_, float *cosine_similarities_, float *qualities_)
 {
     // set the size variables (k, document count, word count)
     k = k_;
-    dc = dc_;
-    wc = wc_;
-
-    // initialize and fill document data structure
-    docs = new Document[dc];
-    for(int i=0; i<dc; i++) {
-        // find all non-zero words in this document
-        Document d;
-        for(int j=0; j<wc; j++) {
-            if(doc_matrix[i][j] > 0) {
-                ValueIndexPair vi;
-                vi.value = doc_matrix[i][j];
-                vi.index = j;
-                d.words.push_back(vi);
-            }
-        }
-        d.count = d.words.size();
-        docs[i] = d;
-    }
-
-    // set concepts pointer
-    if(concepts_== 0)
-        concepts = new float*[k];
-    else
-        concepts = concepts_;
+    dc = docs_->rows;
+    wc = docs_->cols;
+
+    // set the (shared) sparse document matrix
+    docs = docs_;
+
+    // the concept matrix is allocated later (see allocateConcepts)
+    concepts = 0;
+    concept_layout = CLUSTER_MAJOR;
+    concept_stride = 0;
+    word_stride = 0;
+    concepts_size = 0;
+    concepts_mapped = false;
+
+    // everything is stored in fp32 unless reduced later
+    concept_precision = FP32_PRECISION;
+    cache_precision = FP32_PRECISION;
+    reduced_concepts = 0;
+    reduced_cosines = 0;
+
+    // the cluster sums are only allocated in delta mode (see allocateSums)
+    sums = 0;
+    cluster_sizes = 0;
+    sum_errors = 0;
+    sums_valid = false;
+    apply_deltas = false;
 
     // set partition assignment pointers
     if(p_asgns_ == 0)
@@ -55,11 +62,24 @@ ClusterData::ClusterData(int k_, int dc_, int wc_, float **doc_matrix,
     p_asgns_new = new int[dc];
 
     // set document priorities pointer
-    if(doc_priorities_ == 0)
+    // (new documents start with the highest priority)
+    if(doc_priorities_ == 0) {
         doc_priorities = new float[dc];
+        for(int i=0; i<dc; i++)
+            doc_priorities[i] = 2;
+    }
     else
         doc_priorities = doc_priorities_;
 
+    // no document has been skipped yet
+    skip_counts = new int[dc];
+    for(int i=0; i<dc; i++)
+        skip_counts[i] = 0;
+    change_stamps = new int[k];
+    for(int i=0; i<k; i++)
+        change_stamps[i] = 0;
+    iteration = 0;
+
     // set changed flag pointer; if newly created, initialize all to true
     if(changed_ == 0) {
         changed = new bool[k];
@@ -69,11 +89,17 @@ ClusterData::ClusterData(int k_, int dc_, int wc_, float **doc_matrix,
     else
         changed = changed_;
 
-    // set cosine similarity cache pointer
-    if(cosine_similarities_ == 0)
-        cosine_similarities = new float[k*dc];
-    else
-        cosine_similarities = cosine_similarities_;
+    // set cosine similarity cache pointer (if not given, the cache is
+    // allocated later, since its size depends on the chosen cache type)
+    cosine_similarities = cosine_similarities_;
+
+    // the top-m candidate cache is only allocated if selected
+    top_m = 0;
+    top_clusters = 0;
+    top_bounds = 0;
+    rest_bounds = 0;
+    max_drift = 0;
+    num_rescans = 0;
 
     // set cluster qualities cache pointer
     if(qualities_ == 0)
@@ -81,6 +107,41 @@ ClusterData::ClusterData(int k_, int dc_, int wc_, float **doc_matrix,
     else
         qualities = qualities_;
 
+    // set up the concept norms cache (filled in as concepts are computed)
+    concept_norms = new float[k];
+    concept_drifts = new float[k];
+    concept_counts = new int[k];
+    concept_sq_norms = new double[k];
+    concept_locks = new omp_lock_t[k];
+    concept_versions = new std::atomic<unsigned int>[k];
+    for(int i=0; i<k; i++) {
+        concept_norms[i] = 0;
+        concept_drifts[i] = 0;
+        concept_counts[i] = 0;
+        concept_sq_norms[i] = 0;
+        omp_init_lock(&concept_locks[i]);
+        concept_versions[i].store(0);
+    }
+
+    // set up the cluster grouping arrays (filled in by groupByCluster)
+    cluster_offsets = new int[k+1];
+    cluster_docs = new int[dc];
+    group_counts = 0;
+    group_threads = 0;
+
+    // set up the moved document lists (per-thread records are made later)
+    move_marks = 0;
+    move_lists = 0;
+    move_threads = 0;
+    moved_out_offsets = new int[k+1];
+    moved_out_docs = new int[dc];
+    moved_in_offsets = new int[k+1];
+    moved_in_docs = new int[dc];
+    for(int i=0; i<=k; i++) {
+        moved_out_offsets[i] = 0;
+        moved_in_offsets[i] = 0;
+    }
+
     // init all counters to 0
     total_priority = 0;
     total_moved_priority = 0;
@@ -126,7 +187,8 @@ void ClusterData::assignCluster(int doc, int cluster, float priority)
 
 // Swaps the p_assignments and new_p_assignments pointers such so that
 // the new values are updated without needing to manipulate memory.
-// This also resets the priority and moved counts to 0.
+// This also resets the priority totals to 0. The moved count and lists are
+// kept until the next partitioning step (see prepareMoves).
 void ClusterData::applyAssignments()
 {
     int *temp = p_asgns;
@@ -134,7 +196,39 @@ void ClusterData::applyAssignments()
     p_asgns_new = temp;
     total_priority = 0;
     total_moved_priority = 0;
-    num_moved = 0;
+}
+
+
+
+// Starts the next iteration: each cluster that is marked as changed is
+// stamped with the new iteration number, so documents that were skipped in
+// earlier iterations can tell which of their cached cosines are stale.
+void ClusterData::stampChanges()
+{
+    iteration++;
+    max_drift = 0;
+    num_rescans = 0;
+    for(int i=0; i<k; i++) {
+        if(changed[i]) {
+            change_stamps[i] = iteration;
+            if(concept_drifts[i] > max_drift)
+                max_drift = concept_drifts[i];
+        }
+    }
+}
+
+
+
+// Returns the bucket of the given document's priority: the priority range
+// [0, 2] is split into PRIORITY_BUCKETS equal buckets.
+int ClusterData::priorityBucket(int doc)
+{
+    int bucket = doc_priorities[doc] * (PRIORITY_BUCKETS / 2);
+    if(bucket < 0)
+        return 0;
+    if(bucket >= PRIORITY_BUCKETS)
+        return PRIORITY_BUCKETS - 1;
+    return bucket;
 }
 
 
@@ -169,28 +263,583 @@ float ClusterData::getAverageStayPriority()
 
 
 
+// Groups the documents by cluster (a counting sort over p_asgns), so the
+// documents of each cluster can be visited without scanning all documents.
+// Within each cluster, documents are kept in increasing order regardless of
+// the number of threads used. Each thread counts its own contiguous block of
+// documents, so the only shared step is the O(k * threads) prefix sum.
+void ClusterData::groupByCluster(int num_threads)
+{
+    if(num_threads < 1)
+        num_threads = 1;
+
+    // make sure there is a count array for each thread (allocated once)
+    if(num_threads > group_threads) {
+        if(group_counts != 0)
+            delete[] group_counts;
+        group_counts = new int[num_threads * k];
+        group_threads = num_threads;
+    }
+
+    #pragma omp parallel num_threads(num_threads)
+    {
+        int t = omp_get_thread_num();
+        int nt = omp_get_num_threads();
+        int begin = (long)dc * t / nt;
+        int end = (long)dc * (t+1) / nt;
+
+        // count the documents of each cluster in this thread's block
+        int *counts = group_counts + t*k;
+        for(int i=0; i<k; i++)
+            counts[i] = 0;
+        for(int i=begin; i<end; i++)
+            counts[p_asgns[i]]++;
+        #pragma omp barrier
+
+        // turn the counts into each thread's starting position per cluster
+        #pragma omp single
+        {
+            int pos = 0;
+            for(int i=0; i<k; i++) {
+                cluster_offsets[i] = pos;
+                for(int j=0; j<nt; j++) {
+                    int count = group_counts[j*k + i];
+                    group_counts[j*k + i] = pos;
+                    pos += count;
+                }
+            }
+            cluster_offsets[k] = pos;
+        }
+
+        // place each document into its cluster's list
+        for(int i=begin; i<end; i++)
+            cluster_docs[counts[p_asgns[i]]++] = i;
+    }
+}
+
+
+
+// Returns the number of documents in the given cluster, as computed by the
+// last call to groupByCluster.
+int ClusterData::clusterSize(int cIndx)
+{
+    return cluster_offsets[cIndx+1] - cluster_offsets[cIndx];
+}
+
+
+
 // Computes which clusters have changed, and assigns the boolean array
-// accordingly.
-void ClusterData::findChangedClusters()
+// accordingly. This is a separate parallel pass over all documents, for
+// partitioning steps that don't record their moves as they go (the runners
+// call checkMoved from their partitioning loops instead).
+void ClusterData::findChangedClusters(int num_threads)
 {
-    for(int i=0; i<k; i++)
-        changed[i] = false;
-    for(int i=0; i<dc; i++) {
-        if(p_asgns[i] != p_asgns_new[i]) {
-            changed[p_asgns[i]] = true;
-            changed[p_asgns_new[i]] = true;
+    if(num_threads < 1)
+        num_threads = 1;
+    prepareMoves(num_threads);
+    #pragma omp parallel for num_threads(num_threads)
+    for(int i=0; i<dc; i++)
+        checkMoved(omp_get_thread_num(), i);
+    mergeMoves();
+}
+
+
+
+// Clears the move records of the given number of threads (allocating them
+// the first time, or when there are more threads than before).
+void ClusterData::prepareMoves(int num_threads)
+{
+    if(num_threads < 1)
+        num_threads = 1;
+    if(num_threads > move_threads) {
+        if(move_marks != 0)
+            delete[] move_marks;
+        if(move_lists != 0)
+            delete[] move_lists;
+        move_marks = new bool[num_threads * k];
+        move_lists = new std::vector<int>[num_threads];
+        move_threads = num_threads;
+    }
+    for(int i=0; i<move_threads * k; i++)
+        move_marks[i] = false;
+    for(int t=0; t<move_threads; t++)
+        move_lists[t].clear();
+    num_moved = 0;
+}
+
+
+
+// If the given document's new cluster differs from its current one, marks
+// both clusters as changed and lists the document in the records of the
+// given thread. Each thread only writes its own records, so no locking is
+// needed.
+void ClusterData::checkMoved(int thread, int doc)
+{
+    int from = p_asgns[doc];
+    int to = p_asgns_new[doc];
+    if(from == to)
+        return;
+    bool *marks = move_marks + (long)thread * k;
+    marks[from] = true;
+    marks[to] = true;
+    move_lists[thread].push_back(doc);
+}
+
+
+
+// Combines the move records of all threads: counts the moved documents,
+// groups them by old and by new cluster (counting sorts over the moved
+// documents only), and, if mark_changed is set, sets the changed flags from
+// the thread marks. Takes O(moved + k * threads) time.
+void ClusterData::mergeMoves(bool mark_changed)
+{
+    if(mark_changed) {
+        for(int i=0; i<k; i++) {
+            changed[i] = false;
+            for(int t=0; t<move_threads; t++) {
+                if(move_marks[t*k + i]) {
+                    changed[i] = true;
+                    break;
+                }
+            }
+        }
+    }
+
+    for(int i=0; i<=k; i++) {
+        moved_out_offsets[i] = 0;
+        moved_in_offsets[i] = 0;
+    }
+    num_moved = 0;
+    for(int t=0; t<move_threads; t++) {
+        for(size_t a=0; a<move_lists[t].size(); a++) {
+            int doc = move_lists[t][a];
+            moved_out_offsets[p_asgns[doc] + 1]++;
+            moved_in_offsets[p_asgns_new[doc] + 1]++;
+            num_moved++;
+        }
+    }
+    for(int i=0; i<k; i++) {
+        moved_out_offsets[i+1] += moved_out_offsets[i];
+        moved_in_offsets[i+1] += moved_in_offsets[i];
+    }
+    for(int t=0; t<move_threads; t++) {
+        for(size_t a=0; a<move_lists[t].size(); a++) {
+            int doc = move_lists[t][a];
+            moved_out_docs[moved_out_offsets[p_asgns[doc]]++] = doc;
+            moved_in_docs[moved_in_offsets[p_asgns_new[doc]]++] = doc;
+        }
+    }
+    for(int i=k; i>0; i--) {
+        moved_out_offsets[i] = moved_out_offsets[i-1];
+        moved_in_offsets[i] = moved_in_offsets[i-1];
+    }
+    moved_out_offsets[0] = 0;
+    moved_in_offsets[0] = 0;
+}
+
+
+
+// Rounds the given number of floats up to a whole number of aligned blocks.
+static long alignedLength(long length)
+{
+    long block = CONCEPT_ALIGN / sizeof(float);
+    return (length + block - 1) / block * block;
+}
+
+
+
+// Allocates all concept vectors as one zeroed, CONCEPT_ALIGN-aligned
+// matrix. In the CLUSTER_MAJOR layout, each concept is a (padded) row, so
+// every concept vector is itself aligned. In the WORD_MAJOR layout, each
+// word's weights for all k concepts are a (padded) row instead.
+// If huge_pages is set, the matrix is mapped directly and the kernel is
+// asked to back it with transparent huge pages; if that mapping fails, the
+// regular allocation is used.
+void ClusterData::allocateConcepts(ConceptLayout layout, bool huge_pages)
+{
+    clearConcepts();
+
+    concept_layout = layout;
+    if(layout == CLUSTER_MAJOR) {
+        concept_stride = alignedLength(wc);
+        word_stride = 1;
+        concepts_size = concept_stride * k;
+    }
+    else {
+        concept_stride = 1;
+        word_stride = alignedLength(k);
+        concepts_size = word_stride * wc;
+    }
+    size_t bytes = concepts_size * sizeof(float);
+
+    // anonymous mappings are page aligned and already zeroed
+    if(huge_pages) {
+        void *mem = mmap(0, bytes, PROT_READ | PROT_WRITE,
+                         MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if(mem != MAP_FAILED) {
+#ifdef MADV_HUGEPAGE
+            madvise(mem, bytes, MADV_HUGEPAGE);
+#endif
+            concepts = (float*)mem;
+            concepts_mapped = true;
+            return;
         }
     }
+
+    void *mem = 0;
+    if(posix_memalign(&mem, CONCEPT_ALIGN, bytes) != 0)
+        throw std::bad_alloc();
+    concepts = (float*)mem;
+    concepts_mapped = false;
+    for(long i=0; i<concepts_size; i++)
+        concepts[i] = 0;
+}
+
+
+
+// Returns a pointer to the first weight of the given concept vector. Weight
+// w of the concept is at getConcept(cIndx)[w * word_stride].
+float* ClusterData::getConcept(int cIndx)
+{
+    return concepts + cIndx * concept_stride;
+}
+
+
+
+// Allocates the cluster sums as a zeroed matrix with the same size, layout
+// and alignment as the concept matrix, which must already be allocated. The
+// sums only become valid once computed (see SPKMeans::updateConcept).
+void ClusterData::allocateSums()
+{
+    clearSums();
+
+    void *mem = 0;
+    if(posix_memalign(&mem, CONCEPT_ALIGN, concepts_size * sizeof(float)) != 0)
+        throw std::bad_alloc();
+    sums = (float*)mem;
+    for(long i=0; i<concepts_size; i++)
+        sums[i] = 0;
+
+    cluster_sizes = new int[k];
+    sum_errors = new float[k];
+    for(int i=0; i<k; i++) {
+        cluster_sizes[i] = 0;
+        sum_errors[i] = 0;
+    }
+}
+
+
+
+// Returns a pointer to the first weight of the given cluster sum. Weight w
+// of the sum is at getSum(cIndx)[w * word_stride].
+float* ClusterData::getSum(int cIndx)
+{
+    return sums + cIndx * concept_stride;
+}
+
+
+
+// Cleans cluster sum memory (if any was allocated).
+void ClusterData::clearSums()
+{
+    if(sums != 0) {
+        free(sums);
+        sums = 0;
+    }
+    if(cluster_sizes != 0) {
+        delete[] cluster_sizes;
+        cluster_sizes = 0;
+    }
+    if(sum_errors != 0) {
+        delete[] sum_errors;
+        sum_errors = 0;
+    }
+    sums_valid = false;
+    apply_deltas = false;
+}
+
+
+
+// Acquires the lock of the given concept, waiting until it is free, and
+// makes its version odd before anything is changed.
+void ClusterData::lockConcept(int cIndx)
+{
+    omp_set_lock(&concept_locks[cIndx]);
+    std::atomic<unsigned int> &version = concept_versions[cIndx];
+    version.store(version.load(std::memory_order_relaxed) + 1,
+                  std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+}
+
+
+
+// Makes the version of the given concept even again once its changes are
+// done, and releases its lock.
+void ClusterData::unlockConcept(int cIndx)
+{
+    concept_versions[cIndx].fetch_add(1, std::memory_order_release);
+    omp_unset_lock(&concept_locks[cIndx]);
+}
+
+
+
+// Waits until the given concept is not locked (its version is even), and
+// returns its version.
+unsigned int ClusterData::readConceptVersion(int cIndx)
+{
+    unsigned int version;
+    do
+        version = concept_versions[cIndx].load(std::memory_order_acquire);
+    while(version & 1);
+    return version;
+}
+
+
+
+// The reads of the concept must be done before its version is read again.
+bool ClusterData::conceptUnchanged(int cIndx, unsigned int version)
+{
+    std::atomic_thread_fence(std::memory_order_acquire);
+    return concept_versions[cIndx].load(std::memory_order_relaxed) == version;
+}
+
+
+
+// Recomputes the cached norm of the concept vector of the given cluster.
+// This must be called whenever that concept vector is modified.
+void ClusterData::updateConceptNorm(int cIndx)
+{
+    concept_norms[cIndx] = vec_norm_strided(getConcept(cIndx), wc,
+                                            word_stride);
+}
+
+
+
+// Converts the concept matrix to the given 16-bit precision: each weight is
+// rounded to the nearest representable number, and the fp32 matrix is
+// freed. The strides stay the same (see getConcept), but the concepts can
+// now only be read through conceptDot and written through storeConcept.
+void ClusterData::reduceConcepts(Precision precision)
+{
+    if(precision == FP32_PRECISION || concept_precision != FP32_PRECISION)
+        return;
+
+    void *mem = 0;
+    if(posix_memalign(&mem, CONCEPT_ALIGN, concepts_size * sizeof(uint16_t))
+       != 0)
+        throw std::bad_alloc();
+    uint16_t *reduced = (uint16_t*)mem;
+    for(long i=0; i<concepts_size; i++)
+        reduced[i] = floatToReduced(concepts[i], precision);
+
+    long size = concepts_size;
+    clearConcepts();
+    reduced_concepts = reduced;
+    concepts_size = size;
+    concept_precision = precision;
+}
+
+
+
+// Converts a reduced concept matrix back into a (regular) fp32 matrix, so
+// the final concepts can be read with getConcept. Does nothing if the
+// concepts are not reduced.
+void ClusterData::expandConcepts()
+{
+    if(concept_precision == FP32_PRECISION)
+        return;
+
+    Precision precision = concept_precision;
+    uint16_t *reduced = reduced_concepts;
+    reduced_concepts = 0;
+    concept_precision = FP32_PRECISION;
+    allocateConcepts(concept_layout);
+    for(long i=0; i<concepts_size; i++)
+        concepts[i] = reducedToFloat(reduced[i], precision);
+    free(reduced);
+}
+
+
+
+// Returns the dot product of the given concept vector and document, which
+// takes O(nz(doc)) time. The products are always accumulated in fp32.
+float ClusterData::conceptDot(int cIndx, int doc)
+{
+    int start = docs->offsets[doc];
+    int count = docs->offsets[doc+1] - start;
+    if(docs->qvalues != 0) {
+        const void *concept = (concept_precision == FP32_PRECISION)
+            ? (const void*)getConcept(cIndx)
+            : (const void*)(reduced_concepts + cIndx * concept_stride);
+        return quantizedSparseDot(concept, word_stride, docs->indices + start,
+            docs->qvalues + start, docs->qscales[doc], count,
+            concept_precision);
+    }
+    if(concept_precision == FP32_PRECISION)
+        return vec_sparse_dot_strided(getConcept(cIndx), word_stride,
+            docs->indices + start, docs->values + start, count);
+    return reducedSparseDot(reduced_concepts + cIndx * concept_stride,
+        word_stride, docs->indices + start, docs->values + start, count,
+        concept_precision);
+}
+
+
+
+// Stores the given vector of wc weights (contiguous, in fp32) as the given
+// concept vector, rounding each weight if the concepts are reduced.
+void ClusterData::storeConcept(int cIndx, const float *concept)
+{
+    if(concept_precision == FP32_PRECISION) {
+        float *dest = getConcept(cIndx);
+        for(int w=0; w<wc; w++)
+            dest[w * word_stride] = concept[w];
+        return;
+    }
+    uint16_t *dest = reduced_concepts + cIndx * concept_stride;
+    for(int w=0; w<wc; w++)
+        dest[w * word_stride] = floatToReduced(concept[w], concept_precision);
+}
+
+
+
+// Allocates the (uninitialized) cosine similarity cache of k values per
+// document in the given precision, unless an fp32 cache was given to the
+// constructor. A reduced cache can only be accessed through loadCosines,
+// storeCosines and fillCosines.
+void ClusterData::allocateCache(Precision precision)
+{
+    long size = (long)k * dc;
+    if(precision == FP32_PRECISION) {
+        if(cosine_similarities == 0)
+            cosine_similarities = new float[size];
+        return;
+    }
+    if(reduced_cosines == 0)
+        reduced_cosines = new uint16_t[size];
+    cache_precision = precision;
+}
+
+
+
+// Allocates the top-m candidate cache, which takes m clusters and bounds per
+// document (plus the bound of the other clusters) instead of k similarities.
+// No document has any candidates yet, so all of them compute every
+// similarity the first time they are partitioned.
+void ClusterData::allocateTopCache(int m)
+{
+    top_m = m;
+    long size = (long)m * dc;
+    top_clusters = new int[size];
+    top_bounds = new float[size];
+    rest_bounds = new float[dc];
+    for(long i=0; i<size; i++) {
+        top_clusters[i] = -1;
+        top_bounds[i] = 0;
+    }
+    for(int i=0; i<dc; i++)
+        rest_bounds[i] = 0;
 }
 
 
 
-// Cleans concept vector memory, permanently deleting all of the concept
-// vectors. The actual concept vector list is NOT deleted.
+// Copies the k cached cosine similarities of the given document into the
+// given array.
+void ClusterData::loadCosines(int doc, float *cosines)
+{
+    long start = (long)doc * k;
+    if(cache_precision == FP32_PRECISION) {
+        for(int j=0; j<k; j++)
+            cosines[j] = cosine_similarities[start + j];
+        return;
+    }
+    for(int j=0; j<k; j++)
+        cosines[j] = reducedToFloat(reduced_cosines[start + j],
+                                    cache_precision);
+}
+
+
+
+// Copies the given k cosine similarities into the cache of the given
+// document. If round_up is set, a reduced cache rounds them up instead of to
+// the nearest number (see floatToReducedUp).
+void ClusterData::storeCosines(int doc, const float *cosines, bool round_up)
+{
+    long start = (long)doc * k;
+    if(cache_precision == FP32_PRECISION) {
+        for(int j=0; j<k; j++)
+            cosine_similarities[start + j] = cosines[j];
+    }
+    else if(round_up) {
+        for(int j=0; j<k; j++)
+            reduced_cosines[start + j] =
+                floatToReducedUp(cosines[j], cache_precision);
+    }
+    else {
+        for(int j=0; j<k; j++)
+            reduced_cosines[start + j] =
+                floatToReduced(cosines[j], cache_precision);
+    }
+}
+
+
+
+// Sets every cached cosine similarity (of every document) to the value.
+void ClusterData::fillCosines(float value)
+{
+    long size = (long)k * dc;
+    if(cache_precision == FP32_PRECISION) {
+        for(long i=0; i<size; i++)
+            cosine_similarities[i] = value;
+        return;
+    }
+    uint16_t reduced = floatToReducedUp(value, cache_precision);
+    for(long i=0; i<size; i++)
+        reduced_cosines[i] = reduced;
+}
+
+
+
+// Returns the number of bytes used by the concept matrix.
+long ClusterData::conceptBytes()
+{
+    return concepts_size * precisionBytes(concept_precision);
+}
+
+
+
+// Returns the number of bytes used by the cosine similarity cache (or by the
+// top-m candidate cache, if it is used instead).
+long ClusterData::cacheBytes()
+{
+    if(top_m > 0)
+        return (long)dc * top_m * (sizeof(int) + sizeof(float))
+               + (long)dc * sizeof(float);
+    if(cosine_similarities == 0 && reduced_cosines == 0)
+        return 0;
+    return (long)k * dc * precisionBytes(cache_precision);
+}
+
+
+
+// Cleans concept vector memory, permanently deleting the concept matrix
+// (in any precision).
 void ClusterData::clearConcepts()
 {
-    for(int i=0; i<k; i++)
-        delete[] concepts[i];
+    if(reduced_concepts != 0) {
+        free(reduced_concepts);
+        reduced_concepts = 0;
+        concept_precision = FP32_PRECISION;
+        concepts_size = 0;
+    }
+    if(concepts == 0)
+        return;
+    if(concepts_mapped)
+        munmap(concepts, concepts_size * sizeof(float));
+    else
+        free(concepts);
+    concepts = 0;
+    concepts_size = 0;
+    concepts_mapped = false;
 }
 
 
@@ -199,18 +848,12 @@ void ClusterData::clearConcepts()
 // WARNING: this will turn all data structure pointers to NULL.
 void ClusterData::clearMemory()
 {
-    // clean up the document data structures
-    if(docs != 0) {
-        delete[] docs;
-        docs = 0;
-    }
+    // release the document matrix (it is owned by the caller)
+    docs = 0;
 
-    // clean up concept vectors
-    if(concepts != 0) {
-        clearConcepts();
-        delete[] concepts;
-        concepts = 0;
-    }
+    // clean up concept vectors (and cluster sums)
+    clearConcepts();
+    clearSums();
 
     // clean up partition assignment arrays
     if(p_asgns != 0)
@@ -221,6 +864,40 @@ void ClusterData::clearMemory()
     // clean up document priorities array
     if(doc_priorities != 0)
         delete[] doc_priorities;
+    if(skip_counts != 0) {
+        delete[] skip_counts;
+        skip_counts = 0;
+    }
+    if(change_stamps != 0) {
+        delete[] change_stamps;
+        change_stamps = 0;
+    }
+
+    // clean up the move records and moved document lists
+    if(move_marks != 0) {
+        delete[] move_marks;
+        move_marks = 0;
+    }
+    if(move_lists != 0) {
+        delete[] move_lists;
+        move_lists = 0;
+    }
+    if(moved_out_offsets != 0) {
+        delete[] moved_out_offsets;
+        moved_out_offsets = 0;
+    }
+    if(moved_out_docs != 0) {
+        delete[] moved_out_docs;
+        moved_out_docs = 0;
+    }
+    if(moved_in_offsets != 0) {
+        delete[] moved_in_offsets;
+        moved_in_offsets = 0;
+    }
+    if(moved_in_docs != 0) {
+        delete[] moved_in_docs;
+        moved_in_docs = 0;
+    }
 
     // clean up change cache arrays
     if(changed != 0) {
@@ -231,8 +908,60 @@ void ClusterData::clearMemory()
         delete[] cosine_similarities;
         cosine_similarities = 0;
     }
+    if(reduced_cosines != 0) {
+        delete[] reduced_cosines;
+        reduced_cosines = 0;
+    }
+    if(top_clusters != 0) {
+        delete[] top_clusters;
+        delete[] top_bounds;
+        delete[] rest_bounds;
+        top_clusters = 0;
+        top_bounds = 0;
+        rest_bounds = 0;
+    }
     if(qualities != 0) {
         delete[] qualities;
         qualities = 0;
     }
+    if(concept_norms != 0) {
+        delete[] concept_norms;
+        concept_norms = 0;
+    }
+    if(concept_drifts != 0) {
+        delete[] concept_drifts;
+        concept_drifts = 0;
+    }
+    if(concept_counts != 0) {
+        delete[] concept_counts;
+        concept_counts = 0;
+    }
+    if(concept_sq_norms != 0) {
+        delete[] concept_sq_norms;
+        concept_sq_norms = 0;
+    }
+    if(concept_locks != 0) {
+        for(int i=0; i<k; i++)
+            omp_destroy_lock(&concept_locks[i]);
+        delete[] concept_locks;
+        concept_locks = 0;
+    }
+    if(concept_versions != 0) {
+        delete[] concept_versions;
+        concept_versions = 0;
+    }
+
+    // clean up cluster grouping arrays
+    if(cluster_offsets != 0) {
+        delete[] cluster_offsets;
+        cluster_offsets = 0;
+    }
+    if(cluster_docs != 0) {
+        delete[] cluster_docs;
+        cluster_docs = 0;
+    }
+    if(group_counts != 0) {
+        delete[] group_counts;
+        group_counts = 0;
+    }
 }
@@ -8,23 +8,18 @@
 #ifndef CLUSTER_DATA_H
 #define CLUSTER_DATA_H
 
-#include <vector>
-
+#include "precision.h"
+#include "sparse_matrix.h"
 
-// This struct is used to store a word value and index pair, used by the
-// Document struct to map words.
-struct ValueIndexPair {
-    float value;
-    int index;
-};
+#include <atomic>
+#include <omp.h>
+#include <vector>
 
+// alignment (in bytes) of the concept matrix and of each of its rows
+#define CONCEPT_ALIGN 64
 
-// This struct maps each document to the value-index pairs of all words
-// associated with it.
-struct Document {
-    int count;
-    std::vector<ValueIndexPair> words;
-};
+// number of buckets that the document priorities (in [0, 2]) are split into
+#define PRIORITY_BUCKETS 64
 
 
 // ClusterData class can contain partition assignments and concept vector
@@ -33,15 +28,38 @@ class ClusterData {
 
   public:
 
+    // choice of concept matrix layouts
+    enum ConceptLayout {
+        CLUSTER_MAJOR, // k x wc: each concept vector is contiguous
+        WORD_MAJOR     // wc x k: the weights of each word are contiguous
+    };
+
     // clustering variables (k, word count, document count)
     int k;
     int dc;
     int wc;
 
-    // pointers to concept vectors and partition assignments (current and new)
+    // partition assignments (current and new)
     int *p_asgns;
     int *p_asgns_new;
-    float **concepts;
+
+    // concept matrix, stored in a single aligned buffer: word w of concept c
+    // is at concepts[c*concept_stride + w*word_stride] (see getConcept)
+    float *concepts;
+    ConceptLayout concept_layout;
+    long concept_stride;
+    long word_stride;
+    long concepts_size;
+    bool concepts_mapped;
+
+    // reduced precision mode: the precision of the concept matrix and of the
+    // cosine similarity cache. A reduced concept matrix is stored in
+    // reduced_concepts instead (with the same strides), and a reduced cache
+    // in reduced_cosines; both are only accessed through the functions below
+    Precision concept_precision;
+    Precision cache_precision;
+    uint16_t *reduced_concepts;
+    uint16_t *reduced_cosines;
 
     // document priority and heuristic tracking variables
     float *doc_priorities;
@@ -49,18 +67,88 @@ class ClusterData {
     float total_moved_priority;
     int num_moved;
 
+    // number of iterations in a row each document was skipped by the
+    // priority scheduler (its cached cosines are stale if this is not 0), and
+    // the last iteration in which each cluster was marked as changed
+    int *skip_counts;
+    int *change_stamps;
+    int iteration;
+
     // pointers to cosine similarities, qualities, and cluster change flags
+    // (the cosine similarity cache is allocated later, see allocateCache)
     bool *changed;
     float *cosine_similarities;
     float *qualities;
 
-    // document data structures that map documents to words
-    Document *docs;
+    // top-m candidate cache, used instead of the full cosine similarity
+    // cache if top_m is not 0: for each document, m clusters (-1 if unused)
+    // with upper bounds of their similarities, and one upper bound for all
+    // other clusters; the largest drift of the changed clusters in this
+    // iteration (see stampChanges), and the number of documents that had to
+    // compute all similarities in it
+    int top_m;
+    int *top_clusters;
+    float *top_bounds;
+    float *rest_bounds;
+    float max_drift;
+    long num_rescans;
+
+    // cached norms of the concept vectors (refreshed when a concept changes)
+    float *concept_norms;
+
+    // number of documents each concept vector has absorbed (mini-batch mode)
+    int *concept_counts;
+
+    // online mode: squared norms of the (unnormalized) concept sums, one
+    // lock per concept that guards its sum, norm and quality while they are
+    // updated, and a version per concept (odd while it is locked), so the
+    // sums can be read without the locks (see readConceptVersion)
+    double *concept_sq_norms;
+    omp_lock_t *concept_locks;
+    std::atomic<unsigned int> *concept_versions;
+
+    // distance each concept vector moved in its last update (bounds mode)
+    float *concept_drifts;
+
+    // delta mode: persistent (unnormalized) cluster sums in the same layout
+    // as the concepts (see getSum), cluster sizes, and the relative error of
+    // each sum found by the last full recompute; apply_deltas tells
+    // computeConcepts to update the sums from the moved documents only
+    float *sums;
+    int *cluster_sizes;
+    float *sum_errors;
+    bool sums_valid;
+    bool apply_deltas;
+
+    // documents grouped by cluster: the documents of cluster c are stored at
+    // cluster_docs[cluster_offsets[c]] to cluster_docs[cluster_offsets[c+1]-1]
+    int *cluster_offsets;
+    int *cluster_docs;
+
+    // per-thread cluster counts used by groupByCluster (reused every call)
+    int *group_counts;
+    int group_threads;
+
+    // moves of the current partitioning step: each thread marks the
+    // clusters it changed (move_marks, k flags per thread) and lists the
+    // documents it moved (move_lists); mergeMoves combines them into the
+    // moved documents, grouped by old cluster (moved_out) and by new cluster
+    // (moved_in), with offsets like cluster_offsets
+    bool *move_marks;
+    std::vector<int> *move_lists;
+    int move_threads;
+    int *moved_out_offsets;
+    int *moved_out_docs;
+    int *moved_in_offsets;
+    int *moved_in_docs;
+
+    // sparse document matrix that maps documents to words (not owned)
+    SparseMatrix *docs;
 
 
     // Constructor: sets up variables and data structures.
-    ClusterData(int k_, int dc_, int wc_, float **doc_matrix,
-            float **cvs_ = 0, int *p_asgns_ = 0, float *doc_priorities_ = 0,
+    ClusterData(int k_, SparseMatrix *docs_,
+            int *p_asgns_ = 0, float *doc_priorities_ = 0,
             bool *changed_ = 0, float *cosine_similarities_ = 0,
             float *qualities_ = 0);
 
@@ -76,6 +164,13 @@ class ClusterData {
     // Swaps new assignments for the default ones (updates the assignments).
     void applyAssignments();
 
+    // Starts a new iteration, and stamps all changed clusters with it (and
+    // finds their largest drift).
+    void stampChanges();
+
+    // Returns the priority bucket of the given document (0 is the lowest).
+    int priorityBucket(int doc);
+
     // Returns the average priority of all documents.
     float getAveragePriority();
 
@@ -85,8 +180,89 @@ class ClusterData {
     // Returns the average priority of all documents that have NOT moved.
     float getAverageStayPriority();
 
+    // Groups the documents by their current cluster assignments.
+    void groupByCluster(int num_threads = 1);
+
+    // Returns the number of documents in the given cluster, as of the last
+    // call to groupByCluster.
+    int clusterSize(int cIndx);
+
     // Updates which clusters have been changed since last partitioning.
-    void findChangedClusters();
+    void findChangedClusters(int num_threads = 1);
+
+    // Clears the per-thread move records before a partitioning step.
+    void prepareMoves(int num_threads = 1);
+
+    // Records the document's move (if it moved) for the given thread.
+    void checkMoved(int thread, int doc);
+
+    // Combines the move records of all threads (see move_marks).
+    void mergeMoves(bool mark_changed = true);
+
+    // Allocates the (zeroed) concept matrix in the given layout, optionally
+    // backed by huge pages.
+    void allocateConcepts(ConceptLayout layout = CLUSTER_MAJOR,
+                          bool huge_pages = false);
+
+    // Returns a pointer to the first weight of the given concept vector; the
+    // other weights follow every word_stride floats.
+    float* getConcept(int cIndx);
+
+    // Allocates the (zeroed) cluster sums, in the layout of the concepts.
+    void allocateSums();
+
+    // Returns a pointer to the first weight of the given cluster sum (with
+    // the same strides as getConcept).
+    float* getSum(int cIndx);
+
+    // Cleans cluster sum memory.
+    void clearSums();
+
+    // Locks or unlocks the given concept for an update (online mode).
+    void lockConcept(int cIndx);
+    void unlockConcept(int cIndx);
+
+    // Lock-free reads of a concept (online mode): readConceptVersion returns
+    // its version (waiting while it is locked) before the read, and
+    // conceptUnchanged tells whether it was updated meanwhile, in which case
+    // the read must be repeated.
+    unsigned int readConceptVersion(int cIndx);
+    bool conceptUnchanged(int cIndx, unsigned int version);
+
+    // Converts the concept matrix to the given 16-bit precision.
+    void reduceConcepts(Precision precision);
+
+    // Converts a reduced concept matrix back to fp32 (for the results).
+    void expandConcepts();
+
+    // Returns the dot product of the given concept vector and document, in
+    // any precision (and with quantized document values).
+    float conceptDot(int cIndx, int doc);
+
+    // Stores the given (contiguous, fp32) vector as the given concept.
+    void storeConcept(int cIndx, const float *concept);
+
+    // Allocates the cosine similarity cache in the given precision.
+    void allocateCache(Precision precision = FP32_PRECISION);
+
+    // Allocates the top-m candidate cache (instead of the full cache).
+    void allocateTopCache(int m);
+
+    // Copies the cached cosine similarities of the given document into (or
+    // out of) the given array of k floats. If round_up is set, reduced
+    // values are rounded up (so upper bounds remain upper bounds).
+    void loadCosines(int doc, float *cosines);
+    void storeCosines(int doc, const float *cosines, bool round_up);
+
+    // Sets every cached cosine similarity to the given value.
+    void fillCosines(float value);
+
+    // Returns the number of bytes used by the concepts or the cache.
+    long conceptBytes();
+    long cacheBytes();
+
+    // Recomputes the cached norm of the given concept vector.
+    void updateConceptNorm(int cIndx);
 
     // Cleans concept vector memory.
     void clearConcepts();
@@ -0,0 +1,234 @@
+/* File: cluster_model.cpp
+ *
+ * Definitions of the ClusterModel accessors and of the model file writing
+ * and reading functions.
+ */
+
+#include "cluster_model.h"
+
+#include "binary_corpus.h"
+
+#include <stdio.h>
+#include <string.h>
+
+using namespace std;
+
+
+
+// Constructor: no clusters, documents or words.
+ClusterModel::ClusterModel()
+{
+    k = 0;
+    dc = 0;
+    wc = 0;
+}
+
+
+
+// Returns the concept vector of the given cluster.
+const float* ClusterModel::getConcept(int cIndx) const
+{
+    return &concepts[(long)cIndx * wc];
+}
+
+
+
+// Returns the checksum of the arrays of a model file.
+static uint64_t checksumModel(int k, int dc, long nnz, const int *offsets,
+                              const int *indices, const float *weights,
+                              const float *qualities, const int *assignments)
+{
+    uint64_t hash = CHECKSUM_START;
+    hash = checksumWords(hash, offsets, (long)k + 1);
+    hash = checksumWords(hash, indices, nnz);
+    hash = checksumWords(hash, weights, nnz);
+    hash = checksumWords(hash, qualities, k);
+    hash = checksumWords(hash, assignments, dc);
+    return hash;
+}
+
+
+
+// Writes the given array to the file. Returns false if the write failed.
+static bool writeArray(FILE *file, const void *data, size_t bytes)
+{
+    return bytes == 0 || fwrite(data, 1, bytes, file) == bytes;
+}
+
+
+
+// Reads the given array from the file. Returns false if it is truncated.
+static bool readArray(FILE *file, void *data, size_t bytes)
+{
+    return bytes == 0 || fread(data, 1, bytes, file) == bytes;
+}
+
+
+
+// Checks the magic string at the top of the file.
+bool isModelFile(const char *fname)
+{
+    FILE *file = fopen(fname, "rb");
+    if(file == 0)
+        return false;
+    char magic[8];
+    bool model = fread(magic, 1, 8, file) == 8
+        && memcmp(magic, CLUSTER_MODEL_MAGIC, 8) == 0;
+    fclose(file);
+    return model;
+}
+
+
+
+// The non-zero weights of the concepts are gathered into CSR arrays first,
+// so the checksum can be computed before anything is written.
+bool writeModelFile(const char *fname, const ClusterModel *model)
+{
+    int k = model->k;
+    vector<int> offsets(k + 1, 0);
+    vector<int> indices;
+    vector<float> weights;
+    for(int c=0; c<k; c++) {
+        const float *concept = model->getConcept(c);
+        for(int w=0; w<model->wc; w++) {
+            if(concept[w] != 0) {
+                indices.push_back(w);
+                weights.push_back(concept[w]);
+            }
+        }
+        offsets[c+1] = indices.size();
+    }
+    long nnz = indices.size();
+
+    ClusterModelHeader header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, CLUSTER_MODEL_MAGIC, 8);
+    header.version = CLUSTER_MODEL_VERSION;
+    header.k = k;
+    header.words = model->wc;
+    header.docs = model->dc;
+    header.nnz = nnz;
+    header.checksum = checksumModel(k, model->dc, nnz, &offsets[0],
+        nnz > 0 ? &indices[0] : 0, nnz > 0 ? &weights[0] : 0,
+        k > 0 ? &model->qualities[0] : 0,
+        model->dc > 0 ? &model->assignments[0] : 0);
+
+    FILE *file = fopen(fname, "wb");
+    if(file == 0)
+        return false;
+    bool ok = writeArray(file, &header, sizeof(header))
+        && writeArray(file, &offsets[0], sizeof(int) * (k + 1))
+        && writeArray(file, nnz > 0 ? &indices[0] : 0, sizeof(int) * nnz)
+        && writeArray(file, nnz > 0 ? &weights[0] : 0, sizeof(float) * nnz)
+        && writeArray(file, k > 0 ? &model->qualities[0] : 0,
+                      sizeof(float) * k)
+        && writeArray(file, model->dc > 0 ? &model->assignments[0] : 0,
+                      sizeof(int) * model->dc);
+    if(fclose(file) != 0)
+        ok = false;
+    return ok;
+}
+
+
+
+// Stores the given reason in error_message (if it is not null), and returns
+// a null model.
+static ClusterModel* readFailed(const char **error_message, const char *error)
+{
+    if(error_message != 0)
+        *error_message = error;
+    return 0;
+}
+
+
+
+// Checks the header against the file size before anything is allocated, and
+// the arrays against the header once they are read. Nothing is printed: the
+// reason for a failure is returned in error_message.
+ClusterModel* readModelFile(const char *fname, const char **error_message)
+{
+    FILE *file = fopen(fname, "rb");
+    if(file == 0)
+        return readFailed(error_message, "could not open the file");
+    fseek(file, 0, SEEK_END);
+    long file_size = ftell(file);
+    fseek(file, 0, SEEK_SET);
+
+    ClusterModelHeader header;
+    const char *error = 0;
+    if(!readArray(file, &header, sizeof(header))
+       || memcmp(header.magic, CLUSTER_MODEL_MAGIC, 8) != 0)
+        error = "not a model file";
+    else if(header.version != CLUSTER_MODEL_VERSION)
+        error = "unsupported model file version";
+    else if(header.k <= 0 || header.words < 0 || header.docs < 0
+            || header.nnz < 0 || header.k >= 0x7fffffff
+            || header.words > 0x7fffffff || header.docs > 0x7fffffff
+            || header.nnz > 0x7fffffff || header.nnz > header.k * header.words)
+        error = "invalid model dimensions";
+    else if((long)sizeof(header) + sizeof(int) * (header.k + 1)
+            + (sizeof(int) + sizeof(float)) * header.nnz
+            + sizeof(float) * header.k + sizeof(int) * header.docs
+            != (unsigned long)file_size)
+        error = "file size does not match the header";
+    if(error != 0) {
+        fclose(file);
+        return readFailed(error_message, error);
+    }
+
+    int k = header.k;
+    long nnz = header.nnz;
+    ClusterModel *model = new ClusterModel();
+    model->k = k;
+    model->dc = header.docs;
+    model->wc = header.words;
+    model->qualities.resize(k);
+    model->assignments.resize(model->dc);
+    vector<int> offsets(k + 1);
+    vector<int> indices(nnz);
+    vector<float> weights(nnz);
+    bool ok = readArray(file, &offsets[0], sizeof(int) * (k + 1))
+        && readArray(file, nnz > 0 ? &indices[0] : 0, sizeof(int) * nnz)
+        && readArray(file, nnz > 0 ? &weights[0] : 0, sizeof(float) * nnz)
+        && readArray(file, &model->qualities[0], sizeof(float) * k)
+        && readArray(file, model->dc > 0 ? &model->assignments[0] : 0,
+                     sizeof(int) * model->dc);
+    fclose(file);
+
+    // the concept rows must be in order and within the words, and every
+    // document must belong to one of the clusters
+    if(!ok)
+        error = "file is truncated";
+    else if(offsets[0] != 0 || offsets[k] != nnz)
+        error = "inconsistent concept offsets";
+    for(int c=0; error == 0 && c<k; c++) {
+        if(offsets[c+1] < offsets[c])
+            error = "inconsistent concept offsets";
+    }
+    for(long a=0; error == 0 && a<nnz; a++) {
+        if(indices[a] < 0 || indices[a] >= model->wc)
+            error = "word index out of range";
+    }
+    for(int i=0; error == 0 && i<model->dc; i++) {
+        if(model->assignments[i] < 0 || model->assignments[i] >= k)
+            error = "cluster assignment out of range";
+    }
+    if(error == 0 && checksumModel(k, model->dc, nnz, &offsets[0],
+           nnz > 0 ? &indices[0] : 0, nnz > 0 ? &weights[0] : 0,
+           &model->qualities[0],
+           model->dc > 0 ? &model->assignments[0] : 0) != header.checksum)
+        error = "checksum mismatch";
+    if(error != 0) {
+        delete model;
+        return readFailed(error_message, error);
+    }
+
+    // expand the concepts back into dense vectors
+    model->concepts.assign((long)k * model->wc, 0);
+    for(int c=0; c<k; c++) {
+        float *concept = &model->concepts[(long)c * model->wc];
+        for(int a=offsets[c]; a<offsets[c+1]; a++)
+            concept[indices[a]] = weights[a];
+    }
+    return model;
+}
@@ -0,0 +1,97 @@
+/* File: cluster_model.h
+ *
+ * Contains the ClusterModel class (the outcome of a clustering run: concept
+ * vectors, assignments and qualities), and the functions that save a model
+ * to a compact binary file and load it back, so a later run can start from
+ * it (a warm start, see SPKMeans::setWarmStart) instead of seeding again.
+ */
+
+#ifndef CLUSTER_MODEL_H
+#define CLUSTER_MODEL_H
+
+#include <stdint.h>
+#include <vector>
+
+// identifies model files (first 8 bytes of the file)
+#define CLUSTER_MODEL_MAGIC "SPKMMDL"
+#define CLUSTER_MODEL_VERSION 1
+
+
+// ClusterModel class holds the concepts, assignments and qualities of a
+// clustering of dc documents over wc words into k clusters.
+class ClusterModel {
+
+  public:
+
+    // number of clusters, documents and words
+    int k;
+    int dc;
+    int wc;
+
+    // the cluster of each document, the concept vectors (concept c is stored
+    // at concepts[c*wc] to concepts[c*wc + wc-1], in fp32), and the quality
+    // of each cluster
+    std::vector<int> assignments;
+    std::vector<float> concepts;
+    std::vector<float> qualities;
+
+    // Constructor: an empty model (no clusters).
+    ClusterModel();
+
+    // Returns the concept vector of the given cluster.
+    const float* getConcept(int cIndx) const;
+
+};
+
+
+/* Header of a model file. The file is laid out as:
+ *  <top of file>
+ *      header (64 bytes)
+ *      concept offsets  (k+1 ints)
+ *      word indices     (nnz ints)
+ *      weights          (nnz floats)
+ *      qualities        (k floats)
+ *      assignments      (docs ints)
+ *  <end of file>
+ * The concepts are stored as the rows of a sparse (CSR) matrix: only their
+ * non-zero weights are kept, which is most of the savings for sparse text.
+ * Everything is stored in the byte order of the machine that wrote the file,
+ * and the checksum covers all arrays (see checksumWords).
+ */
+struct ClusterModelHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t flags;
+    int64_t k;
+    int64_t words;
+    int64_t docs;
+    int64_t nnz;
+    uint64_t checksum;
+    char reserved[8];
+};
+
+
+// Returns true if the given file exists and starts with the model file
+// magic string.
+bool isModelFile(const char *fname);
+
+
+// Writes the given model to a model file.
+// Returns true on success, or false if the file could not be written.
+bool writeModelFile(const char *fname, const ClusterModel *model);
+
+
+/* Reads a model file back. The header, the concept offsets and indices, the
+ * assignments and the checksum are all checked.
+ * PARAMETERS:
+ *  fname         - Name of the model file.
+ *  error_message - If not null, set to the reason the file was rejected.
+ * RETURNS:
+ *  The model (to be deleted by the caller), or a null pointer if the file
+ *  is not a valid model file (nothing is printed).
+ */
+ClusterModel* readModelFile(const char *fname,
+                            const char **error_message = 0);
+
+
+#endif
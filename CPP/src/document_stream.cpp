@@ -0,0 +1,268 @@
+/* File: document_stream.cpp
+ *
+ * Defines the DocumentStream functions for reading a binary document file
+ * chunk by chunk, with the reads of the next chunk done in the background.
+ */
+
+#include "document_stream.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+using namespace std;
+
+
+
+// Reads the given number of bytes from the given file position, retrying
+// short or interrupted reads. Returns false if the bytes could not be read.
+static bool readFully(int fd, void *dest, size_t bytes, size_t pos)
+{
+    char *out = (char*)dest;
+    while(bytes > 0) {
+        ssize_t count = pread(fd, out, bytes, pos);
+        if(count < 0 && errno == EINTR)
+            continue;
+        if(count <= 0)
+            return false;
+        out += count;
+        pos += count;
+        bytes -= count;
+    }
+    return true;
+}
+
+
+
+// Constructor: the header and the row offsets are checked the same way as
+// in mapBinaryDocFile, but only the offsets are read (the column indices
+// are checked as each chunk is read). Nothing is printed: the reason for a
+// failure is kept for getError.
+DocumentStream::DocumentStream(const char *fname)
+    : fd(-1), loading(false), next_buffer(0), next_chunk(0), failed(false),
+      error(0), index(0), normalized(false), normalize(false),
+      max_chunk_rows(0), max_chunk_nnz(0), bytes_read(0)
+{
+    buffers[0] = 0;
+    buffers[1] = 0;
+
+    fd = open(fname, O_RDONLY);
+    if(fd < 0) {
+        error = "could not open the file";
+        return;
+    }
+    struct stat info;
+    BinaryCorpusHeader header;
+    if(fstat(fd, &info) != 0
+       || !readFully(fd, &header, sizeof(header), 0))
+        error = "not a binary document file";
+    else
+        error = checkBinaryDocHeader(&header, info.st_size, &layout);
+
+    int *offsets = 0;
+    if(error == 0) {
+        offsets = new int[header.rows + 1];
+        if(!readFully(fd, offsets, sizeof(int) * (header.rows + 1),
+                      layout.offsets_pos))
+            error = "file is truncated";
+        else
+            error = checkRowOffsets(offsets, header.rows, header.nnz);
+    }
+    if(error != 0) {
+        delete[] offsets;
+        return;
+    }
+
+    index = new SparseMatrix(header.rows, header.cols, header.nnz,
+                             offsets, 0, 0, 0, 0);
+    normalized = (header.flags & BINARY_CORPUS_TXN) != 0;
+    index->normalized = normalized;
+}
+
+
+
+// Destructor: the index owns the row offsets (and has no other arrays).
+DocumentStream::~DocumentStream()
+{
+    finishRead();
+    delete buffers[0];
+    delete buffers[1];
+    delete index;
+    if(fd >= 0)
+        close(fd);
+}
+
+
+
+// A chunk holds its row offsets (one more than its rows), and an index and a
+// value for each non-zero entry.
+long DocumentStream::chunkBytes(long rows, long nnz)
+{
+    return (rows + 1) * sizeof(int) + nnz * (sizeof(int) + sizeof(float));
+}
+
+
+
+// Each chunk takes as many documents (in file order) as fit in the buffer.
+bool DocumentStream::planChunks(long buffer_bytes)
+{
+    int *offsets = index->offsets;
+    int rows = index->rows;
+    chunk_starts.clear();
+    max_chunk_rows = 0;
+    max_chunk_nnz = 0;
+    int start = 0;
+    while(start < rows) {
+        int end = start;
+        while(end < rows && chunkBytes(end + 1 - start,
+                                       offsets[end+1] - offsets[start])
+                            <= buffer_bytes)
+            end++;
+        if(end == start)
+            return false;
+        chunk_starts.push_back(start);
+        if(end - start > max_chunk_rows)
+            max_chunk_rows = end - start;
+        if(offsets[end] - offsets[start] > max_chunk_nnz)
+            max_chunk_nnz = offsets[end] - offsets[start];
+        start = end;
+    }
+    chunk_starts.push_back(rows);
+
+    for(int b=0; b<2; b++) {
+        delete buffers[b];
+        buffers[b] = new SparseMatrix(max_chunk_rows, index->cols,
+                                      max_chunk_nnz);
+    }
+    return true;
+}
+
+
+
+// Returns the number of chunks of a pass.
+int DocumentStream::numChunks()
+{
+    return chunk_starts.empty() ? 0 : chunk_starts.size() - 1;
+}
+
+
+
+// The chunk's rows are copied from the file, its offsets are made relative
+// to its first row, its column indices are checked (so a corrupted file
+// never reaches the sums), and its rows are normalized if that was
+// requested.
+void DocumentStream::readChunk(int chunk, SparseMatrix *buffer)
+{
+    int start = chunk_starts[chunk];
+    int end = chunk_starts[chunk+1];
+    int first = index->offsets[start];
+    int nnz = index->offsets[end] - first;
+    buffer->rows = end - start;
+    buffer->nnz = nnz;
+    for(int i=0; i<=end-start; i++)
+        buffer->offsets[i] = index->offsets[start + i] - first;
+
+    if(!readFully(fd, buffer->indices, sizeof(int) * nnz,
+                  layout.indices_pos + sizeof(int) * first)
+       || !readFully(fd, buffer->values, sizeof(float) * nnz,
+                     layout.values_pos + sizeof(float) * first)) {
+        error = "file is truncated";
+        failed = true;
+        return;
+    }
+    error = checkColumnIndices(buffer->offsets, buffer->indices, end - start,
+                               index->cols);
+    if(error != 0) {
+        failed = true;
+        return;
+    }
+    bytes_read += (long)nnz * (sizeof(int) + sizeof(float));
+
+    buffer->normalized = normalized;
+    if(normalize && !normalized)
+        buffer->normalizeRows();
+}
+
+
+
+// The next chunk goes into the buffer that is not handed out.
+void DocumentStream::startRead()
+{
+    if(next_chunk >= numChunks())
+        return;
+    loader = thread(&DocumentStream::readChunk, this, next_chunk,
+                    buffers[next_buffer]);
+    loading = true;
+}
+
+
+
+// Joins the background thread (if it is reading).
+void DocumentStream::finishRead()
+{
+    if(!loading)
+        return;
+    wait_timer.start();
+    loader.join();
+    wait_timer.stop();
+    loading = false;
+}
+
+
+
+// The first chunk is read in the background as well, so the caller can do
+// other work until it asks for it.
+void DocumentStream::startPass()
+{
+    finishRead();
+    next_chunk = 0;
+    next_buffer = 0;
+    failed = false;
+    error = 0;
+    startRead();
+}
+
+
+
+// Waits for the pending chunk, then starts reading the one after it into the
+// other buffer before handing the pending one out.
+SparseMatrix* DocumentStream::nextChunk(int *first_row)
+{
+    if(next_chunk >= numChunks())
+        return 0;
+    finishRead();
+    if(failed)
+        return 0;
+
+    SparseMatrix *chunk = buffers[next_buffer];
+    *first_row = chunk_starts[next_chunk];
+    next_chunk++;
+    next_buffer = 1 - next_buffer;
+    startRead();
+    return chunk;
+}
+
+
+
+// Returns true if a read of the last pass failed.
+bool DocumentStream::readFailed()
+{
+    return failed;
+}
+
+
+
+// Returns the reason the file could not be opened, or a read failed.
+const char* DocumentStream::getError()
+{
+    return error;
+}
+
+
+
+// Returns the total time spent in nextChunk waiting for the reads.
+unsigned long DocumentStream::waitTime()
+{
+    return wait_timer.get();
+}
@@ -0,0 +1,120 @@
+/* File: document_stream.h
+ *
+ * Contains the DocumentStream class, which reads a binary document file (see
+ * binary_corpus.h) in chunks of documents instead of loading or mapping all
+ * of it, so corpora that do not fit in memory can still be clustered. Only
+ * the row offsets stay in memory; two chunk buffers are filled in turns, and
+ * the next chunk is read by a background thread while the current one is
+ * being worked on.
+ */
+
+#ifndef DOCUMENT_STREAM_H
+#define DOCUMENT_STREAM_H
+
+#include "binary_corpus.h"
+#include "sparse_matrix.h"
+#include "timer.h"
+
+#include <stddef.h>
+#include <thread>
+#include <vector>
+
+
+// DocumentStream class reads the documents of a binary file chunk by chunk,
+// in file order, in one or more passes over the file.
+class DocumentStream {
+
+  private:
+
+    // open file, and the positions of its CSR arrays
+    int fd;
+    BinaryCorpusLayout layout;
+
+    // two chunk buffers (filled in turns), the buffer and chunk the
+    // background thread is reading, whether its read failed, and why the
+    // file could not be opened or read
+    SparseMatrix *buffers[2];
+    std::thread loader;
+    bool loading;
+    int next_buffer;
+    int next_chunk;
+    bool failed;
+    const char *error;
+
+    // time spent waiting for the background thread
+    Timer wait_timer;
+
+    // Reads the given chunk into the given buffer (on the background thread).
+    void readChunk(int chunk, SparseMatrix *buffer);
+
+    // Starts reading the next chunk (if any) on the background thread.
+    void startRead();
+
+    // Waits for the background thread to finish its read.
+    void finishRead();
+
+  public:
+
+    // the row structure of the whole matrix: the row offsets are filled in,
+    // but the indices and values are not loaded (they are streamed)
+    SparseMatrix *index;
+
+    // true if the file has the TXN scheme applied, and whether the streamed
+    // rows should be normalized (if they are not)
+    bool normalized;
+    bool normalize;
+
+    // first document of each chunk (followed by the document count), and the
+    // most documents and non-zero entries in a chunk
+    std::vector<int> chunk_starts;
+    int max_chunk_rows;
+    int max_chunk_nnz;
+
+    // number of bytes read from the file so far
+    long bytes_read;
+
+
+    // Constructor: opens the given binary document file and reads its header
+    // and row offsets. If anything fails, index stays a null pointer (see
+    // getError; nothing is printed).
+    DocumentStream(const char *fname);
+
+    // Destructor: waits for a pending read, frees the buffers, closes the file.
+    ~DocumentStream();
+
+    // Returns the number of bytes that a chunk buffer of the given number of
+    // documents and non-zero entries takes.
+    static long chunkBytes(long rows, long nnz);
+
+    // Splits the documents into chunks that each fit in a buffer of the given
+    // size, and allocates the two buffers. Returns false if some document
+    // does not fit in a buffer by itself.
+    bool planChunks(long buffer_bytes);
+
+    // Returns the number of chunks (see planChunks).
+    int numChunks();
+
+    // Starts a new pass over the file (reading the first chunk right away).
+    void startPass();
+
+    // Returns the next chunk of the pass (rows are numbered from 0 within the
+    // chunk), and fills in the index of its first document. The chunk stays
+    // valid until the next call. Returns a null pointer at the end of the
+    // pass, or if a read failed (see readFailed).
+    SparseMatrix* nextChunk(int *first_row);
+
+    // Returns true if a read failed in the last pass (the file is truncated,
+    // or a chunk has invalid column indices).
+    bool readFailed();
+
+    // Returns the reason the file could not be opened or the last read
+    // failed (a null pointer if nothing failed).
+    const char* getError();
+
+    // Returns the time (in ms) spent waiting for chunks to be read.
+    unsigned long waitTime();
+
+};
+
+
+#endif
@@ -0,0 +1,444 @@
+/* File: engine.cpp
+ *
+ * Defines the SPKMeansEngine functions: choosing k, checking the options,
+ * picking and configuring the runner, and collecting the result of a run.
+ * Also defines the EngineOptions defaults and the EngineResult accessors.
+ */
+
+#include "engine.h"
+
+#include "cluster_data.h"
+
+#include <ostream>
+#include <streambuf>
+#include <string>
+#include <string.h>
+
+using namespace std;
+
+
+// names of the seedings in the report (in the order of SPKMeans::Seeding)
+static const char *SEEDING_NAMES[] = {
+    "block", "random", "kmeans++", "kmeans||"
+};
+
+
+
+// ListenerBuffer passes everything written to its stream on to a listener,
+// one line at a time.
+class ListenerBuffer : public streambuf {
+
+  private:
+
+    SPKMeansListener *listener;
+    string line;
+
+  protected:
+
+    // Collects the characters of a line, and passes on each full line.
+    int overflow(int c)
+    {
+        if(c == traits_type::eof())
+            return traits_type::not_eof(c);
+        if(c == '\n') {
+            listener->message(line);
+            line.clear();
+        }
+        else
+            line += (char)c;
+        return c;
+    }
+
+  public:
+
+    // Constructor: sets the listener.
+    ListenerBuffer(SPKMeansListener *listener_) : listener(listener_) {}
+
+    // Destructor: passes on the last line, if it was not finished.
+    ~ListenerBuffer()
+    {
+        if(!line.empty())
+            listener->message(line);
+    }
+
+};
+
+
+
+// Constructor: the defaults of the spkmeans program.
+EngineOptions::EngineOptions()
+{
+    k = 2;
+    auto_k = false;
+    mode = SERIAL_MODE;
+    num_threads = 0;
+    use_scheme = true;
+    optimize = true;
+    bounds = false;
+    spmm = false;
+    top_m = 0;
+    word_major = false;
+    huge_pages = false;
+    seeding = SPKMeans::BLOCK_SEEDING;
+    seed = 1;
+    batch_size = 0;
+    epochs = MINIBATCH_EPOCHS;
+    online = false;
+    priority = false;
+    delta = false;
+    precision = FP32_PRECISION;
+    quantize = false;
+    compare_seed = false;
+    stream_mb = 0;
+    warm_model = 0;
+    reassign = false;
+}
+
+
+
+// Constructor: set the options and the listener, and use the engine's own
+// profiler.
+SPKMeansEngine::SPKMeansEngine(const EngineOptions &options_,
+                               SPKMeansListener *listener_)
+    : options(options_), listener(listener_)
+{
+    profile = &run_profile;
+}
+
+
+
+// Returns documents * words / non-zero entries of the given documents, or 0
+// if the number of non-zero entries is not valid.
+static int autoK(SparseMatrix *docs)
+{
+    long numerator = (long)docs->rows * docs->cols;
+    if(docs->nnz <= 0 || docs->nnz > numerator)
+        return 0;
+    return numerator / docs->nnz;
+}
+
+
+
+// A warm start keeps the clusters of its model; otherwise, the automatic k is
+// used if it is selected and can be computed.
+int SPKMeansEngine::getK(SparseMatrix *docs)
+{
+    if(options.warm_model != 0)
+        return options.warm_model->k;
+    if(options.auto_k && autoK(docs) > 0)
+        return autoK(docs);
+    return options.k;
+}
+
+
+
+// Sets the profiler that times the runs.
+void SPKMeansEngine::setProfiler(Profiler *profile_)
+{
+    profile = profile_;
+}
+
+
+
+// Returns the profiler that times the runs.
+Profiler* SPKMeansEngine::getProfiler()
+{
+    return profile;
+}
+
+
+
+// Combinations of options that a runner can not honor are noted (the run
+// still goes ahead without them).
+int SPKMeansEngine::prepareRun(ostream &out, SparseMatrix *docs,
+                               bool streamed)
+{
+    int k = getK(docs);
+    const EngineOptions &o = options;
+    if(o.warm_model != 0 && (o.auto_k || o.k != k))
+        out << "Note: the saved model sets k=" << k << "." << endl;
+    else if(o.auto_k && autoK(docs) == 0)
+        out << "Could not set K automatically. Using k=" << k << endl;
+
+    bool galois = (o.mode == EngineOptions::GALOIS_MODE);
+    if(o.spmm && o.bounds)
+        out << "Note: the SpMM engine does not use similarity bounds." << endl;
+    if(o.spmm && o.top_m > 0 && !galois)
+        out << "Note: the SpMM engine caches all cosine similarities."
+            << endl;
+    if(o.batch_size > 0 && (o.spmm || o.bounds))
+        out << "Note: mini-batch mode does not use the SpMM engine or "
+            << "similarity bounds." << endl;
+    if(o.batch_size > 0 && galois)
+        out << "Note: mini-batch mode is not available with Galois." << endl;
+    if(o.spmm && galois)
+        out << "Note: the SpMM engine is not available with Galois." << endl;
+    if(o.online && o.batch_size > 0)
+        out << "Note: mini-batch mode replaces online updates." << endl;
+    else if(o.online && (o.spmm || o.bounds))
+        out << "Note: online mode does not use the SpMM engine or "
+            << "similarity bounds." << endl;
+    if(o.priority && o.spmm)
+        out << "Note: the SpMM engine does not skip documents." << endl;
+    if(o.delta && (o.online || o.batch_size > 0))
+        out << "Note: online and mini-batch modes do not use delta updates."
+            << endl;
+    if((o.precision != FP32_PRECISION || o.quantize) &&
+       (o.online || o.batch_size > 0 || o.delta || (o.spmm && !galois)))
+        out << "Note: the SpMM engine, online, mini-batch and delta modes "
+            << "store everything in fp32." << endl;
+    if(streamed && (o.bounds || o.top_m > 0 || o.spmm || o.batch_size > 0 ||
+                    o.online || o.priority || o.delta || o.quantize ||
+                    o.precision != FP32_PRECISION || galois))
+        out << "Note: streaming mode runs full batch iterations in fp32 "
+            << "with OpenMP threads only." << endl;
+    if(streamed && o.warm_model != 0)
+        out << "Note: streaming mode can not start from a saved model; "
+            << "the seeding is used instead." << endl;
+    else if(o.warm_model != 0 && o.warm_model->dc > docs->rows)
+        out << "Note: the saved model has more documents than the docfile; "
+            << "the extra ones are ignored." << endl;
+
+    // describe the data and the options in the report
+    const char *mode = streamed ? "streaming" :
+                       galois ? "galois" :
+                       (o.mode == EngineOptions::OPENMP_MODE) ? "openmp" :
+                       "serial";
+    profile->add(Profiler::DATA_SECTION, "documents", docs->rows);
+    profile->add(Profiler::DATA_SECTION, "words", docs->cols);
+    profile->add(Profiler::DATA_SECTION, "nonzeros", docs->nnz);
+    profile->add(Profiler::CONFIG_SECTION, "mode", mode);
+    profile->add(Profiler::CONFIG_SECTION, "k", k);
+    profile->add(Profiler::CONFIG_SECTION, "threads", (int)o.num_threads);
+    profile->add(Profiler::CONFIG_SECTION, "scheme", o.use_scheme);
+    profile->add(Profiler::CONFIG_SECTION, "optimize", o.optimize);
+    profile->add(Profiler::CONFIG_SECTION, "bounds", o.bounds);
+    profile->add(Profiler::CONFIG_SECTION, "top_m", o.top_m);
+    profile->add(Profiler::CONFIG_SECTION, "spmm", o.spmm);
+    profile->add(Profiler::CONFIG_SECTION, "seeding", SEEDING_NAMES[o.seeding]);
+    profile->add(Profiler::CONFIG_SECTION, "seed", (long)o.seed);
+    profile->add(Profiler::CONFIG_SECTION, "batch_size", o.batch_size);
+    profile->add(Profiler::CONFIG_SECTION, "epochs", o.epochs);
+    profile->add(Profiler::CONFIG_SECTION, "online", o.online);
+    profile->add(Profiler::CONFIG_SECTION, "priority", o.priority);
+    profile->add(Profiler::CONFIG_SECTION, "delta", o.delta);
+    profile->add(Profiler::CONFIG_SECTION, "precision",
+                 precisionName(o.precision));
+    profile->add(Profiler::CONFIG_SECTION, "quantize", o.quantize);
+    profile->add(Profiler::CONFIG_SECTION, "word_major", o.word_major);
+    profile->add(Profiler::CONFIG_SECTION, "huge_pages", o.huge_pages);
+    profile->add(Profiler::CONFIG_SECTION, "stream_mb", o.stream_mb);
+    profile->add(Profiler::CONFIG_SECTION, "warm_start", o.warm_model != 0);
+    profile->add(Profiler::CONFIG_SECTION, "reassign", o.reassign);
+    return k;
+}
+
+
+
+// The streaming runner only supports the options that do not change how
+// the documents are accessed; Galois has no SpMM engine or mini-batch mode.
+void SPKMeansEngine::configure(SPKMeans *spkm, bool streamed)
+{
+    const EngineOptions &o = options;
+    if(!o.optimize)
+        spkm->disableOptimization();
+    if(o.word_major)
+        spkm->setConceptLayout(ClusterData::WORD_MAJOR);
+    if(o.huge_pages)
+        spkm->enableHugePages();
+    if(!o.use_scheme)
+        spkm->setScheme(SPKMeans::NO_SCHEME);
+    if(streamed)
+        return;
+
+    if(o.bounds)
+        spkm->enableBounds();
+    if(o.top_m > 0)
+        spkm->setTopCache(o.top_m);
+    if(o.online)
+        spkm->enableOnline();
+    if(o.priority)
+        spkm->enablePriorities();
+    if(o.delta)
+        spkm->enableDeltas();
+    if(o.precision != FP32_PRECISION)
+        spkm->setPrecision(o.precision);
+    if(o.quantize)
+        spkm->enableQuantization();
+    if(o.mode == EngineOptions::GALOIS_MODE)
+        return;
+
+    if(o.spmm)
+        spkm->setEngine(SPKMeans::SPMM_ENGINE);
+    if(o.batch_size > 0)
+        spkm->setMiniBatch(o.batch_size, o.epochs);
+}
+
+
+
+// If compare_seed is set, the algorithm is first run with block seeding,
+// and the number of iterations saved by the selected seeding (or the warm
+// start) is reported.
+// The outcome of the run is added to the result section of the profile.
+EngineResult* SPKMeansEngine::runClustering(SPKMeans *spkm, ostream &out,
+                                            const char *mode, int k,
+                                            int num_threads)
+{
+    spkm->setProfiler(profile);
+    spkm->setOutput(&out);
+    spkm->setListener(listener);
+    if(listener != 0)
+        listener->runStarted(mode, k, num_threads);
+
+    int block_iterations = 0;
+    if(options.compare_seed && (options.seeding != SPKMeans::BLOCK_SEEDING ||
+                                options.warm_model != 0)) {
+        out << "Baseline run (block seeding):" << endl;
+        spkm->setSeeding(SPKMeans::BLOCK_SEEDING);
+        delete spkm->runSPKMeans();
+        block_iterations = spkm->getIterations();
+        out << endl << "Run with the selected seeding:" << endl;
+    }
+
+    spkm->setSeeding(options.seeding);
+    spkm->setSeed(options.seed);
+    spkm->setWarmStart(options.warm_model, options.reassign);
+    ClusterData *data = spkm->runSPKMeans();
+
+    if(block_iterations > 0) {
+        int saved = block_iterations - spkm->getIterations();
+        out << "Seeding saved " << saved << " of " << block_iterations
+            << " iterations (seeding took " << spkm->getSeedingTime()
+            << " ms)." << endl;
+    }
+    if(data == 0)
+        return 0;
+
+    // copy the assignments, concepts (in any layout) and qualities
+    EngineResult *result = new EngineResult();
+    result->k = data->k;
+    result->dc = data->dc;
+    result->wc = data->wc;
+    result->assignments.assign(data->p_asgns, data->p_asgns + data->dc);
+    result->concepts.resize((long)data->k * data->wc);
+    result->qualities.assign(data->qualities, data->qualities + data->k);
+    result->quality = 0;
+    for(int c=0; c<data->k; c++) {
+        float *concept = data->getConcept(c);
+        float *copy = &result->concepts[(long)c * data->wc];
+        for(int w=0; w<data->wc; w++)
+            copy[w] = concept[w * data->word_stride];
+        result->quality += data->qualities[c];
+    }
+    delete data;
+
+    result->iterations = spkm->getIterations();
+    result->num_threads = profile->numThreads();
+    result->run_ms = profile->millis(Profiler::RUN_PHASE);
+    result->seeding_ms = profile->millis(Profiler::SEEDING_PHASE);
+    result->num_cosines = profile->totalCosines();
+
+    profile->add(Profiler::RESULT_SECTION, "iterations", result->iterations);
+    profile->add(Profiler::RESULT_SECTION, "quality",
+                 (double)result->quality);
+    profile->add(Profiler::RESULT_SECTION, "threads", result->num_threads);
+    return result;
+}
+
+
+
+// The runner is picked by the mode of the options (Galois is only available
+// if it was compiled in).
+EngineResult* SPKMeansEngine::run(SparseMatrix *docs)
+{
+    if(profile == &run_profile)
+        run_profile = Profiler();
+    ListenerBuffer buffer(listener);
+    ostream out(listener != 0 ? &buffer : 0);
+    int k = prepareRun(out, docs, false);
+
+    EngineResult *result = 0;
+    if(options.mode == EngineOptions::GALOIS_MODE) {
+#ifndef NO_GALOIS
+        SPKMeansGalois spkm_galois(docs, k, options.num_threads);
+        configure(&spkm_galois, false);
+        result = runClustering(&spkm_galois, out, "galois", k,
+                               spkm_galois.getNumThreads());
+#else
+        out << "Error: GALOIS is not available. Please re-compile with "
+            << "Galois to use the \"--galois\" option." << endl;
+#endif
+    }
+    else if(options.mode == EngineOptions::OPENMP_MODE) {
+        SPKMeansOpenMP spkm_openmp(docs, k, options.num_threads);
+        configure(&spkm_openmp, false);
+        result = runClustering(&spkm_openmp, out, "openmp", k,
+                               spkm_openmp.getNumThreads());
+    }
+    else {
+        SPKMeans spkm(docs, k);
+        configure(&spkm, false);
+        result = runClustering(&spkm, out, "serial", k, 1);
+    }
+    return result;
+}
+
+
+
+// The arrays are checked (row offsets in order and within the entries,
+// column indices within the columns and strictly increasing in each row)
+// before they are copied: the kernels rely on rows without duplicate words.
+EngineResult* SPKMeansEngine::run(int rows, int cols, const int *offsets,
+                                  const int *indices, const float *values)
+{
+    ListenerBuffer buffer(listener);
+    ostream out(listener != 0 ? &buffer : 0);
+    bool valid = (rows > 0 && cols > 0 && offsets != 0 && offsets[0] == 0);
+    for(int i=0; valid && i<rows; i++)
+        valid = (offsets[i+1] >= offsets[i]);
+    int nnz = valid ? offsets[rows] : 0;
+    for(int a=0; valid && a<nnz; a++)
+        valid = (indices[a] >= 0 && indices[a] < cols);
+    if(!valid) {
+        out << "Error: invalid CSR document matrix." << endl;
+        return 0;
+    }
+    for(int i=0; i<rows; i++) {
+        for(int a=offsets[i]+1; a<offsets[i+1]; a++) {
+            if(indices[a] <= indices[a-1]) {
+                out << "Error: the column indices of row " << i
+                    << " are not strictly increasing." << endl;
+                return 0;
+            }
+        }
+    }
+
+    SparseMatrix docs(rows, cols, nnz);
+    memcpy(docs.offsets, offsets, sizeof(int) * (rows + 1));
+    memcpy(docs.indices, indices, sizeof(int) * nnz);
+    memcpy(docs.values, values, sizeof(float) * nnz);
+    return run(&docs);
+}
+
+
+
+// The stream's read statistics are added to the result section of the
+// profile.
+EngineResult* SPKMeansEngine::run(DocumentStream *stream)
+{
+    if(profile == &run_profile)
+        run_profile = Profiler();
+    ListenerBuffer buffer(listener);
+    ostream out(listener != 0 ? &buffer : 0);
+    int k = prepareRun(out, stream->index, true);
+
+    SPKMeansStreaming spkm_stream(stream, k, (long)options.stream_mb << 20,
+                                  options.num_threads);
+    configure(&spkm_stream, true);
+    EngineResult *result = runClustering(&spkm_stream, out, "streaming", k,
+                                         spkm_stream.getNumThreads());
+    profile->add(Profiler::RESULT_SECTION, "bytes_read", stream->bytes_read);
+    profile->add(Profiler::RESULT_SECTION, "read_wait_ms",
+                 (long)stream->waitTime());
+    return result;
+}
@@ -0,0 +1,181 @@
+/* File: engine.h
+ *
+ * Contains the SPKMeansEngine class, the embeddable entry point of the
+ * clustering library (libspkmeans.a, see "make lib"). An engine is given the
+ * options of a run and a CSR document matrix (or a document stream), picks
+ * and configures the runner (serial, OpenMP, Galois or streaming), and
+ * returns the assignments, concepts and statistics of the run. Nothing is
+ * printed: the progress messages and iterations are passed to an optional
+ * SPKMeansListener instead. The spkmeans program is a thin layer on top.
+ */
+
+#ifndef ENGINE_H
+#define ENGINE_H
+
+#include "cluster_model.h"
+#include "document_stream.h"
+#include "precision.h"
+#include "profiler.h"
+#include "sparse_matrix.h"
+#include "spkmeans.h"
+
+#include <vector>
+
+
+// EngineOptions class holds the options of a clustering run; the defaults
+// are those of the spkmeans program.
+class EngineOptions {
+
+  public:
+
+    // choice of runners (the streaming runner is picked by the input)
+    enum Mode {
+        SERIAL_MODE,
+        OPENMP_MODE,
+        GALOIS_MODE
+    };
+
+    // number of clusters, or the automatic choice (documents * words /
+    // non-zero entries) if auto_k is set and it can be computed
+    int k;
+    bool auto_k;
+
+    // runner, and its number of threads (0 for the maximum)
+    Mode mode;
+    unsigned int num_threads;
+
+    // the SPKMeans switches (see spkmeans.h)
+    bool use_scheme;
+    bool optimize;
+    bool bounds;
+    bool spmm;
+    int top_m;
+    bool word_major;
+    bool huge_pages;
+    SPKMeans::Seeding seeding;
+    unsigned int seed;
+    int batch_size;
+    int epochs;
+    bool online;
+    bool priority;
+    bool delta;
+    Precision precision;
+    bool quantize;
+
+    // run with block seeding first, and report the iterations saved
+    bool compare_seed;
+
+    // memory budget (in MB) of a streamed run
+    int stream_mb;
+
+    // warm start: the saved model (not owned) that the runs start from
+    // instead of a seeding, or 0; it also sets k. If reassign is set, the
+    // documents it knows are assigned again too (see seedFromModel)
+    const ClusterModel *warm_model;
+    bool reassign;
+
+    // Constructor: sets the default options.
+    EngineOptions();
+
+};
+
+
+
+// EngineResult class holds the outcome of a clustering run: the model (see
+// cluster_model.h), and the statistics of the run.
+class EngineResult : public ClusterModel {
+
+  public:
+
+    // total quality, iterations, and threads of the run
+    float quality;
+    int iterations;
+    int num_threads;
+
+    // run and seeding times in milliseconds, and the number of cosine
+    // similarities computed (-1 if they are not counted)
+    double run_ms;
+    double seeding_ms;
+    long num_cosines;
+
+};
+
+
+
+// SPKMeansEngine class runs the clustering algorithm with a fixed set of
+// options, as often as needed.
+class SPKMeansEngine {
+
+  private:
+
+    EngineOptions options;
+    SPKMeansListener *listener;
+
+    // the profiler of the runs: run_profile (cleared before every run),
+    // unless another profiler is set
+    Profiler run_profile;
+    Profiler *profile;
+
+    // chooses k (telling the output if it can not be chosen automatically),
+    // passes the notes on the options to the output, and describes the
+    // documents and the options in the profile; returns k
+    int prepareRun(std::ostream &out, SparseMatrix *docs, bool streamed);
+
+    // applies the options that the given runner supports
+    void configure(SPKMeans *spkm, bool streamed);
+
+    // runs the configured runner, and collects its result
+    EngineResult* runClustering(SPKMeans *spkm, std::ostream &out,
+                                const char *mode, int k, int num_threads);
+
+  public:
+
+    // Constructor: sets the options of the runs and the listener (0 for
+    // none, in which case the progress messages are discarded).
+    SPKMeansEngine(const EngineOptions &options_,
+                   SPKMeansListener *listener_ = 0);
+
+    // Returns the number of clusters a run on the given documents will use.
+    int getK(SparseMatrix *docs);
+
+    // Sets the profiler that times the runs (e.g. one that already timed the
+    // loading of the documents), and returns it. The data, config and result
+    // fields of each run are added to it.
+    void setProfiler(Profiler *profile_);
+    Profiler* getProfiler();
+
+    /* Clusters the given documents. Unless the TXN scheme is disabled, the
+     * document vectors are normalized in place (and stay normalized). With
+     * the quantize option, the caller's matrix is quantized in place too:
+     * its fp32 values are freed (values is null afterwards, unless the
+     * matrix is memory-mapped), and later runs on it use the 8-bit values.
+     * RETURNS:
+     *  The result of the run (to be deleted by the caller), or 0 if the run
+     *  failed (the reason is passed to the listener).
+     */
+    EngineResult* run(SparseMatrix *docs);
+
+    /* Clusters the documents given as CSR arrays: the non-zero entries of
+     * row i are at positions offsets[i] to offsets[i+1]-1 of indices and
+     * values, with strictly increasing (sorted, unique) column indices in
+     * each row. The arrays are copied (and left unchanged).
+     * RETURNS:
+     *  The result of the run, or 0 if the arrays are invalid or the run
+     *  failed.
+     */
+    EngineResult* run(int rows, int cols, const int *offsets,
+                      const int *indices, const float *values);
+
+    /* Clusters the documents of the given stream out of core, within the
+     * memory budget of the options, with OpenMP threads (only the scheme,
+     * optimization, concept layout and seeding options apply; there is no
+     * warm start).
+     * RETURNS:
+     *  The result of the run, or 0 if the run failed.
+     */
+    EngineResult* run(DocumentStream *stream);
+
+};
+
+
+#endif
@@ -20,9 +20,17 @@
 #include <string>
 #include <vector>
 
+#include "binary_corpus.h"
 #include "cluster_data.h"
+#include "cluster_model.h"
+#include "document_stream.h"
+#include "engine.h"
+#include "predictor.h"
+#include "profiler.h"
 #include "reader.h"
+#include "sparse_matrix.h"
 #include "spkmeans.h"
+#include "timer.h"
 #include "vectors.h"
 
 
@@ -36,6 +44,7 @@
 #define DEFAULT_K 2
 #define DEFAULT_THREADS 0 // 0 means default to max
 #define DEFAULT_DOC_FILE "test.txt"
+#define DEFAULT_SEED 1
 
 // type of parallel implementations
 #define RUN_NORMAL 0
@@ -63,7 +72,54 @@ void printUsage()
          << "  [--noscheme]     do not normalize weight values" << endl
          << "  [--noresults]    squelch results from being printed" << endl
          << "  [--noop]         turn off all optimizations" << endl
+         << "  [--bounds]       skip cosines using similarity bounds" << endl
+         << "  [--spmm]         use the blocked (SpMM) partitioning" << endl
+         << "  [--topm m]       cache only the top m clusters per document"
+         << endl
+         << "  [--wordmajor]    store the concepts word-major (wc x k)" << endl
+         << "  [--hugepages]    back the concepts with huge pages" << endl
+         << "  [--verify]       check the checksum of a binary docfile" << endl
+         << "  [--fastread]     parse a text docfile with multiple threads"
+         << endl
+         << "  [--init type]    seeding: block, random, kmeans++, kmeans||"
+         << endl
+         << "  [--seed num]     random seed for the seeding" << endl
+         << "  [--seedcompare]  also run with block seeding and compare"
+         << endl
+         << "  [--batch num]    run mini-batch k-means with this batch size"
+         << endl
+         << "  [--epochs num]   max. number of mini-batch epochs" << endl
+         << "  [--online]       update the concepts as soon as documents move"
+         << endl
+         << "  [--priority]     skip documents that are unlikely to move" << endl
+         << "  [--delta]        update the concepts from the moved documents"
+         << endl
+         << "  [--precision p]  store concepts and cosines: fp32, bf16, fp16"
+         << endl
+         << "  [--quantize]     store the document values in 8 bits" << endl
+         << "  [--stream mb]    stream a binary docfile within mb MB of memory"
+         << endl
+         << "  [--report file]  write the phase times and counts as JSON"
+         << endl
+         << "  [--save file]    save the clustering as a model file" << endl
+         << "  [--warm file]    start from a saved model instead of seeding"
+         << endl
+         << "                   (new documents must follow the old ones)"
+         << endl
+         << "  [--reassign]     with --warm, also reassign the old documents"
+         << endl
          << "Other commands:" << endl
+         << "  $ ./spkmeans convert textfile binaryfile [--noscheme]" << endl
+         << "      write a binary document file (the docfile can be either"
+         << endl
+         << "      format; binary files are memory-mapped, not parsed)" << endl
+         << "  $ ./spkmeans predict modelfile docfile [-t numthreads]" << endl
+         << "        [--batch num] [-o outfile]" << endl
+         << "      assign each document to a saved model's clusters: prints"
+         << endl
+         << "      \"docID cluster similarity\" lines (a docfile of \"-\" is"
+         << endl
+         << "      read from stdin, one document after another)" << endl
          << "  $ ./spkmeans --help" << endl
          << "  $ ./spkmeans --version" << endl;
     cout << "Default values:" << endl
@@ -74,7 +130,21 @@ void printUsage()
          << "    No vocabulary file (indices will be used instead)," << endl
          << "    using TXN scheme," << endl
          << "    displaying clustering results," << endl
-         << "    optimization enabled." << endl;
+         << "    optimization enabled," << endl
+         << "    similarity bounds disabled," << endl
+         << "    all k cosine similarities cached per document," << endl
+         << "    per-document partitioning engine," << endl
+         << "    cluster-major concept matrix (no huge pages)," << endl
+         << "    block seeding (random seed " << DEFAULT_SEED << ")," << endl
+         << "    full batch (mini-batch: " << MINIBATCH_EPOCHS
+         << " epochs max.)," << endl
+         << "    online updates disabled," << endl
+         << "    priority scheduling disabled," << endl
+         << "    concepts recomputed from all documents (no delta updates),"
+         << endl
+         << "    fp32 concepts, cosines and document values," << endl
+         << "    documents kept in memory (no streaming)," << endl
+         << "    no JSON report, no model saved or loaded." << endl;
     cout << "*To use max number of threads available, do not set t." << endl;
     cout << endl
          << "Example usage:" << endl
@@ -84,36 +154,60 @@ void printUsage()
 
 
 
+// ConsoleListener prints the progress of a run to stdout, like the
+// clustering classes do on their own.
+class ConsoleListener : public SPKMeansListener {
+  private:
+    string doc_fname;
+
+  public:
+    // constructor: set the document file name of the run
+    ConsoleListener(const string &doc_fname_) : doc_fname(doc_fname_) {}
+
+    // print which runner is used, with how many threads
+    void runStarted(const char *mode, int k, int num_threads)
+    {
+        cout << "Running SPK Means on \"" << doc_fname << "\" with k=" << k;
+        string name(mode);
+        if(name == "serial")
+            cout << " [single thread]." << endl;
+        else if(name == "openmp")
+            cout << " [OpenMP: " << num_threads << " threads]." << endl;
+        else if(name == "galois")
+            cout << " [Galois: " << num_threads << " threads]." << endl;
+        else
+            cout << " [" << mode << ": " << num_threads << " threads]."
+                 << endl;
+    }
+
+    // print each progress message as it is
+    void message(const string &line)
+    {
+        cout << line << endl;
+    }
+};
+
+
+
 // Displays the results of each partition. If a words list is provided,
 // the top num_to_show words will be displayed for each partition.
 // Otherwise, if words is a null pointer, only the indices will be shown.
-void displayResults(ClusterData *data, char **words, int num_to_show = 10)
+void displayResults(EngineResult *result, char **words, int num_to_show = 10)
 {
     // make sure num_to_show doesn't exceed the actual word count
-    if(num_to_show > data->wc)
-        num_to_show = data->wc;
+    if(num_to_show > result->wc)
+        num_to_show = result->wc;
 
-    // for each partition, sum the weights of each word, and show the top
-    //  words that occur in the partition:
-    for(int i=0; i<(data->k); i++) {
+    // for each partition, rank the words by their weight in the partition's
+    //  concept vector (the normalized sum of the partition's documents):
+    for(int i=0; i<(result->k); i++) {
         cout << "Partition #" << (i+1) << ":" << endl;
 
-        // find all documents in this partition and sum them together.
-        float *sum = vec_zeros(data->wc);
-        for(int j=0; j<(data->dc); j++) {
-            if(data->p_asgns[j] == i) {
-                for(int a=0; a<(data->docs[j].count); a++) {
-                    float value = data->docs[j].words[a].value;
-                    sum[data->docs[j].words[a].index] += value;
-                }
-            }
-        }
-
-        // sort this sum using C++ priority queue (keeping track of indices)
-        vector<float> values(sum, sum + data->wc);
+        // sort the weights using C++ priority queue (keeping track of indices)
+        const float *concept = result->getConcept(i);
         priority_queue<pair<float, int>> q;
-        for(int i=0; i<values.size(); i++)
-            q.push(pair<float, int>(values[i], i));
+        for(int w=0; w<(result->wc); w++)
+            q.push(pair<float, int>(concept[w], w));
 
         // show top num_to_show words
         for(int i=0; i<num_to_show; i++) {
@@ -124,8 +218,6 @@ void displayResults(ClusterData *data, char **words, int num_to_show = 10)
                 cout << "   " << index << endl;
             q.pop();
         }
-
-        delete[] sum;
     }
 }
 
@@ -142,6 +234,36 @@ void displayResults(ClusterData *data, char **words, int num_to_show = 10)
  *  run_type     - Int pointer to indicate which module to run (e.g. OpenMP).
  *  show_results - Bool flag to swith displaying results on or off.
  *  auto_k       - Bool flag to switch choosing K automatically on or off.
+ *  optimize     - Bool flag to switch optimizations on or off.
+ *  bounds       - Bool flag to switch bound-based cosine pruning on or off.
+ *  spmm         - Bool flag to switch the blocked SpMM partitioning on or off.
+ *  top_m        - Int pointer that will be filled with the number of
+ *                 clusters cached per document (0 to cache all of them).
+ *  word_major   - Bool flag to store the concept matrix word-major (wc x k).
+ *  huge_pages   - Bool flag to request huge pages for the concept matrix.
+ *  verify       - Bool flag to verify the checksum of a binary document file.
+ *  fast_read    - Bool flag to parse a text document file with many threads.
+ *  seeding      - Seeding pointer that will be filled with the seeding type.
+ *  seed         - Int pointer that will be filled with the random seed.
+ *  compare_seed - Bool flag to compare the seeding against block seeding.
+ *  batch_size   - Int pointer that will be filled with the mini-batch size.
+ *  epochs       - Int pointer that will be filled with the mini-batch epochs.
+ *  online       - Bool flag to switch online concept updates on or off.
+ *  priority     - Bool flag to switch priority scheduling on or off.
+ *  delta        - Bool flag to switch delta concept updates on or off.
+ *  precision    - Precision pointer that will be filled with the storage
+ *                 precision of the concepts and cosine similarity cache.
+ *  quantize     - Bool flag to switch 8-bit document values on or off.
+ *  stream_mb    - Int pointer that will be filled with the memory budget (in
+ *                 MB) of the streaming mode (0 to keep the documents in
+ *                 memory).
+ *  report_fname - String pointer to contain the JSON report file name (empty
+ *                 if no report should be written).
+ *  save_fname   - String pointer to contain the file name the model is saved
+ *                 to (empty if it should not be saved).
+ *  warm_fname   - String pointer to contain the file name of the saved model
+ *                 to start from (empty to seed instead).
+ *  reassign     - Bool flag to reassign the documents the saved model knows.
  * RETURNS:
  *  RETURN_HELP     to print the program help message and exit.
  *  RETURN_VERSION  to print the program version and exit.
@@ -151,7 +273,13 @@ void displayResults(ClusterData *data, char **words, int num_to_show = 10)
 int processArgs(int argc, char **argv,
     string *doc_fname, string *vocab_fname,
     unsigned int *k, unsigned int *num_threads, unsigned int *run_type,
-    bool *use_scheme, bool *show_results, bool *auto_k, bool *optimize)
+    bool *use_scheme, bool *show_results, bool *auto_k, bool *optimize,
+    bool *bounds, bool *spmm, int *top_m, bool *word_major,
+    bool *huge_pages, bool *verify, bool *fast_read, SPKMeans::Seeding *seeding,
+    unsigned int *seed, bool *compare_seed, int *batch_size, int *epochs,
+    bool *online, bool *priority, bool *delta, Precision *precision,
+    bool *quantize, int *stream_mb, string *report_fname, string *save_fname,
+    string *warm_fname, bool *reassign)
 {
     // set defaults before proceeding to check arguments
     *doc_fname = DEFAULT_DOC_FILE;
@@ -163,6 +291,28 @@ int processArgs(int argc, char **argv,
     *show_results = true;
     *auto_k = false;
     *optimize = true;
+    *bounds = false;
+    *spmm = false;
+    *top_m = 0;
+    *word_major = false;
+    *huge_pages = false;
+    *verify = false;
+    *fast_read = false;
+    *seeding = SPKMeans::BLOCK_SEEDING;
+    *seed = DEFAULT_SEED;
+    *compare_seed = false;
+    *batch_size = 0;
+    *epochs = MINIBATCH_EPOCHS;
+    *online = false;
+    *priority = false;
+    *delta = false;
+    *precision = FP32_PRECISION;
+    *quantize = false;
+    *stream_mb = 0;
+    *report_fname = "";
+    *save_fname = "";
+    *warm_fname = "";
+    *reassign = false;
 
     // check arguments: expected command as follows:
     // $ ./spkmeans -d docfile -w wordfile -k 2 -t 2 --galois
@@ -191,6 +341,52 @@ int processArgs(int argc, char **argv,
         else if(arg == "--noop" || arg == "-noop")
             *optimize = false;
 
+        // or if the similarity bounds should be used to prune the cosines
+        else if(arg == "--bounds" || arg == "-bounds")
+            *bounds = true;
+
+        // or if the blocked (SpMM) partitioning engine should be used
+        else if(arg == "--spmm" || arg == "-spmm")
+            *spmm = true;
+
+        // or if the concept matrix layout or memory should be changed
+        else if(arg == "--wordmajor" || arg == "-wordmajor")
+            *word_major = true;
+        else if(arg == "--hugepages" || arg == "-hugepages")
+            *huge_pages = true;
+
+        // or if a binary document file should be checked before it is used
+        else if(arg == "--verify" || arg == "-verify")
+            *verify = true;
+
+        // or if a text document file should be parsed in parallel
+        else if(arg == "--fastread" || arg == "-fastread")
+            *fast_read = true;
+
+        // or if the concepts should be updated online (as documents move)
+        else if(arg == "--online" || arg == "-online")
+            *online = true;
+
+        // or if stable documents should be skipped (priority scheduling)
+        else if(arg == "--priority" || arg == "-priority")
+            *priority = true;
+
+        // or if the concepts should be updated from the moved documents only
+        else if(arg == "--delta" || arg == "-delta")
+            *delta = true;
+
+        // or if the document values should be stored in 8 bits
+        else if(arg == "--quantize" || arg == "-quantize")
+            *quantize = true;
+
+        // or if a warm start should reassign the documents it knows
+        else if(arg == "--reassign" || arg == "-reassign")
+            *reassign = true;
+
+        // or if the seeding should be compared against the block seeding
+        else if(arg == "--seedcompare" || arg == "-seedcompare")
+            *compare_seed = true;
+
         // or if K should be selected automatically
         else if(arg == "--autok" || arg == "-autok" ||
                 arg == "--auto" || arg == "-auto")
@@ -212,6 +408,52 @@ int processArgs(int argc, char **argv,
                 *k = atoi(argv[i]);
             else if(arg == "-t") // number of threads
                 *num_threads = atoi(argv[i]);
+            else if(arg == "--batch" || arg == "-batch") // mini-batch size
+                *batch_size = atoi(argv[i]);
+            else if(arg == "--epochs" || arg == "-epochs") // mini-batch epochs
+                *epochs = atoi(argv[i]);
+            else if(arg == "--topm" || arg == "-topm") // top-m cache size
+                *top_m = atoi(argv[i]);
+            else if(arg == "--stream" || arg == "-stream") // memory budget
+                *stream_mb = atoi(argv[i]);
+            else if(arg == "--report" || arg == "-report") // JSON report
+                *report_fname = string(argv[i]);
+            else if(arg == "--save" || arg == "-save") // model to save
+                *save_fname = string(argv[i]);
+            else if(arg == "--warm" || arg == "-warm") // model to start from
+                *warm_fname = string(argv[i]);
+            else if(arg == "--seed" || arg == "-seed") // random seed
+                *seed = strtoul(argv[i], 0, 10);
+            else if(arg == "--init" || arg == "-init") { // seeding type
+                string type(argv[i]);
+                if(type == "block")
+                    *seeding = SPKMeans::BLOCK_SEEDING;
+                else if(type == "random")
+                    *seeding = SPKMeans::RANDOM_SEEDING;
+                else if(type == "kmeans++")
+                    *seeding = SPKMeans::KMEANSPP_SEEDING;
+                else if(type == "kmeans||")
+                    *seeding = SPKMeans::KMEANSPAR_SEEDING;
+                else {
+                    cout << "Error: unknown seeding \"" << type << "\"."
+                         << endl;
+                    return RETURN_ERROR;
+                }
+            }
+            else if(arg == "--precision" || arg == "-precision") {
+                string type(argv[i]);
+                if(type == "fp32")
+                    *precision = FP32_PRECISION;
+                else if(type == "bf16")
+                    *precision = BF16_PRECISION;
+                else if(type == "fp16")
+                    *precision = FP16_PRECISION;
+                else {
+                    cout << "Error: unknown precision \"" << type << "\"."
+                         << endl;
+                    return RETURN_ERROR;
+                }
+            }
             else { // otherwise, invalid input so print and decrement i again
                 cout << "Unknown argument: \"" << arg
                      << "\". Use argument --help for more info." << endl;
@@ -234,16 +476,229 @@ int processArgs(int argc, char **argv,
 
 
 
+/* Converts a text document file into a binary document file (see
+ * binary_corpus.h), applying the TXN scheme unless it is disabled. Expected
+ * command as follows:
+ * $ ./spkmeans convert textfile binaryfile [--noscheme]
+ * RETURNS:
+ *  0 on success, or -1 if the arguments or files are invalid.
+ */
+int convertDocFile(int argc, char **argv)
+{
+    bool use_scheme = true;
+    vector<string> fnames;
+    for(int i=2; i<argc; i++) {
+        string arg(argv[i]);
+        if(arg == "--noscheme" || arg == "-noscheme")
+            use_scheme = false;
+        else
+            fnames.push_back(arg);
+    }
+    if(fnames.size() != 2) {
+        printUsage();
+        return -1;
+    }
+    ifstream test(fnames[0].c_str());
+    if(!test.good()) {
+        cout << "Error: file \"" << fnames[0] << "\" does not exist." << endl;
+        return -1;
+    }
+    test.close();
+
+    int dc, wc, non_zero;
+    SparseMatrix *D;
+    if(isGraphFile(fnames[0].c_str()))
+        D = readGraphFile(fnames[0].c_str(), &dc, &wc, &non_zero);
+    else
+        D = readDocFile(fnames[0].c_str(), &dc, &wc, &non_zero);
+    if(D == 0) {
+        cout << "Error: could not read \"" << fnames[0] << "\"." << endl;
+        return -1;
+    }
+    if(use_scheme)
+        D->normalizeRows();
+    bool ok = writeBinaryDocFile(fnames[1].c_str(), D);
+    delete D;
+    if(!ok) {
+        cout << "Error: could not write \"" << fnames[1] << "\"." << endl;
+        return -1;
+    }
+    cout << "Wrote " << dc << " documents, " << wc << " words ("
+         << non_zero << " non-zero entries) to \"" << fnames[1] << "\""
+         << (use_scheme ? " with the TXN scheme applied." : ".") << endl;
+    return 0;
+}
+
+
+
+/* Assigns the documents of a document file to the clusters of a saved model
+ * (see predictor.h), without clustering them. Expected command as follows:
+ * $ ./spkmeans predict modelfile docfile [-t numthreads] [--batch num]
+ *                                        [-o outfile]
+ * The documents are predicted in batches of num documents with numthreads
+ * threads (all of them by default). For each document, a line with its ID,
+ * its cluster (numbered from 1, like the partitions of the results) and its
+ * cosine similarity with the cluster's concept is written to outfile (or to
+ * stdout). A text docfile of "-" is read from stdin as it arrives.
+ * RETURNS:
+ *  0 on success, or -1 if the arguments or files are invalid.
+ */
+int predictDocuments(int argc, char **argv)
+{
+    unsigned int num_threads = DEFAULT_THREADS;
+    int batch_size = PREDICT_BATCH;
+    string out_fname;
+    vector<string> fnames;
+    for(int i=2; i<argc; i++) {
+        string arg(argv[i]);
+        bool has_value = (i+1 < argc);
+        if(arg == "-t" && has_value)
+            num_threads = atoi(argv[++i]);
+        else if((arg == "--batch" || arg == "-batch") && has_value)
+            batch_size = atoi(argv[++i]);
+        else if(arg == "-o" && has_value)
+            out_fname = string(argv[++i]);
+        else
+            fnames.push_back(arg);
+    }
+    if(fnames.size() != 2 || batch_size <= 0) {
+        printUsage();
+        return -1;
+    }
+    bool from_stdin = (fnames[1] == "-");
+    if(!from_stdin) {
+        ifstream test(fnames[1].c_str());
+        if(!test.good()) {
+            cout << "Error: file \"" << fnames[1] << "\" does not exist."
+                 << endl;
+            return -1;
+        }
+    }
+
+    // only the concepts of the model are kept
+    const char *error = 0;
+    ClusterModel *model = readModelFile(fnames[0].c_str(), &error);
+    if(model == 0) {
+        cout << "Error: \"" << fnames[0] << "\": " << error << "." << endl;
+        return -1;
+    }
+    ClusterPredictor predictor(model);
+    delete model;
+
+    ofstream out_file;
+    if(!out_fname.empty()) {
+        out_file.open(out_fname.c_str());
+        if(!out_file.good()) {
+            cout << "Error: could not write \"" << out_fname << "\"."
+                 << endl;
+            return -1;
+        }
+    }
+    ostream &out = out_fname.empty() ? cout : out_file;
+
+    // a docfile is read whole (binary files are mapped) and predicted one
+    // batch of rows at a time; stdin is read one batch at a time
+    Timer timer;
+    timer.start();
+    long num_docs = 0;
+    vector<int> clusters(batch_size);
+    vector<float> scores(batch_size);
+    vector<int> doc_ids;
+    SparseMatrix *D = 0;
+    DocBatchReader *reader = 0;
+    if(from_stdin) {
+        reader = new DocBatchReader(&cin);
+        if(!reader->good()) {
+            cout << "Error: stdin does not start with a document file header."
+                 << endl;
+            delete reader;
+            return -1;
+        }
+    }
+    else if(isBinaryDocFile(fnames[1].c_str())) {
+        D = mapBinaryDocFile(fnames[1].c_str(), false, &error);
+        if(D == 0)
+            cout << "Error: \"" << fnames[1] << "\": " << error << "."
+                 << endl;
+    }
+    else {
+        int dc, wc, non_zero;
+        D = readDocFile(fnames[1].c_str(), &dc, &wc, &non_zero);
+    }
+    if(reader == 0 && D == 0)
+        return -1;
+
+    for(int first=0; ; first+=batch_size) {
+        SparseMatrix *batch;
+        int count;
+        if(reader != 0) {
+            batch = reader->next(batch_size, &doc_ids);
+            if(batch == 0)
+                break;
+            count = batch->rows;
+            predictor.predict(batch, 0, count, &clusters[0], &scores[0],
+                              num_threads);
+        }
+        else {
+            if(first >= D->rows)
+                break;
+            batch = 0;
+            count = (first + batch_size < D->rows) ? batch_size
+                                                   : D->rows - first;
+            doc_ids.resize(count);
+            for(int i=0; i<count; i++)
+                doc_ids[i] = first + i + 1;
+            predictor.predict(D, first, count, &clusters[0], &scores[0],
+                              num_threads);
+        }
+        for(int i=0; i<count; i++)
+            out << doc_ids[i] << " " << (clusters[i] + 1) << " " << scores[i]
+                << "\n";
+        num_docs += count;
+        delete batch;
+    }
+    out.flush();
+    timer.stop();
+    delete reader;
+    delete D;
+
+    if(!out_fname.empty())
+        cout << "Predicted " << num_docs << " documents (k="
+             << predictor.getK() << ") in " << timer.get() << " ms. "
+             << "Written to \"" << out_fname << "\"." << endl;
+    return 0;
+}
+
+
+
 // main: set up and start the clustering process.
 int main(int argc, char **argv)
 {
+    // the convert and predict commands do not run the clustering algorithm
+    if(argc > 1 && string(argv[1]) == "convert")
+        return convertDocFile(argc, argv);
+    if(argc > 1 && string(argv[1]) == "predict")
+        return predictDocuments(argc, argv);
+
     // get file names, and set up k and number of threads
     string doc_fname, vocab_fname;
     unsigned int k, num_threads, run_type;
-    bool use_scheme, show_results, auto_k, optimize;
+    bool use_scheme, show_results, auto_k, optimize, bounds, spmm;
+    bool word_major, huge_pages, verify, fast_read, compare_seed, online;
+    bool priority, delta, quantize;
+    SPKMeans::Seeding seeding;
+    Precision precision;
+    unsigned int seed;
+    int batch_size, epochs, top_m, stream_mb;
+    string report_fname, save_fname, warm_fname;
+    bool reassign;
     int retval = processArgs(argc, argv,
         &doc_fname, &vocab_fname, &k, &num_threads, &run_type,
-        &use_scheme, &show_results, &auto_k, &optimize);
+        &use_scheme, &show_results, &auto_k, &optimize, &bounds, &spmm,
+        &top_m, &word_major, &huge_pages, &verify, &fast_read, &seeding,
+        &seed, &compare_seed, &batch_size, &epochs, &online, &priority,
+        &delta, &precision, &quantize, &stream_mb, &report_fname,
+        &save_fname, &warm_fname, &reassign);
     if(retval == RETURN_ERROR) {
         printUsage();
         return -1;
@@ -257,73 +712,152 @@ int main(int argc, char **argv)
         return 0;
     }
 
-    // read data from the document file
+    // read data from the document file (binary files are mapped directly,
+    // or only their row offsets are read if they are streamed); this is the
+    // load phase of the profile
+    Profiler profile;
+    profile.start(Profiler::LOAD_PHASE);
     int dc, wc, non_zero;
-    float **D = readDocFile(doc_fname.c_str(), &dc, &wc, &non_zero);
+    SparseMatrix *D;
+    DocumentStream *stream = 0;
+    if(stream_mb > 0) {
+        if(!isBinaryDocFile(doc_fname.c_str())) {
+            cout << "Error: streaming mode reads binary document files; "
+                 << "convert the docfile first (see --help)." << endl;
+            return -1;
+        }
+        stream = new DocumentStream(doc_fname.c_str());
+        D = stream->index;
+        if(D == 0) {
+            cout << "Error: \"" << doc_fname << "\": " << stream->getError()
+                 << "." << endl;
+            delete stream;
+            return -1;
+        }
+        dc = D->rows;
+        wc = D->cols;
+        non_zero = D->nnz;
+        if(verify)
+            cout << "Note: streaming mode does not verify the checksum."
+                 << endl;
+    }
+    else if(isBinaryDocFile(doc_fname.c_str())) {
+        const char *error = 0;
+        D = mapBinaryDocFile(doc_fname.c_str(), verify, &error);
+        if(D == 0) {
+            cout << "Error: \"" << doc_fname << "\": " << error << "."
+                 << endl;
+            return -1;
+        }
+        dc = D->rows;
+        wc = D->cols;
+        non_zero = D->nnz;
+        if(!use_scheme && D->normalized)
+            cout << "Note: the binary document file already has the TXN "
+                 << "scheme applied." << endl;
+    }
+    else if(isGraphFile(doc_fname.c_str())) {
+        D = readGraphFile(doc_fname.c_str(), &dc, &wc, &non_zero);
+        if(D == 0) {
+            cout << "Error: could not read \"" << doc_fname << "\"." << endl;
+            return -1;
+        }
+    }
+    else if(fast_read)
+        D = readDocFileParallel(doc_fname.c_str(), &dc, &wc, &non_zero,
+                                num_threads);
+    else
+        D = readDocFile(doc_fname.c_str(), &dc, &wc, &non_zero);
+    profile.stop(Profiler::LOAD_PHASE);
     cout << "DATA: " << dc << " documents, " << wc << " words ("
          << non_zero << " non-zero entries)." << endl;
 
-    // if K should be set automatically, compute that here if possible
-    if(auto_k) {
-        int numerator = dc * wc;
-        if(non_zero <= 0 || non_zero > numerator)
-            cout << "Could not set K automatically. Using k=" << k << endl;
-        else
-            k = numerator / non_zero;
-    }
-    cout << "Running SPK Means on \"" << doc_fname << "\" with k=" << k;
-
-    // run the program based on the run type provided (none, openmp, galois)
-    ClusterData *data = 0;
-#ifndef NO_GALOIS
-    if(run_type == RUN_GALOIS) {
-        // tell Galois the max thread count
-        SPKMeansGalois spkm_galois(D, k, dc, wc, num_threads);
-        if(!optimize)
-            spkm_galois.disableOptimization();
-        if(!use_scheme)
-            spkm_galois.setScheme(SPKMeans::NO_SCHEME);
-        cout << " [Galois: " << spkm_galois.getNumThreads()
-             << " threads]." << endl;
-        data = spkm_galois.runSPKMeans();
-    }
-#else
-    if(run_type == RUN_GALOIS) {
-        cout << endl << endl << "Error: GALOIS is not available."
-             << "Please re-compile with Galois to use the \"--galois\" option."
-             << endl << endl;
-        return 0;
+    // read the saved model to start from, if one was given
+    ClusterModel *warm_model = 0;
+    if(!warm_fname.empty()) {
+        const char *error = 0;
+        warm_model = readModelFile(warm_fname.c_str(), &error);
+        if(warm_model == 0) {
+            cout << "Error: \"" << warm_fname << "\": " << error << "."
+                 << endl;
+            return -1;
+        }
+        cout << "MODEL: k=" << warm_model->k << ", " << warm_model->dc
+             << " documents, " << warm_model->wc << " words." << endl;
     }
-#endif
-    else if(run_type == RUN_OPENMP) {
-        // tell OpenMP the max thread count
-        SPKMeansOpenMP spkm_openmp(D, k, dc, wc, num_threads);
-        if(!optimize)
-            spkm_openmp.disableOptimization();
-        if(!use_scheme)
-            spkm_openmp.setScheme(SPKMeans::NO_SCHEME);
-        cout << " [OpenMP: " << spkm_openmp.getNumThreads()
-             << " threads]." << endl;
-        data = spkm_openmp.runSPKMeans();
+
+    // set up the engine with the options of the run: it picks the runner,
+    // and passes the progress of the run to the console
+    EngineOptions options;
+    options.k = k;
+    options.auto_k = auto_k;
+    options.mode = (run_type == RUN_GALOIS) ? EngineOptions::GALOIS_MODE :
+                   (run_type == RUN_OPENMP) ? EngineOptions::OPENMP_MODE :
+                                              EngineOptions::SERIAL_MODE;
+    options.num_threads = num_threads;
+    options.use_scheme = use_scheme;
+    options.optimize = optimize;
+    options.bounds = bounds;
+    options.spmm = spmm;
+    options.top_m = top_m;
+    options.word_major = word_major;
+    options.huge_pages = huge_pages;
+    options.seeding = seeding;
+    options.seed = seed;
+    options.batch_size = batch_size;
+    options.epochs = epochs;
+    options.online = online;
+    options.priority = priority;
+    options.delta = delta;
+    options.precision = precision;
+    options.quantize = quantize;
+    options.compare_seed = compare_seed;
+    options.stream_mb = stream_mb;
+    options.warm_model = warm_model;
+    options.reassign = reassign;
+    profile.add(Profiler::DATA_SECTION, "file", doc_fname.c_str());
+
+    // run the clustering (streamed, or on the documents in memory)
+    ConsoleListener console(doc_fname);
+    SPKMeansEngine engine(options, &console);
+    engine.setProfiler(&profile);
+    EngineResult *result;
+    if(stream != 0)
+        result = engine.run(stream);
+    else
+        result = engine.run(D);
+
+    // write the JSON report of the run, if one was requested
+    if(result && !report_fname.empty()) {
+        if(profile.writeReport(report_fname.c_str()))
+            cout << "Report written to \"" << report_fname << "\"." << endl;
+        else
+            cout << "Error: could not write the report \"" << report_fname
+                 << "\"." << endl;
     }
-    else {
-        SPKMeans spkm(D, k, dc, wc);
-        if(!optimize)
-            spkm.disableOptimization();
-        if(!use_scheme)
-            spkm.setScheme(SPKMeans::NO_SCHEME);
-        cout << " [single thread]." << endl;
-        data = spkm.runSPKMeans();
+
+    // save the model of the run, if requested
+    if(result && !save_fname.empty()) {
+        if(writeModelFile(save_fname.c_str(), result))
+            cout << "Model written to \"" << save_fname << "\"." << endl;
+        else
+            cout << "Error: could not write the model \"" << save_fname
+                 << "\"." << endl;
     }
 
     // display the results of the algorithm (if anything happened)
-    if(data) {
+    if(result) {
         if(show_results) {
             char **words = readWordsFile(vocab_fname.c_str(), wc);
-            displayResults(data, words, 10);
+            displayResults(result, words, 10);
         }
-        delete data;
+        delete result;
     }
+    delete warm_model;
+    if(stream != 0)
+        delete stream;
+    else
+        delete D;
 
     return 0;
 }
@@ -0,0 +1,165 @@
+/* File: precision.cpp
+ *
+ * Defines the helper functions and kernels of the reduced precision mode
+ * (the conversions themselves are inline, see precision.h). On x86, the
+ * fp16 kernels use the hardware conversion (F16C) if the CPU supports it,
+ * which is checked once, when the program starts.
+ */
+
+#include "precision.h"
+
+#include <math.h>
+
+
+// the F16C conversion is only available on x86 processors
+#if defined(__x86_64__) || defined(__i386__)
+#define PRECISION_HAVE_F16C
+#include <immintrin.h>
+#define F16C __attribute__((target("f16c")))
+#endif
+
+
+
+// Converts the number with a small margin added first: twice the largest
+// relative rounding error, and an absolute one for numbers close to zero
+// (where fp16 is subnormal).
+uint16_t floatToReducedUp(float value, Precision precision)
+{
+    float margin = 2 * precisionError(precision);
+    return floatToReduced(value + fabsf(value) * margin + 1.0f / 16384,
+                          precision);
+}
+
+
+
+// Returns half a unit in the last place: bf16 keeps 8 bits of precision and
+// fp16 keeps 11.
+float precisionError(Precision precision)
+{
+    switch(precision) {
+        case BF16_PRECISION:
+            return 1.0f / 256;
+        case FP16_PRECISION:
+            return 1.0f / 2048;
+        default:
+            return 0;
+    }
+}
+
+
+
+// Returns the number of bytes used to store one number in the precision.
+int precisionBytes(Precision precision)
+{
+    return (precision == FP32_PRECISION) ? 4 : 2;
+}
+
+
+
+// Returns the name of the precision.
+const char* precisionName(Precision precision)
+{
+    switch(precision) {
+        case BF16_PRECISION:
+            return "bf16";
+        case FP16_PRECISION:
+            return "fp16";
+        default:
+            return "fp32";
+    }
+}
+
+
+
+#ifdef PRECISION_HAVE_F16C
+
+// Returns true if the CPU can convert fp16 numbers in hardware.
+static bool cpuSupportsF16C()
+{
+    __builtin_cpu_init();
+    return __builtin_cpu_supports("f16c");
+}
+
+// true if the F16C kernels below can be used
+static bool have_f16c = cpuSupportsF16C();
+
+
+// F16C version of the fp16 case of reducedSparseDot.
+F16C static float f16cSparseDot(const uint16_t *dense, long stride,
+                                const int *indices, const float *values,
+                                int count)
+{
+    float dotp = 0;
+    for(int i=0; i<count; i++)
+        dotp += _cvtsh_ss(dense[indices[i] * stride]) * values[i];
+    return dotp;
+}
+
+
+// F16C version of the fp16 case of quantizedSparseDot (without the scale).
+F16C static float f16cQuantizedDot(const uint16_t *dense, long stride,
+                                   const int *indices, const int8_t *quantized,
+                                   int count)
+{
+    float dotp = 0;
+    for(int i=0; i<count; i++)
+        dotp += _cvtsh_ss(dense[indices[i] * stride]) * quantized[i];
+    return dotp;
+}
+
+#endif
+
+
+
+// Returns the dot product of the 16-bit dense vector and the sparse vector.
+// The precision is checked once, outside of the loop.
+float reducedSparseDot(const uint16_t *dense, long stride, const int *indices,
+                       const float *values, int count, Precision precision)
+{
+    float dotp = 0;
+#ifdef PRECISION_HAVE_F16C
+    if(precision == FP16_PRECISION && have_f16c)
+        return f16cSparseDot(dense, stride, indices, values, count);
+#endif
+    if(precision == FP16_PRECISION) {
+        for(int i=0; i<count; i++)
+            dotp += fp16ToFloat(dense[indices[i] * stride]) * values[i];
+    }
+    else {
+        for(int i=0; i<count; i++)
+            dotp += bf16ToFloat(dense[indices[i] * stride]) * values[i];
+    }
+    return dotp;
+}
+
+
+
+// Returns the dot product of the dense vector and the 8-bit sparse vector.
+// The scale is applied once, to the sum.
+float quantizedSparseDot(const void *dense, long stride, const int *indices,
+                         const int8_t *quantized, float scale, int count,
+                         Precision precision)
+{
+    float dotp = 0;
+    if(precision == FP32_PRECISION) {
+        const float *vec = (const float*)dense;
+        for(int i=0; i<count; i++)
+            dotp += vec[indices[i] * stride] * quantized[i];
+    }
+    else if(precision == FP16_PRECISION) {
+        const uint16_t *vec = (const uint16_t*)dense;
+#ifdef PRECISION_HAVE_F16C
+        if(have_f16c)
+            return f16cQuantizedDot(vec, stride, indices, quantized, count)
+                   * scale;
+#endif
+        for(int i=0; i<count; i++)
+            dotp += fp16ToFloat(vec[indices[i] * stride]) * quantized[i];
+    }
+    else {
+        const uint16_t *vec = (const uint16_t*)dense;
+        for(int i=0; i<count; i++)
+            dotp += bf16ToFloat(vec[indices[i] * stride]) * quantized[i];
+    }
+    return dotp * scale;
+}
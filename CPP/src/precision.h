@@ -0,0 +1,162 @@
+/* File: precision.h
+ *
+ * Provides the 16-bit floating point formats used by the reduced precision
+ * mode: bfloat16 (the upper half of an fp32 number: same range, 8 bits of
+ * precision) and IEEE half precision (fp16: 11 bits of precision, values up
+ * to 65504). Values are only stored in these formats; all arithmetic is
+ * done in fp32. The conversions are defined inline, since they are used in
+ * the innermost loops.
+ */
+
+#ifndef PRECISION_H
+#define PRECISION_H
+
+#include <stdint.h>
+#include <string.h>
+
+// choice of possible storage precisions
+enum Precision {
+    FP32_PRECISION, // 32-bit floats (the default)
+    BF16_PRECISION, // bfloat16
+    FP16_PRECISION  // IEEE half precision
+};
+
+
+// Converts an fp32 number to bf16 (rounding to the nearest even number).
+inline uint16_t floatToBF16(float value)
+{
+    uint32_t bits;
+    memcpy(&bits, &value, sizeof(bits));
+    if((bits & 0x7fffffff) > 0x7f800000)
+        return (bits >> 16) | 0x40; // keep NaN a (quiet) NaN
+    bits += 0x7fff + ((bits >> 16) & 1);
+    return bits >> 16;
+}
+
+
+// Converts a bf16 number to fp32 (exactly).
+inline float bf16ToFloat(uint16_t value)
+{
+    uint32_t bits = (uint32_t)value << 16;
+    float result;
+    memcpy(&result, &bits, sizeof(result));
+    return result;
+}
+
+
+// Converts an fp32 number to fp16 (rounding to the nearest even number).
+// Numbers too large for fp16 become infinite, and numbers that are too
+// small become subnormal or zero.
+inline uint16_t floatToFP16(float value)
+{
+    uint32_t bits;
+    memcpy(&bits, &value, sizeof(bits));
+    uint32_t sign = (bits >> 16) & 0x8000;
+    bits &= 0x7fffffff;
+
+    // infinite, NaN, or too large
+    if(bits >= 0x47800000) {
+        if(bits > 0x7f800000)
+            return sign | 0x7e00;
+        return sign | 0x7c00;
+    }
+
+    // subnormal in fp16 (or zero)
+    if(bits < 0x38800000) {
+        if(bits < 0x33000000)
+            return sign;
+        uint32_t mantissa = (bits & 0x7fffff) | 0x800000;
+        int shift = 126 - (bits >> 23);
+        uint32_t result = mantissa >> shift;
+        uint32_t rest = mantissa & ((1u << shift) - 1);
+        uint32_t half = 1u << (shift - 1);
+        if(rest > half || (rest == half && (result & 1)))
+            result++;
+        return sign | result;
+    }
+
+    // normal: rebias the exponent, and round the mantissa
+    uint32_t result = (bits - 0x38000000) >> 13;
+    uint32_t rest = bits & 0x1fff;
+    if(rest > 0x1000 || (rest == 0x1000 && (result & 1)))
+        result++;
+    return sign | result;
+}
+
+
+// Converts an fp16 number to fp32 (exactly), without branches (small
+// concept weights are often subnormal in fp16, so a branch on it would be
+// hard to predict). A subnormal number is given the smallest normal
+// exponent first, and the implied leading 1 of that exponent is subtracted
+// again (which is exact).
+inline float fp16ToFloat(uint16_t value)
+{
+    uint32_t rest = value & 0x7fff;
+    uint32_t subnormal = (rest < 0x400);
+
+    // rebias the exponent (twice for infinite numbers and NaN)
+    uint32_t bits = (rest << 13) + 0x38000000 + (subnormal << 23);
+    bits += (rest >= 0x7c00) ? 0x38000000 : 0;
+    float result;
+    memcpy(&result, &bits, sizeof(result));
+    result -= subnormal * (1.0f / 16384);
+
+    // the sign is copied last (so -0 stays -0)
+    memcpy(&bits, &result, sizeof(bits));
+    bits |= (uint32_t)(value & 0x8000) << 16;
+    memcpy(&result, &bits, sizeof(result));
+    return result;
+}
+
+
+// Converts an fp32 number to the given 16-bit precision.
+inline uint16_t floatToReduced(float value, Precision precision)
+{
+    if(precision == FP16_PRECISION)
+        return floatToFP16(value);
+    return floatToBF16(value);
+}
+
+
+// Converts a number stored in the given 16-bit precision to fp32.
+inline float reducedToFloat(uint16_t value, Precision precision)
+{
+    if(precision == FP16_PRECISION)
+        return fp16ToFloat(value);
+    return bf16ToFloat(value);
+}
+
+
+// Converts an fp32 number to the given 16-bit precision such that the
+// stored number is never smaller than the given one (for upper bounds).
+uint16_t floatToReducedUp(float value, Precision precision);
+
+
+// Returns the largest relative rounding error of the given precision, i.e.
+// half a unit in the last place (0 for fp32, which is not rounded).
+float precisionError(Precision precision);
+
+
+// Returns the number of bytes used to store one number in the precision.
+int precisionBytes(Precision precision);
+
+
+// Returns the name of the precision (as used on the command line).
+const char* precisionName(Precision precision);
+
+
+// Returns the dot product of a dense, strided vector stored in the given
+// 16-bit precision and a sparse vector with fp32 values.
+float reducedSparseDot(const uint16_t *dense, long stride, const int *indices,
+                       const float *values, int count, Precision precision);
+
+
+// Returns the dot product of a dense, strided vector stored in the given
+// precision (either fp32 or 16-bit) and a sparse vector with 8-bit values
+// (each value is quantized[i] * scale).
+float quantizedSparseDot(const void *dense, long stride, const int *indices,
+                         const int8_t *quantized, float scale, int count,
+                         Precision precision);
+
+
+#endif
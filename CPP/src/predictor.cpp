@@ -0,0 +1,102 @@
+/* File: predictor.cpp
+ *
+ * Definitions of the ClusterPredictor functions.
+ */
+
+#include "predictor.h"
+
+#include "vectors.h"
+
+#include <omp.h>
+
+
+
+// Constructor: the concepts are stored transposed (word-major), so that each
+// non-zero word of a document adds one contiguous row to its similarities.
+ClusterPredictor::ClusterPredictor(const ClusterModel *model)
+    : k(model->k), wc(model->wc)
+{
+    weights = new float[(long)wc * k];
+    for(int c=0; c<k; c++) {
+        const float *concept = model->getConcept(c);
+        for(int w=0; w<wc; w++)
+            weights[(long)w * k + c] = concept[w];
+    }
+}
+
+
+
+// Destructor: clean up the concepts.
+ClusterPredictor::~ClusterPredictor()
+{
+    delete[] weights;
+}
+
+
+
+// Returns the number of clusters of the model.
+int ClusterPredictor::getK()
+{
+    return k;
+}
+
+
+
+// Returns the number of words of the model.
+int ClusterPredictor::getWordCount()
+{
+    return wc;
+}
+
+
+
+// The saved concepts are unit vectors (or zero, for empty clusters), so only
+// the document has to be normalized. Ties go to the lowest cluster.
+int ClusterPredictor::predictDocument(SparseMatrix *docs, int doc, float *acc,
+                                      float *score)
+{
+    for(int c=0; c<k; c++)
+        acc[c] = 0;
+    for(int a=docs->offsets[doc]; a<docs->offsets[doc+1]; a++) {
+        if(docs->indices[a] < wc)
+            vec_add_scaled(acc, weights + (long)docs->indices[a] * k, k,
+                           docs->value(doc, a));
+    }
+
+    int cIndx = 0;
+    for(int c=1; c<k; c++) {
+        if(acc[c] > acc[cIndx])
+            cIndx = c;
+    }
+    float dnorm = docs->rowNorm(doc);
+    *score = (dnorm > 0) ? acc[cIndx] / dnorm : 0;
+    return cIndx;
+}
+
+
+
+// The documents are split into chunks of PREDICT_CHUNK, which the threads
+// take as they go (documents can differ a lot in length).
+void ClusterPredictor::predict(SparseMatrix *docs, int first, int count,
+                               int *clusters, float *scores, int num_threads)
+{
+    if(num_threads <= 0)
+        num_threads = omp_get_max_threads();
+    int num_chunks = (count + PREDICT_CHUNK - 1) / PREDICT_CHUNK;
+    #pragma omp parallel num_threads(num_threads)
+    {
+        float *acc = new float[k];
+
+        #pragma omp for schedule(dynamic)
+        for(int b=0; b<num_chunks; b++) {
+            int begin = b * PREDICT_CHUNK;
+            int end = (begin + PREDICT_CHUNK < count) ? begin + PREDICT_CHUNK
+                                                      : count;
+            for(int i=begin; i<end; i++)
+                clusters[i] = predictDocument(docs, first + i, acc,
+                                              &scores[i]);
+        }
+
+        delete[] acc;
+    }
+}
@@ -0,0 +1,70 @@
+/* File: predictor.h
+ *
+ * Contains the ClusterPredictor class, which assigns new documents to the
+ * clusters of a trained model (see cluster_model.h) without clustering them:
+ * each document goes to the concept it is most similar to, and the concepts
+ * never change. Only the model's concepts are kept (transposed, so the
+ * similarities of a document with all clusters are computed like in the
+ * SpMM engine); none of the training state of ClusterData is allocated.
+ */
+
+#ifndef PREDICTOR_H
+#define PREDICTOR_H
+
+#include "cluster_model.h"
+#include "sparse_matrix.h"
+
+// default number of documents predicted at a time (read from a text stream)
+#define PREDICT_BATCH 4096
+// number of documents each thread takes at a time within a batch
+#define PREDICT_CHUNK 64
+
+
+// ClusterPredictor class holds the (fixed) concepts of a model.
+class ClusterPredictor {
+
+  private:
+
+    // number of clusters and words of the model
+    int k;
+    int wc;
+
+    // transposed concepts (wc x k): row w has word w of each concept
+    float *weights;
+
+    // computes the similarities of a document with all concepts in acc (k
+    // floats), and returns its best cluster (0 for an empty document)
+    int predictDocument(SparseMatrix *docs, int doc, float *acc,
+                        float *score);
+
+  public:
+
+    // Constructor: copies the concepts of the given model.
+    ClusterPredictor(const ClusterModel *model);
+
+    // Destructor: clean up the concepts.
+    ~ClusterPredictor();
+
+    // Returns the number of clusters and words of the model.
+    int getK();
+    int getWordCount();
+
+    /* Assigns the documents first to first+count-1 (rows of docs) to their
+     * most similar clusters. Words beyond the model's vocabulary are ignored.
+     * PARAMETERS:
+     *  docs        - The documents (any scheme; only their direction counts).
+     *  first       - First row to predict.
+     *  count       - Number of rows to predict.
+     *  clusters    - Filled in with the cluster of each of the documents.
+     *  scores      - Filled in with the cosine similarity of each document
+     *                and its cluster (0 for an empty document).
+     *  num_threads - Number of threads, each taking PREDICT_CHUNK documents
+     *                at a time (0 for the maximum).
+     */
+    void predict(SparseMatrix *docs, int first, int count, int *clusters,
+                 float *scores, int num_threads = 1);
+
+};
+
+
+#endif
@@ -0,0 +1,368 @@
+/* File: profiler.cpp
+ *
+ * Defines the Profiler functions for timing the phases of a clustering run,
+ * and for writing the JSON report.
+ */
+
+#include "profiler.h"
+
+#include <fstream>
+#include <sstream>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+using namespace std;
+
+
+// names of the phases in the report (in the order of Profiler::Phase)
+static const char *PHASE_NAMES[Profiler::NUM_PHASES] = {
+    "load", "run", "txn", "init", "seeding", "partition", "concepts",
+    "changes"
+};
+
+// names of the sections in the report (in the order of Profiler::Section)
+static const char *SECTION_NAMES[Profiler::NUM_SECTIONS] = {
+    "data", "config", "result"
+};
+
+// the phases of the steps of an iteration (in the order of step_ns)
+static const Profiler::Phase STEP_PHASES[3] = {
+    Profiler::PARTITION_PHASE, Profiler::CONCEPTS_PHASE,
+    Profiler::CHANGES_PHASE
+};
+
+
+
+// Returns the given string as a JSON string (quoted and escaped).
+static string jsonString(const char *value)
+{
+    string json = "\"";
+    for(const char *c=value; *c; c++) {
+        if(*c == '"' || *c == '\\') {
+            json += '\\';
+            json += *c;
+        }
+        else if((unsigned char)*c < 0x20) {
+            char escaped[8];
+            snprintf(escaped, sizeof(escaped), "\\u%04x", *c);
+            json += escaped;
+        }
+        else
+            json += *c;
+    }
+    return json + "\"";
+}
+
+
+
+// Returns the given number as a JSON number (null if it is not finite). The
+// exponent bits are checked directly, since isfinite is always true with
+// -ffast-math.
+static string jsonNumber(double value)
+{
+    uint64_t bits;
+    memcpy(&bits, &value, sizeof(bits));
+    if(((bits >> 52) & 0x7ff) == 0x7ff)
+        return "null";
+    ostringstream json;
+    json.precision(9);
+    json << value;
+    return json.str();
+}
+
+
+
+// Returns the given count as a JSON number (null if it is negative, which
+// means it was not counted).
+static string jsonCount(long long value)
+{
+    if(value < 0)
+        return "null";
+    ostringstream json;
+    json << value;
+    return json.str();
+}
+
+
+
+// Constructor: all phases start at 0, with no threads.
+Profiler::Profiler()
+{
+    for(int s=0; s<3; s++)
+        last_step_ns[s] = 0;
+}
+
+
+
+// Returns the current time of the steady clock in nanoseconds.
+unsigned long long Profiler::now()
+{
+    return chrono::duration_cast<chrono::nanoseconds>(
+        chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+
+
+// The load phase is kept, since the documents are only loaded once.
+void Profiler::startRun(int num_threads)
+{
+    for(int p=0; p<NUM_PHASES; p++) {
+        if(p != LOAD_PHASE)
+            timers[p].reset();
+    }
+    for(int s=0; s<3; s++)
+        last_step_ns[s] = 0;
+    iterations.clear();
+
+    ThreadStats idle = {0, 0, {0}};
+    threads.assign(num_threads > 0 ? num_threads : 0, idle);
+    timers[RUN_PHASE].start();
+}
+
+
+
+// Stops the run phase.
+void Profiler::stopRun()
+{
+    timers[RUN_PHASE].stop();
+}
+
+
+
+// Starts the given phase.
+void Profiler::start(Phase phase)
+{
+    timers[phase].start();
+}
+
+
+
+// Stops the given phase.
+void Profiler::stop(Phase phase)
+{
+    timers[phase].stop();
+}
+
+
+
+// Returns the time spent in the given phase in nanoseconds.
+unsigned long long Profiler::nanos(Phase phase)
+{
+    return timers[phase].getNanos();
+}
+
+
+
+// Returns the time spent in the given phase in milliseconds.
+double Profiler::millis(Phase phase)
+{
+    return timers[phase].getNanos() / 1e6;
+}
+
+
+
+// A count of -1 marks the thread's cosine similarities as not counted.
+void Profiler::addBusy(int thread, unsigned long long start_ns, long cosines)
+{
+    if(thread < 0 || thread >= (int)threads.size())
+        return;
+    ThreadStats &stats = threads[thread];
+    stats.busy_ns += now() - start_ns;
+    if(cosines < 0)
+        stats.cosines = -1;
+    else if(stats.cosines >= 0)
+        stats.cosines += cosines;
+}
+
+
+
+// Returns the number of threads of the run.
+int Profiler::numThreads()
+{
+    return threads.size();
+}
+
+
+
+// The step times are the differences of the phase totals.
+void Profiler::endIteration(float quality, float dQ, long moved,
+                            long cosines, long skipped)
+{
+    Iteration record;
+    record.quality = quality;
+    record.dQ = dQ;
+    record.moved = moved;
+    record.cosines = cosines;
+    record.skipped = skipped;
+    for(int s=0; s<3; s++) {
+        unsigned long long total = nanos(STEP_PHASES[s]);
+        record.step_ns[s] = total - last_step_ns[s];
+        last_step_ns[s] = total;
+    }
+    iterations.push_back(record);
+}
+
+
+
+// Returns the number of recorded iterations.
+int Profiler::numIterations()
+{
+    return iterations.size();
+}
+
+
+
+// A total is -1 if any iteration did not count it.
+void Profiler::iterationTotals(long totals[3])
+{
+    for(int c=0; c<3; c++)
+        totals[c] = 0;
+    for(size_t i=0; i<iterations.size(); i++) {
+        Iteration &record = iterations[i];
+        long counts[3] = {record.moved, record.cosines, record.skipped};
+        for(int c=0; c<3; c++) {
+            if(totals[c] >= 0)
+                totals[c] = (counts[c] < 0) ? -1 : totals[c] + counts[c];
+        }
+    }
+}
+
+
+
+// Returns the total cosine similarity count of the iterations.
+long Profiler::totalCosines()
+{
+    long totals[3];
+    iterationTotals(totals);
+    return totals[1];
+}
+
+
+
+// Adds the given (already encoded) field to the section.
+void Profiler::addField(Section section, const char *name,
+                        const string &json)
+{
+    fields[section].push_back(make_pair(string(name), json));
+}
+
+
+
+// Adds a string field.
+void Profiler::add(Section section, const char *name, const char *value)
+{
+    addField(section, name, jsonString(value));
+}
+
+
+
+// Adds a boolean field.
+void Profiler::add(Section section, const char *name, bool value)
+{
+    addField(section, name, value ? "true" : "false");
+}
+
+
+
+// Adds an integer field.
+void Profiler::add(Section section, const char *name, int value)
+{
+    addField(section, name, to_string((long long)value));
+}
+
+
+
+// Adds an integer field.
+void Profiler::add(Section section, const char *name, long value)
+{
+    addField(section, name, to_string((long long)value));
+}
+
+
+
+// Adds a real number field.
+void Profiler::add(Section section, const char *name, double value)
+{
+    addField(section, name, jsonNumber(value));
+}
+
+
+
+// Writes the given section as a member of the report object (on one line,
+// after a comma).
+void Profiler::writeSection(ostream &out, Section section)
+{
+    out << "," << endl << "  \"" << SECTION_NAMES[section] << "\": {";
+    for(size_t f=0; f<fields[section].size(); f++)
+        out << (f > 0 ? ", " : "")
+            << jsonString(fields[section][f].first.c_str()) << ": "
+            << fields[section][f].second;
+    out << "}";
+}
+
+
+
+// The report is one JSON object: the data and config sections, the phase
+// times, a record for each iteration, the busy and idle time of each thread
+// in the partitioning steps (idle is the rest of the partition phase), the
+// totals of the iteration counts, and the result section. All times are in
+// nanoseconds.
+bool Profiler::writeReport(const char *fname)
+{
+    ofstream out(fname);
+    if(!out.good())
+        return false;
+
+    out << "{" << endl << "  \"version\": 1";
+    writeSection(out, DATA_SECTION);
+    writeSection(out, CONFIG_SECTION);
+
+    out << "," << endl << "  \"phases_ns\": {";
+    for(int p=0; p<NUM_PHASES; p++)
+        out << (p > 0 ? ", " : "") << "\"" << PHASE_NAMES[p] << "\": "
+            << nanos((Phase)p);
+    out << "}";
+
+    out << "," << endl << "  \"iterations\": [";
+    for(size_t i=0; i<iterations.size(); i++) {
+        Iteration &record = iterations[i];
+        out << (i > 0 ? "," : "") << endl
+            << "    {\"iteration\": " << (i+1)
+            << ", \"quality\": " << jsonNumber(record.quality)
+            << ", \"dq\": " << jsonNumber(record.dQ)
+            << ", \"moved\": " << jsonCount(record.moved)
+            << ", \"cosines\": " << jsonCount(record.cosines)
+            << ", \"skipped\": " << jsonCount(record.skipped);
+        for(int s=0; s<3; s++)
+            out << ", \"" << PHASE_NAMES[STEP_PHASES[s]] << "_ns\": "
+                << record.step_ns[s];
+        out << "}";
+    }
+    out << (iterations.empty() ? "]" : "\n  ]");
+
+    unsigned long long partition_ns = nanos(PARTITION_PHASE);
+    out << "," << endl << "  \"threads\": [";
+    for(size_t t=0; t<threads.size(); t++) {
+        unsigned long long busy = threads[t].busy_ns;
+        unsigned long long idle = (busy < partition_ns) ? partition_ns - busy
+                                                        : 0;
+        out << (t > 0 ? "," : "") << endl
+            << "    {\"thread\": " << t << ", \"busy_ns\": " << busy
+            << ", \"idle_ns\": " << idle
+            << ", \"cosines\": " << jsonCount(threads[t].cosines) << "}";
+    }
+    out << (threads.empty() ? "]" : "\n  ]");
+
+    long totals[3];
+    iterationTotals(totals);
+    out << "," << endl << "  \"counters\": {\"moved\": "
+        << jsonCount(totals[0]) << ", \"cosines\": " << jsonCount(totals[1])
+        << ", \"skipped\": " << jsonCount(totals[2]) << "}";
+
+    writeSection(out, RESULT_SECTION);
+    out << endl << "}" << endl;
+
+    out.close();
+    return !out.fail();
+}
@@ -0,0 +1,152 @@
+/* File: profiler.h
+ *
+ * Contains the Profiler class, the instrumentation of a clustering run. It
+ * times the named phases of the run (loading the documents, the TXN scheme,
+ * the initialization, and the partitioning, concepts and changes steps of
+ * each iteration) with nanosecond resolution, keeps a record of each
+ * iteration, and the busy time and cosine similarity count of each thread in
+ * the partitioning steps. Everything is written to a JSON report (see
+ * writeReport), so runs can be compared without parsing the printed output.
+ */
+
+#ifndef PROFILER_H
+#define PROFILER_H
+
+#include "timer.h"
+
+#include <ostream>
+#include <string>
+#include <utility>
+#include <vector>
+
+
+// Profiler class measures one clustering run (the load phase is kept across
+// runs, since the documents are only loaded once).
+class Profiler {
+
+  public:
+
+    // the timed phases (the run phase spans the whole algorithm, and the
+    // init phase includes the seeding phase)
+    enum Phase {
+        LOAD_PHASE,
+        RUN_PHASE,
+        TXN_PHASE,
+        INIT_PHASE,
+        SEEDING_PHASE,
+        PARTITION_PHASE,
+        CONCEPTS_PHASE,
+        CHANGES_PHASE,
+        NUM_PHASES
+    };
+
+    // the sections of descriptive fields in the report
+    enum Section {
+        DATA_SECTION,   // the document matrix
+        CONFIG_SECTION, // the options of the run
+        RESULT_SECTION, // the outcome of the run
+        NUM_SECTIONS
+    };
+
+  private:
+
+    // one timer for each phase
+    Timer timers[NUM_PHASES];
+
+    // the record of an iteration: the quality, its change, the documents
+    // moved, cosine similarities computed and documents skipped (or -1 if
+    // they are not counted), and the time spent in each of the iteration's
+    // steps (partition, concepts, changes)
+    struct Iteration {
+        double quality;
+        double dQ;
+        long moved;
+        long cosines;
+        long skipped;
+        unsigned long long step_ns[3];
+    };
+    std::vector<Iteration> iterations;
+
+    // the step phase totals when the last iteration was recorded
+    unsigned long long last_step_ns[3];
+
+    // fills in the totals of the moved, cosines and skipped counts of all
+    // iterations (-1 if they are not counted)
+    void iterationTotals(long totals[3]);
+
+    // the work of each thread in the partitioning steps (padded to a cache
+    // line, since every thread updates its own entry)
+    struct ThreadStats {
+        unsigned long long busy_ns;
+        long cosines;
+        char padding[64 - sizeof(unsigned long long) - sizeof(long)];
+    };
+    std::vector<ThreadStats> threads;
+
+    // the fields of each section, as names and JSON values
+    std::vector<std::pair<std::string, std::string>> fields[NUM_SECTIONS];
+    void addField(Section section, const char *name, const std::string &json);
+    void writeSection(std::ostream &out, Section section);
+
+  public:
+
+    // Constructor: all phases start at 0, with no threads.
+    Profiler();
+
+    // Returns the current time of the steady clock in nanoseconds (only the
+    // differences between two calls are meaningful).
+    static unsigned long long now();
+
+    // Starts a new run with the given number of threads: everything but the
+    // load phase and the fields is reset, and the run phase starts.
+    void startRun(int num_threads);
+
+    // Stops the run phase.
+    void stopRun();
+
+    // Start and stop the given phase (phases accumulate across calls).
+    void start(Phase phase);
+    void stop(Phase phase);
+
+    // Returns the time spent in the given phase, in nanoseconds or in
+    // (fractional) milliseconds.
+    unsigned long long nanos(Phase phase);
+    double millis(Phase phase);
+
+    // Adds the time from the given start time (see now) until now to the
+    // busy time of the given thread, and the given number of cosine
+    // similarities to its count (-1 if they are not counted). Each thread
+    // must only add to its own entry.
+    void addBusy(int thread, unsigned long long start_ns, long cosines = -1);
+
+    // Returns the number of threads of the run.
+    int numThreads();
+
+    // Records an iteration with the given quality and counts (-1 if they
+    // are not counted); its step times are the phase times since the last
+    // recorded iteration.
+    void endIteration(float quality, float dQ, long moved = -1,
+                      long cosines = -1, long skipped = -1);
+
+    // Returns the number of recorded iterations.
+    int numIterations();
+
+    // Returns the number of cosine similarities computed in all recorded
+    // iterations (-1 if they are not counted).
+    long totalCosines();
+
+    // Adds a descriptive field to the given section of the report.
+    void add(Section section, const char *name, const char *value);
+    void add(Section section, const char *name, bool value);
+    void add(Section section, const char *name, int value);
+    void add(Section section, const char *name, long value);
+    void add(Section section, const char *name, double value);
+
+    // Writes the JSON report to the given file. Returns false if the file
+    // could not be written.
+    bool writeReport(const char *fname);
+
+};
+
+
+#endif
@@ -5,33 +5,90 @@
 
 #include "reader.h"
 
+#include <algorithm>
+#include <fcntl.h>
 #include <fstream>
+#include <math.h>
+#include <omp.h>
 #include <sstream>
+#include <stdlib.h>
 #include <string>
 #include <string.h>
+#include <sys/mman.h>
+#include <stdint.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <utility>
+#include <vector>
 
 using namespace std;
 
 
 
-// Read the document data file into a spare matrix (2D array) format).
+// Sorts the entries of each row of the given matrix by word index, and
+// removes duplicate entries (keeping the one that was read last). The matrix
+// is compacted in place if any duplicates were removed.
+static void sortRows(SparseMatrix *mat)
+{
+    vector<pair<int, int>> order; // (word index, position) for stable sorting
+    int pos = 0;
+    for(int i=0; i<mat->rows; i++) {
+        int start = mat->offsets[i];
+        int end = mat->offsets[i+1];
+        mat->offsets[i] = pos;
+
+        // check if the row is already sorted with no duplicates (usual case)
+        bool sorted = true;
+        for(int j=start+1; j<end && sorted; j++)
+            sorted = mat->indices[j-1] < mat->indices[j];
+        if(sorted) {
+            for(int j=start; j<end; j++, pos++) {
+                mat->indices[pos] = mat->indices[j];
+                mat->values[pos] = mat->values[j];
+            }
+            continue;
+        }
+
+        // otherwise, sort by index (ties by read order), then keep only the
+        // last entry of each word
+        order.clear();
+        for(int j=start; j<end; j++)
+            order.push_back(pair<int, int>(mat->indices[j], j));
+        sort(order.begin(), order.end());
+        vector<float> row_values(mat->values + start, mat->values + end);
+        for(int j=0; j<(int)order.size(); j++) {
+            if(j+1 < (int)order.size() && order[j+1].first == order[j].first)
+                continue;
+            mat->indices[pos] = order[j].first;
+            mat->values[pos] = row_values[order[j].second - start];
+            pos++;
+        }
+    }
+    mat->offsets[mat->rows] = pos;
+    mat->nnz = pos;
+}
+
+
+
+// Read the document data file into a compressed sparse row matrix.
 // This function assumes that the given file name is valid.
-// Returns the 2D array (sparse matrix) - columns are document vectors.
-float** readDocFile(const char *fname, int *dc, int *wc, int *non_zero)
+// Returns the sparse matrix - rows are document vectors.
+SparseMatrix* readDocFile(const char *fname, int *dc, int *wc, int *non_zero)
 {
     ifstream infile(fname);
-    
+
     // get the number of documents and words in the data set
     infile >> (*dc) >> (*wc) >> (*non_zero);
 
-    // set up the matrix and initialize it to all zeros
-    float **mat = new float*[(*dc)];
-    for(int i=0; i<(*dc); i++) {
-        mat[i] = new float[(*wc)];
-        memset(mat[i], 0, (*wc) * sizeof(*mat[i]));
+    // read the triplets, counting the number of entries in each document
+    vector<int> doc_ids, word_ids;
+    vector<float> values;
+    if((*non_zero) > 0) {
+        doc_ids.reserve(*non_zero);
+        word_ids.reserve(*non_zero);
+        values.reserve(*non_zero);
     }
-
-    // populate the matrix from the data file
+    vector<int> counts((*dc) + 1, 0);
     string line;
     while(getline(infile, line)) {
         istringstream iss(line);
@@ -39,10 +96,372 @@ float** readDocFile(const char *fname, int *dc, int *wc, int *non_zero)
         float value;
         if(!(iss >> doc_id >> word_id >> value))
             continue;
-        mat[doc_id-1][word_id-1] = value;
+        if(doc_id < 1 || doc_id > (*dc) || word_id < 1 || word_id > (*wc)
+           || value <= 0)
+            continue;
+        doc_ids.push_back(doc_id - 1);
+        word_ids.push_back(word_id - 1);
+        values.push_back(value);
+        counts[doc_id]++;
     }
-
     infile.close();
+
+    // set up the row offsets from the document counts
+    int count = values.size();
+    SparseMatrix *mat = new SparseMatrix(*dc, *wc, count);
+    for(int i=0; i<(*dc); i++)
+        mat->offsets[i+1] = mat->offsets[i] + counts[i+1];
+
+    // place each entry into its row (stable, so file order is kept per row)
+    vector<int> next(mat->offsets, mat->offsets + (*dc));
+    for(int i=0; i<count; i++) {
+        int pos = next[doc_ids[i]]++;
+        mat->indices[pos] = word_ids[i];
+        mat->values[pos] = values[i];
+    }
+
+    sortRows(mat);
+    (*non_zero) = mat->nnz;
+    return mat;
+}
+
+
+
+
+// Skips spaces and tabs (but not newlines) in the given text.
+static inline const char* skipBlanks(const char *p, const char *end)
+{
+    while(p < end && (*p == ' ' || *p == '\t' || *p == '\r'
+                      || *p == '\v' || *p == '\f'))
+        p++;
+    return p;
+}
+
+
+
+// Parses a (signed) integer starting at p, after any blanks. On success,
+// sets the value, advances p past the number, and returns true.
+static inline bool parseInt(const char *&p, const char *end, int *value)
+{
+    const char *c = skipBlanks(p, end);
+    bool negative = false;
+    if(c < end && (*c == '-' || *c == '+'))
+        negative = (*c++ == '-');
+    if(c >= end || *c < '0' || *c > '9')
+        return false;
+    long number = 0;
+    while(c < end && *c >= '0' && *c <= '9') {
+        if(number < 0x80000000L)
+            number = number*10 + (*c - '0');
+        c++;
+    }
+    if(number > 0x7fffffffL)
+        return false;
+    *value = negative ? -number : number;
+    p = c;
+    return true;
+}
+
+
+
+// Parses a decimal floating point number (digits, an optional fraction and
+// an optional exponent) starting at p, after any blanks. Up to 19 mantissa
+// digits are accumulated as an integer and scaled by an exact power of ten
+// when possible; any other number is handed to strtod. On success, sets the
+// value, advances p past the number, and returns true.
+static inline bool parseFloat(const char *&p, const char *end, float *value)
+{
+    static const double powers[] = {
+        1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+        1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22
+    };
+
+    const char *c = skipBlanks(p, end);
+    const char *start = c;
+    bool negative = false;
+    if(c < end && (*c == '-' || *c == '+'))
+        negative = (*c++ == '-');
+
+    // mantissa digits (before and after the decimal point)
+    unsigned long long mantissa = 0;
+    int digits = 0;
+    int exponent = 0;
+    bool exact = true;
+    for(; c < end && *c >= '0' && *c <= '9'; c++, digits++) {
+        if(mantissa < 1000000000000000000ULL)
+            mantissa = mantissa*10 + (*c - '0');
+        else {
+            exponent++;
+            exact = false;
+        }
+    }
+    if(c < end && *c == '.') {
+        for(c++; c < end && *c >= '0' && *c <= '9'; c++, digits++) {
+            if(mantissa < 1000000000000000000ULL) {
+                mantissa = mantissa*10 + (*c - '0');
+                exponent--;
+            }
+            else
+                exact = false;
+        }
+    }
+    if(digits == 0)
+        return false;
+
+    // optional exponent (only if it is followed by digits)
+    if(c < end && (*c == 'e' || *c == 'E')) {
+        const char *e = c + 1;
+        int exp_value;
+        if(e < end && *e != ' ' && *e != '\t' && parseInt(e, end, &exp_value)) {
+            exponent += exp_value;
+            c = e;
+        }
+    }
+
+    double result;
+    if(exact && mantissa < (1ULL << 53) && exponent >= -22 && exponent <= 22)
+        result = exponent < 0 ? mantissa / powers[-exponent]
+                              : mantissa * powers[exponent];
+    else {
+        string token(start, c);
+        result = fabs(strtod(token.c_str(), 0));
+    }
+    *value = negative ? -result : result;
+    p = c;
+    return true;
+}
+
+
+
+// Entries (document, word, value) parsed by one thread, in file order, with
+// the number of entries found for each document.
+struct ParsedChunk {
+    vector<int> doc_ids;
+    vector<int> word_ids;
+    vector<float> values;
+    vector<int> counts;
+};
+
+
+
+// Parses every line of the text in [begin, end) the same way as readDocFile:
+// lines that do not start with "docID wordID value" are skipped, as are
+// entries that are not positive or are out of range.
+static void parseChunk(const char *begin, const char *end, int dc, int wc,
+                       ParsedChunk *chunk)
+{
+    chunk->counts.assign(dc, 0);
+    const char *p = begin;
+    while(p < end) {
+        const char *line_end = (const char*)memchr(p, '\n', end - p);
+        if(line_end == 0)
+            line_end = end;
+        int doc_id, word_id;
+        float value;
+        if(parseInt(p, line_end, &doc_id) && parseInt(p, line_end, &word_id)
+           && parseFloat(p, line_end, &value)
+           && doc_id >= 1 && doc_id <= dc && word_id >= 1 && word_id <= wc
+           && value > 0) {
+            chunk->doc_ids.push_back(doc_id - 1);
+            chunk->word_ids.push_back(word_id - 1);
+            chunk->values.push_back(value);
+            chunk->counts[doc_id - 1]++;
+        }
+        p = (line_end < end) ? line_end + 1 : end;
+    }
+}
+
+
+
+// Multithreaded reader: the header is parsed first, then each thread parses
+// a chunk of the remaining lines into its own entry lists. The per-thread
+// document counts give each thread its own range inside every row, so the
+// threads then copy their entries into the matrix independently. Chunks are
+// in file order, so each row keeps the file order (and sortRows keeps the
+// last duplicate entry, exactly like readDocFile).
+SparseMatrix* readDocFileParallel(const char *fname, int *dc, int *wc,
+                                  int *non_zero, int num_threads)
+{
+    *dc = 0;
+    *wc = 0;
+    *non_zero = 0;
+
+    // map the whole file (an empty or unreadable file gives an empty matrix)
+    const char *text = 0;
+    size_t size = 0;
+    int fd = open(fname, O_RDONLY);
+    if(fd >= 0) {
+        struct stat info;
+        if(fstat(fd, &info) == 0 && info.st_size > 0) {
+            size = info.st_size;
+            void *mem = mmap(0, size, PROT_READ, MAP_PRIVATE, fd, 0);
+            if(mem != MAP_FAILED) {
+                madvise(mem, size, MADV_SEQUENTIAL);
+                text = (const char*)mem;
+            }
+            else
+                size = 0;
+        }
+        close(fd);
+    }
+    const char *end = text + size;
+
+    // get the number of documents and words in the data set (the header
+    // numbers can be separated by any whitespace, including newlines)
+    const char *p = text;
+    int *header[3] = { dc, wc, non_zero };
+    for(int i=0; i<3; i++) {
+        while(p < end && (*p == '\n' || *p == ' ' || *p == '\t'
+                          || *p == '\r'))
+            p++;
+        if(!parseInt(p, end, header[i])) {
+            p = end;
+            break;
+        }
+    }
+    if(*dc < 0)
+        *dc = 0;
+
+    // split the rest of the file into one chunk per thread, moving each
+    // split point to the start of the next line
+    if(num_threads <= 0)
+        num_threads = omp_get_max_threads();
+    vector<const char*> bounds(num_threads + 1, end);
+    bounds[0] = p;
+    for(int t=1; t<num_threads; t++) {
+        const char *split = p + (end - p) * t / num_threads;
+        if(split < bounds[t-1])
+            split = bounds[t-1];
+        const char *line_end = (const char*)memchr(split, '\n', end - split);
+        bounds[t] = (line_end == 0) ? end : line_end + 1;
+    }
+
+    vector<ParsedChunk> chunks(num_threads);
+    #pragma omp parallel for schedule(static, 1) num_threads(num_threads)
+    for(int t=0; t<num_threads; t++)
+        parseChunk(bounds[t], bounds[t+1], *dc, *wc, &chunks[t]);
+    if(text != 0)
+        munmap((void*)text, size);
+
+    // set up the row offsets from the combined document counts, and turn
+    // each thread's counts into its starting position in every row
+    long count = 0;
+    for(int t=0; t<num_threads; t++)
+        count += chunks[t].values.size();
+    SparseMatrix *mat = new SparseMatrix(*dc, *wc, count);
+    for(int i=0; i<(*dc); i++) {
+        int pos = mat->offsets[i];
+        for(int t=0; t<num_threads; t++) {
+            int c = chunks[t].counts[i];
+            chunks[t].counts[i] = pos;
+            pos += c;
+        }
+        mat->offsets[i+1] = pos;
+    }
+
+    // place each thread's entries into its part of the rows
+    #pragma omp parallel for schedule(static, 1) num_threads(num_threads)
+    for(int t=0; t<num_threads; t++) {
+        ParsedChunk &chunk = chunks[t];
+        for(size_t i=0; i<chunk.values.size(); i++) {
+            int pos = chunk.counts[chunk.doc_ids[i]]++;
+            mat->indices[pos] = chunk.word_ids[i];
+            mat->values[pos] = chunk.values[i];
+        }
+    }
+
+    sortRows(mat);
+    (*non_zero) = mat->nnz;
+    return mat;
+}
+
+
+
+// Reads the four header numbers of a Galois binary graph file (version, edge
+// weight size, nodes, edges), and checks that the file size matches them.
+// Returns false if the file is not a (version 1, float weight) graph file.
+static bool readGraphHeader(ifstream &infile, uint64_t *header)
+{
+    if(!infile.read((char*)header, 4 * sizeof(uint64_t)))
+        return false;
+    if(header[0] != 1 || header[1] != sizeof(float))
+        return false;
+    uint64_t nodes = header[2];
+    uint64_t edges = header[3];
+    uint64_t size = 4 * sizeof(uint64_t) + nodes * sizeof(uint64_t)
+                  + ((edges + 1) / 2) * 2 * sizeof(uint32_t)
+                  + edges * sizeof(float);
+    infile.seekg(0, ios::end);
+    bool valid = (uint64_t)infile.tellg() == size;
+    infile.seekg(4 * sizeof(uint64_t), ios::beg);
+    return valid;
+}
+
+
+
+// Returns true if the given file is a Galois binary graph file.
+bool isGraphFile(const char *fname)
+{
+    ifstream infile(fname, ios::binary);
+    uint64_t header[4];
+    return infile.good() && readGraphHeader(infile, header);
+}
+
+
+
+// Read the document-word graph into a compressed sparse row matrix. The
+// graph is already stored by source node, so the document rows are copied
+// out of it directly (and then sorted by word, like readDocFile's rows).
+SparseMatrix* readGraphFile(const char *fname, int *dc, int *wc,
+                            int *non_zero)
+{
+    ifstream infile(fname, ios::binary);
+    uint64_t header[4];
+    if(!infile.good() || !readGraphHeader(infile, header))
+        return 0;
+    long nodes = header[2];
+    long edges = header[3];
+
+    // read the offsets, destinations (skipping the padding) and weights
+    vector<uint64_t> ends(nodes);
+    vector<uint32_t> dests(edges);
+    vector<float> weights(edges);
+    infile.read((char*)&ends[0], nodes * sizeof(uint64_t));
+    infile.read((char*)&dests[0], edges * sizeof(uint32_t));
+    if(edges % 2 == 1)
+        infile.seekg(sizeof(uint32_t), ios::cur);
+    infile.read((char*)&weights[0], edges * sizeof(float));
+    if(!infile)
+        return 0;
+
+    // the documents are the nodes up to the last one with outgoing edges
+    int docs = 0;
+    for(long i=0; i<nodes; i++) {
+        uint64_t start = (i > 0) ? ends[i-1] : 0;
+        if(ends[i] > start)
+            docs = i + 1;
+    }
+    (*dc) = docs;
+    (*wc) = nodes - docs;
+
+    // copy the edges that point to words (with positive weights)
+    SparseMatrix *mat = new SparseMatrix(*dc, *wc, edges);
+    int pos = 0;
+    for(int i=0; i<docs; i++) {
+        uint64_t start = (i > 0) ? ends[i-1] : 0;
+        for(uint64_t e=start; e<ends[i]; e++) {
+            if(dests[e] < (uint32_t)docs || weights[e] <= 0)
+                continue;
+            mat->indices[pos] = dests[e] - docs;
+            mat->values[pos] = weights[e];
+            pos++;
+        }
+        mat->offsets[i+1] = pos;
+    }
+    mat->nnz = pos;
+
+    sortRows(mat);
+    (*non_zero) = mat->nnz;
     return mat;
 }
 
@@ -81,3 +500,101 @@ char** readWordsFile(const char *fname, int wc)
     infile.close();
     return words;
 }
+
+
+
+// Constructor: read the header, and the first entry.
+DocBatchReader::DocBatchReader(istream *in_) : in(in_)
+{
+    dc = wc = nnz = -1;
+    (*in) >> dc >> wc >> nnz;
+    has_next = false;
+    if(good())
+        readEntry();
+}
+
+
+
+// Returns true if the header could be read.
+bool DocBatchReader::good()
+{
+    return dc >= 0 && wc >= 0;
+}
+
+
+
+// Returns the number of documents given in the header.
+int DocBatchReader::getDocCount()
+{
+    return dc;
+}
+
+
+
+// Returns the number of words given in the header.
+int DocBatchReader::getWordCount()
+{
+    return wc;
+}
+
+
+
+// Entries that are not positive or fall outside of the declared dimensions
+// are skipped (like in readDocFile).
+void DocBatchReader::readEntry()
+{
+    has_next = false;
+    string line;
+    while(getline(*in, line)) {
+        istringstream iss(line);
+        int doc_id, word_id;
+        float value;
+        if(!(iss >> doc_id >> word_id >> value))
+            continue;
+        if(doc_id < 1 || doc_id > dc || word_id < 1 || word_id > wc
+           || value <= 0)
+            continue;
+        next_doc = doc_id;
+        next_word = word_id - 1;
+        next_value = value;
+        has_next = true;
+        return;
+    }
+}
+
+
+
+// The entries of the batch are collected in CSR order as they are read, and
+// each row is then sorted (removing duplicate words, as in readDocFile).
+SparseMatrix* DocBatchReader::next(int max_docs, vector<int> *doc_ids)
+{
+    doc_ids->clear();
+    if(!has_next)
+        return 0;
+
+    vector<int> offsets(1, 0);
+    vector<int> indices;
+    vector<float> values;
+    while(has_next) {
+        if(doc_ids->empty() || next_doc != doc_ids->back()) {
+            if((int)doc_ids->size() == max_docs)
+                break;
+            if(!doc_ids->empty())
+                offsets.push_back(indices.size());
+            doc_ids->push_back(next_doc);
+        }
+        indices.push_back(next_word);
+        values.push_back(next_value);
+        readEntry();
+    }
+    offsets.push_back(indices.size());
+
+    int rows = doc_ids->size();
+    int count = indices.size();
+    SparseMatrix *mat = new SparseMatrix(rows, wc, count);
+    memcpy(mat->offsets, &offsets[0], sizeof(int) * (rows + 1));
+    memcpy(mat->indices, &indices[0], sizeof(int) * count);
+    memcpy(mat->values, &values[0], sizeof(float) * count);
+    sortRows(mat);
+    return mat;
+}
@@ -1,16 +1,26 @@
 /* File: reader.h
  *
  * Provides functions for reading text-based data sets, namely reading a
- * document file and an associated vocabulary file.
+ * document file and an associated vocabulary file, and for reading document
+ * graphs in the Galois binary graph format.
  */
 
 #ifndef READER_H
 #define READER_H
 
+#include "sparse_matrix.h"
 
-/* Read the document data file into a spare matrix (2D array) format).
+#include <istream>
+#include <vector>
+
+
+/* Read the document data file into a compressed sparse row matrix. The
+ * triplets are streamed directly into the sparse format, so the dense
+ * document-word matrix is never allocated. Entries that are not positive or
+ * fall outside of the declared dimensions are skipped, and if a (docID,
+ * wordID) pair appears more than once, the last value is kept.
  * This function assumes that the given file name is valid.
- * Returns the 2D array (sparse matrix) - columns are document vectors.
+ * Returns the sparse matrix - rows are document vectors.
  * FILE FORMAT:
  *  <top of file>
  *      number of documents
@@ -24,11 +34,58 @@
  *  fname    - Name of the file.
  *  dc       - Integer to be filled in with the number of documents.
  *  wc       - Integer to be filled in with the number of words.
- *  non_zero - Integer to be filled in with the number of non-zeor entries.
+ *  non_zero - Integer to be filled in with the number of non-zero entries.
+ * RETURNS:
+ *  A SparseMatrix representing the document matrix D.
+ */
+SparseMatrix* readDocFile(const char *fname, int *dc, int *wc, int *non_zero);
+
+
+/* Multithreaded version of readDocFile: the file is memory-mapped and split
+ * into chunks at line boundaries, each chunk is parsed by its own thread
+ * (without iostreams), and the per-thread entries are merged into the CSR
+ * matrix. The result is the same as that of readDocFile.
+ * PARAMETERS:
+ *  fname       - Name of the file.
+ *  dc          - Integer to be filled in with the number of documents.
+ *  wc          - Integer to be filled in with the number of words.
+ *  non_zero    - Integer to be filled in with the number of non-zero entries.
+ *  num_threads - Number of threads to use (0 to use the OpenMP default).
+ * RETURNS:
+ *  A SparseMatrix representing the document matrix D.
+ */
+SparseMatrix* readDocFileParallel(const char *fname, int *dc, int *wc,
+                                  int *non_zero, int num_threads = 0);
+
+
+/* Read a document-word graph in the Galois binary graph format (version 1,
+ * with 32-bit float edge weights) into a compressed sparse row matrix. The
+ * documents are the first nodes (up to the last node with outgoing edges),
+ * and the words are all remaining nodes; each edge from a document to a
+ * word holds the word's weight in the document. Edges that are not positive
+ * or do not point to a word are skipped.
+ * FILE FORMAT (all little-endian):
+ *  version (1), edge weight size (4), number of nodes, number of edges
+ *      (four 64-bit integers)
+ *  out-edge end offset of each node (64-bit integers)
+ *  destination node of each edge (32-bit integers, padded to 8 bytes)
+ *  weight of each edge (32-bit floats)
+ * PARAMETERS:
+ *  fname    - Name of the file.
+ *  dc       - Integer to be filled in with the number of documents.
+ *  wc       - Integer to be filled in with the number of words.
+ *  non_zero - Integer to be filled in with the number of non-zero entries.
  * RETURNS:
- *  A 2D float array (matrix) representing the document matrix D.
+ *  A SparseMatrix representing the document matrix D, or a null pointer if
+ *  the file could not be read.
  */
-float** readDocFile(const char *fname, int *dc, int *wc, int *non_zero);
+SparseMatrix* readGraphFile(const char *fname, int *dc, int *wc,
+                            int *non_zero);
+
+
+// Returns true if the given file is a Galois binary graph (.gr) file, which
+// is checked from its header and size.
+bool isGraphFile(const char *fname);
 
 
 // Read the word data into a list. Words are just organized one word per line.
@@ -37,4 +94,57 @@ float** readDocFile(const char *fname, int *dc, int *wc, int *non_zero);
 char** readWordsFile(const char *fname, int wc);
 
 
+// DocBatchReader class reads a text document file (in the format of
+// readDocFile) from a stream, a batch of documents at a time, so it can be
+// read from a pipe without being stored. Unlike readDocFile, the entries of
+// each document must be on consecutive lines: a document ends where a line
+// of another document starts. Entries are checked like in readDocFile, and
+// documents without valid entries are left out.
+class DocBatchReader {
+
+  private:
+
+    std::istream *in;
+
+    // dimensions from the header of the file
+    int dc;
+    int wc;
+    int nnz;
+
+    // the first entry of the next batch (read ahead), if has_next is set
+    bool has_next;
+    int next_doc;
+    int next_word;
+    float next_value;
+
+    // reads the next valid entry into the read-ahead entry
+    void readEntry();
+
+  public:
+
+    // Constructor: reads the header from the given stream (not owned).
+    DocBatchReader(std::istream *in_);
+
+    // Returns true if the header could be read.
+    bool good();
+
+    // Returns the number of documents and words given in the header.
+    int getDocCount();
+    int getWordCount();
+
+    /* Reads the next documents from the stream.
+     * PARAMETERS:
+     *  max_docs - The largest number of documents to read.
+     *  doc_ids  - Filled in with the document ID (as in the file) of each
+     *             row of the batch.
+     * RETURNS:
+     *  The documents as the rows of a matrix with the words of the header as
+     *  its columns (to be deleted by the caller), or a null pointer at the
+     *  end of the stream.
+     */
+    SparseMatrix* next(int max_docs, std::vector<int> *doc_ids);
+
+};
+
+
 #endif
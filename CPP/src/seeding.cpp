@@ -0,0 +1,443 @@
+/* File: seeding.cpp
+ *
+ * Definitions of the seeding functions (initial partitioning strategies).
+ */
+
+#include "seeding.h"
+
+#include "vectors.h"
+
+#include <vector>
+
+using namespace std;
+
+// distance given to documents before any concept is chosen (above the
+// largest possible distance, 1 - (-1) = 2)
+#define SEED_FAR 4.0f
+
+// words that are in at least 1/SEED_DENSE_FRACTION of a batch of candidates
+// get a dense row of weights in the batch index (see updateClosestBatch)
+#define SEED_DENSE_FRACTION 16
+
+
+
+// Mixes the bits of the given number (the splitmix64 finalizer).
+static unsigned long long mixBits(unsigned long long x)
+{
+    x += 0x9e3779b97f4a7c15ULL;
+    x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    x = (x ^ (x >> 27)) * 0x94d049bb133111ebULL;
+    return x ^ (x >> 31);
+}
+
+
+
+// Returns a uniform random number in [0, 1) for the given seed, stream and
+// index. The number only depends on these three values (not on the order
+// of the calls), so parallel loops draw the same numbers for any number of
+// threads.
+static double randomUniform(unsigned int seed, long stream, long index)
+{
+    unsigned long long x = mixBits(seed + 0x632be59bd9b4e019ULL * stream);
+    x = mixBits(x ^ (unsigned long long)index);
+    return (x >> 11) * (1.0 / 9007199254740992.0);
+}
+
+
+
+// Returns an index in [0, n) chosen with probability proportional to
+// dist[i] (times weights[i], if weights are given), using the random number
+// u in [0, 1). Returns -1 if all of the weights are zero.
+static int sampleIndex(const float *dist, const int *weights, int n, double u)
+{
+    double total = 0;
+    for(int i=0; i<n; i++)
+        total += (weights != 0) ? (double)weights[i] * dist[i] : dist[i];
+    if(total <= 0)
+        return -1;
+
+    double target = u * total;
+    int last = -1;
+    for(int i=0; i<n; i++) {
+        double w = (weights != 0) ? (double)weights[i] * dist[i] : dist[i];
+        if(w <= 0)
+            continue;
+        last = i;
+        target -= w;
+        if(target < 0)
+            return i;
+    }
+    return last;
+}
+
+
+
+// Returns the cosine similarity of the given document and the dense,
+// strided unit vector (0 for a zero document).
+static float docCosine(ClusterData *data, float *doc_norms, int doc,
+                       float *dense, long stride)
+{
+    if(doc_norms[doc] == 0)
+        return 0;
+    return data->docs->rowDot(doc, dense, stride) / doc_norms[doc];
+}
+
+
+
+// Writes the normalized document into the dense (strided) vector, which
+// must be zero at the document's words. If clear is set, zeroes those words
+// again instead.
+static void scatterDoc(ClusterData *data, float *doc_norms, int doc,
+                       float *dense, long stride, bool clear = false)
+{
+    SparseMatrix *docs = data->docs;
+    for(int a=docs->offsets[doc]; a<docs->offsets[doc+1]; a++)
+        dense[docs->indices[a] * stride] =
+            clear ? 0 : docs->value(doc, a) / doc_norms[doc];
+}
+
+
+
+// Sets the given concept vector to the normalized document (or to a zero
+// vector, if doc is -1).
+static void setConcept(ClusterData *data, float *doc_norms, int cIndx,
+                       int doc)
+{
+    float *concept = data->getConcept(cIndx);
+    vec_fill_strided(concept, data->wc, data->word_stride, 0);
+    data->concept_norms[cIndx] = 0;
+    if(doc >= 0) {
+        scatterDoc(data, doc_norms, doc, concept, data->word_stride);
+        data->concept_norms[cIndx] = 1;
+    }
+}
+
+
+
+// Updates the distance of each document to its closest center with the
+// given (dense, normalized) center, which becomes the closest center (with
+// the given index) of every document that is closer to it.
+static void updateClosest(ClusterData *data, float *doc_norms,
+                          float *center, long stride, int index,
+                          float *dist, int *closest, int num_threads)
+{
+    #pragma omp parallel for num_threads(num_threads)
+    for(int i=0; i<data->dc; i++) {
+        if(doc_norms[i] == 0)
+            continue;
+        float d = 1 - docCosine(data, doc_norms, i, center, stride);
+        if(d < 0)
+            d = 0;
+        if(d < dist[i]) {
+            dist[i] = d;
+            closest[i] = index;
+        }
+    }
+}
+
+
+
+// Updates the distances and closest centers like updateClosest, but with a
+// whole batch of candidate documents (candidate j becomes center number
+// first_index + j) in a single pass over the documents. The candidates are
+// transposed into a word-major index: common words get a dense row with the
+// (normalized) weight of every candidate, which is added to a document's
+// dot products with one vector kernel, and the other words get a list of
+// the candidates that contain them (like a small CSR matrix), so rare words
+// only touch the candidates they are in.
+static void updateClosestBatch(ClusterData *data, float *doc_norms,
+                               const int *candidates, int count,
+                               int first_index, float *dist, int *closest,
+                               int num_threads)
+{
+    SparseMatrix *docs = data->docs;
+    int wc = data->wc;
+    vector<int> word_counts(wc, 0);
+    for(int j=0; j<count; j++) {
+        int doc = candidates[j];
+        for(int a=docs->offsets[doc]; a<docs->offsets[doc+1]; a++)
+            word_counts[docs->indices[a]]++;
+    }
+
+    // choose the dense words, and lay out the lists of the others
+    vector<int> dense_rows(wc, -1);
+    vector<int> word_offsets(wc + 1, 0);
+    int num_dense = 0;
+    for(int w=0; w<wc; w++) {
+        if(word_counts[w] > 0
+           && (long)word_counts[w] * SEED_DENSE_FRACTION >= count)
+            dense_rows[w] = num_dense++;
+        else
+            word_offsets[w+1] = word_counts[w];
+    }
+    for(int w=0; w<wc; w++)
+        word_offsets[w+1] += word_offsets[w];
+
+    // fill in the candidate weights
+    vector<float> dense((long)num_dense * count, 0);
+    vector<int> list_candidates(word_offsets[wc]);
+    vector<float> list_weights(word_offsets[wc]);
+    vector<int> next(word_offsets.begin(), word_offsets.end() - 1);
+    for(int j=0; j<count; j++) {
+        int doc = candidates[j];
+        for(int a=docs->offsets[doc]; a<docs->offsets[doc+1]; a++) {
+            int w = docs->indices[a];
+            float weight = docs->value(doc, a) / doc_norms[doc];
+            if(dense_rows[w] >= 0)
+                dense[(long)dense_rows[w] * count + j] = weight;
+            else {
+                int pos = next[w]++;
+                list_candidates[pos] = j;
+                list_weights[pos] = weight;
+            }
+        }
+    }
+
+    #pragma omp parallel num_threads(num_threads)
+    {
+        float *dots = new float[count];
+
+        #pragma omp for schedule(dynamic, 64)
+        for(int i=0; i<data->dc; i++) {
+            if(doc_norms[i] == 0)
+                continue;
+            for(int j=0; j<count; j++)
+                dots[j] = 0;
+            for(int a=docs->offsets[i]; a<docs->offsets[i+1]; a++) {
+                int w = docs->indices[a];
+                float value = docs->value(i, a);
+                if(dense_rows[w] >= 0)
+                    vec_add_scaled(dots, &dense[(long)dense_rows[w] * count],
+                                   count, value);
+                else {
+                    for(int p=word_offsets[w]; p<word_offsets[w+1]; p++)
+                        dots[list_candidates[p]] += value * list_weights[p];
+                }
+            }
+
+            // the candidates are taken in order, like one updateClosest
+            // call per candidate would
+            for(int j=0; j<count; j++) {
+                float d = 1 - dots[j] / doc_norms[i];
+                if(d < 0)
+                    d = 0;
+                if(d < dist[i]) {
+                    dist[i] = d;
+                    closest[i] = first_index + j;
+                }
+            }
+        }
+
+        delete[] dots;
+    }
+}
+
+
+
+// Sets up the document distances for the k-means++ style seedings: zero
+// documents are never chosen (distance 0) and belong to the first cluster.
+static void initDistances(ClusterData *data, float *doc_norms,
+                          float *dist, int *closest)
+{
+    for(int i=0; i<data->dc; i++) {
+        dist[i] = (doc_norms[i] > 0) ? SEED_FAR : 0;
+        closest[i] = 0;
+    }
+}
+
+
+
+// Splits the documents into k contiguous blocks.
+void seedBlocks(ClusterData *data)
+{
+    int split = data->dc / data->k;
+    int base = 1;
+    for(int i=0; i<data->k; i++) {
+        int top = base + split - 1;
+        if(i == data->k-1)
+            top = data->dc;
+        int p_size = top - base + 1;
+        for(int j=0; j<p_size; j++)
+            data->p_asgns[base-1 + j] = i;
+        base = base + split;
+    }
+}
+
+
+
+// Gives each document a random cluster.
+void seedRandom(ClusterData *data, unsigned int seed)
+{
+    for(int i=0; i<data->dc; i++) {
+        int cIndx = randomUniform(seed, 0, i) * data->k;
+        data->p_asgns[i] = (cIndx < data->k) ? cIndx : data->k - 1;
+    }
+}
+
+
+
+// Chooses each concept from the documents with the k-means++ distribution.
+// The closest concept of every document is tracked along the way, so the
+// final assignment needs no extra pass. If there are fewer distinct
+// (non-zero) documents than k, the remaining concepts are left empty.
+void seedKMeansPP(ClusterData *data, float *doc_norms, unsigned int seed,
+                  int num_threads)
+{
+    float *dist = new float[data->dc];
+    int *closest = data->p_asgns;
+    initDistances(data, doc_norms, dist, closest);
+
+    for(int c=0; c<data->k; c++) {
+        int doc = sampleIndex(dist, 0, data->dc, randomUniform(seed, 1, c));
+        setConcept(data, doc_norms, c, doc);
+        if(doc >= 0)
+            updateClosest(data, doc_norms, data->getConcept(c),
+                          data->word_stride, c, dist, closest, num_threads);
+    }
+
+    delete[] dist;
+}
+
+
+
+// Samples the candidates in a few parallel passes over the documents (one
+// batched pass per round), then reduces them to k concepts. The first
+// candidate and the candidates of the weighted k-means++ only need a dense
+// copy while they are compared, so a single (reused) buffer is enough.
+void seedKMeansParallel(ClusterData *data, float *doc_norms,
+                        unsigned int seed, int num_threads)
+{
+    int dc = data->dc;
+    int k = data->k;
+    float *dist = new float[dc];
+    int *closest = new int[dc];
+    float *dense = vec_zeros(data->wc);
+    initDistances(data, doc_norms, dist, closest);
+
+    // the first candidate is a uniformly random (non-zero) document
+    vector<int> candidates;
+    int first = sampleIndex(dist, 0, dc, randomUniform(seed, 1, 0));
+    if(first >= 0) {
+        candidates.push_back(first);
+        scatterDoc(data, doc_norms, first, dense, 1);
+        updateClosest(data, doc_norms, dense, 1, 0, dist, closest,
+                      num_threads);
+        scatterDoc(data, doc_norms, first, dense, 1, true);
+    }
+
+    // in each round, sample every document independently with probability
+    // proportional to its distance, then update the distances with all of
+    // the round's candidates at once
+    for(int r=0; r<SEED_ROUNDS && first >= 0; r++) {
+        double psi = 0;
+        for(int i=0; i<dc; i++)
+            psi += dist[i];
+        if(psi <= 0)
+            break;
+        double scale = (double)SEED_OVERSAMPLING * k / psi;
+        int round_start = candidates.size();
+        for(int i=0; i<dc; i++) {
+            if(dist[i] > 0 && randomUniform(seed, 2 + r, i) < dist[i] * scale)
+                candidates.push_back(i);
+        }
+        int round_count = candidates.size() - round_start;
+        if(round_count > 0)
+            updateClosestBatch(data, doc_norms, &candidates[round_start],
+                               round_count, round_start, dist, closest,
+                               num_threads);
+    }
+
+    // weigh each candidate by the number of documents closest to it, and
+    // choose the concepts with k-means++ over the weighted candidates
+    int num_candidates = candidates.size();
+    vector<int> weights(num_candidates, 0);
+    for(int i=0; i<dc; i++) {
+        if(doc_norms[i] > 0)
+            weights[closest[i]]++;
+    }
+    vector<float> cand_dist(num_candidates, SEED_FAR);
+    vector<int> chosen;
+    if(num_candidates <= k)
+        chosen = candidates;
+    else {
+        for(int c=0; c<k; c++) {
+            int j = sampleIndex(&cand_dist[0], &weights[0], num_candidates,
+                                randomUniform(seed, 2 + SEED_ROUNDS, c));
+            if(j < 0)
+                break;
+            chosen.push_back(candidates[j]);
+            scatterDoc(data, doc_norms, candidates[j], dense, 1);
+            #pragma omp parallel for num_threads(num_threads)
+            for(int a=0; a<num_candidates; a++) {
+                float d = 1 - docCosine(data, doc_norms, candidates[a],
+                                        dense, 1);
+                if(d < cand_dist[a])
+                    cand_dist[a] = (d > 0) ? d : 0;
+            }
+            scatterDoc(data, doc_norms, candidates[j], dense, 1, true);
+        }
+    }
+
+    // store the concepts, and assign each document to the most similar one
+    // (with the batch index of the chosen documents, in one pass)
+    int num_chosen = chosen.size();
+    for(int c=0; c<k; c++)
+        setConcept(data, doc_norms, c, (c < num_chosen) ? chosen[c] : -1);
+    initDistances(data, doc_norms, dist, data->p_asgns);
+    if(num_chosen > 0)
+        updateClosestBatch(data, doc_norms, &chosen[0], num_chosen, 0, dist,
+                           data->p_asgns, num_threads);
+
+    delete[] dist;
+    delete[] closest;
+    delete[] dense;
+}
+
+
+
+// Returns the cosine similarity of the given document and the given saved
+// concept (a unit vector over the model's words).
+static float modelCosine(ClusterData *data, float *doc_norms, int doc,
+                         const ClusterModel *model, int cIndx)
+{
+    if(doc_norms[doc] == 0)
+        return 0;
+    SparseMatrix *docs = data->docs;
+    const float *concept = model->getConcept(cIndx);
+    float dot = 0;
+    for(int a=docs->offsets[doc]; a<docs->offsets[doc+1]; a++) {
+        if(docs->indices[a] < model->wc)
+            dot += docs->value(doc, a) * concept[docs->indices[a]];
+    }
+    return dot / doc_norms[doc];
+}
+
+
+
+// Only the new (or all, if reassign is set) documents are compared with the
+// saved concepts; zero documents belong to the first cluster.
+int seedFromModel(ClusterData *data, float *doc_norms,
+                  const ClusterModel *model, bool reassign, int num_threads)
+{
+    int num_clusters = (model->k < data->k) ? model->k : data->k;
+    int num_kept = 0;
+    #pragma omp parallel for num_threads(num_threads) reduction(+:num_kept)
+    for(int i=0; i<data->dc; i++) {
+        if(!reassign && i < model->dc && model->assignments[i] < data->k) {
+            data->p_asgns[i] = model->assignments[i];
+            num_kept++;
+            continue;
+        }
+        int best = 0;
+        float best_cos = -SEED_FAR;
+        for(int c=0; c<num_clusters; c++) {
+            float similarity = modelCosine(data, doc_norms, i, model, c);
+            if(similarity > best_cos) {
+                best_cos = similarity;
+                best = c;
+            }
+        }
+        data->p_asgns[i] = best;
+    }
+    return num_kept;
+}
@@ -0,0 +1,76 @@
+/* File: seeding.h
+ *
+ * Provides the functions that choose the initial partitioning for spherical
+ * k-means (the seeding step). Every seeding fills in the current partition
+ * assignments of a ClusterData object; all random choices are derived from
+ * the given seed, so a seeding is reproducible for any number of threads.
+ */
+
+#ifndef SEEDING_H
+#define SEEDING_H
+
+#include "cluster_data.h"
+#include "cluster_model.h"
+
+// number of sampling rounds, and the expected number of candidates sampled
+// per round (as a multiple of k), used by the k-means|| seeding
+#define SEED_ROUNDS 5
+#define SEED_OVERSAMPLING 2
+
+
+// Assigns the documents to clusters in contiguous blocks of dc / k documents
+// (in file order); the last cluster also gets the remaining documents.
+void seedBlocks(ClusterData *data);
+
+
+// Assigns each document to a uniformly random cluster.
+void seedRandom(ClusterData *data, unsigned int seed);
+
+
+/* Spherical k-means++: chooses k documents as initial concepts, one at a
+ * time, each with probability proportional to its distance (1 - cosine
+ * similarity) to the closest concept chosen so far, and assigns every
+ * document to its most similar concept. The concept matrix must already be
+ * allocated; the chosen (normalized) documents are stored in it.
+ * PARAMETERS:
+ *  data        - ClusterData with the documents and allocated concepts.
+ *  doc_norms   - Norms of the document vectors.
+ *  seed        - Seed for the random choices.
+ *  num_threads - Number of threads used for the similarity passes.
+ */
+void seedKMeansPP(ClusterData *data, float *doc_norms, unsigned int seed,
+                  int num_threads = 1);
+
+
+/* k-means|| (scalable k-means++): instead of k sequential passes, samples
+ * about SEED_OVERSAMPLING * k candidate documents in each of SEED_ROUNDS
+ * passes, weighs each candidate by the number of documents closest to it,
+ * and then chooses the k concepts among the candidates with a weighted
+ * k-means++. Every document is then assigned to its most similar concept.
+ * The parameters are the same as those of seedKMeansPP.
+ */
+void seedKMeansParallel(ClusterData *data, float *doc_norms,
+                        unsigned int seed, int num_threads = 1);
+
+
+/* Warm start: seeds from a saved model of an earlier run. Documents that the
+ * model already knows (the first model->dc documents, so new documents must
+ * be appended) keep their saved clusters, and every other document is
+ * assigned to its most similar saved concept. Words beyond the model's
+ * vocabulary are ignored, as are clusters beyond k.
+ * PARAMETERS:
+ *  data        - ClusterData with the documents.
+ *  doc_norms   - Norms of the document vectors.
+ *  model       - The saved model.
+ *  reassign    - If true, every document is assigned to its most similar
+ *                saved concept (none of the saved assignments are kept).
+ *  num_threads - Number of threads used for the similarity pass.
+ * RETURNS:
+ *  The number of documents that kept their saved clusters.
+ */
+int seedFromModel(ClusterData *data, float *doc_norms,
+                  const ClusterModel *model, bool reassign,
+                  int num_threads = 1);
+
+
+#endif
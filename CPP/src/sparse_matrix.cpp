@@ -0,0 +1,171 @@
+/* File: sparse_matrix.cpp
+ *
+ * Defines the SparseMatrix functions for allocating and manipulating the
+ * compressed sparse row document matrix.
+ */
+
+#include "sparse_matrix.h"
+
+#include "vectors.h"
+
+#include <math.h>
+#include <sys/mman.h>
+
+
+
+// Constructor: allocate the row offsets and the non-zero arrays. The offset
+// of the first row is set to 0; everything else must be filled in by the
+// caller (e.g. the document file reader).
+SparseMatrix::SparseMatrix(int rows_, int cols_, int nnz_)
+    : rows(rows_), cols(cols_), nnz(nnz_), qvalues(0), qscales(0),
+      normalized(false), mapping(0), mapping_size(0)
+{
+    offsets = new int[rows + 1];
+    offsets[0] = 0;
+    indices = new int[nnz];
+    values = new float[nnz];
+}
+
+
+
+// Constructor: use the given CSR arrays, which point into the given mapped
+// memory region (e.g. a binary document file). Nothing is copied; the matrix
+// takes ownership of the mapping. If the mapping is private, the arrays can
+// still be modified in place (e.g. by normalizeRows) without changing the
+// file.
+SparseMatrix::SparseMatrix(int rows_, int cols_, int nnz_,
+                           int *offsets_, int *indices_, float *values_,
+                           void *mapping_, size_t mapping_size_)
+    : rows(rows_), cols(cols_), nnz(nnz_),
+      offsets(offsets_), indices(indices_), values(values_),
+      qvalues(0), qscales(0), normalized(false),
+      mapping(mapping_), mapping_size(mapping_size_)
+{
+}
+
+
+
+// Destructor: clean up the CSR arrays (or the mapped region holding them).
+SparseMatrix::~SparseMatrix()
+{
+    delete[] qvalues;
+    delete[] qscales;
+    if(mapping != 0) {
+        munmap(mapping, mapping_size);
+        return;
+    }
+    delete[] offsets;
+    delete[] indices;
+    delete[] values;
+}
+
+
+
+// Returns the number of non-zero entries (words) in the given row.
+int SparseMatrix::rowSize(int row)
+{
+    return offsets[row+1] - offsets[row];
+}
+
+
+
+// Returns the norm of the given row. Only the non-zero entries contribute.
+float SparseMatrix::rowNorm(int row)
+{
+    if(qvalues == 0)
+        return vec_norm(values + offsets[row], rowSize(row));
+    float norm = 0;
+    for(int a=offsets[row]; a<offsets[row+1]; a++)
+        norm += (float)qvalues[a] * qvalues[a];
+    return sqrt(norm) * qscales[row];
+}
+
+
+
+// Returns the dot product of the given row and the dense vector, whose
+// element w is at dense[w * stride].
+float SparseMatrix::rowDot(int row, float *dense, long stride)
+{
+    int start = offsets[row];
+    if(qvalues == 0)
+        return vec_sparse_dot_strided(dense, stride, indices + start,
+                                      values + start, offsets[row+1] - start);
+    float dotp = 0;
+    for(int a=start; a<offsets[row+1]; a++)
+        dotp += dense[indices[a] * stride] * qvalues[a];
+    return dotp * qscales[row];
+}
+
+
+
+// Adds the given row vector to the dense vector (element w is at
+// dense[w * stride]).
+void SparseMatrix::rowScatterAdd(int row, float *dense, long stride)
+{
+    int start = offsets[row];
+    if(qvalues == 0) {
+        vec_scatter_add_strided(dense, stride, indices + start,
+                                values + start, offsets[row+1] - start);
+        return;
+    }
+    float scale = qscales[row];
+    for(int a=start; a<offsets[row+1]; a++)
+        dense[indices[a] * stride] += qvalues[a] * scale;
+}
+
+
+
+// Normalizes every row vector. Rows that are entirely zero are unchanged.
+void SparseMatrix::normalizeRows()
+{
+    for(int i=0; i<rows; i++)
+        vec_normalize(values + offsets[i], rowSize(i));
+    normalized = true;
+}
+
+
+
+// Quantizes every value to a signed 8-bit number: each value is rounded to
+// the nearest multiple of its row's largest absolute value / 127. The scale
+// of each row is then chosen so that the row keeps its norm (so normalized
+// rows stay unit vectors). The fp32 values are freed afterwards (unless they
+// live in a mapped file, which is left unchanged). Does nothing if the
+// values are already quantized.
+void SparseMatrix::quantizeValues()
+{
+    if(qvalues != 0)
+        return;
+
+    qvalues = new int8_t[nnz];
+    qscales = new float[rows];
+    for(int i=0; i<rows; i++) {
+        float max = 0;
+        for(int a=offsets[i]; a<offsets[i+1]; a++) {
+            if(fabsf(values[a]) > max)
+                max = fabsf(values[a]);
+        }
+        float norm = 0;
+        for(int a=offsets[i]; a<offsets[i+1]; a++) {
+            qvalues[a] = (max > 0) ? lrintf(values[a] * 127 / max) : 0;
+            norm += (float)qvalues[a] * qvalues[a];
+        }
+        qscales[i] = (norm > 0)
+            ? vec_norm(values + offsets[i], rowSize(i)) / sqrt(norm) : 0;
+    }
+
+    if(mapping == 0) {
+        delete[] values;
+        values = 0;
+    }
+}
+
+
+
+// Returns the number of bytes used by the values: 4 per value, or 1 per
+// value plus 4 per row if they are quantized.
+long SparseMatrix::valueBytes()
+{
+    if(qvalues != 0)
+        return (long)nnz + (long)rows * sizeof(float);
+    return (long)nnz * sizeof(float);
+}
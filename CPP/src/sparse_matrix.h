@@ -0,0 +1,91 @@
+/* File: sparse_matrix.h
+ *
+ * Contains the SparseMatrix class, which stores the document-word matrix in
+ * compressed sparse row (CSR) format. Each row is a document vector, and only
+ * the non-zero word weights are kept, so memory is proportional to the number
+ * of non-zero entries rather than the full document-word matrix size.
+ */
+
+#ifndef SPARSE_MATRIX_H
+#define SPARSE_MATRIX_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+
+// SparseMatrix class stores each document (row) as a list of word indices
+// (columns) and their values. The non-zero entries of row i are stored at
+// positions offsets[i] through offsets[i+1]-1 of the indices and values
+// arrays, sorted by word index.
+class SparseMatrix {
+
+  public:
+
+    // matrix dimensions (rows are documents, columns are words)
+    int rows;
+    int cols;
+    int nnz;
+
+    // CSR arrays: row offsets (rows+1), column indices and values (nnz each)
+    int *offsets;
+    int *indices;
+    float *values;
+
+    // 8-bit quantized values (null unless quantizeValues was called): value
+    // a of row i is qvalues[a] * qscales[i], and the fp32 values are freed,
+    // so the values must be read with value(), rowDot or rowScatterAdd
+    int8_t *qvalues;
+    float *qscales;
+
+    // true if every row has been normalized (i.e. the TXN scheme is applied)
+    bool normalized;
+
+    // memory-mapped file region holding the CSR arrays (null if allocated)
+    void *mapping;
+    size_t mapping_size;
+
+
+    // Constructor: allocates (but does not fill) the CSR arrays.
+    SparseMatrix(int rows_, int cols_, int nnz_);
+
+    // Constructor: wraps CSR arrays that live inside a memory-mapped file
+    // region, without copying them. The region is unmapped on destruction.
+    SparseMatrix(int rows_, int cols_, int nnz_,
+                 int *offsets_, int *indices_, float *values_,
+                 void *mapping_, size_t mapping_size_);
+
+    // Destructor: frees (or unmaps) the CSR arrays.
+    ~SparseMatrix();
+
+    // Returns the number of non-zero entries in the given row.
+    int rowSize(int row);
+
+    // Returns the norm of the given row vector.
+    float rowNorm(int row);
+
+    // Returns value a (an index into indices) of the given row, whether the
+    // values are quantized or not.
+    float value(int row, int a)
+    {
+        return (qvalues != 0) ? qvalues[a] * qscales[row] : values[a];
+    }
+
+    // Returns the dot product of the given row and a dense, strided vector.
+    float rowDot(int row, float *dense, long stride);
+
+    // Adds the given row vector to a dense, strided vector.
+    void rowScatterAdd(int row, float *dense, long stride);
+
+    // [in-place] Normalizes each row vector into a unit vector.
+    void normalizeRows();
+
+    // [in-place] Quantizes the values to 8 bits, with one scale per row.
+    void quantizeValues();
+
+    // Returns the number of bytes used by the stored values.
+    long valueBytes();
+
+};
+
+
+#endif
@@ -7,10 +7,12 @@
 
 #include "spkmeans.h"
 
-#include "timer.h"
+#include "seeding.h"
+#include "spmm_partitioner.h"
 #include "vectors.h"
 
 #include <iostream>
+#include <math.h>
 #include <vector>
 
 using namespace std;
@@ -18,19 +20,67 @@ using namespace std;
 
 
 // Constructor: initialize variables and document norms.
-SPKMeans::SPKMeans(float **doc_matrix_, int k_, int dc_, int wc_)
-    : doc_matrix(doc_matrix_), k(k_), dc(dc_), wc(wc_)
+SPKMeans::SPKMeans(SparseMatrix *doc_matrix_, int k_)
+    : doc_matrix(doc_matrix_), k(k_),
+      dc(doc_matrix_->rows), wc(doc_matrix_->cols)
 {
-    // init the doc vector norms
+    // init the doc vector norms (a streamed matrix only has its row offsets
+    // in memory, so its norms are found while it is streamed)
     doc_norms = new float[dc];
+    bool loaded = (doc_matrix->values != 0 || doc_matrix->qvalues != 0);
     for(int i=0; i<dc; i++)
-        doc_norms[i] = vec_norm(doc_matrix[i], wc);
+        doc_norms[i] = loaded ? doc_matrix->rowNorm(i) : 0;
 
-    // default scheme to TXN
+    // default scheme to TXN, and the per-document partitioning engine
     prep_scheme = TXN_SCHEME;
+    engine = DOCUMENT_ENGINE;
+
+    // seed with contiguous blocks (the seed only affects the random
+    // seedings)
+    seeding = BLOCK_SEEDING;
+    seed = 1;
+    seed_time = 0;
+    warm_model = 0;
+    warm_reassign = false;
+    num_iterations = 0;
+    profile = &run_profile;
+
+    // print the progress to stdout, with nobody listening
+    out = &cout;
+    listener = 0;
+
+    // priority scheduling is disabled by default (every document, every time)
+    use_priorities = false;
+    skip_bucket = 0;
+    num_skipped = 0;
+    total_skipped = 0;
+
+    // delta mode is disabled by default (concepts are summed from scratch)
+    use_deltas = false;
+
+    // everything is stored in fp32 by default
+    precision = FP32_PRECISION;
+    quantize = false;
+
+    // online mode is disabled by default (concepts update after each pass)
+    online = false;
+
+    // mini-batch mode is disabled by default (full passes)
+    batch_size = 0;
+    max_epochs = MINIBATCH_EPOCHS;
+
+    // store concepts cluster-major, in regular (aligned) memory by default
+    concept_layout = ClusterData::CLUSTER_MAJOR;
+    huge_pages = false;
 
     // initialize optimization to true (optimization will happen)
     optimize = true;
+
+    // bounds are disabled by default (all changed clusters are recomputed)
+    use_bounds = false;
+
+    // the full cosine similarity cache (k per document) is used by default
+    top_m = 0;
 }
 
 
@@ -51,6 +101,209 @@ void SPKMeans::setScheme(SPKMeans::Scheme type)
 
 
 
+// Set the partitioning engine to the given type. The SpMM engine computes
+// exact similarities for all changed clusters, so it does not use bounds.
+void SPKMeans::setEngine(SPKMeans::Engine type)
+{
+    engine = type;
+}
+
+
+
+// Set the seeding of the initial partitioning to the given type.
+void SPKMeans::setSeeding(SPKMeans::Seeding type)
+{
+    seeding = type;
+}
+
+
+
+// Set the random seed used by the random seedings. The same seed always
+// gives the same initial partitioning.
+void SPKMeans::setSeed(unsigned int seed_)
+{
+    seed = seed_;
+}
+
+
+
+// Start the runs from the given saved model (the model must stay alive until
+// the runs are done).
+void SPKMeans::setWarmStart(const ClusterModel *model, bool reassign)
+{
+    warm_model = model;
+    warm_reassign = reassign;
+}
+
+
+
+// Returns the time (in ms) taken by the seeding of the last run.
+float SPKMeans::getSeedingTime()
+{
+    return seed_time;
+}
+
+
+
+// Returns the number of iterations of the last run.
+int SPKMeans::getIterations()
+{
+    return num_iterations;
+}
+
+
+
+// Sets the profiler that times the following runs (it is not owned).
+void SPKMeans::setProfiler(Profiler *profile_)
+{
+    profile = profile_;
+}
+
+
+
+// Returns the profiler that times the runs.
+Profiler* SPKMeans::getProfiler()
+{
+    return profile;
+}
+
+
+
+// Sets the stream that the progress messages are printed to.
+void SPKMeans::setOutput(ostream *out_)
+{
+    out = out_;
+}
+
+
+
+// Sets the listener of the runs (0 for none).
+void SPKMeans::setListener(SPKMeansListener *listener_)
+{
+    listener = listener_;
+}
+
+
+
+// Disables priority scheduling.
+void SPKMeans::disablePriorities()
+{
+    use_priorities = false;
+}
+
+
+
+// Enables priority scheduling: documents whose priority (1 - cosine
+// similarity to their own concept) is low are skipped in the partitioning
+// step for a few iterations, since they are unlikely to move.
+void SPKMeans::enablePriorities()
+{
+    use_priorities = true;
+}
+
+
+
+// Disables delta updates of the concept vectors.
+void SPKMeans::disableDeltas()
+{
+    use_deltas = false;
+}
+
+
+
+// Enables delta updates of the concept vectors: the unnormalized cluster
+// sums are kept between iterations, and each iteration only adds or
+// subtracts the documents that moved, with a full recompute every
+// DELTA_FULL_PERIOD iterations to measure and reset the rounding drift.
+void SPKMeans::enableDeltas()
+{
+    use_deltas = true;
+}
+
+
+
+// Sets the storage precision of the concept matrix and of the cosine
+// similarity cache. Reduced (16-bit) precisions halve their memory; all
+// arithmetic is still done in fp32.
+void SPKMeans::setPrecision(Precision precision_)
+{
+    precision = precision_;
+}
+
+
+
+// Disables quantization of the document values.
+void SPKMeans::disableQuantization()
+{
+    quantize = false;
+}
+
+
+
+// Enables quantization of the document values to 8 bits (with one scale per
+// document), which shrinks the values to about a quarter of their memory.
+// The document matrix is changed in place (and stays quantized).
+void SPKMeans::enableQuantization()
+{
+    quantize = true;
+}
+
+
+
+// Disables online concept updates.
+void SPKMeans::disableOnline()
+{
+    online = false;
+}
+
+
+
+// Enables online concept updates: each document that moves is immediately
+// removed from its old concept and added to its new one, so there is no
+// global concept update step between the passes over the documents.
+void SPKMeans::enableOnline()
+{
+    online = true;
+}
+
+
+
+// Enables mini-batch mode: each step only assigns a random batch of
+// batch_size_ documents and moves their concepts towards them, for at most
+// the given number of epochs. A batch size of 0 disables mini-batch mode.
+void SPKMeans::setMiniBatch(int batch_size_, int epochs)
+{
+    batch_size = (batch_size_ > 0) ? batch_size_ : 0;
+    max_epochs = (epochs > 0) ? epochs : 1;
+}
+
+
+
+// Set the memory layout of the concept matrix to the given type.
+void SPKMeans::setConceptLayout(ClusterData::ConceptLayout layout)
+{
+    concept_layout = layout;
+}
+
+
+
+// Disables huge page backing of the concept matrix.
+void SPKMeans::disableHugePages()
+{
+    huge_pages = false;
+}
+
+
+
+// Requests huge page backing for the concept matrix, which reduces TLB
+// misses when k * wc is large. Falls back to regular memory if unavailable.
+void SPKMeans::enableHugePages()
+{
+    huge_pages = true;
+}
+
+
+
 // Disables optimization for testing purposes.
 void SPKMeans::disableOptimization()
 {
@@ -67,79 +320,265 @@ void SPKMeans::enableOptimization()
 
 
 
+// Disables bound-based pruning of the cosine similarity computations.
+void SPKMeans::disableBounds()
+{
+    use_bounds = false;
+}
+
+
+
+// Enables bound-based pruning: a cosine similarity is only computed if its
+// upper bound shows that the cluster could beat the best one so far.
+void SPKMeans::enableBounds()
+{
+    use_bounds = true;
+}
+
+
+
+// Replaces the full cosine similarity cache (k values per document) with a
+// top-m candidate cache: only the m best clusters of each document and one
+// bound for all others are kept, which bounds the cache memory when k is
+// large. The candidates hold upper bounds, so this also prunes like bounds
+// mode. An m of 0 (or less) selects the full cache again. The SpMM engine
+// always uses the full cache.
+void SPKMeans::setTopCache(int m)
+{
+    top_m = (m > 0) ? m : 0;
+}
+
+
+
+// Returns true if the concept drifts are tracked to keep similarity upper
+// bounds (in bounds mode, or with the top-m candidate cache).
+bool SPKMeans::usesBounds()
+{
+    return use_bounds || top_m > 0;
+}
+
+
+
+// Records an iteration in the profile, and tells the listener (if there is
+// one) about it; the iteration number is the number of records.
+void SPKMeans::endIteration(float quality, float dQ, long moved,
+                            long num_cosines, long skipped)
+{
+    profile->endIteration(quality, dQ, moved, num_cosines, skipped);
+    if(listener != 0)
+        listener->iterationDone(profile->numIterations(), quality, dQ, moved);
+}
+
+
+
 // Reports the overall quality and, if optimizing, also displays how many
-// clusters have changed.
-void SPKMeans::reportQuality(ClusterData *data, float quality, float dQ)
+// clusters have changed. In bounds mode, if the number of cosine
+// similarities computed in this iteration is given, also displays the
+// fraction of cosine similarities that were skipped. The number of documents
+// that moved (see ClusterData::mergeMoves) is always displayed. The
+// iteration is recorded in the profile.
+void SPKMeans::reportQuality(ClusterData *data, float quality, float dQ,
+                             long num_cosines)
 {
-    cout << "Quality: " << quality << " (+" << dQ << ")";
+    endIteration(quality, dQ, data->num_moved, num_cosines,
+                 use_priorities ? num_skipped : -1);
+
+    *out << "Quality: " << quality << " (+" << dQ << ")";
     if(optimize) {
         int num_same = 0;
         for (int i=0; i<k; i++)
             if(!(data->changed[i]))
                 num_same++;
-        cout << " --- " << num_same << " clusters are the same." << endl;
+        *out << " --- " << num_same << " clusters are the same.";
     }
     else
-        cout << " --- optimization disabled." << endl;
+        *out << " --- optimization disabled.";
+    if(usesBounds() && num_cosines >= 0) {
+        float skipped = 1 - (float)num_cosines / ((float)dc * k);
+        *out << " (" << skipped*100 << "% cosines skipped)";
+    }
+    if(data->top_m > 0)
+        *out << " (top-" << data->top_m << " cache: "
+             << data->cacheBytes() / (1024.0 * 1024) << " MB, "
+             << data->num_rescans << " documents rescanned)";
+    if(use_priorities)
+        *out << " (" << num_skipped << " documents skipped)";
+    if(data->sums_valid && !data->apply_deltas) {
+        float error = 0;
+        for(int i=0; i<k; i++) {
+            if(data->sum_errors[i] > error)
+                error = data->sum_errors[i];
+        }
+        *out << " (max. sum drift " << error << ")";
+    }
+    *out << " " << data->num_moved << " documents moved." << endl;
 }
 
 
 
-// Reports time data after running the algorithm.
-void SPKMeans::reportTime(int iterations, float total_time,
-                          float p_time, float c_time)
+// Reports time data after running the algorithm, from the phases of the
+// profile (the run phase must be stopped first).
+void SPKMeans::reportTime(int iterations, long num_cosines)
 {
-    cout << "Done in " << total_time / 1000
+    float p_time = profile->millis(Profiler::PARTITION_PHASE);
+    float c_time = profile->millis(Profiler::CONCEPTS_PHASE);
+    float r_time = profile->millis(Profiler::CHANGES_PHASE);
+    *out << "Done in " << profile->millis(Profiler::RUN_PHASE) / 1000
          << " seconds after " << iterations << " iterations." << endl;
-    float total = p_time + c_time;
+    *out << "Seeding time: " << seed_time << " ms." << endl;
+    float total = p_time + c_time + r_time;
     if(total == 0)
-        cout << "No individual time stats available." << endl;
+        *out << "No individual time stats available." << endl;
     else {
-        cout << "Timers (ms): " << endl
+        *out << "Timers (ms): " << endl
              << "   partitioning [" << p_time << "] ("
                 << (p_time/total)*100 << "%)" << endl
              << "   concepts     [" << c_time << "] ("
-                << (c_time/total)*100 << "%)" << endl;
+                << (c_time/total)*100 << "%)" << endl
+             << "   changes      [" << r_time << "] ("
+                << (r_time/total)*100 << "%)" << endl;
+    }
+    if(usesBounds() && num_cosines >= 0 && iterations > 0) {
+        long all = (long)dc * k * iterations;
+        *out << "Cosine similarities computed: " << num_cosines << " of "
+             << all << " (" << (1 - (float)num_cosines / all)*100
+             << "% skipped)." << endl;
+    }
+    if(use_priorities && iterations > 0) {
+        long all = (long)dc * iterations;
+        *out << "Documents partitioned: " << (all - total_skipped) << " of "
+             << all << " (" << ((float)total_skipped / all)*100
+             << "% skipped)." << endl;
     }
 }
 
 
 
+// Returns true if the reduced precision storage (and quantization) can be
+// used by this run. The SpMM engine, online, mini-batch and delta modes
+// access the fp32 concepts and cache directly, so they always run in fp32
+// (they read the document values through SparseMatrix::value, so they also
+// work on a matrix that an earlier run has quantized).
+bool SPKMeans::reducedStorage()
+{
+    return engine == DOCUMENT_ENGINE && !online && batch_size == 0 &&
+           !use_deltas;
+}
+
+
+
+// Reports the storage precision and memory (in MB) of the concept matrix,
+// the cosine similarity cache and the document values, if any of them are
+// reduced.
+void SPKMeans::reportStorage(ClusterData *data)
+{
+    if(data->concept_precision == FP32_PRECISION &&
+       data->cache_precision == FP32_PRECISION && doc_matrix->qvalues == 0)
+        return;
+    float mb = 1024 * 1024;
+    *out << "Storage: " << precisionName(data->concept_precision)
+         << " concepts (" << data->conceptBytes() / mb << " MB), "
+         << precisionName(data->cache_precision) << " cosine cache ("
+         << data->cacheBytes() / mb << " MB), "
+         << (doc_matrix->qvalues != 0 ? "8-bit" : "fp32")
+         << " document values (" << doc_matrix->valueBytes() / mb
+         << " MB)." << endl;
+}
+
+
+
 // Applies the TXN scheme to each document vector of the given matrix.
-// TXN effectively just normalizes each of the document vectors.
-// TXN scheme must be set, otherwise this function will do nothing.
+// TXN effectively just normalizes each of the document vectors, so the
+// cached document norms are refreshed as well.
+// TXN scheme must be set, otherwise this function will do nothing. Matrices
+// that are already normalized (e.g. binary files converted with the scheme
+// applied) are left untouched, so mapped files are not copied.
 void SPKMeans::txnScheme()
 {
-    if(prep_scheme != SPKMeans::TXN_SCHEME)
+    if(prep_scheme != SPKMeans::TXN_SCHEME || doc_matrix->normalized)
         return;
 
+    profile->start(Profiler::TXN_PHASE);
+    doc_matrix->normalizeRows();
     for(int i=0; i<dc; i++)
-        vec_normalize(doc_matrix[i], wc);
+        doc_norms[i] = doc_matrix->rowNorm(i);
+    profile->stop(Profiler::TXN_PHASE);
 }
 
 
 
 // Initializes the first partitioning (randomly or otherwise assigned) to
-// provide a starting point for the clustering algorithm.
-void SPKMeans::initClusters(ClusterData *data)
+// provide a starting point for the clustering algorithm. The seeding is
+// timed separately; the k-means++ seedings use the given number of threads.
+void SPKMeans::initClusters(ClusterData *data, int num_threads)
 {
+    profile->start(Profiler::INIT_PHASE);
+
+    // the document values are quantized before anything is computed from
+    // them, so the document norms are refreshed
+    bool reduced = reducedStorage();
+    if(quantize && reduced && doc_matrix->qvalues == 0) {
+        doc_matrix->quantizeValues();
+        for(int i=0; i<dc; i++)
+            doc_norms[i] = doc_matrix->rowNorm(i);
+    }
+
+    // the k-means++ seedings store their chosen documents as the concepts,
+    // so the concept matrix is allocated first
+    data->allocateConcepts(concept_layout, huge_pages);
+    if(use_deltas)
+        data->allocateSums();
+
     // choose an initial partitioning
-    int split = dc / k;
-    cout << "Split = " << split << endl;
-    int base = 1;
-    for(int i=0; i<k; i++) {
-        int top = base + split - 1;
-        if(i == k-1)
-            top = dc;
-        int p_size = top - base + 1;
-        for(int j=0; j<p_size; j++)
-            data->p_asgns[base-1 + j] = i;
-        base = base + split;
+    profile->start(Profiler::SEEDING_PHASE);
+    if(warm_model != 0) {
+        int num_kept = seedFromModel(data, doc_norms, warm_model,
+                                     warm_reassign, num_threads);
+        *out << "Seeding: warm start (" << num_kept << " documents kept, "
+             << (dc - num_kept) << " assigned)" << endl;
     }
+    else switch(seeding) {
+        case RANDOM_SEEDING:
+            *out << "Seeding: random partition (seed " << seed << ")" << endl;
+            seedRandom(data, seed);
+            break;
+        case KMEANSPP_SEEDING:
+            *out << "Seeding: k-means++ (seed " << seed << ")" << endl;
+            seedKMeansPP(data, doc_norms, seed, num_threads);
+            break;
+        case KMEANSPAR_SEEDING:
+            *out << "Seeding: k-means|| (seed " << seed << ")" << endl;
+            seedKMeansParallel(data, doc_norms, seed, num_threads);
+            break;
+        default:
+            *out << "Split = " << dc / k << endl;
+            seedBlocks(data);
+    }
+    profile->stop(Profiler::SEEDING_PHASE);
+    seed_time = profile->millis(Profiler::SEEDING_PHASE);
+
+    // the seeding works in fp32; from here on, the concepts and the cache
+    // are stored in the selected precision
+    if(reduced)
+        data->reduceConcepts(precision);
+    if(top_m > 0 && engine == DOCUMENT_ENGINE)
+        data->allocateTopCache(top_m);
+    else
+        data->allocateCache(reduced ? precision : FP32_PRECISION);
+    reportStorage(data);
+
+    // compute the initial concept vectors (all clusters are marked as
+    // changed at this point, so every concept is computed)
+    computeConcepts(data);
+    data->sums_valid = (data->sums != 0);
 
-    // compute the initial concept vectors
-    for(int i=0; i<k; i++)
-        data->concepts[i] = computeConcept(data, i);
+    // in bounds mode, the cosine similarity cache holds upper bounds, which
+    // start out above any possible similarity (forcing the first pass to
+    // compute everything); the top-m cache starts out empty instead
+    if(use_bounds && data->top_m == 0)
+        data->fillCosines(BOUND_MAX);
+
+    profile->stop(Profiler::INIT_PHASE);
 }
 
 
@@ -149,22 +588,12 @@ void SPKMeans::initClusters(ClusterData *data)
 // whenever possible.
 float SPKMeans::computeQ(ClusterData *data)
 {
-    float quality = 0;
+    data->groupByCluster();
 
-    // NOTE - there was a single-cluster computeQ function, re-implement?
+    float quality = 0;
     for(int i=0; i<k; i++) {
-        if(data->changed[i]) {
-            float *sum_p = vec_zeros(wc);
-            // add all documents associated with this cluster
-            for(int j=0; j<dc; j++) {
-                if(data->p_asgns[j] == i) {
-                    for(int a=0; a<wc; a++)
-                        sum_p[a] += doc_matrix[j][a];
-                }
-            }
-            data->qualities[i] = vec_dot(sum_p, data->concepts[i], wc);
-            delete[] sum_p;
-        }
+        if(data->changed[i])
+            clusterQuality(data, i);
         quality += data->qualities[i];
     }
 
@@ -173,92 +602,234 @@ float SPKMeans::computeQ(ClusterData *data)
 
 
 
+// Computes the quality of the given cluster (by index) against its current
+// concept vector, and stores it in the ClusterData qualities cache. The
+// quality is the sum of the dot products of each document in the cluster
+// with the concept vector, so only the non-zero entries of the cluster's
+// documents (as grouped by ClusterData::groupByCluster) are visited, with the
+// concept in any precision (see ClusterData::conceptDot).
+float SPKMeans::clusterQuality(ClusterData *data, int cIndx)
+{
+    float quality = 0;
+    for(int a=data->cluster_offsets[cIndx];
+        a<data->cluster_offsets[cIndx+1]; a++)
+        quality += data->conceptDot(cIndx, data->cluster_docs[a]);
+
+    data->qualities[cIndx] = quality;
+    return quality;
+}
+
+
+
 // Computes the cosine similarity value of the two given vectors (dv and cv).
+// Both norms are cached, so this only takes O(nz(doc)) time. If either vector
+// is a zero vector (e.g. the concept of an empty cluster), returns 0.
 float SPKMeans::cosineSimilarity(ClusterData *data, int doc_index, int cIndx)
 {
-    // TODO - same optimization for concepts? can we cache doc norms better?
-    float cnorm = vec_norm(data->concepts[cIndx], wc);
+    float cnorm = data->concept_norms[cIndx];
     float dnorm = doc_norms[doc_index];
+    if(cnorm == 0 || dnorm == 0)
+        return 0;
 
-    // here is where we save time: compute the dot product!
-    float dotp = 0;
-    for(int i=0; i<(data->docs[doc_index].count); i++) {
-        int word = data->docs[doc_index].words[i].index;
-        float value = data->docs[doc_index].words[i].value;
-        dotp += data->concepts[cIndx][word] * value;
-    }
-    
+    // here is where we save time: compute the (sparse) dot product!
+    float dotp = data->conceptDot(cIndx, doc_index);
     return dotp / (dnorm * cnorm);
 }
 
 
 
-// Computes the concept vector of the given cluster (by index). The
-// cluster documents are accessed using the ClusterData struct, and the
-// associated concept vector will be allocated and populated.
-float SPKMeans::computeConcepts(ClusterData *data)
+// Finds the cluster with the highest cosine similarity to the given document
+// and assigns the document to it (see ClusterData::assignCluster). Only the
+// similarities of clusters that changed are recomputed; the others are read
+// from the cosine similarity cache.
+// In bounds mode, the cache holds an upper bound of each similarity instead.
+// The bound of a changed cluster grows by how far its concept vector moved,
+// and the exact similarity is only computed if the bound is higher than the
+// best similarity found so far (starting with the document's own cluster).
+// If the document was skipped by the priority scheduler, the similarities
+// of all clusters that changed since it was last partitioned are computed.
+// The document's priority is set to 1 - the similarity to its (old) own
+// concept. If the cache is stored in reduced precision, the document's row
+// is worked on in fp32 and stored back (bounds rounded up) at the end.
+// Returns the number of cosine similarities that were actually computed.
+int SPKMeans::partitionDocument(ClusterData *data, int doc_index)
 {
-    // init sum vectors and cluster sizes to 0
-    //float sums[k][wc];
-    float **sums = new float*[k];
-    int sizes[k];
-    for(int i=0; i<k; i++) {
-        sizes[i] = 0;
-        sums[i] = new float[wc];
-        for(int j=0; j<wc; j++)
-            sums[i][j] = 0;
+    if(data->top_m > 0)
+        return partitionDocumentTop(data, doc_index);
+
+    bool *changed = data->changed;
+    bool reduced = (data->cache_precision != FP32_PRECISION);
+    float row[reduced ? k : 1];
+    float *cosines = row;
+    if(reduced)
+        data->loadCosines(doc_index, row);
+    else
+        cosines = data->cosine_similarities + (long)doc_index * k;
+    int computed = 0;
+
+    int cIndx = 0;
+    int skipped = data->skip_counts[doc_index];
+    if(skipped > 0) {
+        // recompute the clusters that changed since the document was last
+        // partitioned (in bounds mode, its bounds missed those drifts: all)
+        int since = data->iteration - skipped;
+        for(int j=0; j<k; j++) {
+            if(use_bounds || data->change_stamps[j] >= since) {
+                cosines[j] = cosineSimilarity(data, doc_index, j);
+                computed++;
+            }
+            if(cosines[j] > cosines[cIndx])
+                cIndx = j;
+        }
+        data->skip_counts[doc_index] = 0;
     }
+    else if(!use_bounds) {
+        for(int j=0; j<k; j++) {
+            if(changed[j]) {
+                cosines[j] = cosineSimilarity(data, doc_index, j);
+                computed++;
+            }
+            if(cosines[j] > cosines[cIndx])
+                cIndx = j;
+        }
+    }
+    else {
+        // the similarity to the document's own cluster is always exact
+        cIndx = data->p_asgns[doc_index];
+        if(changed[cIndx]) {
+            cosines[cIndx] = cosineSimilarity(data, doc_index, cIndx);
+            computed++;
+        }
+        int own = cIndx;
+        for(int j=0; j<k; j++) {
+            if(j == own)
+                continue;
+            if(changed[j])
+                cosines[j] += data->concept_drifts[j];
+            if(cosines[j] > cosines[cIndx]) {
+                cosines[j] = cosineSimilarity(data, doc_index, j);
+                computed++;
+                if(cosines[j] > cosines[cIndx])
+                    cIndx = j;
+            }
+        }
+    }
+
+    data->doc_priorities[doc_index] = 1 - cosines[data->p_asgns[doc_index]];
+    data->assignCluster(doc_index, cIndx);
+    if(reduced)
+        data->storeCosines(doc_index, row, use_bounds);
+    return computed;
+}
+
 
-    // increment values for each cluster
-    for(int i=0; i<dc; i++) {
-        int cluster = data->p_asgns[i];
-        sizes[cluster]++;
-        for(auto word : data->docs[i].words)
-            sums[cluster][word.index] += word.value;
+
+// Recomputes the concept vector of the given cluster (by index) in place,
+// from the documents grouped into it by ClusterData::groupByCluster. The
+// cluster's cached norm and quality are also updated. Only the documents of
+// this cluster are touched, so different clusters can be updated by
+// different threads at the same time. Returns the new cluster quality.
+float SPKMeans::updateConcept(ClusterData *data, int cIndx)
+{
+    SparseMatrix *docs = data->docs;
+
+    // with bounds (see usesBounds), find the dot product of the old concept
+    // vector and the new cluster sum before overwriting it, to measure the
+    // concept drift
+    float old_dot = 0;
+    if(usesBounds()) {
+        for(int a=data->cluster_offsets[cIndx];
+            a<data->cluster_offsets[cIndx+1]; a++)
+            old_dot += data->conceptDot(cIndx, data->cluster_docs[a]);
     }
 
-    float quality = 0;
-    for(int i=0; i<k; i++) {
-        if(data->changed[i]) {
-            // get new concept vector
-            //delete[] data->concepts[i];
-            memcpy(data->concepts[i], sums[i], wc*sizeof(float));
-            if(sizes[i] > 0)
-                vec_divide(data->concepts[i], sizes[i], wc);
-            vec_normalize(data->concepts[i], wc);
-
-            // update quality
-            data->qualities[i] = vec_dot(data->concepts[i], sums[i], wc);
+    // a reduced concept is summed up in an fp32 scratch vector instead, and
+    // stored (rounded) at the end
+    bool reduced = (data->concept_precision != FP32_PRECISION);
+    vector<float> scratch;
+    float *concept;
+    long stride;
+    if(reduced) {
+        scratch.resize(wc);
+        concept = &scratch[0];
+        stride = 1;
+    }
+    else {
+        concept = data->getConcept(cIndx);
+        stride = data->word_stride;
+    }
+
+    // sum up all of the documents in this cluster
+    vec_fill_strided(concept, wc, stride, 0);
+    for(int a=data->cluster_offsets[cIndx];
+        a<data->cluster_offsets[cIndx+1]; a++)
+        docs->rowScatterAdd(data->cluster_docs[a], concept, stride);
+
+    // in delta mode, keep the sum (and measure how far the delta-updated
+    // sum, with this step's moves applied, had drifted from it)
+    if(data->sums != 0) {
+        float *sum = data->getSum(cIndx);
+        long sum_stride = data->word_stride;
+        if(data->sums_valid)
+            applyMoves(data, cIndx);
+        double error = 0;
+        double total = 0;
+        for(int w=0; w<wc; w++) {
+            double diff = sum[w*sum_stride] - concept[w*stride];
+            error += diff * diff;
+            total += (double)concept[w*stride] * concept[w*stride];
+            sum[w*sum_stride] = concept[w*stride];
         }
-        quality += data->qualities[i];
+        data->sum_errors[cIndx] = (data->sums_valid && total > 0)
+                                ? sqrt(error / total) : 0;
+        data->cluster_sizes[cIndx] = data->clusterSize(cIndx);
+    }
+
+    // the concept is the normalized sum, so the quality (the dot product of
+    // the concept and the sum) is just the norm of the sum
+    float quality = vec_norm_strided(concept, wc, stride);
+    if(quality > 0)
+        vec_divide_strided(concept, wc, stride, quality);
+    if(reduced)
+        data->storeConcept(cIndx, concept);
+
+    // the drift is |new - old|, where |new - old|^2 = |new|^2 + |old|^2 -
+    // 2 (old . new), and old . new = (old . sum) / |sum|
+    if(usesBounds()) {
+        float old_norm = data->concept_norms[cIndx];
+        float new_norm = (quality > 0) ? 1 : 0;
+        float dotp = (quality > 0) ? old_dot / quality : 0;
+        float drift = old_norm*old_norm + new_norm*new_norm - 2*dotp;
+        if(drift < 0)
+            drift = 0;
+        // the rounding of a reduced concept moves it by up to its relative
+        // rounding error as well
+        data->concept_drifts[cIndx] = sqrt(drift + DRIFT_EPSILON)
+            + precisionError(data->concept_precision);
     }
 
-    delete[] sums;
+    data->concept_norms[cIndx] = (quality > 0) ? 1 : 0;
+    data->qualities[cIndx] = quality;
 
     return quality;
 }
-float* SPKMeans::computeConcept(ClusterData *data, int cIndx)
+
+
+
+// Computes the concept vectors of all clusters that changed since the last
+// iteration, and returns the total quality of the new partitioning.
+float SPKMeans::computeConcepts(ClusterData *data)
 {
-    // create the concept vector and initialize it to 0
-    float *concept = new float[wc];
-    for(int i=0; i<wc; i++)
-        concept[i] = 0;
+    if(!data->apply_deltas)
+        data->groupByCluster();
 
-    // find documents associated w/ this cluster, and sum them
-    int n_docs = 0;
-    for(int i=0; i<dc; i++) { // for each document
-        if(data->p_asgns[i] == cIndx) { // if doc in cluster
-            n_docs++;
-            for(int j=0; j<wc; j++) // add words to concept
-                concept[j] += doc_matrix[i][j];
-        }
+    float quality = 0;
+    for(int i=0; i<k; i++) {
+        refreshConcept(data, i);
+        quality += data->qualities[i];
     }
 
-    // compute the concept vector from the mean and return it
-    if(n_docs > 0)
-        vec_divide(concept, n_docs, wc);
-    vec_normalize(concept, wc);
-    return concept;
+    return quality;
 }
 
 
@@ -267,123 +838,100 @@ float* SPKMeans::computeConcept(ClusterData *data, int cIndx)
 // clusters the data into k clusters. Non-parallel (standard) version.
 ClusterData* SPKMeans::runSPKMeans()
 {
-    // keep track of the run time for this algorithm
-    Timer timer;
-    timer.start();
+    if(batch_size > 0)
+        return runMiniBatch();
+    if(online)
+        return runOnline();
 
-    // keep track of all individual component times for analysis
-    Timer ptimer;
-    Timer ctimer;
+    // keep track of the run time for this algorithm, and of its phases
+    profile->startRun(1);
 
     // apply the TXN scheme on the document vectors (normalize them)
     txnScheme();
 
-    // initialize the data arrays; keep track of the arrays locally
-    ClusterData *data = new ClusterData(k, dc, wc, doc_matrix);
-    float **concepts = data->concepts;
-    bool *changed = data->changed;
-    float *cosines = data->cosine_similarities;
+    // initialize the data arrays
+    ClusterData *data = new ClusterData(k, doc_matrix);
 
     // compute initial partitioning, concepts, and quality
     initClusters(data);
     float quality = computeQ(data);
-    cout << "Initial quality: " << quality << endl;
-    
+    *out << "Initial quality: " << quality << endl;
+
+    // set up the blocked partitioning engine, if selected
+    SpMMPartitioner *spmm = 0;
+    if(engine == SPMM_ENGINE)
+        spmm = new SpMMPartitioner(data, doc_norms);
 
-    // do spherical k-means loop
+
+    // the documents to partition in the iterations that skip some (see
+    // scheduleDocuments); only needed with priorities
+    int *active = use_priorities ? new int[dc] : 0;
+    total_skipped = 0;
+    skip_bucket = 0;
+
+    // do spherical k-means loop; when priorities are used, the run only
+    // stops after a full (unscheduled) iteration
     float dQ = Q_THRESHOLD * 10;
     int iterations = 0;
-    while(dQ > Q_THRESHOLD) {
+    long total_cosines = 0;
+    bool full = true;
+    while(dQ > Q_THRESHOLD || !full) {
+        full = !use_priorities || iterations == 0 || dQ <= Q_THRESHOLD;
         iterations++;
 
-        // TODO - temporary (testing) -----------------------------------------
-        /*if(iterations > 1) {
-            cout << "New version." << endl;
-            ptimer.start();
-            float averagePriority = data->getAverageMovedPriority();
-            for(int i=0; i<dc; i++) {
-                if(data->doc_priorities[i] > averagePriority) {
-                    int cIndx = 0;
-                    if(changed[0])
-                        cosines[i*k] = cosineSimilarity(data, i, 0);
-                    for(int j=1; j<k; j++) {
-                        if(changed[j])
-                            cosines[i*k + j] = cosineSimilarity(data, i, j);
-                        if(cosines[i*k + j] > cosines[i*k + cIndx])
-                            cIndx = j;
-                    }
-                    // compute the priority heuristic and assign the document
-                    float priority = 1 - cosines[i*k + data->p_asgns[i]];
-                    data->assignCluster(i, cIndx, priority);
-                }
-            }
-        } else {*/
-        // --------------------------------------------------------------------
-
         // compute new clusters based on old concept vectors
-        ptimer.start();
-
-        // TODO - temporary testing for empty clusters
-        bool has_docs[k];
-        for(int i=0; i<k; i++)
-            has_docs[i] = false;
-
-        for(int i=0; i<dc; i++) {
-            // only update cosine similarities if cluster has changed
-            int cIndx = 0;
-            if(changed[0])
-                cosines[i*k] = cosineSimilarity(data, i, 0);
-            for(int j=1; j<k; j++) {
-                if(changed[j])
-                    cosines[i*k + j] = cosineSimilarity(data, i, j);
-                if(cosines[i*k + j] > cosines[i*k + cIndx])
-                    cIndx = j;
+        profile->start(Profiler::PARTITION_PHASE);
+
+        long num_cosines = 0;
+        data->prepareMoves();
+        unsigned long long busy = Profiler::now();
+        if(spmm != 0)
+            num_cosines = spmm->partition(data);
+        else {
+            int count = scheduleDocuments(data, active, full);
+            for(int a=0; a<count; a++) {
+                int doc = (count == dc) ? a : active[a];
+                num_cosines += partitionDocument(data, doc);
+                data->checkMoved(0, doc);
             }
-            // compute the priority heuristic and assign the document
-            //float priority = 1 - cosines[i*k + data->p_asgns[i]];
-            data->assignCluster(i, cIndx);//, priority);
-            has_docs[cIndx] = true;
-        }//}
-
-        // TODO - temporary testing for empty clusters:
-        for(int i=0; i<k; i++) {
-            if(!has_docs[i])
-                cout << "Cluster " << i << " is empty!" << endl;
         }
-
-        ptimer.stop();
-
-        // TODO - temporary (testing) -----------------------------------------
-        // report priorities and number of documents that moved
-        /*cout << "Number of documents moved: " << data->num_moved << endl;
-        cout << "Average document priority: "
-             << data->getAveragePriority() << endl;
-        cout << "   Average moved priority: "
-             << data->getAverageMovedPriority() << endl;
-        cout << "  Average stayed priority: "
-             << data->getAverageStayPriority() << endl;*/
-        // --------------------------------------------------------------------
-
-        // update which clusters changed since last time, then swap pointers
-        if(optimize)
-            data->findChangedClusters();
+        profile->addBusy(0, busy, num_cosines);
+        profile->stop(Profiler::PARTITION_PHASE);
+
+        // collect the moves (and which clusters changed), then swap pointers
+        profile->start(Profiler::CHANGES_PHASE);
+        data->mergeMoves(optimize);
+        if(use_priorities)
+            updateSchedule(data);
         data->applyAssignments();
+        profile->stop(Profiler::CHANGES_PHASE);
 
-        // compute new concept vectors and quality
-        ctimer.start();
+        // compute new concept vectors and quality (in delta mode, from the
+        // moved documents only, except for the full recompute iterations)
+        profile->start(Profiler::CONCEPTS_PHASE);
+        startConceptStep(data, iterations);
         float n_quality = computeConcepts(data);
         dQ = n_quality - quality;
         quality = n_quality;
-        ctimer.stop();
+        profile->stop(Profiler::CONCEPTS_PHASE);
 
         // report the quality of the current partitioning
-        reportQuality(data, quality, dQ);
+        reportQuality(data, quality, dQ, num_cosines);
+        total_cosines += num_cosines;
     }
 
 
     // report runtime statistics
-    timer.stop();
-    reportTime(iterations, timer.get(), ptimer.get(), ctimer.get());
+    profile->stopRun();
+    num_iterations = iterations;
+    reportTime(iterations, total_cosines);
+
+    delete[] active;
+    if(spmm != 0)
+        delete spmm;
+
+    // the results are read from the fp32 concepts (see getConcept)
+    data->expandConcepts();
 
     // return the resulting clusters and concepts in the ClusterData struct
     return data;
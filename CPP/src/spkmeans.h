@@ -8,12 +8,70 @@
 #ifndef SPKMEANS_H
 #define SPKMEANS_H
 
+#include <ostream>
+#include <string>
 #include <vector>
 
 #include "cluster_data.h"
+#include "cluster_model.h"
+#include "document_stream.h"
+#include "profiler.h"
+#include "sparse_matrix.h"
 
 #define Q_THRESHOLD 0.001
 
+// initial value of the similarity upper bounds (above any cosine similarity)
+#define BOUND_MAX 2.0
+// added to squared concept drifts to absorb rounding error in the bounds
+#define DRIFT_EPSILON 1e-6
+
+// mini-batch mode: default number of epochs (passes over the documents), and
+// the number of batches in a row in which the smoothed batch quality (the
+// average similarity) does not improve before the run is converged
+#define MINIBATCH_EPOCHS 10
+#define MINIBATCH_PATIENCE 10
+// a concept's pending scale factor is folded into it below this value
+#define MINIBATCH_MIN_SCALE 0.001
+
+// priority scheduling: a document is evaluated again after being skipped in
+// this many iterations in a row, and documents are only skipped if their
+// priority is below the lowest priorities of (all but) this fraction of the
+// documents that moved in the last iteration
+#define PRIORITY_MAX_SKIP 2
+#define PRIORITY_MISS_FRACTION 0.01
+
+// streaming mode: bytes kept in memory per document besides the concepts
+// and the cluster sums (row offset, norm, and the ClusterData assignment,
+// priority, skip count, grouping and move arrays)
+#define STREAM_DOC_BYTES 36
+
+// delta mode: every this many iterations, the cluster sums are recomputed
+// from all documents instead of from the moved documents only
+#define DELTA_FULL_PERIOD 10
+
+
+
+// Receives the progress of a run (see SPKMeans::setListener). The default
+// callbacks do nothing.
+class SPKMeansListener {
+  public:
+    virtual ~SPKMeansListener() {}
+
+    // called when a run starts, with the name of the runner ("serial",
+    // "openmp", "galois" or "streaming"), k and the number of threads
+    virtual void runStarted(const char *mode, int k, int num_threads) {}
+
+    // called after each recorded iteration (or online pass, or mini-batch
+    // epoch), with its number (from 1), quality, change in quality, and the
+    // number of documents moved (-1 if they are not counted)
+    virtual void iterationDone(int iteration, float quality, float dQ,
+                               long moved) {}
+
+    // called with each line (without the newline) of the progress messages
+    // of a run, if the run's output is sent to the listener
+    virtual void message(const std::string &line) {}
+};
+
 
 
 // Abstract implementation of the SPKMeans algorithm
@@ -25,9 +83,23 @@ class SPKMeans {
         TXN_SCHEME
     };
 
+    // choice of possible partitioning engines
+    enum Engine {
+        DOCUMENT_ENGINE, // one cosine similarity at a time (per document)
+        SPMM_ENGINE      // tiled sparse-times-dense similarity blocks
+    };
+
+    // choice of possible seedings (initial partitionings, see seeding.h)
+    enum Seeding {
+        BLOCK_SEEDING,    // contiguous blocks of documents in file order
+        RANDOM_SEEDING,   // uniformly random partition
+        KMEANSPP_SEEDING, // spherical k-means++
+        KMEANSPAR_SEEDING // k-means|| (parallel oversampling k-means++)
+    };
+
   protected:
-    // clustering variables
-    float **doc_matrix;
+    // clustering variables (the sparse document matrix is not owned)
+    SparseMatrix *doc_matrix;
     int k;
     int dc;
     int wc;
@@ -37,41 +109,188 @@ class SPKMeans {
 
     // optimization flag
     bool optimize;
-    
-    // matrix setup schemes
-    Scheme prep_scheme;
-    void txnScheme();
 
-    // initial partitioning setup
-    void initClusters(ClusterData *data);
+    // bounds flag: prune cosine computations using similarity upper bounds
+    bool use_bounds;
 
-    // compute quality of partitioning
-    float computeQ(ClusterData *data);
+    // top-m candidate cache (see spkmeans_topm.cpp): the number of clusters
+    // cached per document, or 0 to cache all k similarities
+    int top_m;
+    bool usesBounds();
 
-    // report current partitioning quality
-    void reportQuality(ClusterData *data, float quality, float dQ);
+    // matrix setup schemes
+    Scheme prep_scheme;
+    void txnScheme();
 
-    // report timer stats
-    void reportTime(int iterations, float total_time,
-                    float p_time = 0, float c_time = 0);
+    // partitioning engine
+    Engine engine;
+
+    // concept matrix storage (layout, and whether to request huge pages)
+    ClusterData::ConceptLayout concept_layout;
+    bool huge_pages;
+
+    // initial partitioning setup (seeding), and its run time in ms
+    Seeding seeding;
+    unsigned int seed;
+    float seed_time;
+    void initClusters(ClusterData *data, int num_threads = 1);
+
+    // warm start: a saved model (not owned) that replaces the seeding if it
+    // is set, and whether its saved assignments are all recomputed
+    const ClusterModel *warm_model;
+    bool warm_reassign;
+
+    // number of iterations of the last run
+    int num_iterations;
+
+    // the phase times and iteration records of the runs (see profiler.h):
+    // run_profile, unless another profiler is set
+    Profiler run_profile;
+    Profiler *profile;
+
+    // mini-batch mode (disabled if the batch size is 0)
+    int batch_size;
+    int max_epochs;
+    void updateConceptBatch(ClusterData *data, int cIndx,
+                            int *batch_docs, int count);
+    ClusterData* runMiniBatch(int num_threads = 1);
+
+    // priority scheduling: skip documents that are unlikely to move (see
+    // spkmeans_priority.cpp); skip_bucket is the highest skipped bucket + 1
+    bool use_priorities;
+    int skip_bucket;
+    long num_skipped;
+    long total_skipped;
+    // (if it returns dc, the active list is not filled: all documents are
+    // partitioned, in order)
+    int scheduleDocuments(ClusterData *data, int *active, bool full);
+    void updateSchedule(ClusterData *data);
+
+    // delta mode: the cluster sums are kept between iterations, and only the
+    // moved documents are added to or subtracted from them
+    bool use_deltas;
+    void applyMoves(ClusterData *data, int cIndx);
+    void rebuildSum(ClusterData *data, int cIndx);
+    void startConceptStep(ClusterData *data, int iteration);
+
+    // reduced precision mode: the storage precision of the concepts and the
+    // cosine similarity cache, and whether the document values are quantized
+    // to 8 bits (only used by the full batch runs, see reducedStorage)
+    Precision precision;
+    bool quantize;
+    bool reducedStorage();
+    void reportStorage(ClusterData *data);
+
+    // online mode: concepts are updated as soon as a document moves
+    bool online;
+    void moveDocument(ClusterData *data, int doc_index, int from, int to);
+    virtual long onlinePass(ClusterData *data, int num_threads);
+    ClusterData* runOnline(int num_threads = 1);
+
+    // compute quality of partitioning (parallel in the subclasses)
+    virtual float computeQ(ClusterData *data);
+
+    // where the progress messages are printed (cout by default), and who is
+    // told about each iteration (nobody by default)
+    std::ostream *out;
+    SPKMeansListener *listener;
+
+    // record an iteration in the profile, and tell the listener about it
+    void endIteration(float quality, float dQ, long moved = -1,
+                      long num_cosines = -1, long skipped = -1);
+
+    // report current partitioning quality (and record the iteration)
+    void reportQuality(ClusterData *data, float quality, float dQ,
+                       long num_cosines = -1);
+
+    // report timer stats (from the profiled phases)
+    void reportTime(int iterations, long num_cosines = -1);
 
   public:
-    // initialize wc, dc, k, and doc_matrix, and document norms
-    SPKMeans(float **doc_matrix_, int k_, int dc_, int wc_);
-    // clean up memory
-    ~SPKMeans();
+    // initialize k and doc_matrix (and dc, wc from it), and document norms
+    SPKMeans(SparseMatrix *doc_matrix_, int k_);
+    // clean up memory (virtual, so runners can be deleted through SPKMeans*)
+    virtual ~SPKMeans();
 
     // set which scheme to use
     void setScheme(Scheme type);
 
+    // set which partitioning engine to use (not supported by Galois)
+    void setEngine(Engine type);
+
+    // set the seeding (and its random seed) of the initial partitioning
+    void setSeeding(Seeding type);
+    void setSeed(unsigned int seed_);
+
+    // start from the given saved model instead of a seeding (0 to seed
+    // again); see seedFromModel
+    void setWarmStart(const ClusterModel *model, bool reassign = false);
+
+    // returns the seeding time and the number of iterations of the last run
+    float getSeedingTime();
+    int getIterations();
+
+    // set the profiler that times the runs, and return it
+    void setProfiler(Profiler *profile_);
+    Profiler* getProfiler();
+
+    // set the stream that the progress messages are printed to, and the
+    // listener of the runs (0 for none)
+    void setOutput(std::ostream *out_);
+    void setListener(SPKMeansListener *listener_);
+
+    // switches for priority scheduling of the partitioning step
+    void disablePriorities();
+    void enablePriorities();
+
+    // switches for delta updates of the concept vectors
+    void disableDeltas();
+    void enableDeltas();
+
+    // set the storage precision of the concepts and cosine similarity cache
+    void setPrecision(Precision precision_);
+
+    // switches for 8-bit quantization of the document values
+    void disableQuantization();
+    void enableQuantization();
+
+    // switches for online (incremental) concept updates
+    void disableOnline();
+    void enableOnline();
+
+    // enable mini-batch mode with the given batch size (0 to disable it)
+    void setMiniBatch(int batch_size_, int epochs = MINIBATCH_EPOCHS);
+
+    // set the memory layout of the concept matrix
+    void setConceptLayout(ClusterData::ConceptLayout layout);
+
+    // switches for huge page backing of the concept matrix
+    void disableHugePages();
+    void enableHugePages();
+
     // switches for optimization
     void disableOptimization();
     void enableOptimization();
 
+    // switches for bound-based pruning of the partitioning step
+    void disableBounds();
+    void enableBounds();
+
+    // cache only the top m clusters of each document (0 to cache all k)
+    void setTopCache(int m);
+
     // spkmeans computation functions made public for binding to Galois structs
     float cosineSimilarity(ClusterData *data, int doc_index, int cIndx);
-    float computeConcepts(ClusterData *data);
-    float* computeConcept(ClusterData *data, int cIndx);
+    int partitionDocument(ClusterData *data, int doc_index);
+    int partitionDocumentTop(ClusterData *data, int doc_index);
+    float updateConcept(ClusterData *data, int cIndx);
+    float updateConceptDelta(ClusterData *data, int cIndx);
+    void refreshConcept(ClusterData *data, int cIndx);
+    float clusterQuality(ClusterData *data, int cIndx);
+    int partitionDocumentOnline(ClusterData *data, int doc_index);
+
+    // recompute all changed concept vectors (parallel in the subclasses)
+    virtual float computeConcepts(ClusterData *data);
 
     // the algorithm is implemented differently by each type of paradigm
     virtual ClusterData* runSPKMeans();
@@ -86,12 +305,48 @@ class SPKMeansOpenMP : public SPKMeans {
 
   public:
     // constructor: set the number of threads
-    SPKMeansOpenMP(float **doc_matrix_, int k_, int dc_, int wc_,
+    SPKMeansOpenMP(SparseMatrix *doc_matrix_, int k_,
         unsigned int t_ = 1);
 
     // returns the actual number of threads Galois will use
     unsigned int getNumThreads();
 
+    // compute the concept vectors and partitioning quality in parallel
+    float computeConcepts(ClusterData *data);
+    float computeQ(ClusterData *data);
+
+    // run the algorithm
+    ClusterData* runSPKMeans();
+};
+
+
+
+// Streaming (out-of-core) version of the SPKMeans algorithm: the documents
+// are read chunk by chunk from a binary document file in every iteration,
+// and the chunks are partitioned with OpenMP threads
+class SPKMeansStreaming : public SPKMeans {
+  private:
+    DocumentStream *stream;
+    long memory_budget;
+    unsigned int num_threads;
+
+    // passes over the documents: sums up the clusters of the current
+    // assignments, or partitions the documents and sums up their new clusters
+    bool sumPass(ClusterData *data);
+    bool partitionPass(ClusterData *data, long *num_cosines);
+
+    // computes the concepts from the cluster sums (and clears the sums)
+    float conceptsFromSums(ClusterData *data);
+
+  public:
+    // constructor: set the stream, the memory budget (in bytes), and the
+    // number of threads
+    SPKMeansStreaming(DocumentStream *stream_, int k_, long memory_budget_,
+        unsigned int t_ = 1);
+
+    // returns the actual number of threads OpenMP will use
+    unsigned int getNumThreads();
+
     // run the algorithm
     ClusterData* runSPKMeans();
 };
@@ -106,12 +361,19 @@ class SPKMeansGalois : public SPKMeans {
 
   public:
     // constructor: set the number of threads and initialize Galois
-    SPKMeansGalois(float **doc_matrix_, int k_, int dc_, int wc_,
+    SPKMeansGalois(SparseMatrix *doc_matrix_, int k_,
         unsigned int t_ = 1);
 
     // returns the actual number of threads Galois will use
     unsigned int getNumThreads();
 
+    // compute the concept vectors and partitioning quality in parallel
+    float computeConcepts(ClusterData *data);
+    float computeQ(ClusterData *data);
+
+    // run one online pass over the documents with the Galois operator
+    long onlinePass(ClusterData *data, int num_threads);
+
     // run the algorithm
     ClusterData* runSPKMeans();
 };
@@ -0,0 +1,159 @@
+/* File: spkmeans_delta.cpp
+ *
+ * Defines the delta updates of the concept vectors. In delta mode, the
+ * unnormalized cluster sums are kept in the ClusterData object, so after
+ * the first iteration only the documents that moved (see
+ * ClusterData::mergeMoves) have to be subtracted from their old cluster's
+ * sum and added to their new one, and only the changed concepts are
+ * normalized again. This takes O(nz(moved documents) + k' * wc) time (for
+ * k' changed clusters) instead of O(nnz). Every DELTA_FULL_PERIOD
+ * iterations, the sums are recomputed from all documents instead, and the
+ * rounding drift of the delta-updated sums is measured.
+ */
+
+#include "spkmeans.h"
+
+#include "vectors.h"
+
+#include <math.h>
+
+using namespace std;
+
+
+
+// Adds the given document (times sign, which is 1 or -1) to the dense,
+// strided sum.
+static void addDocument(SparseMatrix *docs, int doc, float *sum, long stride,
+                        float sign)
+{
+    for(int a=docs->offsets[doc]; a<docs->offsets[doc+1]; a++)
+        sum[docs->indices[a] * stride] += sign * docs->value(doc, a);
+}
+
+
+
+// Sets up the next concept step of the given iteration: the sums are
+// updated from the moves, unless delta mode is off, the sums are not
+// computed yet, or this is a full recompute iteration.
+void SPKMeans::startConceptStep(ClusterData *data, int iteration)
+{
+    data->apply_deltas = use_deltas && data->sums_valid &&
+                         iteration % DELTA_FULL_PERIOD != 0;
+}
+
+
+
+// Subtracts the documents that moved out of the given cluster in the last
+// partitioning step from its sum, and adds the ones that moved into it.
+void SPKMeans::applyMoves(ClusterData *data, int cIndx)
+{
+    SparseMatrix *docs = data->docs;
+    float *sum = data->getSum(cIndx);
+    long stride = data->word_stride;
+
+    for(int a=data->moved_out_offsets[cIndx];
+        a<data->moved_out_offsets[cIndx+1]; a++)
+        addDocument(docs, data->moved_out_docs[a], sum, stride, -1);
+    for(int a=data->moved_in_offsets[cIndx];
+        a<data->moved_in_offsets[cIndx+1]; a++)
+        addDocument(docs, data->moved_in_docs[a], sum, stride, 1);
+    data->cluster_sizes[cIndx] +=
+        (data->moved_in_offsets[cIndx+1] - data->moved_in_offsets[cIndx]) -
+        (data->moved_out_offsets[cIndx+1] - data->moved_out_offsets[cIndx]);
+}
+
+
+
+// Recomputes the given cluster's sum from its documents (grouped by
+// ClusterData::groupByCluster), without changing its concept vector. This
+// is done for the clusters that did not change in a full recompute
+// iteration; the difference from the delta-updated sum is kept in
+// sum_errors (relative to the new sum's norm).
+void SPKMeans::rebuildSum(ClusterData *data, int cIndx)
+{
+    SparseMatrix *docs = data->docs;
+    float *sum = data->getSum(cIndx);
+    long stride = data->word_stride;
+
+    // subtracting the documents from the old sum leaves the error
+    for(int a=data->cluster_offsets[cIndx];
+        a<data->cluster_offsets[cIndx+1]; a++)
+        addDocument(docs, data->cluster_docs[a], sum, stride, -1);
+    float error = vec_norm_strided(sum, wc, stride);
+
+    vec_fill_strided(sum, wc, stride, 0);
+    for(int a=data->cluster_offsets[cIndx];
+        a<data->cluster_offsets[cIndx+1]; a++)
+        addDocument(docs, data->cluster_docs[a], sum, stride, 1);
+    float norm = vec_norm_strided(sum, wc, stride);
+
+    data->sum_errors[cIndx] = (norm > 0) ? error / norm : 0;
+    data->cluster_sizes[cIndx] = data->clusterSize(cIndx);
+}
+
+
+
+// Updates the given cluster's sum with the documents that moved out of and
+// into it in the last partitioning step, then normalizes the sum into the
+// concept vector. The cluster's cached norm and quality (and, in bounds
+// mode, its drift) are also updated, as in updateConcept. Only this
+// cluster's sum and concept are touched, so different clusters can be
+// updated by different threads at the same time. Returns the new cluster
+// quality.
+float SPKMeans::updateConceptDelta(ClusterData *data, int cIndx)
+{
+    float *sum = data->getSum(cIndx);
+    float *concept = data->getConcept(cIndx);
+    long stride = data->word_stride;
+
+    applyMoves(data, cIndx);
+
+    // with bounds, the drift needs the dot product of the old concept
+    // vector and the new sum (see updateConcept)
+    float old_dot = 0;
+    if(usesBounds()) {
+        for(int w=0; w<wc; w++)
+            old_dot += concept[w*stride] * sum[w*stride];
+    }
+
+    float quality = vec_norm_strided(sum, wc, stride);
+    if(quality > 0) {
+        for(int w=0; w<wc; w++)
+            concept[w*stride] = sum[w*stride] / quality;
+    }
+    else
+        vec_fill_strided(concept, wc, stride, 0);
+
+    if(usesBounds()) {
+        float old_norm = data->concept_norms[cIndx];
+        float new_norm = (quality > 0) ? 1 : 0;
+        float dotp = (quality > 0) ? old_dot / quality : 0;
+        float drift = old_norm*old_norm + new_norm*new_norm - 2*dotp;
+        if(drift < 0)
+            drift = 0;
+        data->concept_drifts[cIndx] = sqrt(drift + DRIFT_EPSILON);
+    }
+
+    data->concept_norms[cIndx] = (quality > 0) ? 1 : 0;
+    data->qualities[cIndx] = quality;
+
+    return quality;
+}
+
+
+
+// Brings the given cluster's concept vector up to date for the current
+// concept step: changed clusters are updated from the moves (in a delta
+// step) or from all of their documents; in a full recompute step of delta
+// mode, the sums of the unchanged clusters are rebuilt as well.
+void SPKMeans::refreshConcept(ClusterData *data, int cIndx)
+{
+    if(data->changed[cIndx]) {
+        if(data->apply_deltas)
+            updateConceptDelta(data, cIndx);
+        else
+            updateConcept(data, cIndx);
+    }
+    else if(!data->apply_deltas && data->sums_valid)
+        rebuildSum(data, cIndx);
+}
@@ -7,13 +7,13 @@
 
 #include "spkmeans.h"
 
-#include "timer.h"
-
 #include <functional>
 #include <iostream>
 
+#include "Galois/Accumulator.h"
 #include "Galois/Galois.h"
 #include "Galois/Graph/Graph.h"
+#include "Galois/Runtime/ll/TID.h"
 #include "llvm/ADT/SmallVector.h"
 
 #include <boost/iterator/counting_iterator.hpp>
@@ -24,8 +24,8 @@ using namespace std;
 
 // Constructor: set number of threads and initialize Galois.
 SPKMeansGalois::SPKMeansGalois(
-    float **doc_matrix_, int k_, int dc_, int wc_, unsigned int t_)
-    : SPKMeans::SPKMeans(doc_matrix_, k_, dc_, wc_)
+    SparseMatrix *doc_matrix_, int k_, unsigned int t_)
+    : SPKMeans::SPKMeans(doc_matrix_, k_)
 {
     // if number of threads given is <= 0, set to max
     if(t_ <= 0)
@@ -91,103 +91,189 @@ struct ComputeClustersBasic {
 
     ClusterData *data;
 
-    function<float(ClusterData*, int, int)> cosineSimilarity;
+    function<int(ClusterData*, int)> partitionDocument;
 
-    // Constructor: assign the ClusterData pointer
-    ComputeClustersBasic(ClusterData *data_) : data(data_) { }
+    // number of cosine similarities computed (summed over all threads)
+    Galois::GAccumulator<long> *num_cosines;
+
+    // the profiler that gets the busy time of each thread
+    Profiler *profile;
+
+    // Constructor: assign the ClusterData and Profiler pointers
+    ComputeClustersBasic(ClusterData *data_, Profiler *profile_)
+        : data(data_), profile(profile_) { }
 
     // Galois operator: run the clustering computation
     void operator() (int &i, Galois::UserContext<int> &ctx)
     {
-        int k = data->k;
-        bool *changed = data->changed;
-        float *cosines = data->cosine_similarities;
-
         // find the cluster with the best cosine similarity, and assign it
-        int cIndx = 0;
-        if(changed[0])
-            cosines[i*k] = cosineSimilarity(data, i, 0);
-        for(int j=1; j<k; j++) {
-            if(changed[j])
-                cosines[i*k + j] = cosineSimilarity(data, i, j);
-            if(cosines[i*k + j] > cosines[i*k + cIndx])
-                cIndx = j;
-        }
-        data->assignCluster(i, cIndx);
+        unsigned long long busy = Profiler::now();
+        int cosines = partitionDocument(data, i);
+        *num_cosines += cosines;
+        data->checkMoved(Galois::Runtime::LL::getTID(), i);
+        profile->addBusy(Galois::Runtime::LL::getTID(), busy, cosines);
     }
 };
 
 
 
-// Runs SPKMeans in with the online algorithm to loop constantly until
-// convergence. This version can make use of the priority function.
+// Recomputes the concept vectors of all changed clusters (see
+// SPKMeans::refreshConcept). Each cluster is owned by a single iteration, so
+// no locking is needed.
+struct ComputeConceptsBasic {
+
+    ClusterData *data;
+
+    function<void(ClusterData*, int)> refreshConcept;
+
+    // Constructor: assign the ClusterData pointer
+    ComputeConceptsBasic(ClusterData *data_) : data(data_) { }
+
+    // Galois operator: update the concept vector if the cluster changed
+    void operator() (int i)
+    {
+        refreshConcept(data, i);
+    }
+};
+
+
+
+// Computes the quality of each changed cluster. Each cluster is owned by a
+// single iteration, so no locking is needed.
+struct ComputeQualityBasic {
+
+    ClusterData *data;
+
+    function<float(ClusterData*, int)> clusterQuality;
+
+    // Constructor: assign the ClusterData pointer
+    ComputeQualityBasic(ClusterData *data_) : data(data_) { }
+
+    // Galois operator: recompute the quality if the cluster changed
+    void operator() (int i)
+    {
+        if(data->changed[i])
+            clusterQuality(data, i);
+    }
+};
+
+
+
+// Runs SPKMeans with the online algorithm: each document that moves is
+// moved between the cluster sums right away (see partitionDocumentOnline),
+// under the per-cluster locks. This version can make use of the priority
+// function.
 struct ComputeClustersOnline : public ComputeClustersBasic {
 
-    // Galois operator: run the clustering computation, with online additions
+    // number of documents moved (summed over all threads)
+    Galois::GAccumulator<long> *num_moved;
+
+    // Constructor: assign the ClusterData and Profiler pointers
+    ComputeClustersOnline(ClusterData *data_, Profiler *profile_)
+        : ComputeClustersBasic(data_, profile_) { }
+
+    // Galois operator: run the clustering computation, with online updates
     void operator() (int &i, Galois::UserContext<int> &ctx)
     {
-        int k = data->k;
-        bool *changed = data->changed;
-        float *cosines = data->cosine_similarities;
-
-        // find the cluster with the best cosine similarity, and assign it
-        int cIndx = 0;
-        if(changed[0])
-            cosines[i*k] = cosineSimilarity(data, i, 0);
-        for(int j=1; j<k; j++) {
-            if(changed[j])
-                cosines[i*k + j] = cosineSimilarity(data, i, j);
-            if(cosines[i*k + j] > cosines[i*k + cIndx])
-                cIndx = j;
-        }
-        data->assignCluster(i, cIndx);
-        // TODO - assignCluster doesn't finalize the assignment, which must
-        //        be done in the online case
-        // Make another function: assignClusterOnline
-
-        // if the document moved, we must update quality and concept vectors
-        // TODO - this part needs to be thread safe (locking)
-        if(data->p_asgns[i] != cIndx) {
-            // TODO - update the concept vector (live)
-            // TODO - all of these updates should only take nz(i) time.
-/*            sU[cIndx] = sU[cIndx] - vec_sum(vec_squared(concepts[cIndx]));
-            for(int a=0; a<wc; a++) {
-                concepts[cIndx][a] =
-                    concepts[cIndx][a] + LR * cNorms[cIndx] + doc_matrix[i][a];
-            }
-            sU[cIndx] = sU[cIndx] + vec_sum(vec_squared(concepts[cIndx]));
-            cNorms[cIndx] = sqrt(sU[cIndx]);*/
-            
-            // remove quality from old vector
-            // TODO - ClusterData stores documents in compressed format
-            /*float old_quality = vec_dot(data->doc_matrix[i],
-                                        data->concepts[data->p_asgns[i]],
-                                        data->wc);
-            data->qualities[data->p_asgns[i]] -= old_quality;
-            // add quality to new vector
-            float new_quality = vec_dot(data->doc_matrix[i],
-                                        data->concepts[cIndx],
-                                        data->wc);
-            data->qualities[cIndx] += new_quality;*/
-        }
+        // find the best cluster, and move the document there if needed
+        unsigned long long busy = Profiler::now();
+        *num_moved += partitionDocument(data, i);
+        profile->addBusy(Galois::Runtime::LL::getTID(), busy);
     }
 };
 
 
 
-// Priority computation for the online version of the algorithm.
+// Priority computation for the worklists: documents in higher priority
+// buckets (further away from their own concept, so more likely to move)
+// get lower integers, and are processed first.
 struct ComputePriority {
+
+    ClusterData *data;
+
+    // Constructors: assign the ClusterData pointer
+    ComputePriority() : data(0) { }
+    ComputePriority(ClusterData *data_) : data(data_) { }
+
     unsigned int operator() (const int& document_index) const {
-        // TODO - implement priority scheme and reference to documents
-        return 1;
+        return PRIORITY_BUCKETS - 1 - data->priorityBucket(document_index);
     }
 };
 
 
 
+// Computes the concept vectors of all changed clusters in parallel using
+// Galois. The total quality is summed in cluster order afterwards.
+float SPKMeansGalois::computeConcepts(ClusterData *data)
+{
+    if(!data->apply_deltas)
+        data->groupByCluster();
+
+    ComputeConceptsBasic comp(data);
+    comp.refreshConcept = bind(&SPKMeans::refreshConcept, this,
+        placeholders::_1, placeholders::_2);
+    Galois::do_all(boost::make_counting_iterator<int>(0),
+                   boost::make_counting_iterator<int>(k), comp,
+                   Galois::loopname("Compute Concepts"));
+
+    float quality = 0;
+    for(int i=0; i<k; i++)
+        quality += data->qualities[i];
+    return quality;
+}
+
+
+
+// Computes the quality of all changed clusters in parallel using Galois.
+// The total quality is summed in cluster order afterwards.
+float SPKMeansGalois::computeQ(ClusterData *data)
+{
+    data->groupByCluster();
+
+    ComputeQualityBasic comp(data);
+    comp.clusterQuality = bind(&SPKMeans::clusterQuality, this,
+        placeholders::_1, placeholders::_2);
+    Galois::do_all(boost::make_counting_iterator<int>(0),
+                   boost::make_counting_iterator<int>(k), comp,
+                   Galois::loopname("Compute Quality"));
+
+    float quality = 0;
+    for(int i=0; i<k; i++)
+        quality += data->qualities[i];
+    return quality;
+}
+
+
+
+// Runs one online pass over all documents using Galois. Returns the number
+// of documents that moved.
+long SPKMeansGalois::onlinePass(ClusterData *data, int num_threads)
+{
+    ComputeClustersOnline comp(data, profile);
+    Galois::GAccumulator<long> num_moved;
+    comp.num_moved = &num_moved;
+    comp.partitionDocument = bind(&SPKMeans::partitionDocumentOnline, this,
+        placeholders::_1, placeholders::_2);
+
+    typedef Galois::WorkList::OrderedByIntegerMetric
+            <ComputePriority, Galois::WorkList::ChunkedFIFO<32>>
+            comp_wl;
+    Galois::for_each(boost::make_counting_iterator<int>(0),
+                     boost::make_counting_iterator<int>(dc), comp,
+                     Galois::wl<comp_wl>(ComputePriority(data)),
+                     Galois::loopname("Compute Clusters Online"));
+
+    return num_moved.reduce();
+}
+
+
+
 // Run the spherical K-means algorithm using the Galois library.
 ClusterData* SPKMeansGalois::runSPKMeans()
 {
+    if(online)
+        return runOnline(num_threads);
+
     /*// first, convert the document matrix to a graph
     Galois::Graph::LC_CSR_Graph<DataNode, float> g;
     
@@ -198,79 +284,103 @@ ClusterData* SPKMeansGalois::runSPKMeans()
 
     //-----------------------------------------------------------------------//
 
+    // keep track of the run time for this algorithm, and of its phases (the
+    // run includes the TXN scheme and the initialization, like the others)
+    profile->startRun(num_threads);
+
     // apply the TXN scheme on the document vectors (normalize them)
     txnScheme();
 
-    // initialize the data arrays; keep track of the arrays locally
-    ClusterData *data = new ClusterData(k, dc, wc, doc_matrix);
-    float **concepts = data->concepts;
-    bool *changed = data->changed;
+    // initialize the data arrays
+    ClusterData *data = new ClusterData(k, doc_matrix);
 
     // compute initial partitioning, concepts, and quality
-    initClusters(data);
+    initClusters(data, num_threads);
     float quality = computeQ(data);
-    cout << "Initial quality: " << quality << endl;
+    *out << "Initial quality: " << quality << endl;
 
 
     // set up Galois computing structures, and worklist prioritization
-    ComputeClustersBasic comp(data);
+    ComputeClustersBasic comp(data, profile);
+    Galois::GAccumulator<long> num_cosines;
+    comp.num_cosines = &num_cosines;
 
-    // bind the cosineSimilarity function
-    comp.cosineSimilarity = bind(&SPKMeans::cosineSimilarity, this,
-        placeholders::_1, placeholders::_2, placeholders::_3);
+    // bind the partitionDocument function
+    comp.partitionDocument = bind(&SPKMeans::partitionDocument, this,
+        placeholders::_1, placeholders::_2);
 
     // this is the worklist ordering scheme using the ComputePriority struct
-    // TODO - the ChunkedFIFO: 32 vs. 64 vs. 16 vs. 8 etc.? What does it mean?
+    // (within a bucket, documents are handed out in chunks of 32)
     typedef Galois::WorkList::OrderedByIntegerMetric
             <ComputePriority, Galois::WorkList::ChunkedFIFO<32>>
             comp_wl;
 
-    // set up iterators for use by the Galois loops
-    auto start_any = boost::make_counting_iterator<int>(0);
-    auto end_dc = boost::make_counting_iterator<int>(dc);
-    //auto end_k = boost::make_counting_iterator<int>(k);
-
+    // the documents to partition in the iterations that skip some (see
+    // scheduleDocuments); only needed with priorities
+    int *active = use_priorities ? new int[dc] : 0;
+    total_skipped = 0;
+    skip_bucket = 0;
 
-    // keep track of the run time of this algorithm
-    Timer timer;
-    timer.start();
 
-    // keep track of all individual component times for analysis
-    Timer ptimer;
-    Timer ctimer;
-
-    // do spherical k-means loop
+    // do spherical k-means loop; when priorities are used, the run only
+    // stops after a full (unscheduled) iteration
     float dQ = Q_THRESHOLD * 10;
     int iterations = 0;
-    while(dQ > Q_THRESHOLD) {
+    long total_cosines = 0;
+    bool full = true;
+    while(dQ > Q_THRESHOLD || !full) {
+        full = !use_priorities || iterations == 0 || dQ <= Q_THRESHOLD;
         iterations++;
 
-        // compute new partitions based on old concept vectors
-        ptimer.start();
-        Galois::for_each(start_any, end_dc, comp,
-                         Galois::wl<comp_wl>(),
-                         Galois::loopname("Compute Clusters"));
-        ptimer.stop();
-
-        if(optimize)
-            data->findChangedClusters();
+        // compute new partitions based on old concept vectors, taking the
+        // scheduled documents in priority order
+        profile->start(Profiler::PARTITION_PHASE);
+        num_cosines.reset();
+        data->prepareMoves(num_threads);
+        int count = scheduleDocuments(data, active, full);
+        if(count == dc)
+            Galois::for_each(boost::make_counting_iterator<int>(0),
+                             boost::make_counting_iterator<int>(count), comp,
+                             Galois::wl<comp_wl>(ComputePriority(data)),
+                             Galois::loopname("Compute Clusters"));
+        else
+            Galois::for_each(active, active + count, comp,
+                             Galois::wl<comp_wl>(ComputePriority(data)),
+                             Galois::loopname("Compute Clusters"));
+        profile->stop(Profiler::PARTITION_PHASE);
+
+        profile->start(Profiler::CHANGES_PHASE);
+        data->mergeMoves(optimize);
+        if(use_priorities)
+            updateSchedule(data);
         data->applyAssignments();
+        profile->stop(Profiler::CHANGES_PHASE);
 
-        // compute new concept vectors and quality
-        ctimer.start();
+        // compute new concept vectors and quality (in delta mode, from the
+        // moved documents only, except for the full recompute iterations)
+        profile->start(Profiler::CONCEPTS_PHASE);
+        startConceptStep(data, iterations);
         float n_quality = computeConcepts(data);
         dQ = n_quality - quality;
         quality = n_quality;
-        ctimer.stop();
+        profile->stop(Profiler::CONCEPTS_PHASE);
 
         // report the quality of the current partitioning
-        reportQuality(data, quality, dQ);
+        long iter_cosines = num_cosines.reduce();
+        reportQuality(data, quality, dQ, iter_cosines);
+        total_cosines += iter_cosines;
     }
 
 
     // report runtime statistics
-    timer.stop();
-    reportTime(iterations, timer.get(), ptimer.get(), ctimer.get());
+    profile->stopRun();
+    num_iterations = iterations;
+    reportTime(iterations, total_cosines);
+
+    delete[] active;
+
+    // the results are read from the fp32 concepts (see getConcept)
+    data->expandConcepts();
 
     // return the resulting partitions and concepts in the ClusterData struct
     return data;
@@ -0,0 +1,247 @@
+/* File: spkmeans_minibatch.cpp
+ *
+ * Defines the mini-batch version of the spherical k-means algorithm. Instead
+ * of assigning every document in each iteration, each step assigns a small
+ * random batch of documents and moves their concept vectors towards them,
+ * with a learning rate of 1 / (number of documents the concept absorbed).
+ * The serial and OpenMP runners both use this implementation.
+ */
+
+#include "spkmeans.h"
+
+#include "vectors.h"
+
+#include <algorithm>
+#include <iostream>
+#include <math.h>
+#include <omp.h>
+#include <random>
+
+using namespace std;
+
+
+
+// Moves the concept vector of the given cluster towards each of the given
+// documents in turn: with learning rate eta = 1 / count, the concept becomes
+// (1 - eta) * concept + eta * doc / |doc|. To keep each update O(nz(doc)),
+// the (1 - eta) factors are collected in a separate scale, and the document
+// is added with weight eta / scale instead; the scale is only applied to the
+// concept when it gets too small, and at the end, when the concept is
+// normalized again.
+void SPKMeans::updateConceptBatch(ClusterData *data, int cIndx,
+                                  int *batch_docs, int count)
+{
+    SparseMatrix *docs = data->docs;
+    float *concept = data->getConcept(cIndx);
+    long stride = data->word_stride;
+
+    double scale = 1;
+    for(int a=0; a<count; a++) {
+        int doc = batch_docs[a];
+        if(doc_norms[doc] == 0)
+            continue;
+        data->concept_counts[cIndx]++;
+        double eta = 1.0 / data->concept_counts[cIndx];
+        scale *= 1 - eta;
+        if(scale < MINIBATCH_MIN_SCALE) {
+            for(int w=0; w<wc; w++)
+                concept[w*stride] *= scale;
+            scale = 1;
+        }
+
+        float weight = eta / (scale * doc_norms[doc]);
+        for(int i=docs->offsets[doc]; i<docs->offsets[doc+1]; i++)
+            concept[docs->indices[i]*stride] += weight * docs->value(doc, i);
+    }
+
+    // the scale doesn't change the direction, so normalizing is enough
+    float norm = vec_norm_strided(concept, wc, stride);
+    if(norm > 0) {
+        vec_divide_strided(concept, wc, stride, norm);
+        data->concept_norms[cIndx] = 1;
+    }
+}
+
+
+
+// Runs mini-batch spherical k-means with the given number of threads. Each
+// epoch visits the documents in a new random order (from the seed), in
+// batches of batch_size. Each batch is assigned in parallel, then grouped by
+// cluster, and each cluster's concept is updated by a single thread, with
+// its documents in batch order; so the result does not depend on the number
+// of threads. The run stops when the smoothed batch quality stops improving,
+// or after max_epochs epochs. A final full pass then assigns all documents
+// and computes the concepts and quality from them. Each epoch is recorded in
+// the profile, with its smoothed batch quality.
+ClusterData* SPKMeans::runMiniBatch(int num_threads)
+{
+    // keep track of the run time for this algorithm, and of its phases
+    profile->startRun(num_threads);
+
+    // apply the TXN scheme on the document vectors (normalize them)
+    txnScheme();
+
+    // initialize the data arrays, and compute the initial concepts
+    ClusterData *data = new ClusterData(k, doc_matrix);
+    initClusters(data, num_threads);
+    float quality = computeQ(data);
+    *out << "Initial quality: " << quality << endl;
+
+    // the seeded concepts only decide where the first batch goes: each
+    // concept's first update replaces it with its first document
+    for(int c=0; c<k; c++)
+        data->concept_counts[c] = 0;
+
+    int batch = (batch_size < dc) ? batch_size : dc;
+    int *order = new int[dc];
+    for(int i=0; i<dc; i++)
+        order[i] = i;
+    int *batch_asgns = new int[batch];
+    float *batch_cosines = new float[batch];
+    int *batch_offsets = new int[k+1];
+    int *batch_docs = new int[batch];
+    mt19937 rng(seed);
+
+    // the batch quality is smoothed over about 2 * dc / batch batches
+    float alpha = 2.0f * batch / dc;
+    if(alpha > 1)
+        alpha = 1;
+    float smoothed = 0;
+    float last_smoothed = 0;
+    long epoch_cosines = 0;
+    float best = 0;
+    int stale = 0;
+    int steps = 0;
+    bool converged = false;
+    for(int epoch=0; epoch<max_epochs && !converged; epoch++) {
+        for(int i=dc-1; i>0; i--)
+            swap(order[i], order[rng() % (i+1)]);
+
+        for(int start=0; start<dc && !converged; start+=batch) {
+            int count = min(batch, dc - start);
+            int *docs = order + start;
+            steps++;
+
+            // assign each document of the batch to its closest concept
+            profile->start(Profiler::PARTITION_PHASE);
+            #pragma omp parallel num_threads(num_threads)
+            {
+                unsigned long long busy = Profiler::now();
+                long num_docs = 0;
+                #pragma omp for nowait
+                for(int i=0; i<count; i++) {
+                    int cIndx = 0;
+                    float best_cos = cosineSimilarity(data, docs[i], 0);
+                    for(int c=1; c<k; c++) {
+                        float cos_c = cosineSimilarity(data, docs[i], c);
+                        if(cos_c > best_cos) {
+                            best_cos = cos_c;
+                            cIndx = c;
+                        }
+                    }
+                    batch_asgns[i] = cIndx;
+                    batch_cosines[i] = best_cos;
+                    data->p_asgns[docs[i]] = cIndx;
+                    num_docs++;
+                }
+                profile->addBusy(omp_get_thread_num(), busy, num_docs * k);
+            }
+            epoch_cosines += (long)count * k;
+            profile->stop(Profiler::PARTITION_PHASE);
+
+            // group the batch by cluster (keeping the batch order)
+            profile->start(Profiler::CHANGES_PHASE);
+            for(int c=0; c<=k; c++)
+                batch_offsets[c] = 0;
+            for(int i=0; i<count; i++)
+                batch_offsets[batch_asgns[i] + 1]++;
+            for(int c=0; c<k; c++)
+                batch_offsets[c+1] += batch_offsets[c];
+            for(int i=0; i<count; i++)
+                batch_docs[batch_offsets[batch_asgns[i]]++] = docs[i];
+            for(int c=k; c>0; c--)
+                batch_offsets[c] = batch_offsets[c-1];
+            batch_offsets[0] = 0;
+            profile->stop(Profiler::CHANGES_PHASE);
+
+            // move each concept towards its documents
+            profile->start(Profiler::CONCEPTS_PHASE);
+            #pragma omp parallel for schedule(dynamic) num_threads(num_threads)
+            for(int c=0; c<k; c++) {
+                int size = batch_offsets[c+1] - batch_offsets[c];
+                if(size > 0)
+                    updateConceptBatch(data, c, batch_docs + batch_offsets[c],
+                                       size);
+            }
+            profile->stop(Profiler::CONCEPTS_PHASE);
+
+            // check convergence on the smoothed average similarity; the
+            // quality first drops while the concepts move away from the
+            // seeds, so the check starts after the first epoch
+            float batch_quality = 0;
+            for(int i=0; i<count; i++)
+                batch_quality += batch_cosines[i];
+            batch_quality /= count;
+            if(steps == 1)
+                smoothed = batch_quality;
+            else
+                smoothed = (1 - alpha) * smoothed + alpha * batch_quality;
+            if(epoch == 0 || smoothed > best) {
+                best = smoothed;
+                stale = 0;
+            }
+            else if(++stale >= MINIBATCH_PATIENCE)
+                converged = true;
+        }
+        *out << "Epoch " << (epoch+1) << ": smoothed batch quality "
+             << smoothed << " after " << steps << " batches." << endl;
+        endIteration(smoothed, smoothed - last_smoothed, -1, epoch_cosines);
+        last_smoothed = smoothed;
+        epoch_cosines = 0;
+    }
+    if(converged)
+        *out << "Converged after " << steps << " batches." << endl;
+
+    // final pass: assign all documents, and recompute all concepts from them
+    profile->start(Profiler::PARTITION_PHASE);
+    for(int c=0; c<k; c++)
+        data->changed[c] = true;
+    #pragma omp parallel num_threads(num_threads)
+    {
+        unsigned long long busy = Profiler::now();
+        long num_docs = 0;
+        #pragma omp for nowait
+        for(int i=0; i<dc; i++) {
+            int cIndx = 0;
+            float best_cos = cosineSimilarity(data, i, 0);
+            for(int c=1; c<k; c++) {
+                float cos_c = cosineSimilarity(data, i, c);
+                if(cos_c > best_cos) {
+                    best_cos = cos_c;
+                    cIndx = c;
+                }
+            }
+            data->p_asgns[i] = cIndx;
+            num_docs++;
+        }
+        profile->addBusy(omp_get_thread_num(), busy, num_docs * k);
+    }
+    profile->stop(Profiler::PARTITION_PHASE);
+    profile->start(Profiler::CONCEPTS_PHASE);
+    quality = computeConcepts(data);
+    profile->stop(Profiler::CONCEPTS_PHASE);
+    *out << "Final quality: " << quality << endl;
+
+    delete[] order;
+    delete[] batch_asgns;
+    delete[] batch_cosines;
+    delete[] batch_offsets;
+    delete[] batch_docs;
+
+    // report runtime statistics (each batch counts as an iteration)
+    profile->stopRun();
+    num_iterations = steps;
+    reportTime(steps);
+
+    return data;
+}
@@ -0,0 +1,222 @@
+/* File: spkmeans_online.cpp
+ *
+ * Defines the online version of the spherical k-means algorithm. Instead of
+ * recomputing all concept vectors after each pass over the documents, every
+ * document that moves is immediately subtracted from the sum of its old
+ * cluster and added to the sum of its new one, so the documents visited
+ * later in the same pass already see the updated concepts. The serial,
+ * OpenMP and Galois runners all use this implementation; only the pass over
+ * the documents (onlinePass) differs.
+ */
+
+#include "spkmeans.h"
+
+#include "vectors.h"
+
+#include <iostream>
+#include <math.h>
+#include <omp.h>
+
+using namespace std;
+
+
+
+// Adds the given document (times sign, which is 1 or -1) to the sum of the
+// given cluster, and updates the squared norm, norm and quality of the sum:
+// |s + x|^2 = |s|^2 + 2 (s . x) + |x|^2. Takes O(nz(doc)) time. The caller
+// must hold the lock of the cluster.
+static void addToConcept(ClusterData *data, float *doc_norms, int doc_index,
+                         int cIndx, float sign)
+{
+    SparseMatrix *docs = data->docs;
+    float *concept = data->getConcept(cIndx);
+    long stride = data->word_stride;
+    int start = docs->offsets[doc_index];
+    int end = docs->offsets[doc_index+1];
+
+    double dotp = docs->rowDot(doc_index, concept, stride);
+    for(int a=start; a<end; a++)
+        concept[docs->indices[a] * stride] += sign * docs->value(doc_index, a);
+
+    double dnorm = doc_norms[doc_index];
+    double sq_norm = data->concept_sq_norms[cIndx]
+                   + 2 * sign * dotp + dnorm * dnorm;
+    if(sq_norm < 0)
+        sq_norm = 0;
+    data->concept_sq_norms[cIndx] = sq_norm;
+    data->concept_norms[cIndx] = sqrt(sq_norm);
+    data->qualities[cIndx] = data->concept_norms[cIndx];
+}
+
+
+
+// Returns the cosine similarity of the given document and the live sum of
+// the given cluster, without taking its lock: if moveDocument changed the
+// sum (or its norm) during the read, the version of the cluster changed,
+// and the similarity is computed again.
+static float liveCosine(SPKMeans *spkm, ClusterData *data, int doc_index,
+                        int cIndx)
+{
+    float similarity;
+    unsigned int version;
+    do {
+        version = data->readConceptVersion(cIndx);
+        similarity = spkm->cosineSimilarity(data, doc_index, cIndx);
+    } while(!data->conceptUnchanged(cIndx, version));
+    return similarity;
+}
+
+
+
+// Moves the given document from one cluster to another, updating both
+// cluster sums in O(nz(doc)) time. Each sum is only changed while its
+// cluster's lock is held (which also makes its version odd, so readers
+// retry), and the two locks are never held at the same time, so
+// concurrent moves cannot deadlock.
+void SPKMeans::moveDocument(ClusterData *data, int doc_index, int from, int to)
+{
+    data->lockConcept(from);
+    addToConcept(data, doc_norms, doc_index, from, -1);
+    data->unlockConcept(from);
+
+    data->lockConcept(to);
+    addToConcept(data, doc_norms, doc_index, to, 1);
+    data->unlockConcept(to);
+
+    data->p_asgns[doc_index] = to;
+    data->p_asgns_new[doc_index] = to;
+}
+
+
+
+// Finds the cluster with the highest cosine similarity to the given document
+// under the current (live) cluster sums, and moves the document there right
+// away if it is not already in it. The concept norms are kept equal to the
+// norms of the sums, so cosineSimilarity works on the sums unchanged. The
+// similarities are read without locks (see liveCosine), so a similarity is
+// never computed from a sum that moveDocument (on another thread) is
+// changing; other clusters may still change between two similarities,
+// which only changes which cluster is found. The document's priority is set
+// to 1 - the similarity to its own concept.
+// Returns 1 if the document moved, or 0 otherwise.
+int SPKMeans::partitionDocumentOnline(ClusterData *data, int doc_index)
+{
+    int own = data->p_asgns[doc_index];
+    int cIndx = own;
+    float best = liveCosine(this, data, doc_index, own);
+    data->doc_priorities[doc_index] = 1 - best;
+    for(int j=0; j<k; j++) {
+        if(j == own)
+            continue;
+        float cos_j = liveCosine(this, data, doc_index, j);
+        if(cos_j > best) {
+            best = cos_j;
+            cIndx = j;
+        }
+    }
+
+    if(cIndx == own)
+        return 0;
+    moveDocument(data, doc_index, own, cIndx);
+    return 1;
+}
+
+
+
+// Runs one online pass over all documents with OpenMP (a dynamic schedule,
+// since the documents that move take longer). Returns the number of
+// documents that moved.
+long SPKMeans::onlinePass(ClusterData *data, int num_threads)
+{
+    long moved = 0;
+    #pragma omp parallel num_threads(num_threads) reduction(+:moved)
+    {
+        unsigned long long busy = Profiler::now();
+        #pragma omp for schedule(dynamic, 64) nowait
+        for(int i=0; i<dc; i++)
+            moved += partitionDocumentOnline(data, i);
+        profile->addBusy(omp_get_thread_num(), busy);
+    }
+    return moved;
+}
+
+
+
+// Runs online spherical k-means with the given number of threads. The
+// seeded concepts are turned back into cluster sums, then each pass moves
+// documents between the sums as it goes, until a pass improves the quality
+// by no more than Q_THRESHOLD (or no document moves). After each pass, the
+// squared norms are recomputed from the sums so rounding errors of the
+// incremental updates don't add up. The final concepts are recomputed from
+// the final partitioning, and normalized as usual.
+ClusterData* SPKMeans::runOnline(int num_threads)
+{
+    // keep track of the run time for this algorithm, and of its phases
+    profile->startRun(num_threads);
+
+    // apply the TXN scheme on the document vectors (normalize them)
+    txnScheme();
+
+    // initialize the data arrays, and compute the initial concepts
+    ClusterData *data = new ClusterData(k, doc_matrix);
+    initClusters(data, num_threads);
+    float quality = computeQ(data);
+    *out << "Initial quality: " << quality << endl;
+
+    // each concept is the normalized sum, and its quality is the sum's norm
+    profile->start(Profiler::CHANGES_PHASE);
+    for(int c=0; c<k; c++) {
+        float *concept = data->getConcept(c);
+        float norm = data->qualities[c];
+        for(int w=0; w<wc; w++)
+            concept[w * data->word_stride] *= norm;
+        data->concept_norms[c] = norm;
+        data->concept_sq_norms[c] = (double)norm * norm;
+    }
+    profile->stop(Profiler::CHANGES_PHASE);
+
+    // do online spherical k-means passes
+    float dQ = Q_THRESHOLD * 10;
+    int iterations = 0;
+    long moved = 1;
+    while(dQ > Q_THRESHOLD && moved > 0) {
+        iterations++;
+
+        profile->start(Profiler::PARTITION_PHASE);
+        moved = onlinePass(data, num_threads);
+        profile->stop(Profiler::PARTITION_PHASE);
+
+        profile->start(Profiler::CHANGES_PHASE);
+        float n_quality = 0;
+        for(int c=0; c<k; c++) {
+            float norm = vec_norm_strided(data->getConcept(c), wc,
+                                          data->word_stride);
+            data->concept_sq_norms[c] = (double)norm * norm;
+            data->concept_norms[c] = norm;
+            data->qualities[c] = norm;
+            n_quality += norm;
+        }
+        dQ = n_quality - quality;
+        quality = n_quality;
+        profile->stop(Profiler::CHANGES_PHASE);
+        endIteration(quality, dQ, moved);
+
+        *out << "Pass " << iterations << ": quality " << quality
+             << " (+" << dQ << "), " << moved << " documents moved." << endl;
+    }
+
+    // recompute (and normalize) all concepts from the final partitioning
+    profile->start(Profiler::CONCEPTS_PHASE);
+    for(int c=0; c<k; c++)
+        data->changed[c] = true;
+    quality = computeConcepts(data);
+    profile->stop(Profiler::CONCEPTS_PHASE);
+    *out << "Final quality: " << quality << endl;
+
+    // report runtime statistics (each pass counts as an iteration)
+    profile->stopRun();
+    num_iterations = iterations;
+    reportTime(iterations);
+
+    return data;
+}
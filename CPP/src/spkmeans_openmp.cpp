@@ -9,17 +9,17 @@
 #include <iostream>
 
 #include <omp.h>
-#include "timer.h"
 
 #include "cluster_data.h"
+#include "spmm_partitioner.h"
 
 using namespace std;
 
 
 // CONSTRUCTOR: set a pre-defined number of threads.
 SPKMeansOpenMP::SPKMeansOpenMP(
-    float **doc_matrix_, int k_, int dc_, int wc_, unsigned int t_)
-    : SPKMeans::SPKMeans(doc_matrix_, k_, dc_, wc_)
+    SparseMatrix *doc_matrix_, int k_, unsigned int t_)
+    : SPKMeans::SPKMeans(doc_matrix_, k_)
 {
     // make sure num_threads doesn't exceed the max available
     if(t_ > omp_get_max_threads())
@@ -41,77 +41,152 @@ unsigned int SPKMeansOpenMP::getNumThreads()
 
 
 
+// Computes the concept vectors of all changed clusters in parallel. Each
+// cluster is updated by a single thread, so the concept sums need no locking
+// or merging, and no memory is allocated. The total quality is summed in
+// cluster order so that it does not depend on the thread scheduling.
+float SPKMeansOpenMP::computeConcepts(ClusterData *data)
+{
+    if(!data->apply_deltas)
+        data->groupByCluster(num_threads);
+
+    #pragma omp parallel for schedule(dynamic)
+    for(int i=0; i<k; i++)
+        refreshConcept(data, i);
+
+    float quality = 0;
+    for(int i=0; i<k; i++)
+        quality += data->qualities[i];
+    return quality;
+}
+
+
+
+// Computes the quality of each changed cluster in parallel (one thread per
+// cluster), and returns the total quality summed in cluster order.
+float SPKMeansOpenMP::computeQ(ClusterData *data)
+{
+    data->groupByCluster(num_threads);
+
+    #pragma omp parallel for schedule(dynamic)
+    for(int i=0; i<k; i++) {
+        if(data->changed[i])
+            clusterQuality(data, i);
+    }
+
+    float quality = 0;
+    for(int i=0; i<k; i++)
+        quality += data->qualities[i];
+    return quality;
+}
+
+
+
 // Runs the spherical k-means algorithm on the given sparse matrix D and
 // clusters the data into k clusters.
 ClusterData* SPKMeansOpenMP::runSPKMeans()
 {
-    // keep track of the run time for this algorithm
-    Timer timer;
-    timer.start();
+    if(batch_size > 0)
+        return runMiniBatch(num_threads);
+    if(online)
+        return runOnline(num_threads);
 
-    // keep track of all individual component times for analysis
-    Timer ptimer;
-    Timer ctimer;
+    // keep track of the run time for this algorithm, and of its phases
+    profile->startRun(num_threads);
 
     // apply the TXN scheme on the document vectors (normalize them)
     txnScheme();
 
     // initialize the data arrays; keep track of the arrays locally
-    ClusterData *data = new ClusterData(k, dc, wc, doc_matrix);
-    float **concepts = data->concepts;
-    bool *changed = data->changed;
-    float *cosines = data->cosine_similarities;
+    ClusterData *data = new ClusterData(k, doc_matrix);
 
     // compute initial partitioning, concepts, and quality
-    initClusters(data);
+    initClusters(data, num_threads);
     float quality = computeQ(data);
-    cout << "Initial quality: " << quality << endl;
+    *out << "Initial quality: " << quality << endl;
 
+    // set up the blocked partitioning engine, if selected
+    SpMMPartitioner *spmm = 0;
+    if(engine == SPMM_ENGINE)
+        spmm = new SpMMPartitioner(data, doc_norms);
 
-    // do spherical k-means loop
+
+    // the documents to partition in the iterations that skip some (see
+    // scheduleDocuments); only needed with priorities
+    int *active = use_priorities ? new int[dc] : 0;
+    total_skipped = 0;
+    skip_bucket = 0;
+
+    // do spherical k-means loop; when priorities are used, the run only
+    // stops after a full (unscheduled) iteration
     float dQ = Q_THRESHOLD * 10;
     int iterations = 0;
-    while(dQ > Q_THRESHOLD) {
+    long total_cosines = 0;
+    bool full = true;
+    while(dQ > Q_THRESHOLD || !full) {
+        full = !use_priorities || iterations == 0 || dQ <= Q_THRESHOLD;
         iterations++;
 
-        // compute new clusters based on old concept vectors
-        ptimer.start();
-        #pragma omp parallel for
-        for(int i=0; i<dc; i++) {
-            int cIndx = 0;
-            // only update cosine similarities if cluster has changed
-            if(changed[0])
-                cosines[i*k] = cosineSimilarity(data, i, 0);
-            for(int j=1; j<k; j++) {
-                if(changed[j]) // again, only if changed
-                    cosines[i*k + j] = cosineSimilarity(data, i, j);
-                if(cosines[i*k + j] > cosines[i*k + cIndx])
-                    cIndx = j;
+        // compute new clusters based on old concept vectors (each thread's
+        // busy time ends when it runs out of documents, before the barrier)
+        profile->start(Profiler::PARTITION_PHASE);
+        long num_cosines = 0;
+        data->prepareMoves(num_threads);
+        if(spmm != 0)
+            num_cosines = spmm->partition(data, num_threads, profile);
+        else {
+            int count = scheduleDocuments(data, active, full);
+            #pragma omp parallel reduction(+:num_cosines)
+            {
+                unsigned long long busy = Profiler::now();
+                long thread_cosines = 0;
+                #pragma omp for schedule(dynamic, 256) nowait
+                for(int a=0; a<count; a++) {
+                    int doc = (count == dc) ? a : active[a];
+                    thread_cosines += partitionDocument(data, doc);
+                    data->checkMoved(omp_get_thread_num(), doc);
+                }
+                profile->addBusy(omp_get_thread_num(), busy, thread_cosines);
+                num_cosines += thread_cosines;
             }
-            data->assignCluster(i, cIndx);
         }
-        ptimer.stop();
-
-        // update which clusters changed since last time, then swap pointers
-        if(optimize)
-            data->findChangedClusters();
+        profile->stop(Profiler::PARTITION_PHASE);
+
+        // collect the moves of all threads (and which clusters changed), then
+        // swap pointers
+        profile->start(Profiler::CHANGES_PHASE);
+        data->mergeMoves(optimize);
+        if(use_priorities)
+            updateSchedule(data);
         data->applyAssignments();
+        profile->stop(Profiler::CHANGES_PHASE);
 
-        // compute new concept vectors and quality
-        ctimer.start();
+        // compute new concept vectors and quality (in delta mode, from the
+        // moved documents only, except for the full recompute iterations)
+        profile->start(Profiler::CONCEPTS_PHASE);
+        startConceptStep(data, iterations);
         float n_quality = computeConcepts(data);
         dQ = n_quality - quality;
         quality = n_quality;
-        ctimer.stop();
+        profile->stop(Profiler::CONCEPTS_PHASE);
 
         // report the quality of the current partitioning
-        reportQuality(data, quality, dQ);
+        reportQuality(data, quality, dQ, num_cosines);
+        total_cosines += num_cosines;
     }
 
 
     // report runtime statistics
-    timer.stop();
-    reportTime(iterations, timer.get(), ptimer.get(), ctimer.get());
+    profile->stopRun();
+    num_iterations = iterations;
+    reportTime(iterations, total_cosines);
+
+    delete[] active;
+    if(spmm != 0)
+        delete spmm;
+
+    // the results are read from the fp32 concepts (see getConcept)
+    data->expandConcepts();
 
     // return the resulting clusters and concepts in the ClusterData struct
     return data;
@@ -0,0 +1,73 @@
+/* File: spkmeans_priority.cpp
+ *
+ * Defines the priority scheduler of the partitioning step. The priority of a
+ * document is 1 - the cosine similarity to its own concept: documents that
+ * are close to their concept are unlikely to move, so they can be skipped
+ * for a few iterations. The priorities are split into PRIORITY_BUCKETS
+ * buckets (see ClusterData::priorityBucket); the Galois runner orders its
+ * worklist by bucket, and all runners skip the lowest buckets.
+ */
+
+#include "spkmeans.h"
+
+using namespace std;
+
+
+
+// Fills the active list with the documents to partition in this iteration,
+// and returns how many there are. Documents in buckets below skip_bucket are
+// skipped, except for those that were already skipped PRIORITY_MAX_SKIP
+// times in a row. Skipped documents keep their cluster, and their skip
+// counts (with the clusters' change stamps) tell partitionDocument which of
+// their cached cosine similarities are stale. If no bucket is skipped (in a
+// full iteration, which is always the case without priorities), dc is
+// returned without a pass over the documents, and the active list is not
+// used: the callers take all documents in order whenever the count is dc.
+int SPKMeans::scheduleDocuments(ClusterData *data, int *active, bool full)
+{
+    data->stampChanges();
+    num_skipped = 0;
+    if(full || skip_bucket == 0)
+        return dc;
+    int count = 0;
+    for(int i=0; i<dc; i++) {
+        if(data->skip_counts[i] >= PRIORITY_MAX_SKIP ||
+           data->priorityBucket(i) >= skip_bucket)
+            active[count++] = i;
+        else {
+            data->skip_counts[i]++;
+            data->p_asgns_new[i] = data->p_asgns[i];
+            num_skipped++;
+        }
+    }
+    total_skipped += num_skipped;
+    return count;
+}
+
+
+
+// Chooses the buckets to skip in the next iteration from the (pre-move)
+// priorities of the documents that moved in this one: the skipped buckets
+// together held at most PRIORITY_MISS_FRACTION of the moved documents. This
+// must be called after ClusterData::mergeMoves, before the assignments are
+// applied.
+void SPKMeans::updateSchedule(ClusterData *data)
+{
+    int moved[PRIORITY_BUCKETS];
+    for(int b=0; b<PRIORITY_BUCKETS; b++)
+        moved[b] = 0;
+    int num_moved = data->num_moved;
+    for(int a=0; a<num_moved; a++)
+        moved[data->priorityBucket(data->moved_out_docs[a])]++;
+
+    // if nothing moved, the next iteration is the last one anyway
+    skip_bucket = 0;
+    if(num_moved == 0)
+        return;
+    int allowed = num_moved * PRIORITY_MISS_FRACTION;
+    int missed = moved[0];
+    while(missed <= allowed && skip_bucket < PRIORITY_BUCKETS - 1) {
+        skip_bucket++;
+        missed += moved[skip_bucket];
+    }
+}
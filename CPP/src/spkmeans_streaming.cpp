@@ -0,0 +1,284 @@
+/* File: spkmeans_streaming.cpp
+ *
+ * Contains the definitions of the streaming (out-of-core) version of the
+ * spherical k-means algorithm. The document matrix is never held in memory:
+ * each iteration reads the binary document file chunk by chunk (see
+ * DocumentStream), assigns the documents of each chunk to their closest
+ * concepts, and adds them to the sums of their new clusters, from which the
+ * next concepts are computed. Only the concepts, the cluster sums and a few
+ * numbers per document stay in memory. The concepts are computed from the
+ * same documents in the same order as in the in-memory runs, so the results
+ * are the same as those of a run with the same (block or random) seeding.
+ */
+
+#include "spkmeans.h"
+
+#include "seeding.h"
+#include "vectors.h"
+
+#include <iostream>
+#include <omp.h>
+
+using namespace std;
+
+
+
+// CONSTRUCTOR: the base class is given the stream's index (the row offsets
+// only), so it knows the dimensions; the document norms are found in the
+// first pass.
+SPKMeansStreaming::SPKMeansStreaming(DocumentStream *stream_, int k_,
+    long memory_budget_, unsigned int t_)
+    : SPKMeans::SPKMeans(stream_->index, k_),
+      stream(stream_), memory_budget(memory_budget_)
+{
+    // make sure num_threads doesn't exceed the max available
+    if(t_ > (unsigned int)omp_get_max_threads() || t_ == 0)
+        num_threads = omp_get_max_threads();
+    else
+        num_threads = t_;
+}
+
+
+// returns the actual number of threads that OpenMP will use
+unsigned int SPKMeansStreaming::getNumThreads()
+{
+    return num_threads;
+}
+
+
+
+// Streams all documents once, and adds each one to the sum of its current
+// cluster (in document order). The document norms are (re)computed from the
+// streamed rows. Returns false if a chunk could not be read.
+bool SPKMeansStreaming::sumPass(ClusterData *data)
+{
+    int first;
+    stream->startPass();
+    while(SparseMatrix *chunk = stream->nextChunk(&first)) {
+        for(int i=0; i<chunk->rows; i++) {
+            int doc = first + i;
+            doc_norms[doc] = chunk->rowNorm(i);
+            chunk->rowScatterAdd(i, data->getSum(data->p_asgns[doc]),
+                                 data->word_stride);
+        }
+    }
+    return !stream->readFailed();
+}
+
+
+
+// Returns the cosine similarity of the given row of the chunk (whose norm is
+// dnorm) and the given concept, like cosineSimilarity.
+static float chunkCosine(ClusterData *data, SparseMatrix *chunk, int row,
+                         float dnorm, int cIndx)
+{
+    float cnorm = data->concept_norms[cIndx];
+    if(cnorm == 0 || dnorm == 0)
+        return 0;
+    return chunk->rowDot(row, data->getConcept(cIndx), data->word_stride)
+           / (dnorm * cnorm);
+}
+
+
+
+// Streams all documents once: the documents of each chunk are assigned to
+// their closest concepts in parallel, and then added to the sums of their
+// new clusters in document order. There is no cosine similarity cache, but
+// if a document's own cluster did not change, no unchanged cluster can beat
+// it (they did not last time), so only the changed clusters are computed.
+// Ties are broken as in partitionDocument (towards the lowest cluster).
+// Adds the number of cosine similarities computed to num_cosines. Returns
+// false if a chunk could not be read.
+bool SPKMeansStreaming::partitionPass(ClusterData *data, long *num_cosines)
+{
+    bool *changed = data->changed;
+    int num_changed = 0;
+    for(int c=0; c<k; c++)
+        num_changed += changed[c] ? 1 : 0;
+
+    int first;
+    stream->startPass();
+    while(SparseMatrix *chunk = stream->nextChunk(&first)) {
+        long chunk_cosines = 0;
+        #pragma omp parallel num_threads(num_threads) \
+            reduction(+:chunk_cosines)
+        {
+            unsigned long long busy = Profiler::now();
+            long thread_cosines = 0;
+            #pragma omp for nowait
+            for(int i=0; i<chunk->rows; i++) {
+                int doc = first + i;
+                float dnorm = doc_norms[doc];
+                int own = data->p_asgns[doc];
+                bool all = changed[own];
+                int cIndx = own;
+                float best = all ? 0
+                                 : chunkCosine(data, chunk, i, dnorm, own);
+                for(int c=0; c<k; c++) {
+                    if((!all && !changed[c]) || c == own)
+                        continue;
+                    float cos = chunkCosine(data, chunk, i, dnorm, c);
+                    if(cos > best || (cos == best && c < cIndx)) {
+                        best = cos;
+                        cIndx = c;
+                    }
+                }
+                if(all) {
+                    float cos = chunkCosine(data, chunk, i, dnorm, own);
+                    if(cos > best || (cos == best && own < cIndx))
+                        cIndx = own;
+                }
+                data->assignCluster(doc, cIndx);
+                thread_cosines += all ? k : num_changed + 1;
+            }
+            profile->addBusy(omp_get_thread_num(), busy, thread_cosines);
+            chunk_cosines += thread_cosines;
+        }
+        *num_cosines += chunk_cosines;
+
+        for(int i=0; i<chunk->rows; i++) {
+            int doc = first + i;
+            chunk->rowScatterAdd(i, data->getSum(data->p_asgns_new[doc]),
+                                 data->word_stride);
+            data->checkMoved(0, doc);
+        }
+    }
+    return !stream->readFailed();
+}
+
+
+
+// Each concept is its normalized cluster sum (computed like in
+// updateConcept), and the quality of the cluster is the norm of the sum.
+// The sums are cleared for the next pass. Returns the total quality.
+float SPKMeansStreaming::conceptsFromSums(ClusterData *data)
+{
+    long stride = data->word_stride;
+    float quality = 0;
+    for(int c=0; c<k; c++) {
+        float *concept = data->getConcept(c);
+        float *sum = data->getSum(c);
+        for(int w=0; w<wc; w++) {
+            concept[w*stride] = sum[w*stride];
+            sum[w*stride] = 0;
+        }
+        float norm = vec_norm_strided(concept, wc, stride);
+        if(norm > 0)
+            vec_divide_strided(concept, wc, stride, norm);
+        data->concept_norms[c] = (norm > 0) ? 1 : 0;
+        data->qualities[c] = norm;
+        quality += norm;
+    }
+    return quality;
+}
+
+
+
+// Runs the spherical k-means algorithm by streaming the documents. Each
+// iteration is a single pass over the file: the documents are assigned with
+// the current concepts and summed up into the next ones at the same time.
+// The memory budget covers the concepts, the cluster sums, STREAM_DOC_BYTES
+// per document, and the two chunk buffers, which get what is left of it.
+ClusterData* SPKMeansStreaming::runSPKMeans()
+{
+    // keep track of the run time for this algorithm, and of its phases
+    profile->startRun(num_threads);
+
+    // the streamed rows are normalized as they are read (TXN scheme)
+    stream->normalize = (prep_scheme == TXN_SCHEME);
+
+    // the concepts and the cluster sums stay in memory
+    ClusterData *data = new ClusterData(k, doc_matrix);
+    data->allocateConcepts(concept_layout, huge_pages);
+    data->allocateSums();
+    long resident = 2 * data->conceptBytes() + (long)dc * STREAM_DOC_BYTES;
+    float mb = 1024 * 1024;
+    long buffer_bytes = (memory_budget - resident) / 2;
+    if(buffer_bytes <= 0 || !stream->planChunks(buffer_bytes)) {
+        *out << "Error: a memory budget of " << memory_budget / mb
+             << " MB is too small (the concepts, cluster sums and document "
+             << "arrays take " << resident / mb << " MB)." << endl;
+        delete data;
+        return 0;
+    }
+    *out << "Streaming: " << stream->numChunks() << " chunks of up to "
+         << DocumentStream::chunkBytes(stream->max_chunk_rows,
+                                       stream->max_chunk_nnz) / mb
+         << " MB (" << resident / mb << " MB resident, budget "
+         << memory_budget / mb << " MB)." << endl;
+
+    // only the seedings that do not look at the documents can be streamed
+    profile->start(Profiler::INIT_PHASE);
+    profile->start(Profiler::SEEDING_PHASE);
+    if(seeding == RANDOM_SEEDING) {
+        *out << "Seeding: random partition (seed " << seed << ")" << endl;
+        seedRandom(data, seed);
+    }
+    else {
+        if(seeding != BLOCK_SEEDING)
+            *out << "Note: the k-means++ seedings need random access to the "
+                 << "documents; streaming uses block seeding." << endl;
+        *out << "Split = " << dc / k << endl;
+        seedBlocks(data);
+    }
+    profile->stop(Profiler::SEEDING_PHASE);
+    seed_time = profile->millis(Profiler::SEEDING_PHASE);
+
+    // compute the initial concepts and quality
+    bool ok = sumPass(data);
+    float quality = conceptsFromSums(data);
+    profile->stop(Profiler::INIT_PHASE);
+    if(ok)
+        *out << "Initial quality: " << quality << endl;
+
+    // do spherical k-means loop
+    float dQ = Q_THRESHOLD * 10;
+    int iterations = 0;
+    long total_cosines = 0;
+    while(ok && dQ > Q_THRESHOLD) {
+        iterations++;
+
+        // assign the documents and sum up their new clusters
+        profile->start(Profiler::PARTITION_PHASE);
+        long num_cosines = 0;
+        data->prepareMoves();
+        ok = partitionPass(data, &num_cosines);
+        profile->stop(Profiler::PARTITION_PHASE);
+
+        // collect the moves (and which clusters changed), then swap pointers
+        profile->start(Profiler::CHANGES_PHASE);
+        data->mergeMoves(optimize);
+        data->applyAssignments();
+        profile->stop(Profiler::CHANGES_PHASE);
+
+        // compute new concept vectors and quality
+        profile->start(Profiler::CONCEPTS_PHASE);
+        float n_quality = conceptsFromSums(data);
+        dQ = n_quality - quality;
+        quality = n_quality;
+        profile->stop(Profiler::CONCEPTS_PHASE);
+
+        // report the quality of the current partitioning
+        if(ok)
+            reportQuality(data, quality, dQ, num_cosines);
+        total_cosines += num_cosines;
+    }
+    if(!ok) {
+        *out << "Error: could not read the documents from the binary file ("
+             << stream->getError() << ")." << endl;
+        delete data;
+        return 0;
+    }
+
+    // report runtime statistics, with the time spent waiting for reads
+    profile->stopRun();
+    num_iterations = iterations;
+    reportTime(iterations, total_cosines);
+    *out << "Streamed " << stream->bytes_read / mb << " MB in "
+         << iterations + 1 << " passes (" << stream->waitTime()
+         << " ms waiting for reads)." << endl;
+
+    // the sums are not part of the results
+    data->clearSums();
+    return data;
+}
@@ -0,0 +1,169 @@
+/* File: spkmeans_topm.cpp
+ *
+ * Defines the partitioning step with the top-m candidate cache. Instead of
+ * caching all k cosine similarities of each document, only m candidate
+ * clusters (the best ones seen so far) are kept with an upper bound of each
+ * similarity, and a single upper bound for all other clusters. Like in
+ * bounds mode, the bounds grow by the drift of the changed concepts, and a
+ * similarity is only computed if its bound could beat the best one so far.
+ * Only if the bound of the other clusters could beat it are they scanned;
+ * since the unchanged ones cannot have improved, usually only the changed
+ * ones need to be computed.
+ */
+
+#include "spkmeans.h"
+
+using namespace std;
+
+
+
+// Offers the given cluster and its (exact) similarity to the document's
+// candidates: it takes an empty slot, or replaces the candidate with the
+// lowest bound if its similarity is higher. The bound of the replaced
+// candidate (or the similarity itself, if it is not taken) is folded into
+// the bound of the other clusters.
+static void offerCandidate(int *clusters, float *bounds, int m, float *rest,
+                           int cIndx, float cos)
+{
+    int slot = 0;
+    for(int i=0; i<m; i++) {
+        if(clusters[i] < 0) {
+            slot = i;
+            break;
+        }
+        if(bounds[i] < bounds[slot])
+            slot = i;
+    }
+
+    if(clusters[slot] >= 0 && bounds[slot] >= cos) {
+        if(cos > *rest)
+            *rest = cos;
+        return;
+    }
+    if(clusters[slot] >= 0 && bounds[slot] > *rest)
+        *rest = bounds[slot];
+    clusters[slot] = cIndx;
+    bounds[slot] = cos;
+}
+
+
+
+// Returns true if the given cluster is one of the document's candidates.
+static bool isCandidate(int *clusters, int m, int cIndx)
+{
+    for(int i=0; i<m; i++) {
+        if(clusters[i] == cIndx)
+            return true;
+    }
+    return false;
+}
+
+
+
+// Finds the cluster with the highest cosine similarity to the given document
+// using its top-m candidates, and assigns the document to it. The bounds of
+// the changed candidates grow by their concept drift. The own cluster is
+// always a candidate with an exact similarity (it was the best one), so the
+// other candidates are only computed if their bounds are above the best
+// similarity so far. If the bound of the other clusters, grown by the
+// largest drift of this iteration, is still above the best similarity, the
+// changed other clusters are computed and offered as candidates. Documents
+// without candidates (in the first iteration), that were skipped by the
+// priority scheduler, or whose unchanged other clusters could still be
+// better are scanned against all clusters. The document's priority is set
+// to 1 - the similarity to its own concept.
+// Returns the number of cosine similarities that were actually computed.
+int SPKMeans::partitionDocumentTop(ClusterData *data, int doc_index)
+{
+    int m = data->top_m;
+    int *clusters = data->top_clusters + (long)doc_index * m;
+    float *bounds = data->top_bounds + (long)doc_index * m;
+    float *rest = data->rest_bounds + doc_index;
+    bool *changed = data->changed;
+    int own = data->p_asgns[doc_index];
+    int computed = 0;
+
+    // grow the bounds of the candidates, and find the own cluster
+    int own_pos = -1;
+    for(int i=0; i<m; i++) {
+        int c = clusters[i];
+        if(c < 0)
+            continue;
+        if(changed[c])
+            bounds[i] += data->concept_drifts[c];
+        if(c == own)
+            own_pos = i;
+    }
+    bool full = (own_pos < 0 || data->skip_counts[doc_index] > 0);
+
+    // check the candidates, starting with the own cluster
+    int cIndx = own;
+    float best = -BOUND_MAX;
+    if(!full) {
+        if(changed[own]) {
+            bounds[own_pos] = cosineSimilarity(data, doc_index, own);
+            computed++;
+        }
+        best = bounds[own_pos];
+        data->doc_priorities[doc_index] = 1 - best;
+        for(int i=0; i<m; i++) {
+            if(i == own_pos || clusters[i] < 0 || bounds[i] <= best)
+                continue;
+            bounds[i] = cosineSimilarity(data, doc_index, clusters[i]);
+            computed++;
+            if(bounds[i] > best) {
+                best = bounds[i];
+                cIndx = clusters[i];
+            }
+        }
+    }
+
+    // scan the changed other clusters if one of them could be better; if
+    // the unchanged ones could still be better after that, scan them all
+    if(!full && *rest + data->max_drift > best) {
+        float unchanged = *rest;
+        for(int j=0; j<k; j++) {
+            if(!changed[j] || isCandidate(clusters, m, j))
+                continue;
+            float cos_j = cosineSimilarity(data, doc_index, j);
+            computed++;
+            offerCandidate(clusters, bounds, m, rest, j, cos_j);
+            if(cos_j > best) {
+                best = cos_j;
+                cIndx = j;
+            }
+        }
+        full = (unchanged > best);
+        if(!full) {
+            #pragma omp atomic
+            data->num_rescans++;
+        }
+    }
+    else if(!full)
+        *rest += data->max_drift;
+
+    if(full) {
+        for(int i=0; i<m; i++)
+            clusters[i] = -1;
+        *rest = -BOUND_MAX;
+        cIndx = own;
+        best = -BOUND_MAX;
+        for(int j=0; j<k; j++) {
+            float cos_j = cosineSimilarity(data, doc_index, j);
+            computed++;
+            if(j == own)
+                data->doc_priorities[doc_index] = 1 - cos_j;
+            offerCandidate(clusters, bounds, m, rest, j, cos_j);
+            if(cos_j > best) {
+                best = cos_j;
+                cIndx = j;
+            }
+        }
+        #pragma omp atomic
+        data->num_rescans++;
+    }
+
+    data->skip_counts[doc_index] = 0;
+    data->assignCluster(doc_index, cIndx);
+    return computed;
+}
@@ -0,0 +1,166 @@
+/* File: spmm_partitioner.cpp
+ *
+ * Defines the SpMMPartitioner functions: the tiled sparse-times-dense
+ * computation of the document-cluster cosine similarities, followed by the
+ * argmax over each document's similarities.
+ */
+
+#include "spmm_partitioner.h"
+
+#include "vectors.h"
+
+#include <omp.h>
+
+
+
+// Constructor: choose the tile width so that a wc by tile_width block of
+// concept values fits in the tile cache budget (but is at least one full
+// SIMD register wide), and allocate the tiles for all k clusters.
+SpMMPartitioner::SpMMPartitioner(ClusterData *data, float *doc_norms_)
+    : k(data->k), dc(data->dc), wc(data->wc), doc_norms(doc_norms_)
+{
+    tile_width = SPMM_TILE_BYTES / (sizeof(float) * (wc > 0 ? wc : 1));
+    tile_width -= tile_width % SPMM_TILE_ALIGN;
+    if(tile_width < SPMM_TILE_ALIGN)
+        tile_width = SPMM_TILE_ALIGN;
+    int max_tiles = (k + tile_width - 1) / tile_width;
+
+    columns = new int[k];
+    num_columns = 0;
+    tiles = new float[(long)max_tiles * tile_width * wc];
+    num_tiles = 0;
+}
+
+
+
+// Destructor: clean up the tile memory.
+SpMMPartitioner::~SpMMPartitioner()
+{
+    delete[] columns;
+    delete[] tiles;
+}
+
+
+
+// Finds the clusters that changed, and copies their concept vectors into the
+// transposed tiles, divided by their norms (so the tile products are already
+// cosine similarities up to the document norm). Unused columns of the last
+// tile are zero. Tiles are filled in parallel with the given number of
+// threads.
+void SpMMPartitioner::buildTiles(ClusterData *data, int num_threads)
+{
+    num_columns = 0;
+    for(int j=0; j<k; j++) {
+        if(data->changed[j])
+            columns[num_columns++] = j;
+    }
+    num_tiles = (num_columns + tile_width - 1) / tile_width;
+
+    #pragma omp parallel for num_threads(num_threads)
+    for(int t=0; t<num_tiles; t++) {
+        float *tile = tiles + (long)t * tile_width * wc;
+        for(int c=0; c<tile_width; c++) {
+            int col = t * tile_width + c;
+            if(col >= num_columns) {
+                for(int w=0; w<wc; w++)
+                    tile[(long)w*tile_width + c] = 0;
+                continue;
+            }
+            int cIndx = columns[col];
+            float *concept = data->getConcept(cIndx);
+            long stride = data->word_stride;
+            float norm = data->concept_norms[cIndx];
+            float scale = (norm > 0) ? 1 / norm : 0;
+            for(int w=0; w<wc; w++)
+                tile[(long)w*tile_width + c] = concept[w*stride] * scale;
+        }
+    }
+}
+
+
+
+// Multiplies each document in the given block with each concept in the
+// given tile, and stores the cosine similarities in the cache. For each
+// non-zero (word, value) of a document, the word's row of the tile is scaled
+// by the value and added to the document's accumulator, so the inner loop
+// is a contiguous (vectorized) operation over the tile width.
+void SpMMPartitioner::multiplyBlock(ClusterData *data, int block, int tile,
+                                    float *acc)
+{
+    SparseMatrix *docs = data->docs;
+    float *tile_data = tiles + (long)tile * tile_width * wc;
+    int first_col = tile * tile_width;
+    int cols = num_columns - first_col;
+    if(cols > tile_width)
+        cols = tile_width;
+
+    int begin = block * SPMM_DOC_BLOCK;
+    int end = begin + SPMM_DOC_BLOCK;
+    if(end > dc)
+        end = dc;
+    for(int i=begin; i<end; i++) {
+        for(int c=0; c<tile_width; c++)
+            acc[c] = 0;
+        for(int a=docs->offsets[i]; a<docs->offsets[i+1]; a++) {
+            float *row = tile_data + (long)docs->indices[a] * tile_width;
+            vec_add_scaled(acc, row, tile_width, docs->value(i, a));
+        }
+
+        float *cosines = data->cosine_similarities + (long)i * k;
+        float dnorm = doc_norms[i];
+        for(int c=0; c<cols; c++)
+            cosines[columns[first_col + c]] = (dnorm > 0) ? acc[c]/dnorm : 0;
+    }
+}
+
+
+
+// Runs the partitioning step: computes the similarities of every document
+// with every changed cluster (one cluster tile at a time for each block of
+// documents), then assigns each document to the cluster with the highest
+// similarity. Blocks of documents are processed in parallel with the given
+// number of threads; the moves are recorded with ClusterData::checkMoved,
+// so ClusterData::prepareMoves must be called first. If a profiler is given,
+// the busy time and cosine similarities of each thread are added to it.
+long SpMMPartitioner::partition(ClusterData *data, int num_threads,
+                                Profiler *profile)
+{
+    buildTiles(data, num_threads);
+
+    int num_blocks = (dc + SPMM_DOC_BLOCK - 1) / SPMM_DOC_BLOCK;
+    #pragma omp parallel num_threads(num_threads)
+    {
+        unsigned long long busy = Profiler::now();
+        long num_docs = 0;
+        float *acc = new float[tile_width];
+
+        #pragma omp for schedule(dynamic) nowait
+        for(int b=0; b<num_blocks; b++) {
+            for(int t=0; t<num_tiles; t++)
+                multiplyBlock(data, b, t, acc);
+
+            // take the argmax over each document's row of similarities
+            int begin = b * SPMM_DOC_BLOCK;
+            int end = (begin + SPMM_DOC_BLOCK < dc) ? begin + SPMM_DOC_BLOCK
+                                                    : dc;
+            num_docs += end - begin;
+            for(int i=begin; i<end; i++) {
+                float *cosines = data->cosine_similarities + (long)i * k;
+                int cIndx = 0;
+                for(int j=1; j<k; j++) {
+                    if(cosines[j] > cosines[cIndx])
+                        cIndx = j;
+                }
+                data->assignCluster(i, cIndx);
+                data->checkMoved(omp_get_thread_num(), i);
+            }
+        }
+
+        delete[] acc;
+        if(profile != 0)
+            profile->addBusy(omp_get_thread_num(), busy,
+                             num_docs * num_columns);
+    }
+
+    return (long)dc * num_columns;
+}
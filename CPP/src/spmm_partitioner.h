@@ -0,0 +1,71 @@
+/* File: spmm_partitioner.h
+ *
+ * Contains the SpMMPartitioner class, an alternative engine for the
+ * partitioning step of spherical k-means. Instead of computing one cosine
+ * similarity at a time, it computes the whole document-by-cluster similarity
+ * block as a sparse (documents) times dense (concepts) matrix product, tiled
+ * so that each tile of concept vectors stays in cache while a block of
+ * documents is multiplied against it.
+ */
+
+#ifndef SPMM_PARTITIONER_H
+#define SPMM_PARTITIONER_H
+
+#include "cluster_data.h"
+#include "profiler.h"
+
+// number of documents multiplied against each cluster tile at a time
+#define SPMM_DOC_BLOCK 128
+// cache budget for one tile of (transposed) concept vectors, in bytes
+#define SPMM_TILE_BYTES (512 * 1024)
+// cluster tile widths are a multiple of this (one AVX-512 register)
+#define SPMM_TILE_ALIGN 16
+
+
+// SpMMPartitioner class keeps the transposed concept tiles and the tiling
+// parameters between iterations, so no memory is allocated per iteration.
+class SpMMPartitioner {
+
+  private:
+
+    // sizes (clusters, documents, words) and document norms (not owned)
+    int k;
+    int dc;
+    int wc;
+    float *doc_norms;
+
+    // changed clusters (as indices) being recomputed in this iteration
+    int *columns;
+    int num_columns;
+
+    // transposed concept tiles: tile t holds a wc by tile_width block, where
+    // row w has word w of each concept in the tile (scaled by 1/norm)
+    float *tiles;
+    int tile_width;
+    int num_tiles;
+
+    // copies the changed concept vectors into the transposed tiles
+    void buildTiles(ClusterData *data, int num_threads);
+
+    // multiplies one block of documents with one tile of concepts
+    void multiplyBlock(ClusterData *data, int block, int tile, float *acc);
+
+  public:
+
+    // Constructor: set up the tiles for the given data (k, dc, wc).
+    SpMMPartitioner(ClusterData *data, float *doc_norms_);
+
+    // Destructor: clean up the tile memory.
+    ~SpMMPartitioner();
+
+    // Computes the cosine similarities of all documents with all changed
+    // clusters, and assigns each document to its best cluster. Returns the
+    // number of cosine similarities computed. The threads' work is added to
+    // the given profiler (if any).
+    long partition(ClusterData *data, int num_threads = 1,
+                   Profiler *profile = 0);
+
+};
+
+
+#endif
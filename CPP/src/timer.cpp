@@ -7,13 +7,12 @@
 
 #include "timer.h"
 
-using namespace boost::posix_time;
+using namespace std::chrono;
 
 
 // Constructor: initializes the timer's counter to 0.
 Timer::Timer()
 {
-    started = false;
     running = false;
     counter = 0;
 }
@@ -23,8 +22,7 @@ Timer::Timer()
 // or after a reset).
 void Timer::start()
 {
-    start_t = microsec_clock::local_time();
-    started = true;
+    start_t = steady_clock::now();
     running = true;
 }
 
@@ -39,33 +37,36 @@ void Timer::stop()
 }
 
 
-// Resets the timer's counter back to 0.
+// Stops the timer, and resets its counter back to 0.
 void Timer::reset()
 {
-    started = false;
+    running = false;
     counter = 0;
 }
 
 
-// Returns the number of milliseconds that passed since the last start()
-// functon call. If it was never called, returns 0.
-unsigned long Timer::getDiff()
+// Returns the number of nanoseconds that passed since the last start()
+// function call. If the timer is not running, returns 0.
+unsigned long long Timer::getDiff()
 {
-    if(!started)
+    if(!running)
         return 0;
-
-    ptime end_t = microsec_clock::local_time();
-    time_duration diff = end_t - start_t;
-    return diff.total_milliseconds();
+    return duration_cast<nanoseconds>(steady_clock::now() - start_t).count();
 }
 
 
-// Returns the number of seconds elapsed while the timer was running. Stopping
-// the timer does not reset the counter value.
+// Returns the number of milliseconds elapsed while the timer was running
+// (including the current interval, if it is still running). Stopping the
+// timer does not reset the counter value.
 unsigned long Timer::get()
 {
-    if(running)
-        return getDiff();
-    else
-        return counter;
+    return getNanos() / 1000000;
+}
+
+
+// Returns the number of nanoseconds elapsed while the timer was running,
+// like get().
+unsigned long long Timer::getNanos()
+{
+    return counter + getDiff();
 }
@@ -2,24 +2,24 @@
  *
  * Provides an abstraction for a Timer object to keep track of the processing
  * time of the various algorithm implementation. This class allows different
- * libraries to be swapped out in the underlying timer implementation.
+ * libraries to be swapped out in the underlying timer implementation (it
+ * uses the monotonic std::chrono::steady_clock, with nanosecond resolution).
  */
 
 #ifndef TIMER_H
 #define TIMER_H
 
-#include "boost/date_time/local_time/local_time.hpp"
+#include <chrono>
 
 
 class Timer {
   private:
-    boost::posix_time::ptime start_t;
-    bool started; // true if the timer was ever started with start()
+    std::chrono::steady_clock::time_point start_t;
     bool running; // true if the timer is currently ticking
-    unsigned long counter;
+    unsigned long long counter; // nanoseconds of the finished intervals
 
-    // returns the number of milliseconds since start() was called
-    unsigned long getDiff();
+    // returns the number of nanoseconds since start() was called
+    unsigned long long getDiff();
 
 
   public:
@@ -29,11 +29,14 @@ class Timer {
     void start();
     void stop();
 
-    // reset the counter to 0
+    // stop the clock and reset the counter to 0
     void reset();
 
     // return the number of milliseconds that passed
     unsigned long get();
+
+    // return the number of nanoseconds that passed
+    unsigned long long getNanos();
 };
 
 
@@ -1,22 +1,206 @@
 /* File: vectors.cpp
  *
  * This file contains basic vector manipulation functions used by the
- * spherical K-means algorithm.
+ * spherical K-means algorithm. The scalar versions of the hot kernels are
+ * defined here, and the public functions dispatch to the best kernel set
+ * that the CPU supports (see vectors_simd.cpp).
  */
 
 #include "vectors.h"
 
+#include "vectors_simd.h"
+
 #include <math.h>
 
 
 
-// Returns the norm of the given vector (array).
-float vec_norm(float *vec, int size)
+/******************************* SCALAR KERNELS *******************************/
+
+
+// Returns the sum of the squares of each component of the vector.
+static float scalar_norm_squared(float *vec, int size)
 {
     float squared_sum = 0;
     for(int i=0; i<size; i++)
         squared_sum += vec[i] * vec[i];
-    return sqrt(squared_sum);
+    return squared_sum;
+}
+
+
+// Returns the dot product of the two vectors.
+static float scalar_dot(float *vec1, float *vec2, int size)
+{
+    float dotp = 0;
+    for(int i=0; i<size; i++)
+        dotp += vec1[i] * vec2[i];
+    return dotp;
+}
+
+
+// Returns the dot product of a dense and a sparse vector.
+static float scalar_sparse_dot(float *dense, int *indices, float *values,
+                               int count)
+{
+    float dotp = 0;
+    for(int i=0; i<count; i++)
+        dotp += dense[indices[i]] * values[i];
+    return dotp;
+}
+
+
+// [in-place] Adds the sparse vector to the dense one.
+static void scalar_scatter_add(float *dense, int *indices, float *values,
+                               int count)
+{
+    for(int i=0; i<count; i++)
+        dense[indices[i]] += values[i];
+}
+
+
+// [in-place] Adds the second vector to the first.
+static void scalar_add(float *vec1, float *vec2, int size)
+{
+    for(int i=0; i<size; i++)
+        vec1[i] += vec2[i];
+}
+
+
+// [in-place] Adds the second vector, scaled by the given value, to the first.
+static void scalar_add_scaled(float *vec1, float *vec2, int size, float scale)
+{
+    for(int i=0; i<size; i++)
+        vec1[i] += vec2[i] * scale;
+}
+
+
+// [in-place] Multiplies each component by the given value.
+static void scalar_multiply(float *vec, int size, float value)
+{
+    for(int i=0; i<size; i++)
+        vec[i] *= value;
+}
+
+
+// [in-place] Divides each component by the given value.
+static void scalar_divide(float *vec, int size, float value)
+{
+    for(int i=0; i<size; i++)
+        vec[i] /= value;
+}
+
+
+
+/****************************** KERNEL DISPATCH *******************************/
+
+
+// The kernel table used by the dispatched vector functions.
+struct KernelTable {
+    VecKernels type;
+    float (*norm_squared)(float*, int);
+    float (*dot)(float*, float*, int);
+    float (*sparse_dot)(float*, int*, float*, int);
+    void (*scatter_add)(float*, int*, float*, int);
+    void (*add)(float*, float*, int);
+    void (*add_scaled)(float*, float*, int, float);
+    void (*multiply)(float*, int, float);
+    void (*divide)(float*, int, float);
+};
+
+
+// Returns true if the CPU supports the given kernel set.
+static bool cpuSupports(VecKernels type)
+{
+#ifdef VEC_HAVE_SIMD
+    if(type == VEC_AVX512)
+        return __builtin_cpu_supports("avx512f");
+    if(type == VEC_AVX2)
+        return __builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma");
+#endif
+    return type == VEC_SCALAR;
+}
+
+
+// Returns the kernel table for the given kernel set (which must be supported
+// by the CPU). AVX2 has no scatter instruction, so it uses the scalar one.
+static KernelTable makeKernels(VecKernels type)
+{
+    KernelTable t = { VEC_SCALAR, scalar_norm_squared, scalar_dot,
+                      scalar_sparse_dot, scalar_scatter_add, scalar_add,
+                      scalar_add_scaled, scalar_multiply, scalar_divide };
+#ifdef VEC_HAVE_SIMD
+    if(type == VEC_AVX2) {
+        KernelTable avx2 = { VEC_AVX2, avx2_norm_squared, avx2_dot,
+                             avx2_sparse_dot, scalar_scatter_add, avx2_add,
+                             avx2_add_scaled, avx2_multiply, avx2_divide };
+        t = avx2;
+    }
+    else if(type == VEC_AVX512) {
+        KernelTable avx512 = { VEC_AVX512, avx512_norm_squared, avx512_dot,
+                               avx512_sparse_dot, avx512_scatter_add,
+                               avx512_add, avx512_add_scaled,
+                               avx512_multiply, avx512_divide };
+        t = avx512;
+    }
+#endif
+    return t;
+}
+
+
+// Returns the kernel table of the best kernel set supported by the CPU.
+static KernelTable bestKernels()
+{
+    if(cpuSupports(VEC_AVX512))
+        return makeKernels(VEC_AVX512);
+    if(cpuSupports(VEC_AVX2))
+        return makeKernels(VEC_AVX2);
+    return makeKernels(VEC_SCALAR);
+}
+
+
+// the active kernel table (chosen once, when the program starts)
+static KernelTable kernels = bestKernels();
+
+
+
+// Selects the kernel set used by the dispatched functions. Returns false
+// (and keeps the current set) if the CPU does not support the requested one.
+bool vec_set_kernels(VecKernels type)
+{
+    if(!cpuSupports(type))
+        return false;
+    kernels = makeKernels(type);
+    return true;
+}
+
+
+
+// Returns the kernel set currently in use.
+VecKernels vec_get_kernels()
+{
+    return kernels.type;
+}
+
+
+
+// Returns the name of the kernel set currently in use.
+const char* vec_kernels_name()
+{
+    if(kernels.type == VEC_AVX512)
+        return "AVX-512";
+    if(kernels.type == VEC_AVX2)
+        return "AVX2";
+    return "scalar";
+}
+
+
+
+/****************************** VECTOR FUNCTIONS ******************************/
+
+
+// Returns the norm of the given vector (array).
+float vec_norm(float *vec, int size)
+{
+    return sqrt(kernels.norm_squared(vec, size));
 }
 
 
@@ -35,10 +219,16 @@ float vec_sum(float *vec, int size)
 // Returns the dot product of the two given vectors.
 float vec_dot(float *vec1, float *vec2, int size)
 {
-    float dotp = 0;
-    for(int i=0; i<size; i++)
-        dotp += vec1[i] * vec2[i];
-    return dotp;
+    return kernels.dot(vec1, vec2, size);
+}
+
+
+
+// Returns the dot product of a dense vector and a sparse vector (given by
+// its non-zero values and their indices into the dense vector).
+float vec_sparse_dot(float *dense, int *indices, float *values, int count)
+{
+    return kernels.sparse_dot(dense, indices, values, count);
 }
 
 
@@ -88,8 +278,25 @@ float* vec_zeros(int size)
 // vector but leaving the second unchanged.
 void vec_add(float *vec1, float *vec2, int size)
 {
-    for(int i=0; i<size; i++)
-        vec1[i] += vec2[i];
+    kernels.add(vec1, vec2, size);
+}
+
+
+
+// [in-place] Adds the second vector, multiplied by the given scale, to the
+// first one.
+void vec_add_scaled(float *vec1, float *vec2, int size, float scale)
+{
+    kernels.add_scaled(vec1, vec2, size, scale);
+}
+
+
+
+// [in-place] Adds a sparse vector (given by its non-zero values and their
+// indices) to the dense vector. The indices must not contain duplicates.
+void vec_scatter_add(float *dense, int *indices, float *values, int count)
+{
+    kernels.scatter_add(dense, indices, values, count);
 }
 
 
@@ -97,8 +304,7 @@ void vec_add(float *vec1, float *vec2, int size)
 // [in-place] Multiplies each value in the given vector by the given number.
 void vec_multiply(float *vec, int size, float value)
 {
-    for(int i=0; i<size; i++)
-        vec[i] *= value;
+    kernels.multiply(vec, size, value);
 }
 
 
@@ -106,8 +312,7 @@ void vec_multiply(float *vec, int size, float value)
 // [in-place] Divides each value in the given vector by the given number.
 void vec_divide(float *vec, int size, float value)
 {
-    for(int i=0; i<size; i++)
-        vec[i] /= value;
+    kernels.divide(vec, size, value);
 }
 
 
@@ -129,3 +334,66 @@ void vec_normalize(float *vec, int size)
     if(norm > 0)
         vec_divide(vec, size, norm);
 }
+
+
+
+// Returns the norm of the given strided vector.
+float vec_norm_strided(float *vec, int size, long stride)
+{
+    if(stride == 1)
+        return vec_norm(vec, size);
+    float squared_sum = 0;
+    for(int i=0; i<size; i++)
+        squared_sum += vec[i*stride] * vec[i*stride];
+    return sqrt(squared_sum);
+}
+
+
+
+// Returns the dot product of a strided dense vector and a sparse vector.
+float vec_sparse_dot_strided(float *dense, long stride,
+                             int *indices, float *values, int count)
+{
+    if(stride == 1)
+        return kernels.sparse_dot(dense, indices, values, count);
+    float dotp = 0;
+    for(int i=0; i<count; i++)
+        dotp += dense[indices[i]*stride] * values[i];
+    return dotp;
+}
+
+
+
+// [in-place] Adds a sparse vector to the strided dense vector.
+void vec_scatter_add_strided(float *dense, long stride,
+                             int *indices, float *values, int count)
+{
+    if(stride == 1) {
+        kernels.scatter_add(dense, indices, values, count);
+        return;
+    }
+    for(int i=0; i<count; i++)
+        dense[indices[i]*stride] += values[i];
+}
+
+
+
+// [in-place] Sets each value of the strided vector to the given number.
+void vec_fill_strided(float *vec, int size, long stride, float value)
+{
+    for(int i=0; i<size; i++)
+        vec[i*stride] = value;
+}
+
+
+
+// [in-place] Divides each value of the strided vector by the given number.
+void vec_divide_strided(float *vec, int size, long stride, float value)
+{
+    if(stride == 1) {
+        kernels.divide(vec, size, value);
+        return;
+    }
+    for(int i=0; i<size; i++)
+        vec[i*stride] /= value;
+}
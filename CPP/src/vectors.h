@@ -1,13 +1,33 @@
 /* File: vectors.h
  *
  * This file contains basic vector manipulation functions used by the
- * spherical K-means algorithm.
+ * spherical K-means algorithm. The hot kernels (norms, dot products, and the
+ * sparse gather/scatter operations) are dispatched at runtime to AVX-512 or
+ * AVX2 implementations if the CPU supports them, with a scalar fallback.
  */
 
 #ifndef VECTORS_H
 #define VECTORS_H
 
 
+// Available kernel sets for the dispatched vector functions.
+enum VecKernels {
+    VEC_SCALAR,
+    VEC_AVX2,
+    VEC_AVX512
+};
+
+// Selects the kernel set used by the dispatched functions. Returns false (and
+// keeps the current set) if the CPU does not support the requested one.
+bool vec_set_kernels(VecKernels type);
+
+// Returns the kernel set currently in use (the best available by default).
+VecKernels vec_get_kernels();
+
+// Returns the name of the kernel set currently in use.
+const char* vec_kernels_name();
+
+
 // Returns the norm of the given vector (array).
 float vec_norm(float *vec, int size);
 
@@ -17,6 +37,10 @@ float vec_sum(float *vec, int size);
 // Returns the dot product of the two given vectors.
 float vec_dot(float *vec1, float *vec2, int size);
 
+// Returns the dot product of a dense vector and a sparse vector, given by
+// the count non-zero values and their indices into the dense vector.
+float vec_sparse_dot(float *dense, int *indices, float *values, int count);
+
 // [return] Returns a new vector that is the sum of the given list of vectors.
 float* vec_sum(float **vecs, int size, int num_vecs);
 
@@ -30,6 +54,14 @@ float* vec_zeros(int size);
 // [in-place] Adds the second vector to the first one.
 void vec_add(float *vec1, float *vec2, int size);
 
+// [in-place] Adds the second vector, multiplied by the given scale, to the
+// first one.
+void vec_add_scaled(float *vec1, float *vec2, int size, float scale);
+
+// [in-place] Adds a sparse vector (count values and their indices) to the
+// given dense vector. The indices must not contain duplicates.
+void vec_scatter_add(float *dense, int *indices, float *values, int count);
+
 // [in-place] Multiplies each value in the given vector by the given number.
 void vec_multiply(float *vec, int size, float value);
 
@@ -44,4 +76,27 @@ void vec_pow(float *vec, int size, float power);
 void vec_normalize(float *vec, int size);
 
 
+
+// Strided versions of the vector functions: component i of the (dense)
+// vector is stored at vec[i*stride]. If the stride is 1, these use the same
+// dispatched kernels as the contiguous versions.
+
+// Returns the norm of the given strided vector.
+float vec_norm_strided(float *vec, int size, long stride);
+
+// Returns the dot product of a strided dense vector and a sparse vector.
+float vec_sparse_dot_strided(float *dense, long stride,
+                             int *indices, float *values, int count);
+
+// [in-place] Adds a sparse vector to the strided dense vector.
+void vec_scatter_add_strided(float *dense, long stride,
+                             int *indices, float *values, int count);
+
+// [in-place] Sets each value of the strided vector to the given number.
+void vec_fill_strided(float *vec, int size, long stride, float value);
+
+// [in-place] Divides each value of the strided vector by the given number.
+void vec_divide_strided(float *vec, int size, long stride, float value);
+
+
 #endif
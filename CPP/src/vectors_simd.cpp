@@ -0,0 +1,309 @@
+/* File: vectors_simd.cpp
+ *
+ * Defines the AVX2 and AVX-512 versions of the hot vector kernels. Each
+ * function is compiled for its own instruction set (using target
+ * attributes), so the rest of the program does not need any special flags
+ * and can still run on CPUs without these extensions.
+ */
+
+#include "vectors_simd.h"
+
+#ifdef VEC_HAVE_SIMD
+
+#include <immintrin.h>
+
+#define AVX2 __attribute__((target("avx2,fma")))
+#define AVX512 __attribute__((target("avx512f")))
+
+
+
+/******************************** AVX2 KERNELS ********************************/
+
+
+// Returns the horizontal sum of the 8 floats of an AVX register.
+AVX2 static inline float avx2_hsum(__m256 v)
+{
+    __m128 sum = _mm_add_ps(_mm256_castps256_ps128(v),
+                            _mm256_extractf128_ps(v, 1));
+    sum = _mm_add_ps(sum, _mm_movehl_ps(sum, sum));
+    sum = _mm_add_ss(sum, _mm_movehdup_ps(sum));
+    return _mm_cvtss_f32(sum);
+}
+
+
+// Returns the sum of the squares of each component of the vector.
+AVX2 float avx2_norm_squared(float *vec, int size)
+{
+    __m256 acc0 = _mm256_setzero_ps();
+    __m256 acc1 = _mm256_setzero_ps();
+    int i = 0;
+    for(; i+16<=size; i+=16) {
+        __m256 a = _mm256_loadu_ps(vec + i);
+        __m256 b = _mm256_loadu_ps(vec + i + 8);
+        acc0 = _mm256_fmadd_ps(a, a, acc0);
+        acc1 = _mm256_fmadd_ps(b, b, acc1);
+    }
+    float sum = avx2_hsum(_mm256_add_ps(acc0, acc1));
+    for(; i<size; i++)
+        sum += vec[i] * vec[i];
+    return sum;
+}
+
+
+// Returns the dot product of the two vectors.
+AVX2 float avx2_dot(float *vec1, float *vec2, int size)
+{
+    __m256 acc0 = _mm256_setzero_ps();
+    __m256 acc1 = _mm256_setzero_ps();
+    int i = 0;
+    for(; i+16<=size; i+=16) {
+        acc0 = _mm256_fmadd_ps(_mm256_loadu_ps(vec1 + i),
+                               _mm256_loadu_ps(vec2 + i), acc0);
+        acc1 = _mm256_fmadd_ps(_mm256_loadu_ps(vec1 + i + 8),
+                               _mm256_loadu_ps(vec2 + i + 8), acc1);
+    }
+    float sum = avx2_hsum(_mm256_add_ps(acc0, acc1));
+    for(; i<size; i++)
+        sum += vec1[i] * vec2[i];
+    return sum;
+}
+
+
+// Returns the dot product of a dense and a sparse vector, gathering the
+// dense values at the sparse indices.
+AVX2 float avx2_sparse_dot(float *dense, int *indices, float *values,
+                           int count)
+{
+    __m256 acc = _mm256_setzero_ps();
+    int i = 0;
+    for(; i+8<=count; i+=8) {
+        __m256i idx = _mm256_loadu_si256((__m256i*)(indices + i));
+        __m256 d = _mm256_i32gather_ps(dense, idx, 4);
+        acc = _mm256_fmadd_ps(d, _mm256_loadu_ps(values + i), acc);
+    }
+    float sum = avx2_hsum(acc);
+    for(; i<count; i++)
+        sum += dense[indices[i]] * values[i];
+    return sum;
+}
+
+
+// [in-place] Adds the second vector to the first.
+AVX2 void avx2_add(float *vec1, float *vec2, int size)
+{
+    int i = 0;
+    for(; i+8<=size; i+=8)
+        _mm256_storeu_ps(vec1 + i, _mm256_add_ps(_mm256_loadu_ps(vec1 + i),
+                                                 _mm256_loadu_ps(vec2 + i)));
+    for(; i<size; i++)
+        vec1[i] += vec2[i];
+}
+
+
+// [in-place] Adds the second vector, scaled by the given value, to the first.
+AVX2 void avx2_add_scaled(float *vec1, float *vec2, int size, float scale)
+{
+    __m256 v = _mm256_set1_ps(scale);
+    int i = 0;
+    for(; i+8<=size; i+=8)
+        _mm256_storeu_ps(vec1 + i, _mm256_fmadd_ps(_mm256_loadu_ps(vec2 + i), v,
+                                                   _mm256_loadu_ps(vec1 + i)));
+    for(; i<size; i++)
+        vec1[i] += vec2[i] * scale;
+}
+
+
+// [in-place] Multiplies each component by the given value.
+AVX2 void avx2_multiply(float *vec, int size, float value)
+{
+    __m256 v = _mm256_set1_ps(value);
+    int i = 0;
+    for(; i+8<=size; i+=8)
+        _mm256_storeu_ps(vec + i, _mm256_mul_ps(_mm256_loadu_ps(vec + i), v));
+    for(; i<size; i++)
+        vec[i] *= value;
+}
+
+
+// [in-place] Divides each component by the given value.
+AVX2 void avx2_divide(float *vec, int size, float value)
+{
+    __m256 v = _mm256_set1_ps(value);
+    int i = 0;
+    for(; i+8<=size; i+=8)
+        _mm256_storeu_ps(vec + i, _mm256_div_ps(_mm256_loadu_ps(vec + i), v));
+    for(; i<size; i++)
+        vec[i] /= value;
+}
+
+
+
+/******************************* AVX-512 KERNELS ******************************/
+
+
+// Returns a mask selecting the first n (< 16) lanes.
+AVX512 static inline __mmask16 avx512_tail(int n)
+{
+    return (__mmask16)((1u << n) - 1);
+}
+
+
+// Returns the sum of the squares of each component of the vector.
+AVX512 float avx512_norm_squared(float *vec, int size)
+{
+    __m512 acc0 = _mm512_setzero_ps();
+    __m512 acc1 = _mm512_setzero_ps();
+    int i = 0;
+    for(; i+32<=size; i+=32) {
+        __m512 a = _mm512_loadu_ps(vec + i);
+        __m512 b = _mm512_loadu_ps(vec + i + 16);
+        acc0 = _mm512_fmadd_ps(a, a, acc0);
+        acc1 = _mm512_fmadd_ps(b, b, acc1);
+    }
+    for(; i+16<=size; i+=16) {
+        __m512 a = _mm512_loadu_ps(vec + i);
+        acc0 = _mm512_fmadd_ps(a, a, acc0);
+    }
+    if(i < size) {
+        __m512 a = _mm512_maskz_loadu_ps(avx512_tail(size - i), vec + i);
+        acc1 = _mm512_fmadd_ps(a, a, acc1);
+    }
+    return _mm512_reduce_add_ps(_mm512_add_ps(acc0, acc1));
+}
+
+
+// Returns the dot product of the two vectors.
+AVX512 float avx512_dot(float *vec1, float *vec2, int size)
+{
+    __m512 acc0 = _mm512_setzero_ps();
+    __m512 acc1 = _mm512_setzero_ps();
+    int i = 0;
+    for(; i+32<=size; i+=32) {
+        acc0 = _mm512_fmadd_ps(_mm512_loadu_ps(vec1 + i),
+                               _mm512_loadu_ps(vec2 + i), acc0);
+        acc1 = _mm512_fmadd_ps(_mm512_loadu_ps(vec1 + i + 16),
+                               _mm512_loadu_ps(vec2 + i + 16), acc1);
+    }
+    for(; i+16<=size; i+=16)
+        acc0 = _mm512_fmadd_ps(_mm512_loadu_ps(vec1 + i),
+                               _mm512_loadu_ps(vec2 + i), acc0);
+    if(i < size) {
+        __mmask16 m = avx512_tail(size - i);
+        acc1 = _mm512_fmadd_ps(_mm512_maskz_loadu_ps(m, vec1 + i),
+                               _mm512_maskz_loadu_ps(m, vec2 + i), acc1);
+    }
+    return _mm512_reduce_add_ps(_mm512_add_ps(acc0, acc1));
+}
+
+
+// Returns the dot product of a dense and a sparse vector, gathering the
+// dense values at the sparse indices. The tail is handled with a masked
+// gather, so no scalar loop is needed.
+AVX512 float avx512_sparse_dot(float *dense, int *indices, float *values,
+                               int count)
+{
+    __m512 acc = _mm512_setzero_ps();
+    int i = 0;
+    for(; i+16<=count; i+=16) {
+        __m512i idx = _mm512_loadu_si512(indices + i);
+        __m512 d = _mm512_i32gather_ps(idx, dense, 4);
+        acc = _mm512_fmadd_ps(d, _mm512_loadu_ps(values + i), acc);
+    }
+    if(i < count) {
+        __mmask16 m = avx512_tail(count - i);
+        __m512i idx = _mm512_maskz_loadu_epi32(m, indices + i);
+        __m512 d = _mm512_mask_i32gather_ps(_mm512_setzero_ps(), m, idx,
+                                            dense, 4);
+        acc = _mm512_fmadd_ps(d, _mm512_maskz_loadu_ps(m, values + i), acc);
+    }
+    return _mm512_reduce_add_ps(acc);
+}
+
+
+// [in-place] Adds the sparse vector to the dense one (gather, add, scatter).
+// The indices must be unique, otherwise lanes would overwrite each other.
+AVX512 void avx512_scatter_add(float *dense, int *indices, float *values,
+                               int count)
+{
+    int i = 0;
+    for(; i+16<=count; i+=16) {
+        __m512i idx = _mm512_loadu_si512(indices + i);
+        __m512 d = _mm512_i32gather_ps(idx, dense, 4);
+        d = _mm512_add_ps(d, _mm512_loadu_ps(values + i));
+        _mm512_i32scatter_ps(dense, idx, d, 4);
+    }
+    if(i < count) {
+        __mmask16 m = avx512_tail(count - i);
+        __m512i idx = _mm512_maskz_loadu_epi32(m, indices + i);
+        __m512 d = _mm512_mask_i32gather_ps(_mm512_setzero_ps(), m, idx,
+                                            dense, 4);
+        d = _mm512_add_ps(d, _mm512_maskz_loadu_ps(m, values + i));
+        _mm512_mask_i32scatter_ps(dense, m, idx, d, 4);
+    }
+}
+
+
+// [in-place] Adds the second vector to the first.
+AVX512 void avx512_add(float *vec1, float *vec2, int size)
+{
+    int i = 0;
+    for(; i+16<=size; i+=16)
+        _mm512_storeu_ps(vec1 + i, _mm512_add_ps(_mm512_loadu_ps(vec1 + i),
+                                                 _mm512_loadu_ps(vec2 + i)));
+    if(i < size) {
+        __mmask16 m = avx512_tail(size - i);
+        __m512 sum = _mm512_add_ps(_mm512_maskz_loadu_ps(m, vec1 + i),
+                                   _mm512_maskz_loadu_ps(m, vec2 + i));
+        _mm512_mask_storeu_ps(vec1 + i, m, sum);
+    }
+}
+
+
+// [in-place] Adds the second vector, scaled by the given value, to the first.
+AVX512 void avx512_add_scaled(float *vec1, float *vec2, int size, float scale)
+{
+    __m512 v = _mm512_set1_ps(scale);
+    int i = 0;
+    for(; i+16<=size; i+=16)
+        _mm512_storeu_ps(vec1 + i, _mm512_fmadd_ps(_mm512_loadu_ps(vec2 + i), v,
+                                                   _mm512_loadu_ps(vec1 + i)));
+    if(i < size) {
+        __mmask16 m = avx512_tail(size - i);
+        __m512 sum = _mm512_fmadd_ps(_mm512_maskz_loadu_ps(m, vec2 + i), v,
+                                     _mm512_maskz_loadu_ps(m, vec1 + i));
+        _mm512_mask_storeu_ps(vec1 + i, m, sum);
+    }
+}
+
+
+// [in-place] Multiplies each component by the given value.
+AVX512 void avx512_multiply(float *vec, int size, float value)
+{
+    __m512 v = _mm512_set1_ps(value);
+    int i = 0;
+    for(; i+16<=size; i+=16)
+        _mm512_storeu_ps(vec + i, _mm512_mul_ps(_mm512_loadu_ps(vec + i), v));
+    if(i < size) {
+        __mmask16 m = avx512_tail(size - i);
+        _mm512_mask_storeu_ps(vec + i, m,
+            _mm512_mul_ps(_mm512_maskz_loadu_ps(m, vec + i), v));
+    }
+}
+
+
+// [in-place] Divides each component by the given value.
+AVX512 void avx512_divide(float *vec, int size, float value)
+{
+    __m512 v = _mm512_set1_ps(value);
+    int i = 0;
+    for(; i+16<=size; i+=16)
+        _mm512_storeu_ps(vec + i, _mm512_div_ps(_mm512_loadu_ps(vec + i), v));
+    if(i < size) {
+        __mmask16 m = avx512_tail(size - i);
+        _mm512_mask_storeu_ps(vec + i, m,
+            _mm512_div_ps(_mm512_maskz_loadu_ps(m, vec + i), v));
+    }
+}
+
+
+#endif
@@ -0,0 +1,42 @@
+/* File: vectors_simd.h
+ *
+ * Declares the explicitly vectorized (AVX2 and AVX-512) versions of the hot
+ * vector kernels. These are only used through the runtime dispatch in
+ * vectors.cpp, which checks that the CPU supports them first.
+ */
+
+#ifndef VECTORS_SIMD_H
+#define VECTORS_SIMD_H
+
+
+// SIMD kernels are only available on x86 processors.
+#if defined(__x86_64__) || defined(__i386__)
+#define VEC_HAVE_SIMD
+#endif
+
+
+#ifdef VEC_HAVE_SIMD
+
+// AVX2 (with FMA) kernels.
+float avx2_norm_squared(float *vec, int size);
+float avx2_dot(float *vec1, float *vec2, int size);
+float avx2_sparse_dot(float *dense, int *indices, float *values, int count);
+void avx2_add(float *vec1, float *vec2, int size);
+void avx2_add_scaled(float *vec1, float *vec2, int size, float scale);
+void avx2_multiply(float *vec, int size, float value);
+void avx2_divide(float *vec, int size, float value);
+
+// AVX-512 kernels.
+float avx512_norm_squared(float *vec, int size);
+float avx512_dot(float *vec1, float *vec2, int size);
+float avx512_sparse_dot(float *dense, int *indices, float *values, int count);
+void avx512_scatter_add(float *dense, int *indices, float *values, int count);
+void avx512_add(float *vec1, float *vec2, int size);
+void avx512_add_scaled(float *vec1, float *vec2, int size, float scale);
+void avx512_multiply(float *vec, int size, float value);
+void avx512_divide(float *vec, int size, float value);
+
+#endif
+
+
+#endif
@@ -0,0 +1,291 @@
+/* File: vector_test.cpp
+ *
+ * Checks the SIMD vector kernels (AVX2 and AVX-512, where the CPU supports
+ * them) against the scalar kernels: every dispatched vec_* routine is run
+ * with each kernel set on the same random inputs, over sizes that exercise
+ * the vector tails (0, 1, 7, 15, 16, 17, ..., 1003) and unaligned pointers,
+ * and the results must agree with the scalar ones within a small tolerance
+ * (the SIMD sums are added in a different order, and may use FMA).
+ *
+ * $ ./vector_test
+ * Exits with 1 if any check fails.
+ */
+
+#include <iostream>
+#include <math.h>
+#include <vector>
+
+#include "vectors.h"
+
+using namespace std;
+
+// relative tolerance of the checks (fp32 has about 7 significant digits)
+#define TEST_TOLERANCE 1e-5
+
+// size of the dense vectors that the sparse kernels gather from / scatter to
+#define TEST_DENSE_SIZE 4096
+
+// number of zeros after each vector, which must not be written to
+#define TEST_GUARD 16
+
+
+// the sizes of the vectors (and of the sparse vectors) that are checked
+static const int TEST_SIZES[] = {
+    0, 1, 2, 3, 7, 8, 9, 15, 16, 17, 31, 32, 33, 63, 64, 65, 1000 + 3
+};
+
+// offsets (in floats) of the dense vectors from aligned memory
+static const int TEST_OFFSETS[] = { 0, 1, 3 };
+
+// the kernel sets that are compared with the scalar kernels
+static const VecKernels TEST_KERNELS[] = { VEC_AVX2, VEC_AVX512 };
+static const char *TEST_KERNEL_NAMES[] = { "avx2", "avx512" };
+
+
+
+// Inputs of one check: two dense vectors and a scale, a larger dense vector,
+// and a sparse vector with unique indices into it.
+struct TestInput {
+    vector<float> a;
+    vector<float> b;
+    float scale;
+    vector<float> dense;
+    vector<int> indices;
+    vector<float> values;
+};
+
+
+// Outputs of all kernels for one input.
+struct TestOutput {
+    float norm;
+    float dot;
+    float sparse_dot;
+    vector<float> add;
+    vector<float> add_scaled;
+    vector<float> scatter_add;
+    vector<float> multiply;
+    vector<float> divide;
+};
+
+
+
+// Returns a reproducible random number in [-1, 1) (a 64-bit LCG).
+static float randomValue(unsigned long long *state)
+{
+    *state = *state * 6364136223846793005ULL + 1442695040888963407ULL;
+    return (float)((*state >> 40) * (2.0 / 16777216.0) - 1.0);
+}
+
+
+
+// Fills the input for the given size. The dense vectors are stored at the
+// given offset (in floats) from the start of their arrays, so offsets that
+// are not a multiple of 16 test the unaligned loads and stores, and are
+// followed by TEST_GUARD zeros (so writes past the end are caught).
+static void makeInput(TestInput *input, int size, int offset,
+                      unsigned long long seed)
+{
+    unsigned long long state = seed;
+    input->a.assign(offset + size + TEST_GUARD, 0);
+    input->b.assign(offset + size + TEST_GUARD, 0);
+    for(int i=0; i<size; i++) {
+        input->a[offset + i] = randomValue(&state);
+        input->b[offset + i] = randomValue(&state);
+    }
+    input->scale = 0.5f + 0.25f * randomValue(&state);
+    input->dense.resize(TEST_DENSE_SIZE);
+    for(int i=0; i<TEST_DENSE_SIZE; i++)
+        input->dense[i] = randomValue(&state);
+
+    // a random subset of the dense indices (partial Fisher-Yates shuffle),
+    // so the scatter kernels never see duplicates
+    vector<int> order(TEST_DENSE_SIZE);
+    for(int i=0; i<TEST_DENSE_SIZE; i++)
+        order[i] = i;
+    int count = (size < TEST_DENSE_SIZE) ? size : TEST_DENSE_SIZE;
+    input->indices.resize(count);
+    input->values.resize(count);
+    for(int i=0; i<count; i++) {
+        int j = i + (int)((randomValue(&state) + 1) / 2
+                          * (TEST_DENSE_SIZE - i));
+        if(j >= TEST_DENSE_SIZE)
+            j = TEST_DENSE_SIZE - 1;
+        int swap = order[i];
+        order[i] = order[j];
+        order[j] = swap;
+        input->indices[i] = order[i];
+        input->values[i] = randomValue(&state);
+    }
+}
+
+
+
+// Runs every kernel of the current kernel set on the given input. The in
+// place kernels work on copies of the input.
+static void runKernels(TestInput *input, int size, int offset,
+                       TestOutput *output)
+{
+    float *a = &input->a[0] + offset;
+    float *b = &input->b[0] + offset;
+    int count = input->indices.size();
+    int *indices = count > 0 ? &input->indices[0] : 0;
+    float *values = count > 0 ? &input->values[0] : 0;
+
+    output->norm = vec_norm(a, size);
+    output->dot = vec_dot(a, b, size);
+    output->sparse_dot = vec_sparse_dot(&input->dense[0], indices, values,
+                                        count);
+
+    vector<float> copy;
+    copy = input->a;
+    vec_add(&copy[0] + offset, b, size);
+    output->add.assign(copy.begin() + offset, copy.end());
+    copy = input->a;
+    vec_add_scaled(&copy[0] + offset, b, size, input->scale);
+    output->add_scaled.assign(copy.begin() + offset, copy.end());
+    copy = input->a;
+    vec_multiply(&copy[0] + offset, size, input->scale);
+    output->multiply.assign(copy.begin() + offset, copy.end());
+    copy = input->a;
+    vec_divide(&copy[0] + offset, size, input->scale);
+    output->divide.assign(copy.begin() + offset, copy.end());
+    output->scatter_add = input->dense;
+    vec_scatter_add(&output->scatter_add[0], indices, values, count);
+}
+
+
+
+// Returns true if value is within the tolerance of expected, relative to
+// the given magnitude (the size of the terms that were summed up).
+static bool closeTo(float value, float expected, double magnitude)
+{
+    return fabs((double)value - expected)
+        <= TEST_TOLERANCE * (magnitude + fabs((double)expected) + 1e-30);
+}
+
+
+
+// Checks one scalar result, and prints it if it is not within the
+// tolerance. Returns the number of failures (0 or 1).
+static int checkValue(const char *kernels, const char *name, int size,
+                      int offset, float value, float expected,
+                      double magnitude)
+{
+    if(closeTo(value, expected, magnitude))
+        return 0;
+    cout << "FAIL: " << kernels << " " << name << " (size " << size
+         << ", offset " << offset << "): " << value << ", expected "
+         << expected << endl;
+    return 1;
+}
+
+
+
+// Checks every component of a vector result, including the guard zeros
+// (each component is at most a sum of two products of inputs in [-1, 1], so
+// the magnitude is 1). Returns the number of failures (0 or 1).
+static int checkVector(const char *kernels, const char *name, int size,
+                       int offset, const vector<float> &value,
+                       const vector<float> &expected)
+{
+    for(size_t i=0; i<expected.size(); i++) {
+        if(value.size() != expected.size()
+           || !closeTo(value[i], expected[i], 1)) {
+            cout << "FAIL: " << kernels << " " << name << " (size " << size
+                 << ", offset " << offset << ") at " << i << ": "
+                 << value[i] << ", expected " << expected[i] << endl;
+            return 1;
+        }
+    }
+    return 0;
+}
+
+
+
+// Compares the outputs of a SIMD kernel set with the scalar outputs. The
+// magnitudes of the reductions are the sums of the absolute terms, so the
+// tolerance scales with the rounding error of any summation order.
+static int compareOutputs(const char *kernels, int size, int offset,
+                          TestInput *input, TestOutput *out,
+                          TestOutput *expected)
+{
+    double sq_sum = 0, dot_sum = 0, sparse_sum = 0;
+    for(int i=0; i<size; i++) {
+        float a = input->a[offset + i];
+        float b = input->b[offset + i];
+        sq_sum += (double)a * a;
+        dot_sum += fabs((double)a * b);
+    }
+    for(size_t i=0; i<input->indices.size(); i++)
+        sparse_sum += fabs((double)input->dense[input->indices[i]]
+                           * input->values[i]);
+
+    int failures = 0;
+    failures += checkValue(kernels, "vec_norm", size, offset, out->norm,
+                           expected->norm, sqrt(sq_sum));
+    failures += checkValue(kernels, "vec_dot", size, offset, out->dot,
+                           expected->dot, dot_sum);
+    failures += checkValue(kernels, "vec_sparse_dot", size, offset,
+                           out->sparse_dot, expected->sparse_dot,
+                           sparse_sum);
+    failures += checkVector(kernels, "vec_add", size, offset, out->add,
+                            expected->add);
+    failures += checkVector(kernels, "vec_add_scaled", size, offset,
+                            out->add_scaled, expected->add_scaled);
+    failures += checkVector(kernels, "vec_scatter_add", size, offset,
+                            out->scatter_add, expected->scatter_add);
+    failures += checkVector(kernels, "vec_multiply", size, offset,
+                            out->multiply, expected->multiply);
+    failures += checkVector(kernels, "vec_divide", size, offset,
+                            out->divide, expected->divide);
+    return failures;
+}
+
+
+
+// main: compare each supported SIMD kernel set with the scalar kernels.
+int main()
+{
+    int num_sizes = sizeof(TEST_SIZES) / sizeof(TEST_SIZES[0]);
+    int num_sets = sizeof(TEST_KERNELS) / sizeof(TEST_KERNELS[0]);
+    int num_offsets = sizeof(TEST_OFFSETS) / sizeof(TEST_OFFSETS[0]);
+    VecKernels best = vec_get_kernels();
+
+    int failures = 0;
+    int num_checks = 0;
+    for(int s=0; s<num_sets; s++) {
+        if(!vec_set_kernels(TEST_KERNELS[s])) {
+            cout << TEST_KERNEL_NAMES[s] << ": not supported by this CPU, "
+                 << "skipped." << endl;
+            continue;
+        }
+        int set_failures = 0;
+        for(int n=0; n<num_sizes; n++) {
+            for(int o=0; o<num_offsets; o++) {
+                int size = TEST_SIZES[n];
+                int offset = TEST_OFFSETS[o];
+                TestInput input;
+                makeInput(&input, size, offset, 1 + n * num_offsets + o);
+
+                TestOutput expected, output;
+                vec_set_kernels(VEC_SCALAR);
+                runKernels(&input, size, offset, &expected);
+                vec_set_kernels(TEST_KERNELS[s]);
+                runKernels(&input, size, offset, &output);
+
+                set_failures += compareOutputs(TEST_KERNEL_NAMES[s], size,
+                    offset, &input, &output, &expected);
+                num_checks += 8;
+            }
+        }
+        cout << TEST_KERNEL_NAMES[s] << ": "
+             << (set_failures == 0 ? "all kernels match" : "FAILED")
+             << " the scalar kernels (" << num_sizes << " sizes, "
+             << num_offsets << " offsets)." << endl;
+        failures += set_failures;
+    }
+    vec_set_kernels(best);
+
+    cout << num_checks << " checks, " << failures << " failed." << endl;
+    return (failures == 0) ? 0 : 1;
+}
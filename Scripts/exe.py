@@ -1,5 +1,6 @@
 #!/usr/bin/env python3
 
+import json
 import os
 import subprocess
 import sys
@@ -8,6 +9,7 @@ import sys
 EXE_PATH = "../CPP"
 IN_FILE = "batch"
 OUT_FILE = "output"
+REPORT_FILE = "run_report.json"
 
 
 def run(path, dataset, k = 0, noscheme = False):
@@ -23,11 +25,14 @@ def run(path, dataset, k = 0, noscheme = False):
 
     # set up the command
     cmd = "./spkmeans -d ../TestData/" + dataset + " " + k_cmd + " --noresults --openmp"
+    cmd += " --report " + REPORT_FILE
     if noscheme:
         cmd += " --noscheme"
 
-    # run the k-means program
+    # run the k-means program (removing the report of an earlier run first)
     print("Running: \"" + cmd + "\"")
+    if os.path.isfile(REPORT_FILE):
+        os.remove(REPORT_FILE)
     cmd = cmd.split()
     p = subprocess.Popen(cmd, stdout = subprocess.PIPE, \
                               stderr = subprocess.STDOUT)
@@ -37,39 +42,27 @@ def run(path, dataset, k = 0, noscheme = False):
     if err:
         err = err.decode(encoding = "UTF-8")
 
+    # read the JSON report of the run (None if it was not written)
+    report = None
+    if os.path.isfile(REPORT_FILE):
+        with open(REPORT_FILE, "r") as f:
+            report = json.load(f)
+        os.remove(REPORT_FILE)
+
     # change back the path
     os.chdir(old_path)
 
-    return out, err
-
-
-def interpret(out):
-    docs = ""
-    words = ""
-    nz = ""
-    k = ""
-    iters = ""
-    runtime = ""
-    lines = out.split("\n")
-    for line in lines:
-        if "DATA" in line:
-            line = line.split()
-            docs = line[1]
-            words = line[3]
-            nz = line[5]
-            nz = nz[1:]
-        if "k=" in line:
-            if "threads" in line:
-                indx = -4
-            else:
-                indx = -3
-            line = line.split()
-            k = line[indx]
-            k = k[2:]
-        if "Done" in line:
-            line = line.split()
-            iters = line[-2]
-            runtime = line[2]
+    return report, err
+
+
+def interpret(report):
+    # the run time is reported in seconds, like the program prints it
+    docs = str(report["data"]["documents"])
+    words = str(report["data"]["words"])
+    nz = str(report["data"]["nonzeros"])
+    k = str(report["config"]["k"])
+    iters = str(report["result"]["iterations"])
+    runtime = str(report["phases_ns"]["run"] / 1e9)
     return docs, words, nz, k, iters, runtime
 
 
@@ -99,10 +92,10 @@ def main(infile, outfile, path):
             k = int(line[1])
         if len(line) > 2 and line[2].lower() == "true":
             noscheme = True
-        out, err = run(path, dataset, k, noscheme)
-        # if we got anything, format it and append it to the output file
-        if out and not err and "error" not in out.lower():
-            info = interpret(out)
+        report, err = run(path, dataset, k, noscheme)
+        # if we got a report, format it and append it to the output file
+        if report and not err:
+            info = interpret(report)
             output = open(outfile, "a")
             split = list(map(lambda x : x.ljust(10), info[:-1]))
             info = ''.join(split) + info[-1]